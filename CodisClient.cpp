@@ -3,150 +3,517 @@
 //
 
 #include "CodisClient.h"
+#include "RedisCommands.h"
 #include "Utils.h"
-#include <boost/property_tree/ptree.hpp>
-#include <boost/property_tree/json_parser.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
 
 CodisClient::CodisClient(const CodisConfig &config) :
-        childrenWatcher(config.zkConfig) {
+        codisConfig(config),
+        zkWatcher(nullptr),
+        routing(std::make_shared<const RoutingTable>()),
+        pendingBuildNum(0),
+        maintenanceStopping(false),
+        poolBuilder(config.poolBuildConfig.threadNum, config.poolBuildConfig.maxQueueSize) {
     roundRobinIndex = -1;
+    remoteRoundRobinIndex = -1;
+    zoneRoutedNum = 0;
+    crossZoneNum = 0;
+    overloadRerouteNum = 0;
+    localZone = config.zoneConfig.localZone;
+    if (localZone.empty()) {
+        const char *env = getenv("CODIS_LOCAL_ZONE");
+        if (env) localZone = env;
+    }
+    if (!localZone.empty()) LOG_SPCL << "zone-aware routing, local zone: " << localZone;
+    const DiscoveryConfig &discoveryConfig = config.discoveryConfig;
+    if (discoveryConfig.type == "static") {
+        discovery.reset(new StaticProxyDiscovery(discoveryConfig.staticProxies));
+    } else if (discoveryConfig.type == "file") {
+        discovery.reset(new FileProxyDiscovery(discoveryConfig.filePath, config.zkConfig.debounceQuietMs,
+                                               config.zkConfig.debounceMaxDelayMs));
+    } else {
+        if (discoveryConfig.type != "zk") {
+            LOG_ERROR << "unknown discovery type: " << discoveryConfig.type << ", use zk";
+        }
+        zkWatcher = new ZKChildrenWatcher(config.zkConfig);
+        discovery.reset(zkWatcher);
+    }
+    if (config.hedgeConfig.enable) hedger.reset(new Hedger(config.hedgeConfig));
+    if (config.retryConfig.enable) retryPolicy.reset(new RetryPolicy(config.retryConfig));
+    if (config.singleFlightConfig.enable) singleFlight.reset(new SingleFlight(config.singleFlightConfig.commands));
+    if (config.connectionBudgetConfig.totalConns > 0) {
+        connectionBudget.reset(new ConnectionBudget(config.connectionBudgetConfig));
+    }
+    RedisTracer::getInstance().setSlowThreshold((uint64_t) config.traceConfig.slowThresholdMs * 1000,
+                                                (size_t) config.traceConfig.maxSlowRequestNum);
+    RedisTracer::getInstance().setDrainInterval(config.traceConfig.drainIntervalMs);
+    RedisTracer::setSampleRate(config.traceConfig.sampleRate);
 
+    memset(&innerRedisPoolConf, 0, sizeof(innerRedisPoolConf));
     innerRedisPoolConf.connect_timeout = config.redisConfig.connTimeout;
     innerRedisPoolConf.net_readwrite_timeout = config.redisConfig.socketTimeout;
     innerRedisPoolConf.num_redis_socks = config.redisConfig.connPoolSize;
     innerRedisPoolConf.connect_failure_retry_delay = 1;
     innerRedisPoolConf.reader_buf_max_size = 1024 * 1024; // 1M
+    if (config.concurrencyLimitConfig.enable) {
+        innerRedisPoolConf.min_concurrency_limit = config.concurrencyLimitConfig.minLimit;
+    }
+    innerRedisPoolConf.disable_inline_retry = config.retryConfig.inlineRetry ? 0 : 1;
+    innerRedisPoolConf.reconnect_backoff_base_ms = config.reconnectBackoffConfig.baseMs;
+    innerRedisPoolConf.reconnect_backoff_max_ms = config.reconnectBackoffConfig.maxMs;
+}
+
+CodisClient::~CodisClient() {
+    if (discoveryInitThread.joinable()) discoveryInitThread.join();
+    // no more updates from discovery threads from here on
+    zkWatcher = nullptr;
+    discovery.reset();
+    {
+        std::lock_guard<std::mutex> g(maintenanceMtx);
+        maintenanceStopping = true;
+    }
+    maintenanceCv.notify_all();
+    if (maintenanceThread.joinable()) maintenanceThread.join();
 }
 
 void CodisClient::init() {
-    childrenWatcher.setChildrenWatcher(std::bind(&CodisClient::proxyWatcher, this));
-    childrenWatcher.init();
+    discovery->setChildrenWatcher(std::bind(&CodisClient::proxyWatcher, this));
+    maintenanceThread = std::thread(&CodisClient::maintenanceLoop, this);
+    if (warmStart()) {
+        discoveryInitThread = std::thread([this] {
+            discovery->init();
+            LOG_SPCL << discovery->getType() << " discovery init done after warm start";
+        });
+    } else {
+        discovery->init();
+        // static/file discovery publish in init: serve their pools on return, as before
+        waitPoolBuilds(codisConfig.poolBuildConfig.initWaitMs);
+    }
+}
+
+bool CodisClient::warmStart() {
+    const WarmStartConfig &conf = codisConfig.warmStartConfig;
+    if (conf.snapshotPath.empty()) return false;
+
+    std::vector<CodisProxyInfo> proxies;
+    std::int64_t saveTime = 0;
+    if (!TopologySnapshot::load(conf.snapshotPath, conf.maxSnapshotAgeSec, proxies, &saveTime)) return false;
+    LOG_SPCL << "warm start from topology snapshot: " << conf.snapshotPath << ", saved at: " << saveTime
+             << ", proxy number: " << proxies.size();
+
+    // discovery 的首次更新会与快照对账，复用相同proxy的连接池
+    applyProxies(proxies);
+    waitPoolBuilds(codisConfig.poolBuildConfig.initWaitMs);
+    return !getRouting()->pools.empty();
 }
 
 void CodisClient::initRoundRobinRedisPool() {
-    boost::property_tree::ptree pt;
-    std::vector<std::shared_ptr<RedisClient>> additionalPoolList;
-    for (auto &value : childrenWatcher.additionalValueList) {
+    std::vector<std::string> values = discovery->getValueList();
+    std::vector<CodisProxyInfo> proxies;
+    proxies.reserve(values.size());
+    CodisProxyInfo info;  // parse reuses the capacity of its strings
+    for (auto &value : values) {
         if (value.empty()) {
-            LOG_ERROR << "codis proxy data empty! valueList size: " << childrenWatcher.valueList.size();
-            continue;
-        }
-        while (value.back() != '}') value.pop_back();
-        LOG_DEBUG << value;
-        std::stringstream ss;
-        ss << value;
-        try {
-            boost::property_tree::read_json(ss, pt);
-            if (pt.get<std::string>("state") == "online") {
-                auto addr = pt.get<std::string>("addr");
-                additionalPoolList.emplace_back(getRedisClient(pt.get<std::string>("addr")));
-            }
-        } catch (std::exception &e) {
-            LOG_ERROR << "parse codis proxy addr error: " << e.what();
+            LOG_ERROR << "codis proxy data empty!";
+        } else if (CodisProxyInfo::parse(value, info)) {
+            proxies.push_back(info);
+        } else {
+            LOG_ERROR << "parse codis proxy data error: " << value;
         }
     }
 
-    // 先删除， 后追加
-    if (!childrenWatcher.additionalValueList.empty() || !childrenWatcher.deletedValueList.empty()) {
-        // write lock
-        boost::unique_lock<boost::shared_mutex> g(poolListSMtx);
-        size_t tmpSize = childrenWatcher.valueList.size();
+    applyProxies(proxies);
 
-        if (!childrenWatcher.valueList.empty() && !childrenWatcher.deletedValueList.empty()) {
-            auto finder = childrenWatcher.getFinder(childrenWatcher.deletedValueList);
-            for (size_t i = 0; i < tmpSize;) {
-                if (finder.count(childrenWatcher.valueList[i]) > 0)
-                    poolList[i] = std::move(poolList[--tmpSize]);
-                else ++i;
-            }
-            poolList.resize(tmpSize);
-            LOG_SPCL << "delete " << childrenWatcher.deletedValueList.size() << " redis client";
-        }
+    const std::string &snapshotPath = codisConfig.warmStartConfig.snapshotPath;
+    if (!snapshotPath.empty() && !proxies.empty()) TopologySnapshot::save(snapshotPath, proxies);
+}
+
+void CodisClient::applyProxies(const std::vector<CodisProxyInfo> &proxies) {
+    std::lock_guard<std::mutex> g(poolListUpdateMtx);
+    ProxyRegistry::Diff diff = proxyRegistry.update(proxies);
+    if (diff.empty()) {
+        LOG_SPCL << "no codis proxy to be added, deleted or changed";
+    } else {
+        LOG_SPCL << "codis proxy added: " << diff.added << ", removed: " << diff.removed
+                 << ", state changed: " << diff.stateChanged << ", addr changed: " << diff.addrChanged;
+        publishRouting();
+    }
+    // 新连接池在后台建好后才发布，不阻塞 discovery 的线程
+    scheduleBuilds();
+}
 
-        if (!additionalPoolList.empty()) {
-            size_t appendSize = additionalPoolList.size();
-            std::move(additionalPoolList.begin(), additionalPoolList.end(),
-                      std::inserter(poolList, poolList.end()));
-            LOG_SPCL << "append " << appendSize << " new redis client";
+void CodisClient::publishRouting() {
+    std::shared_ptr<const RoutingTable> newRouting = std::make_shared<const RoutingTable>(
+            proxyRegistry.getRoutable(localZone, codisConfig.zoneConfig.minLocalHealthyRatio));
+    if (newRouting->pools.empty()) {
+        LOG_ERROR << "no valid codis proxy!";
+    } else {
+        LOG_SPCL << "init redis pool ok, redis pool number: " << newRouting->pools.size()
+                 << ", routing slot number: " << newRouting->slots.size();
+    }
+    std::atomic_store(&routing, newRouting);
+}
+
+void CodisClient::scheduleBuilds() {
+    for (auto &task : proxyRegistry.takeBuildTasks()) {
+        // 建连前先预留连接数，同时建多个连接池时总数不超预算
+        if (connectionBudget) {
+            task.poolSize = connectionBudget->reserve(proxyRegistry.getOnlineNum(), proxyRegistry.getPools());
         }
+        {
+            std::lock_guard<std::mutex> g(buildMtx);
+            ++pendingBuildNum;
+        }
+        if (poolBuilder.trySubmit(std::bind(&CodisClient::buildPool, this, task))) continue;
 
-        if (poolList.empty()) {
-            LOG_ERROR << "no valid codis proxy!";
-        } else {
-            LOG_SPCL << "init redis pool ok, redis pool number: " << poolList.size();
+        LOG_WARN << "pool build queue full, codis proxy " << task.key << " will be retried";
+        proxyRegistry.attach(task, std::shared_ptr<RedisClient>());
+        if (connectionBudget) connectionBudget->release(task.poolSize);
+        std::lock_guard<std::mutex> g(buildMtx);
+        if (--pendingBuildNum == 0) buildCv.notify_all();
+    }
+}
+
+void CodisClient::buildPool(const ProxyRegistry::BuildTask &task) {
+    // released after the lock: dropping a pool takes a while
+    std::shared_ptr<RedisClient> client = createProxyClient(task.info, task.poolSize);
+    {
+        std::lock_guard<std::mutex> g(poolListUpdateMtx);
+        if (proxyRegistry.attach(task, client)) publishRouting();
+        // attached, the pool counts by its size from now on
+        if (connectionBudget) connectionBudget->release(task.poolSize);
+    }
+    std::lock_guard<std::mutex> g(buildMtx);
+    if (--pendingBuildNum == 0) buildCv.notify_all();
+}
+
+void CodisClient::waitPoolBuilds(int timeoutMs) {
+    std::unique_lock<std::mutex> lk(buildMtx);
+    if (!buildCv.wait_for(lk, std::chrono::milliseconds(timeoutMs), [this] { return pendingBuildNum == 0; })) {
+        LOG_WARN << "pool build(s) still pending after " << timeoutMs << "ms: " << pendingBuildNum;
+    }
+}
+
+void CodisClient::maintenanceLoop() {
+    std::chrono::milliseconds retryInterval(codisConfig.poolBuildConfig.retryIntervalMs);
+    std::chrono::milliseconds interval = retryInterval;
+    if (connectionBudget) {
+        interval = std::min(interval, std::chrono::milliseconds(connectionBudget->getConfig().rebalanceIntervalMs));
+    }
+    auto lastRetry = std::chrono::steady_clock::now();
+    std::unique_lock<std::mutex> lk(maintenanceMtx);
+    while (!maintenanceCv.wait_for(lk, interval, [this] { return maintenanceStopping; })) {
+        lk.unlock();
+        auto now = std::chrono::steady_clock::now();
+        if (now - lastRetry >= retryInterval) {
+            lastRetry = now;
+            std::lock_guard<std::mutex> g(poolListUpdateMtx);
+            if (proxyRegistry.refreshWeights()) publishRouting();
+            scheduleBuilds();
+        }
+        if (connectionBudget) {
+            std::shared_ptr<const RoutingTable> table = getRouting();
+            ProxyRegistry::PoolList pools;
+            {
+                // 与 reserve 统计同一批连接池：已建好的，不论是否可路由
+                std::lock_guard<std::mutex> g(poolListUpdateMtx);
+                pools = proxyRegistry.getPools();
+            }
+            // grows connect: on the build threads, not to hold up the build retries
+            connectionBudget->rebalance(pools, table->pools, [this](const std::function<void()> &task) {
+                return poolBuilder.trySubmit(task);
+            });
         }
-    } else { LOG_SPCL << "no node to be added or deleted"; }
-    LOG_SPCL << "codis redis client number: " << poolList.size();
+        lk.lock();
+    }
 }
 
 std::shared_ptr<RedisClient> CodisClient::RoundRobinRedisPool() {
-    boost::shared_lock<boost::shared_mutex> g(poolListSMtx);
-    if (poolList.empty()) return std::shared_ptr<RedisClient>();
-    // todo 优化？
-    return poolList[++roundRobinIndex % poolList.size()];
+    std::shared_ptr<const RoutingTable> table = getRouting();
+    if (!table->localSlots.empty()) {
+        ++zoneRoutedNum;
+        const PoolList &local = table->localSlots;
+        const PoolList &remote = table->remoteSlots;
+        auto &res = local[++roundRobinIndex % local.size()];
+        if (!codisConfig.zoneConfig.spillOnSaturation || remote.empty() || res->getIdleNum() > 0) return res;
+        // 本区连接已占满，若他区有空闲连接则溢出
+        auto &other = remote[++remoteRoundRobinIndex % remote.size()];
+        if (other->getIdleNum() <= 0) return res;
+        ++crossZoneNum;
+        return other;
+    }
+
+    const PoolList &slots = table->slots;
+    if (slots.empty()) return std::shared_ptr<RedisClient>();
+    size_t i = ++roundRobinIndex % slots.size();
+    if (table->zoneAware) {
+        ++zoneRoutedNum;
+        if (table->slotIsRemote[i]) ++crossZoneNum;
+    }
+    return slots[i];
 //    roundRobinIndex = (roundRobinIndex + 1) % poolList.size();
 //    return poolList[roundRobinIndex];
 }
 
+std::shared_ptr<RedisClient> CodisClient::RoundRobinOtherRedisPool(const std::shared_ptr<RedisClient> &exclude) {
+    std::shared_ptr<const RoutingTable> table = getRouting();
+    if (table->pools.size() < 2) return std::shared_ptr<RedisClient>();
+    // a heavy pool may hold several slots in a row
+    auto pick = [&exclude](const PoolList &slots, std::atomic<std::int64_t> &index) -> const std::shared_ptr<RedisClient> * {
+        for (size_t i = 0; i < slots.size(); ++i) {
+            auto &res = slots[++index % slots.size()];
+            if (res != exclude) return &res;
+        }
+        return nullptr;
+    };
+
+    if (!table->localSlots.empty()) {
+        ++zoneRoutedNum;
+        // 先选本区的其他 proxy，本区没有时才溢出到他区
+        if (auto res = pick(table->localSlots, roundRobinIndex)) return *res;
+        if (auto res = pick(table->remoteSlots, remoteRoundRobinIndex)) {
+            ++crossZoneNum;
+            return *res;
+        }
+        return std::shared_ptr<RedisClient>();
+    }
+
+    const PoolList &slots = table->slots;
+    for (size_t n = 0; n < slots.size(); ++n) {
+        size_t i = ++roundRobinIndex % slots.size();
+        if (slots[i] == exclude) continue;
+        if (table->zoneAware) {
+            ++zoneRoutedNum;
+            if (table->slotIsRemote[i]) ++crossZoneNum;
+        }
+        return slots[i];
+    }
+    return std::shared_ptr<RedisClient>();
+}
+
+RedisReplyPtr CodisClient::redisCommandArgv(const std::vector<std::string> &argv) {
+    if (argv.empty()) {
+        LOG_ERROR << "redisCommandArgv: empty command!";
+        return RedisReplyPtr();
+    }
+    if (singleFlight && singleFlight->isEnabled(argv[0])) {
+        return singleFlight->execute(argv, std::bind(&CodisClient::routeCommandArgv, this, std::cref(argv),
+                                                     nullptr));
+    }
+    return routeCommandArgv(argv, nullptr);
+}
+
+RedisReplyPtr CodisClient::redisCommandArgv(const std::vector<std::string> &argv,
+                                            const std::chrono::steady_clock::time_point &deadline) {
+    if (argv.empty()) {
+        LOG_ERROR << "redisCommandArgv: empty command!";
+        return RedisReplyPtr();
+    }
+    return routeCommandArgv(argv, &deadline);
+}
+
+RedisReplyPtr CodisClient::routeCommandArgv(const std::vector<std::string> &argv,
+                                            const std::chrono::steady_clock::time_point *deadline) {
+    std::shared_ptr<RedisClient> client = RoundRobinRedisPool();
+    if (!client) {
+        LOG_ERROR << "no valid codis proxy!";
+        return RedisReplyPtr();
+    }
+    if (!client->hasCapacity()) {
+        // 超过并发上限的请求转给有余量的proxy，都没有余量时由原proxy拒绝
+        std::shared_ptr<RedisClient> other = RoundRobinOtherRedisPool(client);
+        if (other && other->hasCapacity()) {
+            ++overloadRerouteNum;
+            client = other;
+        }
+    }
+
+    int code = CLIENT_OK;
+    RedisReplyPtr reply = executeOn(client, argv, deadline, &code);
+    if (!retryPolicy) return reply;
+
+    int attempt = 0;
+    while (reply.isNull()) {
+        int backoff = retryPolicy->backoffMs(attempt);
+        // 重试(含退避)须在deadline之前完成，不够时直接返回
+        if (deadline && std::chrono::steady_clock::now() + std::chrono::milliseconds(backoff) >= *deadline) break;
+        if (!retryPolicy->shouldRetry(argv[0], code, attempt)) break;
+        ++attempt;
+        if (backoff > 0) std::this_thread::sleep_for(std::chrono::milliseconds(backoff));
+        if (retryPolicy->getConfig().differentProxy) {
+            std::shared_ptr<RedisClient> other = RoundRobinOtherRedisPool(client);
+            if (other) client = other;
+        }
+        reply = executeOn(client, argv, deadline, &code);
+    }
+    if (reply.notNull()) retryPolicy->onSuccess(attempt);
+    return reply;
+}
+
+RedisReplyPtr CodisClient::executeOn(const std::shared_ptr<RedisClient> &client, const std::vector<std::string> &argv,
+                                     const std::chrono::steady_clock::time_point *deadline, int *code) {
+    // 启用重试策略时只由策略重试：连接池的内联重发不受预算约束
+    bool inlineRetry = !retryPolicy;
+    if (deadline) return client->redisCommandArgv(argv, *deadline, code, inlineRetry);
+    if (hedger && RedisCommands::isReadOnly(argv[0])) {
+        return hedger->execute(client,
+                               std::bind(&CodisClient::RoundRobinOtherRedisPool, this, std::placeholders::_1),
+                               argv, code);
+    }
+    return client->redisCommandArgv(argv, code, inlineRetry);
+}
+
 void CodisClient::proxyWatcher() {
-//    childrenWatcher.updateValueList();
     initRoundRobinRedisPool();
 }
 
-std::shared_ptr<RedisClient> CodisClient::getRedisClient(const std::string &clusterAddr) {
+std::shared_ptr<RedisClient> CodisClient::getRedisClient(const std::string &clusterAddr, int poolSize) {
     std::string host, port;
     std::vector<std::string> addrs = Utils::splitString(clusterAddr, ",");
     // boost::shared_array<REDIS_ENDPOINT> endpoints(new REDIS_ENDPOINT[addrs.size()]);
     std::vector<REDIS_ENDPOINT> endpoints(addrs.size());
     // addrs 是proxy地址，目前没有发现addrs有多个proxy地址的情况
     LOG_SPCL << "redis cluster size(proxy num): " << addrs.size();
+    const SocketConfig &socketConfig = codisConfig.socketConfig;
     size_t i = 0;
     for (auto &addr : addrs) {
+        std::string path = unixSocketPath(addr);
+        if (!path.empty()) {
+            if (path.size() >= sizeof(endpoints[i].path)) {
+                throw std::runtime_error("unix socket path too long: " + path);
+            }
+            memcpy(endpoints[i].path, path.c_str(), path.size());
+            endpoints[i].path[path.size()] = '\0';
+            LOG_SPCL << "codis proxy " << addr << ", unix socket: " << endpoints[i].path;
+            ++i;
+            continue;
+        }
         host = Utils::getHost(addr);
         port = Utils::getPort(addr);
         memset(endpoints[i].host, 0, sizeof(endpoints[i].host));
         memcpy(endpoints[i].host, host.c_str(), host.size());
         endpoints[i].host[host.size()] = '\0';
         endpoints[i].port = std::stoi(port);
+        endpoints[i].tcp_nodelay = socketConfig.tcpNoDelay ? 1 : -1;
+        endpoints[i].sndbuf = socketConfig.sendBufferBytes;
+        endpoints[i].rcvbuf = socketConfig.recvBufferBytes;
+        endpoints[i].busy_poll_us = socketConfig.busyPollUs;
         LOG_SPCL << "codis proxy host: " << endpoints[i].host << ", codis proxy port: " << endpoints[i].port;
         ++i;
     }
-    innerRedisPoolConf.num_endpoints = addrs.size();
+    // pools are built concurrently: fill a copy, not the shared template
+    REDIS_CONFIG conf = innerRedisPoolConf;
+    conf.num_endpoints = addrs.size();
+    if (poolSize > 0) conf.num_redis_socks = poolSize;
     // conf.endpoints = endpoints.get();
-    innerRedisPoolConf.endpoints = &(endpoints.at(0));
+    conf.endpoints = &(endpoints.at(0));
 
-    std::shared_ptr<RedisClient> res = std::make_shared<RedisClient>(innerRedisPoolConf);
-    if (!res->checkAllSocketConnected()) LOG_FATAL(std::string("cannot connect to codis proxy: ") + clusterAddr);
+    std::shared_ptr<RedisClient> res = std::make_shared<RedisClient>(conf);
+    if (singleFlight) res->setSingleFlight(singleFlight);
+    res->setMuxPreferUring(codisConfig.socketConfig.ioUring);
+    if (!res->checkAllSocketConnected()) LOG_WARN << "not all sockets connected to codis proxy: " << clusterAddr;
     return res;
 }
 
+std::string CodisClient::unixSocketPath(const std::string &addr) const {
+    static const std::string scheme("unix://");
+    if (addr.compare(0, scheme.size(), scheme) == 0) return addr.substr(scheme.size());
+    auto it = codisConfig.socketConfig.unixSocketPaths.find(addr);
+    return it == codisConfig.socketConfig.unixSocketPaths.end() ? std::string() : it->second;
+}
+
+std::shared_ptr<RedisClient> CodisClient::createProxyClient(const CodisProxyInfo &info, int poolSize) {
+    try {
+        std::shared_ptr<RedisClient> res = getRedisClient(info.addr, poolSize);
+        if (res->getStats().connectedNum > 0) return res;
+        LOG_ERROR << "cannot connect to codis proxy " << info.addr << ", will retry";
+        return std::shared_ptr<RedisClient>();
+    } catch (std::exception &e) {
+        LOG_ERROR << "create redis client of codis proxy " << info.addr << " error: " << e.what();
+    }
+    return std::shared_ptr<RedisClient>();
+}
+
 std::vector<std::shared_ptr<RedisClient> > *CodisClient::getRedisPool() {
     return nullptr;
 }
 
 long CodisClient::getTotalWaitConnNum() {
-    boost::shared_lock<boost::shared_mutex> g(poolListSMtx);
     long res = 0;
-    for (auto &e : poolList) {
+    std::shared_ptr<const RoutingTable> table = getRouting();
+    for (auto &e : table->pools) {
         res += e->getWaitingNum();
     }
     return res;
 }
 
 long CodisClient::getTotalIdleConnNum() {
-    boost::shared_lock<boost::shared_mutex> g(poolListSMtx);
     long res = 0;
-    for (auto &e : poolList) {
+    std::shared_ptr<const RoutingTable> table = getRouting();
+    for (auto &e : table->pools) {
         res += e->getIdleNum();
     }
     return res;
 }
 
 bool CodisClient::isHealthy() {
-    boost::shared_lock<boost::shared_mutex> g(poolListSMtx);
     bool res = false;
-    for (auto &e : poolList) {
+    std::shared_ptr<const RoutingTable> table = getRouting();
+    for (auto &e : table->pools) {
         res |= e->isHealthy();
     }
     return res;
 }
+
+std::vector<LatencyStat> CodisClient::getLatencySnapshot() {
+    return LatencyRecorder::getInstance().snapshot();
+}
+
+CodisSnapshot CodisClient::getSnapshot() {
+    CodisSnapshot res;
+    res.time = (std::int64_t) time(nullptr);
+    std::shared_ptr<const RoutingTable> table = getRouting();
+    const PoolList &pools = table->pools;
+    res.proxies.reserve(pools.size());
+    for (auto &e : pools) {
+        res.proxies.push_back(e->getStats());
+    }
+    res.zkChildrenNum = discovery->getChildrenNum();
+    res.zkLastUpdateTime = discovery->getLastUpdateTime();
+    res.zkUpdateNum = discovery->getUpdateNum();
+    res.zkEventNum = discovery->getEventNum();
+    res.zkSessionExpiredNum = discovery->getSessionExpiredNum();
+    res.zkLastResyncConvergeMs = discovery->getLastResyncConvergeMs();
+    res.localZone = localZone;
+    res.zoneRoutedNum = zoneRoutedNum;
+    res.crossZoneNum = crossZoneNum;
+    res.overloadRerouteNum = overloadRerouteNum;
+    if (retryPolicy) {
+        res.retryNum = retryPolicy->getRetryNum();
+        res.retrySuccessNum = retryPolicy->getRetrySuccessNum();
+        res.retryBudgetExhaustedNum = retryPolicy->getBudgetExhaustedNum();
+    }
+    if (hedger) {
+        res.hedgeRequestNum = hedger->getRequestNum();
+        res.hedgeNum = hedger->getHedgeNum();
+        res.hedgeWinNum = hedger->getHedgeWinNum();
+        res.hedgeDelayUs = hedger->getDelayUs();
+    }
+    if (singleFlight) {
+        res.singleFlightLeaderNum = singleFlight->getLeaderNum();
+        res.singleFlightSharedNum = singleFlight->getSharedNum();
+    }
+    if (connectionBudget) {
+        res.connectionBudget = connectionBudget->getConfig().totalConns;
+        res.connectionAllocatedNum = connectionBudget->getAllocatedNum();
+        res.budgetRebalanceNum = connectionBudget->getRebalanceNum();
+        res.budgetResizeNum = connectionBudget->getResizeNum();
+    }
+    res.latencies = getLatencySnapshot();
+    if (RedisTracer::getSampleRate() > 0) res.tracePhases = getTracePhaseStats();
+    res.traceDroppedNum = RedisTracer::getInstance().getDroppedNum();
+    return res;
+}
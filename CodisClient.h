@@ -9,36 +9,154 @@
 #include "CodisConfig.h"
 #include "redis_client/RedisClient.h"
 #include "zk_children_watcher/ZKChildrenWatcher.h"
+#include "StaticProxyDiscovery.h"
+#include "FileProxyDiscovery.h"
+#include "Hedger.h"
+#include "RetryPolicy.h"
+#include "ConnectionBudget.h"
+#include "redis_client/SingleFlight.h"
+#include "redis_client/LatencyRecorder.h"
+#include "CodisSnapshot.h"
+#include "redis_client/RedisTracer.h"
+#include "ProxyRegistry.h"
+#include "TopologySnapshot.h"
+#include "ThreadPool.h"
 #include <unordered_map>
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
 
 class CodisClient {
     CodisConfig codisConfig;
     REDIS_CONFIG innerRedisPoolConf;
-    ZKChildrenWatcher childrenWatcher;
+    std::unique_ptr<ProxyDiscovery> discovery;
+    ZKChildrenWatcher *zkWatcher;  // discovery if it is zk, else null
 
-//    std::unordered_map<std::string, std::shared_ptr<RedisClient>> poolList;
-    std::vector<std::shared_ptr<RedisClient> > poolList;
-    boost::shared_mutex poolListSMtx;
+    typedef ProxyRegistry::PoolList PoolList;
+    typedef ProxyRegistry::RoutingTable RoutingTable;
+
+    ProxyRegistry proxyRegistry;  // under poolListUpdateMtx
+    // pools of the online proxies, copy-on-write: readers take the current table with std::atomic_load and
+    // never wait, an update publishes a whole new table with std::atomic_store
+    std::shared_ptr<const RoutingTable> routing;
+    std::mutex poolListUpdateMtx;  // serializes updates
     std::atomic<std::int64_t> roundRobinIndex;
+    std::atomic<std::int64_t> remoteRoundRobinIndex;
+
+    std::string localZone;  // zoneConfig.localZone or $CODIS_LOCAL_ZONE
+    std::atomic<std::int64_t> zoneRoutedNum;  // picks while zone-aware
+    std::atomic<std::int64_t> crossZoneNum;   // of which to another zone
+    std::atomic<std::int64_t> overloadRerouteNum;
+
+    // pool builds submitted and not finished yet
+    std::mutex buildMtx;
+    std::condition_variable buildCv;
+    int pendingBuildNum;
+
+    std::mutex maintenanceMtx;
+    std::condition_variable maintenanceCv;
+    bool maintenanceStopping;
 
     std::function<void()> reconnectNotifier;
     std::function<void()> resumeCustomWatcherNotifier;
 
+    std::unique_ptr<Hedger> hedger;
+    std::unique_ptr<RetryPolicy> retryPolicy;
+    std::shared_ptr<SingleFlight> singleFlight;  // also set on every pool
+    std::unique_ptr<ConnectionBudget> connectionBudget;  // null unless connectionBudgetConfig.totalConns > 0
+
+    // builds the pools of new proxies; declared after the members the
+    // builds use, so it is drained before they go
+    ThreadPool poolBuilder;
+
+    // retries failed pool builds, refreshes weights and rebalances the connection budget
+    std::thread maintenanceThread;
+
+    // starts discovery in the background after a warm start; declared
+    // after the members it uses, joined in the destructor
+    std::thread discoveryInitThread;
+
+    // deadline: nullptr for none
+    RedisReplyPtr routeCommandArgv(const std::vector<std::string> &argv,
+                                   const std::chrono::steady_clock::time_point *deadline);
+
+    // one attempt on client, hedged for read-only commands when enabled and there is no deadline
+    RedisReplyPtr executeOn(const std::shared_ptr<RedisClient> &client, const std::vector<std::string> &argv,
+                            const std::chrono::steady_clock::time_point *deadline, int *code);
+
+    // diff the registry against proxies, publish the routable pools and
+    // start building the pools of new proxies
+    void applyProxies(const std::vector<CodisProxyInfo> &proxies);
+
+    // under poolListUpdateMtx
+    void publishRouting();
+
+    // under poolListUpdateMtx
+    void scheduleBuilds();
+
+    // runs on poolBuilder
+    void buildPool(const ProxyRegistry::BuildTask &task);
+
+    // wait until no pool build is pending, at most timeoutMs
+    void waitPoolBuilds(int timeoutMs);
+
+    void maintenanceLoop();
+
+    bool warmStart();
+
+    // path of addr given as unix:///path or mapped in socketConfig, empty for TCP
+    std::string unixSocketPath(const std::string &addr) const;
+
+    std::shared_ptr<const RoutingTable> getRouting() const { return std::atomic_load(&routing); }
+
 public:
     CodisClient(const CodisConfig &config);
 
+    ~CodisClient();
+
+    // With warmStartConfig.snapshotPath set and a fresh snapshot, serves
+    // the saved proxies at once and starts discovery in the background;
+    // otherwise blocks until discovery is started (zk connected), as before.
     void init();
 
     void initRoundRobinRedisPool();
 
     std::vector<std::shared_ptr<RedisClient> > *getRedisPool();
 
+    // Round-robin by weight; zone-aware when a local zone is set, see ZoneConfig
     std::shared_ptr<RedisClient> RoundRobinRedisPool();
 
+    // next pool in round-robin order that is not the given one,
+    // or an empty pointer if there is no other pool. While the local zone
+    // is routed to, another local pool is preferred, and a pool of another
+    // zone is counted in crossZoneNum.
+    std::shared_ptr<RedisClient> RoundRobinOtherRedisPool(const std::shared_ptr<RedisClient> &exclude);
+
+    // Execute a command given as an argument vector on a round-robin pool,
+    // or on another pool if that one is over its concurrency limit.
+    // Failed commands are retried per retryConfig when it is enabled.
+    // Read-only commands are hedged when hedgeConfig.enable is set, and
+    // identical concurrent commands are coalesced when singleFlightConfig.enable is set.
+    RedisReplyPtr redisCommandArgv(const std::vector<std::string> &argv);
+
+    // redisCommandArgv bounded by an absolute deadline (e.g. the upstream
+    // RPC deadline), which every attempt and backoff must fit in: an empty
+    // reply once it passes. Neither hedged nor coalesced.
+    RedisReplyPtr redisCommandArgv(const std::vector<std::string> &argv,
+                                   const std::chrono::steady_clock::time_point &deadline);
+
     void proxyWatcher();
 
-    std::shared_ptr<RedisClient> getRedisClient(const std::string &clusterAddr);
+    // a pool of clusterAddr (comma separated host:port or unix:///path) of
+    // poolSize sockets (0: redisConfig.connPoolSize); sockets that fail to
+    // connect are retried on use
+    std::shared_ptr<RedisClient> getRedisClient(const std::string &clusterAddr, int poolSize = 0);
+
+    // getRedisClient for a proxy, an empty pointer if it fails or no socket is connected
+    std::shared_ptr<RedisClient> createProxyClient(const CodisProxyInfo &info, int poolSize = 0);
 
     long getTotalWaitConnNum();
 
@@ -46,10 +164,31 @@ public:
 
     bool isHealthy();
 
-    void setZKReconnectNotifier(const std::function<void()> &func) { childrenWatcher.setReconnectNotifier(func); }
+    // latency percentiles per (command, proxy), merged over all threads;
+    // covers single commands and pipelines ("PIPELINE")
+    std::vector<LatencyStat> getLatencySnapshot();
+
+    // per proxy pool state and counters, zk watcher state, hedge and
+    // single-flight counters and latency percentiles;
+    // render with toPrometheus() or toJson()
+    CodisSnapshot getSnapshot();
+
+    // trace one in oneInN requests, 0 turns tracing off
+    void setTraceSampleRate(int oneInN) { RedisTracer::setSampleRate(oneInN); }
+
+    // per-phase latency of the sampled requests
+    std::vector<PhaseStat> getTracePhaseStats() { return RedisTracer::getInstance().getPhaseStats(); }
+
+    // latest sampled requests slower than traceConfig.slowThresholdMs
+    std::vector<SlowRequest> getSlowRequests() { return RedisTracer::getInstance().getSlowRequests(); }
+
+    // no-op unless discoveryConfig.type is "zk"
+    void setZKReconnectNotifier(const std::function<void()> &func) {
+        if (zkWatcher) zkWatcher->setReconnectNotifier(func);
+    }
 
     void setZKResumeCustomWatcherNotifier(const std::function<void()> &func) {
-        childrenWatcher.setResumeCustomWatcherNotifier(func);
+        if (zkWatcher) zkWatcher->setResumeCustomWatcherNotifier(func);
     }
 };
 
@@ -3,6 +3,87 @@
 //
 
 #include "CodisConfig.h"
+#include "redis_client/RedisClient.h"
+
+HedgeConfig::HedgeConfig() {
+    enable = false;
+    delayPercentile = 95;
+    minDelayMs = 1;
+    maxDelayMs = 50;
+    budgetRatio = 0.05;
+    executorThreadNum = 32;
+    executorQueueSize = 1024;
+}
+
+SingleFlightConfig::SingleFlightConfig() {
+    enable = false;
+    commands = {"GET", "MGET", "HGET", "HMGET", "HGETALL", "EXISTS"};
+}
+
+TraceConfig::TraceConfig() {
+    sampleRate = 0;
+    slowThresholdMs = 100;
+    maxSlowRequestNum = 128;
+    drainIntervalMs = 100;
+}
+
+WarmStartConfig::WarmStartConfig() {
+    maxSnapshotAgeSec = 24 * 3600;
+}
+
+PoolBuildConfig::PoolBuildConfig() {
+    threadNum = 8;
+    maxQueueSize = 1024;
+    retryIntervalMs = 3000;
+    initWaitMs = 10000;
+}
+
+ZoneConfig::ZoneConfig() {
+    minLocalHealthyRatio = 0.5;
+    spillOnSaturation = true;
+}
+
+ConcurrencyLimitConfig::ConcurrencyLimitConfig() {
+    enable = false;
+    minLimit = 2;
+}
+
+RetryConfig::RetryConfig() {
+    enable = false;
+    maxRetries = 1;
+    retryableCodes = {CLIENT_ERROR, CLIENT_OVERLOAD};
+    readOnlyOnly = true;
+    differentProxy = true;
+    backoffBaseMs = 1;
+    backoffMaxMs = 20;
+    budgetRatio = 0.1;
+    budgetBurst = 10;
+    inlineRetry = true;
+}
+
+ReconnectBackoffConfig::ReconnectBackoffConfig() {
+    baseMs = 100;
+    maxMs = 10000;
+}
+
+SocketConfig::SocketConfig() {
+    tcpNoDelay = true;
+    sendBufferBytes = 0;
+    recvBufferBytes = 0;
+    busyPollUs = 0;
+    ioUring = false;
+}
+
+ConnectionBudgetConfig::ConnectionBudgetConfig() {
+    totalConns = 0;
+    minPerPool = 2;
+    maxPerPool = 0;
+    rebalanceIntervalMs = 1000;
+}
+
+DiscoveryConfig::DiscoveryConfig() {
+    type = "zk";
+}
 
 CodisConfig::CodisConfig(const RedisConfig &redisConfig, const ZKConfig &zkConfig) :
         redisConfig(redisConfig),
@@ -7,11 +7,195 @@
 
 #include "redis_client/RedisConfig.h"
 #include "zk_children_watcher/ZKConfig.h"
+#include <map>
+#include <string>
+#include <vector>
+
+// Hedged reads: a read-only command still pending after the hedge delay
+// is duplicated to another proxy and the first reply wins.
+class HedgeConfig {
+public:
+    bool enable;
+    double delayPercentile;  // hedge delay = this percentile of observed read latency
+    int minDelayMs;
+    int maxDelayMs;          // also the delay used until enough samples are seen
+    double budgetRatio;      // at most this fraction of extra requests, e.g. 0.05
+    int executorThreadNum;
+    int executorQueueSize;
+
+    HedgeConfig();
+};
+
+// Single-flight: concurrent identical commands (same argument vector)
+// share one in-flight request. Only the listed commands are coalesced.
+class SingleFlightConfig {
+public:
+    bool enable;
+    std::vector<std::string> commands;
+
+    SingleFlightConfig();
+};
+
+// Sampled phase tracing of requests (acquire, format, write, wait, parse,
+// reconnect); the sample rate can be changed at runtime too.
+class TraceConfig {
+public:
+    int sampleRate;         // trace one in sampleRate requests, 0: off
+    int slowThresholdMs;    // keep the phase breakdown of requests slower than this
+    int maxSlowRequestNum;
+    int drainIntervalMs;    // background drain of the trace ring buffer while tracing is on
+
+    TraceConfig();
+};
+
+// Warm start: the proxy list is saved to snapshotPath after each update
+// from discovery. On init a snapshot younger than maxSnapshotAgeSec is
+// served right away and discovery (zk) is started in the background.
+class WarmStartConfig {
+public:
+    std::string snapshotPath;  // empty: off
+    int maxSnapshotAgeSec;
+
+    WarmStartConfig();
+};
+
+// Pools of new proxies are connected on a background executor and
+// routed to once built; proxies whose pool could not be connected are
+// retried, and pool weights refreshed, every retryIntervalMs.
+class PoolBuildConfig {
+public:
+    int threadNum;
+    int maxQueueSize;
+    int retryIntervalMs;
+    int initWaitMs;  // init (and warm start) waits this long at most for the first pools
+
+    PoolBuildConfig();
+};
+
+// Zone-aware routing: requests go to the proxies whose datacenter is
+// localZone (or $CODIS_LOCAL_ZONE if empty; off if both are empty).
+// They spill over to other zones when the local zone is unhealthy (less
+// than minLocalHealthyRatio of its sockets connected) or, with
+// spillOnSaturation, when the picked local pool has no idle socket.
+class ZoneConfig {
+public:
+    std::string localZone;
+    double minLocalHealthyRatio;
+    bool spillOnSaturation;
+
+    ZoneConfig();
+};
+
+// Adaptive concurrency limit per proxy pool (see ConcurrencyLimiter):
+// in-flight requests are capped between minLimit and the pool size, and
+// a command over the limit of its pool is sent to another pool instead.
+class ConcurrencyLimitConfig {
+public:
+    bool enable;
+    int minLimit;
+
+    ConcurrencyLimitConfig();
+};
+
+// Retries of commands that failed with one of retryableCodes (CLIENT_CODE),
+// on another proxy when differentProxy is set, after a jittered
+// exponential backoff. Retries are capped by a budget of budgetRatio
+// retry per successful command (plus a burst of budgetBurst).
+// With enable set this policy is the only retry of redisCommandArgv: the
+// pool's own resend on the reconnected socket is skipped for those calls,
+// as it would bypass the budget. inlineRetry keeps or turns off that resend
+// for every other call (redisCommand, pipelines, hedges).
+class RetryConfig {
+public:
+    bool enable;
+    int maxRetries;
+    std::vector<int> retryableCodes;
+    bool readOnlyOnly;  // retry only read-only commands (writes may have been applied)
+    bool differentProxy;
+    int backoffBaseMs;
+    int backoffMaxMs;
+    double budgetRatio;
+    int budgetBurst;
+    bool inlineRetry;
+
+    RetryConfig();
+};
+
+// Reconnect backoff of the pooled sockets, per socket and per proxy
+// endpoint: after n consecutive failed connects, the next attempt waits
+// min(maxMs, baseMs * 2^(n-1)) with the upper half jittered, so that the
+// sockets of all clients do not reconnect to a restarted proxy at once.
+class ReconnectBackoffConfig {
+public:
+    int baseMs;
+    int maxMs;
+
+    ReconnectBackoffConfig();
+};
+
+// Transport of the pooled sockets. A proxy running on this host (e.g. as
+// a sidecar) is connected over its Unix domain socket: give its addr as
+// unix:///path, or map its discovered host:port to the path in
+// unixSocketPaths. The buffer and poll options apply to TCP, 0 keeps the
+// default. ioUring drives pipeline::RedisGetReplies over io_uring when the
+// pool is built with HPOOL_HAVE_LIBURING, else epoll is used.
+class SocketConfig {
+public:
+    std::map<std::string, std::string> unixSocketPaths;  // proxy addr -> unix socket path
+    bool tcpNoDelay;
+    int sendBufferBytes;
+    int recvBufferBytes;
+    int busyPollUs;  // SO_BUSY_POLL, needs CAP_NET_ADMIN
+    bool ioUring;
+
+    SocketConfig();
+};
+
+// Connections shared by all proxy pools (see ConnectionBudget). With
+// totalConns > 0, every rebalanceIntervalMs each routable pool is resized
+// to between minPerPool and maxPerPool (0: no cap) sockets, in proportion
+// to its demand, instead of redisConfig.connPoolSize each; a new pool
+// starts with an even share among the online proxies, reserved before it
+// is built. Pools grow on the pool build threads (poolBuildConfig).
+class ConnectionBudgetConfig {
+public:
+    int totalConns;
+    int minPerPool;
+    int maxPerPool;
+    int rebalanceIntervalMs;
+
+    ConnectionBudgetConfig();
+};
+
+// Where the proxy list comes from: "zk" (zkConfig, the default),
+// "static" (staticProxies) or "file" (filePath, watched with inotify).
+// Entries of staticProxies and lines of the file are the json data of a
+// codis proxy node or a bare host:port.
+class DiscoveryConfig {
+public:
+    std::string type;
+    std::vector<std::string> staticProxies;
+    std::string filePath;
+
+    DiscoveryConfig();
+};
 
 class CodisConfig {
 public:
     RedisConfig redisConfig;
     ZKConfig zkConfig;
+    HedgeConfig hedgeConfig;
+    SingleFlightConfig singleFlightConfig;
+    TraceConfig traceConfig;
+    WarmStartConfig warmStartConfig;
+    DiscoveryConfig discoveryConfig;
+    PoolBuildConfig poolBuildConfig;
+    ZoneConfig zoneConfig;
+    ConcurrencyLimitConfig concurrencyLimitConfig;
+    RetryConfig retryConfig;
+    ReconnectBackoffConfig reconnectBackoffConfig;
+    SocketConfig socketConfig;
+    ConnectionBudgetConfig connectionBudgetConfig;
 
     CodisConfig() = default;
     CodisConfig(const RedisConfig &redisConfig, const ZKConfig &zkConfig);
@@ -0,0 +1,247 @@
+//
+// Created by admin on 2019-03-20.
+//
+
+#include "CodisProxyInfo.h"
+#include <cstring>
+
+namespace {
+    const int MAX_DEPTH = 32;  // of skipped nested values
+
+    struct Cursor {
+        const char *p;
+        const char *end;
+
+        bool eof() const { return p >= end; }
+
+        void skipSpace() {
+            while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) ++p;
+        }
+
+        bool consume(char c) {
+            skipSpace();
+            if (p < end && *p == c) {
+                ++p;
+                return true;
+            }
+            return false;
+        }
+    };
+
+    int hexValue(char c) {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return -1;
+    }
+
+    // p at the opening quote; sets [begin, end) to the raw (escaped) content
+    bool scanString(Cursor &c, const char *&begin, const char *&end, bool &escaped) {
+        if (!c.consume('"')) return false;
+        begin = c.p;
+        escaped = false;
+        while (c.p < c.end) {
+            if (*c.p == '"') {
+                end = c.p++;
+                return true;
+            }
+            if (*c.p == '\\') {
+                escaped = true;
+                if (++c.p >= c.end) return false;
+            }
+            ++c.p;
+        }
+        return false;
+    }
+
+    // appends the utf-8 encoding of code point cp
+    void appendUtf8(std::string &out, unsigned cp) {
+        if (cp < 0x80) {
+            out += (char) cp;
+        } else if (cp < 0x800) {
+            out += (char) (0xC0 | (cp >> 6));
+            out += (char) (0x80 | (cp & 0x3F));
+        } else {
+            out += (char) (0xE0 | (cp >> 12));
+            out += (char) (0x80 | ((cp >> 6) & 0x3F));
+            out += (char) (0x80 | (cp & 0x3F));
+        }
+    }
+
+    bool unescape(const char *begin, const char *end, bool escaped, std::string &out) {
+        if (!escaped) {
+            out.assign(begin, end - begin);
+            return true;
+        }
+        out.clear();
+        for (const char *p = begin; p < end; ++p) {
+            if (*p != '\\') {
+                out += *p;
+                continue;
+            }
+            ++p;  // scanString guarantees a char after '\'
+            switch (*p) {
+                case '"':
+                case '\\':
+                case '/':
+                    out += *p;
+                    break;
+                case 'b':
+                    out += '\b';
+                    break;
+                case 'f':
+                    out += '\f';
+                    break;
+                case 'n':
+                    out += '\n';
+                    break;
+                case 'r':
+                    out += '\r';
+                    break;
+                case 't':
+                    out += '\t';
+                    break;
+                case 'u': {
+                    if (end - p < 5) return false;
+                    unsigned cp = 0;
+                    for (int i = 1; i <= 4; ++i) {
+                        int h = hexValue(p[i]);
+                        if (h < 0) return false;
+                        cp = (cp << 4) | (unsigned) h;
+                    }
+                    appendUtf8(out, cp);  // surrogate pairs are kept as two code points
+                    p += 4;
+                    break;
+                }
+                default:
+                    return false;
+            }
+        }
+        return true;
+    }
+
+    bool scanNumber(Cursor &c, std::int64_t *value) {
+        c.skipSpace();
+        const char *begin = c.p;
+        bool negative = false;
+        std::int64_t v = 0;
+        if (c.p < c.end && *c.p == '-') {
+            negative = true;
+            ++c.p;
+        }
+        while (c.p < c.end && *c.p >= '0' && *c.p <= '9') {
+            if (v < INT64_MAX / 10) v = v * 10 + (*c.p - '0');
+            ++c.p;
+        }
+        // fraction/exponent: accepted, not kept
+        while (c.p < c.end && (*c.p == '.' || *c.p == 'e' || *c.p == 'E' || *c.p == '+' || *c.p == '-' ||
+                               (*c.p >= '0' && *c.p <= '9')))
+            ++c.p;
+        if (c.p == begin || (negative && c.p == begin + 1)) return false;
+        if (value) *value = negative ? -v : v;
+        return true;
+    }
+
+    bool skipValue(Cursor &c, int depth);
+
+    bool skipContainer(Cursor &c, char close, int depth) {
+        if (depth > MAX_DEPTH) return false;
+        if (c.consume(close)) return true;
+        for (;;) {
+            if (close == '}') {
+                const char *b, *e;
+                bool escaped;
+                if (!scanString(c, b, e, escaped) || !c.consume(':')) return false;
+            }
+            if (!skipValue(c, depth + 1)) return false;
+            if (c.consume(close)) return true;
+            if (!c.consume(',')) return false;
+        }
+    }
+
+    bool skipLiteral(Cursor &c, const char *literal) {
+        size_t n = strlen(literal);
+        if ((size_t) (c.end - c.p) < n || memcmp(c.p, literal, n) != 0) return false;
+        c.p += n;
+        return true;
+    }
+
+    bool skipValue(Cursor &c, int depth) {
+        c.skipSpace();
+        if (c.eof()) return false;
+        switch (*c.p) {
+            case '"': {
+                const char *b, *e;
+                bool escaped;
+                return scanString(c, b, e, escaped);
+            }
+            case '{':
+                ++c.p;
+                return skipContainer(c, '}', depth);
+            case '[':
+                ++c.p;
+                return skipContainer(c, ']', depth);
+            case 't':
+                return skipLiteral(c, "true");
+            case 'f':
+                return skipLiteral(c, "false");
+            case 'n':
+                return skipLiteral(c, "null");
+            default:
+                return scanNumber(c, nullptr);
+        }
+    }
+
+    bool keyIs(const char *b, const char *e, const char *key) {
+        size_t n = strlen(key);
+        return (size_t) (e - b) == n && memcmp(b, key, n) == 0;
+    }
+
+    // field of info a key maps to, nullptr if not a string field
+    std::string *stringField(CodisProxyInfo &info, const char *b, const char *e) {
+        if (keyIs(b, e, "addr") || keyIs(b, e, "proxy_addr")) return &info.addr;
+        if (keyIs(b, e, "token")) return &info.token;
+        if (keyIs(b, e, "state")) return &info.state;
+        if (keyIs(b, e, "admin") || keyIs(b, e, "admin_addr")) return &info.adminAddr;
+        if (keyIs(b, e, "datacenter")) return &info.datacenter;
+        if (keyIs(b, e, "start") || keyIs(b, e, "start_time")) return &info.startTime;
+        return nullptr;
+    }
+}
+
+bool CodisProxyInfo::parse(const char *data, size_t len, CodisProxyInfo &info) {
+    Cursor c = {data, data + len};
+    info.token.clear();
+    info.addr.clear();
+    info.adminAddr.clear();
+    info.state.clear();
+    info.datacenter.clear();
+    info.startTime.clear();
+    info.pid = 0;
+
+    if (!c.consume('{')) return false;
+    if (!c.consume('}')) {
+        for (;;) {
+            const char *kb, *ke;
+            bool escaped;
+            if (!scanString(c, kb, ke, escaped) || !c.consume(':')) return false;
+
+            c.skipSpace();
+            std::string *field = escaped ? nullptr : stringField(info, kb, ke);
+            if (field && !c.eof() && *c.p == '"') {
+                const char *vb, *ve;
+                bool valueEscaped;
+                if (!scanString(c, vb, ve, valueEscaped) || !unescape(vb, ve, valueEscaped, *field)) return false;
+            } else if (!escaped && keyIs(kb, ke, "pid") && !c.eof() && (*c.p == '-' || (*c.p >= '0' && *c.p <= '9'))) {
+                if (!scanNumber(c, &info.pid)) return false;
+            } else if (!skipValue(c, 0)) {
+                return false;
+            }
+
+            if (c.consume('}')) break;
+            if (!c.consume(',')) return false;
+        }
+    }
+    // bytes after the object (e.g. padding in the node data) are ignored
+    return !info.addr.empty();
+}
@@ -0,0 +1,43 @@
+//
+// Created by admin on 2019-03-20.
+//
+
+#ifndef CPPSERVER_CODISPROXYINFO_H
+#define CPPSERVER_CODISPROXYINFO_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// CodisProxyInfo is the data of a codis proxy node in zk (jodis), e.g.
+// {"token":"...","addr":"10.0.0.1:19000","admin":"10.0.0.1:11080","start":"...","state":"online"}.
+struct CodisProxyInfo {
+    std::string token;      // may be missing in older codis versions
+    std::string addr;       // host:port, or a ',' separated list; "addr" or "proxy_addr"
+    std::string adminAddr;  // "admin" or "admin_addr"
+    std::string state;
+    std::string datacenter;
+    std::string startTime;  // "start" or "start_time", as written by the proxy
+    std::int64_t pid;       // 0 if missing
+
+    CodisProxyInfo() : pid(0) {}
+
+    bool isOnline() const { return state == "online"; }
+
+    // identity of the proxy across topology updates
+    const std::string &key() const { return token.empty() ? addr : token; }
+
+    // Parses the node data without intermediate allocations: the json is
+    // scanned in place and only the known fields are copied out (reusing
+    // the capacity of info's strings). Unknown fields, of any type, are
+    // skipped and bytes after the closing '}' are ignored.
+    // Returns false if data is not a json object with an addr.
+    static bool parse(const char *data, size_t len, CodisProxyInfo &info);
+
+    static bool parse(const std::string &value, CodisProxyInfo &info) {
+        return parse(value.data(), value.size(), info);
+    }
+};
+
+
+#endif //CPPSERVER_CODISPROXYINFO_H
@@ -0,0 +1,367 @@
+//
+// Created by admin on 2019-03-11.
+//
+
+#include "CodisSnapshot.h"
+#include <cstdio>
+#include <sstream>
+
+namespace {
+    std::string escapeLabel(const std::string &s) {
+        std::string res;
+        res.reserve(s.size());
+        for (char c : s) {
+            if (c == '\\' || c == '"') {
+                res += '\\';
+                res += c;
+            } else if (c == '\n') {
+                res += "\\n";
+            } else {
+                res += c;
+            }
+        }
+        return res;
+    }
+
+    std::string escapeJson(const std::string &s) {
+        std::string res;
+        res.reserve(s.size() + 2);
+        res += '"';
+        for (char c : s) {
+            if (c == '\\' || c == '"') {
+                res += '\\';
+                res += c;
+            } else if ((unsigned char) c < 0x20) {
+                char buf[8];
+                snprintf(buf, sizeof(buf), "\\u%04x", (unsigned char) c);
+                res += buf;
+            } else {
+                res += c;
+            }
+        }
+        res += '"';
+        return res;
+    }
+
+    void help(std::ostringstream &os, const char *name, const char *type, const char *text) {
+        os << "# HELP " << name << ' ' << text << '\n';
+        os << "# TYPE " << name << ' ' << type << '\n';
+    }
+}
+
+CodisSnapshot::CodisSnapshot() :
+        time(0),
+        zkChildrenNum(0),
+        zkLastUpdateTime(0),
+        zkUpdateNum(0),
+        zkEventNum(0),
+        zkSessionExpiredNum(0),
+        zkLastResyncConvergeMs(-1),
+        zoneRoutedNum(0),
+        crossZoneNum(0),
+        overloadRerouteNum(0),
+        retryNum(0),
+        retrySuccessNum(0),
+        retryBudgetExhaustedNum(0),
+        hedgeRequestNum(0),
+        hedgeNum(0),
+        hedgeWinNum(0),
+        hedgeDelayUs(0),
+        singleFlightLeaderNum(0),
+        singleFlightSharedNum(0),
+        connectionBudget(0),
+        connectionAllocatedNum(0),
+        budgetRebalanceNum(0),
+        budgetResizeNum(0),
+        traceDroppedNum(0) {}
+
+const char *CodisSnapshot::clientCodeName(int code) {
+    switch (code) {
+        case CLIENT_OK:
+            return "ok";
+        case CLIENT_RWTIMEOUT:
+            return "rwtimeout";
+        case CLIENT_ERROR:
+            return "error";
+        case CLIENT_OTHER:
+            return "other";
+        case CLIENT_INVALID_REPLY:
+            return "invalid_reply";
+        case CLIENT_OVERLOAD:
+            return "overload";
+        default:
+            return "unknown";
+    }
+}
+
+std::string CodisSnapshot::toPrometheus() const {
+    std::ostringstream os;
+
+    help(os, "codis_proxy_healthy", "gauge", "Whether the proxy passes health checks.");
+    for (auto &p : proxies) {
+        os << "codis_proxy_healthy{proxy=\"" << escapeLabel(p.proxy) << "\"} " << (p.healthy ? 1 : 0) << '\n';
+    }
+
+    help(os, "codis_proxy_sockets", "gauge", "Pooled sockets by state.");
+    for (auto &p : proxies) {
+        std::string proxy = escapeLabel(p.proxy);
+        os << "codis_proxy_sockets{proxy=\"" << proxy << "\",state=\"connected\"} " << p.connectedNum << '\n';
+        os << "codis_proxy_sockets{proxy=\"" << proxy << "\",state=\"unconnected\"} " << p.unconnectedNum << '\n';
+        os << "codis_proxy_sockets{proxy=\"" << proxy << "\",state=\"inuse\"} " << p.inuseNum << '\n';
+        os << "codis_proxy_sockets{proxy=\"" << proxy << "\",state=\"backoff\"} " << p.backoffNum << '\n';
+        os << "codis_proxy_sockets{proxy=\"" << proxy << "\",state=\"parked\"} " << p.parkedNum << '\n';
+    }
+
+    help(os, "codis_proxy_endpoints_backoff", "gauge", "Endpoints of the pool waiting for their reconnect backoff.");
+    for (auto &p : proxies) {
+        os << "codis_proxy_endpoints_backoff{proxy=\"" << escapeLabel(p.proxy) << "\"} "
+           << p.backoffEndpointNum << '\n';
+    }
+
+    help(os, "codis_proxy_waiting", "gauge", "Threads currently acquiring a socket.");
+    for (auto &p : proxies) {
+        os << "codis_proxy_waiting{proxy=\"" << escapeLabel(p.proxy) << "\"} " << p.waitNum << '\n';
+    }
+
+    help(os, "codis_proxy_concurrency_limit", "gauge", "Adaptive limit of in-flight requests, 0 if not limited.");
+    for (auto &p : proxies) {
+        os << "codis_proxy_concurrency_limit{proxy=\"" << escapeLabel(p.proxy) << "\"} " << p.concurrencyLimit << '\n';
+    }
+
+    help(os, "codis_proxy_inflight", "gauge", "Requests in flight under the concurrency limit.");
+    for (auto &p : proxies) {
+        os << "codis_proxy_inflight{proxy=\"" << escapeLabel(p.proxy) << "\"} " << p.inflightNum << '\n';
+    }
+
+    help(os, "codis_proxy_acquire_total", "counter", "Socket acquisitions by result.");
+    for (auto &p : proxies) {
+        std::string proxy = escapeLabel(p.proxy);
+        os << "codis_proxy_acquire_total{proxy=\"" << proxy << "\",result=\"ok\"} "
+           << p.counters.acquire_num << '\n';
+        os << "codis_proxy_acquire_total{proxy=\"" << proxy << "\",result=\"fail\"} "
+           << p.counters.acquire_fail_num << '\n';
+    }
+
+    help(os, "codis_proxy_acquire_wait_us_total", "counter", "Time spent acquiring sockets.");
+    for (auto &p : proxies) {
+        os << "codis_proxy_acquire_wait_us_total{proxy=\"" << escapeLabel(p.proxy) << "\"} "
+           << p.counters.acquire_wait_us << '\n';
+    }
+
+    help(os, "codis_proxy_connect_total", "counter", "Socket connects by result.");
+    for (auto &p : proxies) {
+        std::string proxy = escapeLabel(p.proxy);
+        os << "codis_proxy_connect_total{proxy=\"" << proxy << "\",result=\"ok\"} "
+           << p.counters.connect_num << '\n';
+        os << "codis_proxy_connect_total{proxy=\"" << proxy << "\",result=\"fail\"} "
+           << p.counters.connect_fail_num << '\n';
+    }
+
+    help(os, "codis_proxy_connect_backoff_skips_total", "counter",
+         "Connects not tried, endpoint in reconnect backoff.");
+    for (auto &p : proxies) {
+        os << "codis_proxy_connect_backoff_skips_total{proxy=\"" << escapeLabel(p.proxy) << "\"} "
+           << p.counters.backoff_skip_num << '\n';
+    }
+
+    help(os, "codis_proxy_reconnect_total", "counter", "Successful reconnects of sockets.");
+    for (auto &p : proxies) {
+        os << "codis_proxy_reconnect_total{proxy=\"" << escapeLabel(p.proxy) << "\"} "
+           << p.counters.reconnect_num << '\n';
+    }
+
+    help(os, "codis_proxy_bytes_total", "counter", "Bytes sent (out) and received (in).");
+    for (auto &p : proxies) {
+        std::string proxy = escapeLabel(p.proxy);
+        os << "codis_proxy_bytes_total{proxy=\"" << proxy << "\",direction=\"out\"} "
+           << p.counters.bytes_out << '\n';
+        os << "codis_proxy_bytes_total{proxy=\"" << proxy << "\",direction=\"in\"} "
+           << p.counters.bytes_in << '\n';
+    }
+
+    help(os, "codis_proxy_errors_total", "counter", "Failed requests by client code.");
+    for (auto &p : proxies) {
+        std::string proxy = escapeLabel(p.proxy);
+        for (int i = 1; i < HPOOL_ERROR_CODE_NUM; ++i) {
+            if (p.counters.error_num[i] == 0) continue;
+            os << "codis_proxy_errors_total{proxy=\"" << proxy << "\",code=\"" << clientCodeName(-i) << "\"} "
+               << p.counters.error_num[i] << '\n';
+        }
+    }
+
+    help(os, "codis_zk_children", "gauge", "Proxy nodes under the zk path.");
+    os << "codis_zk_children " << zkChildrenNum << '\n';
+    help(os, "codis_zk_last_update_timestamp_seconds", "gauge", "Last update of the proxy list from zk.");
+    os << "codis_zk_last_update_timestamp_seconds " << zkLastUpdateTime << '\n';
+    help(os, "codis_zk_updates_total", "counter", "Updates of the proxy list from zk.");
+    os << "codis_zk_updates_total " << zkUpdateNum << '\n';
+    help(os, "codis_zk_events_total", "counter", "Children and data change events from zk.");
+    os << "codis_zk_events_total " << zkEventNum << '\n';
+    help(os, "codis_zk_session_expired_total", "counter", "Zk session expiries.");
+    os << "codis_zk_session_expired_total " << zkSessionExpiredNum << '\n';
+    help(os, "codis_zk_resync_converge_ms", "gauge",
+         "Time from the last session expiry until the resynced proxy list was published, -1 if none.");
+    os << "codis_zk_resync_converge_ms " << zkLastResyncConvergeMs << '\n';
+
+    if (!localZone.empty()) {
+        std::string label = "{zone=\"" + escapeLabel(localZone) + "\"}";
+        help(os, "codis_zone_routed_requests_total", "counter", "Requests routed with zone-aware routing.");
+        os << "codis_zone_routed_requests_total" << label << ' ' << zoneRoutedNum << '\n';
+        help(os, "codis_cross_zone_requests_total", "counter", "Requests routed to a proxy outside the local zone.");
+        os << "codis_cross_zone_requests_total" << label << ' ' << crossZoneNum << '\n';
+        help(os, "codis_cross_zone_ratio", "gauge", "Fraction of routed requests that went to another zone.");
+        os << "codis_cross_zone_ratio" << label << ' '
+           << (zoneRoutedNum > 0 ? (double) crossZoneNum / zoneRoutedNum : 0.0) << '\n';
+    }
+
+    help(os, "codis_overload_reroutes_total", "counter",
+         "Commands sent to another proxy, the picked one being over its limit.");
+    os << "codis_overload_reroutes_total " << overloadRerouteNum << '\n';
+
+    help(os, "codis_retries_total", "counter", "Retries of failed commands.");
+    os << "codis_retries_total " << retryNum << '\n';
+    help(os, "codis_retry_successes_total", "counter", "Commands that succeeded after a retry.");
+    os << "codis_retry_successes_total " << retrySuccessNum << '\n';
+    help(os, "codis_retry_budget_exhausted_total", "counter", "Retryable failures not retried for lack of budget.");
+    os << "codis_retry_budget_exhausted_total " << retryBudgetExhaustedNum << '\n';
+
+    help(os, "codis_hedge_requests_total", "counter", "Requests eligible for hedging.");
+    os << "codis_hedge_requests_total " << hedgeRequestNum << '\n';
+    help(os, "codis_hedges_total", "counter", "Hedge requests sent.");
+    os << "codis_hedges_total " << hedgeNum << '\n';
+    help(os, "codis_hedge_wins_total", "counter", "Hedge requests that replied first.");
+    os << "codis_hedge_wins_total " << hedgeWinNum << '\n';
+    help(os, "codis_hedge_delay_us", "gauge", "Current hedge delay.");
+    os << "codis_hedge_delay_us " << hedgeDelayUs << '\n';
+
+    if (connectionBudget > 0) {
+        help(os, "codis_connection_budget", "gauge", "Sockets shared by all proxy pools.");
+        os << "codis_connection_budget " << connectionBudget << '\n';
+        help(os, "codis_connection_budget_allocated", "gauge",
+             "Sockets of the routable pools after the last rebalance.");
+        os << "codis_connection_budget_allocated " << connectionAllocatedNum << '\n';
+        help(os, "codis_connection_budget_rebalances_total", "counter", "Rebalances of the connection budget.");
+        os << "codis_connection_budget_rebalances_total " << budgetRebalanceNum << '\n';
+        help(os, "codis_connection_budget_resizes_total", "counter", "Pools resized by a rebalance.");
+        os << "codis_connection_budget_resizes_total " << budgetResizeNum << '\n';
+    }
+
+    help(os, "codis_singleflight_leaders_total", "counter", "Coalescable requests sent to a proxy.");
+    os << "codis_singleflight_leaders_total " << singleFlightLeaderNum << '\n';
+    help(os, "codis_singleflight_shared_total", "counter", "Requests served by another request's reply.");
+    os << "codis_singleflight_shared_total " << singleFlightSharedNum << '\n';
+
+    help(os, "codis_command_latency_us", "summary", "Command latency by command and proxy.");
+    for (auto &l : latencies) {
+        std::string labels = "command=\"" + escapeLabel(l.command) + "\",proxy=\"" + escapeLabel(l.proxy) + "\"";
+        os << "codis_command_latency_us{" << labels << ",quantile=\"0.5\"} " << l.p50 << '\n';
+        os << "codis_command_latency_us{" << labels << ",quantile=\"0.9\"} " << l.p90 << '\n';
+        os << "codis_command_latency_us{" << labels << ",quantile=\"0.99\"} " << l.p99 << '\n';
+        os << "codis_command_latency_us{" << labels << ",quantile=\"0.999\"} " << l.p999 << '\n';
+        os << "codis_command_latency_us_count{" << labels << "} " << l.count << '\n';
+    }
+
+    if (!tracePhases.empty()) {
+        help(os, "codis_trace_phase_us", "summary", "Time per request phase of sampled requests.");
+        for (auto &p : tracePhases) {
+            std::string labels = "phase=\"" + p.phase + "\"";
+            os << "codis_trace_phase_us{" << labels << ",quantile=\"0.5\"} " << p.p50 << '\n';
+            os << "codis_trace_phase_us{" << labels << ",quantile=\"0.99\"} " << p.p99 << '\n';
+            os << "codis_trace_phase_us{" << labels << ",quantile=\"0.999\"} " << p.p999 << '\n';
+            os << "codis_trace_phase_us_count{" << labels << "} " << p.count << '\n';
+        }
+        help(os, "codis_trace_dropped_total", "counter", "Traces lost because the ring buffer was full.");
+        os << "codis_trace_dropped_total " << traceDroppedNum << '\n';
+    }
+
+    return os.str();
+}
+
+std::string CodisSnapshot::toJson() const {
+    std::ostringstream os;
+    os << "{\"time\":" << time << ",\"proxies\":[";
+    for (size_t i = 0; i < proxies.size(); ++i) {
+        const RedisClientStats &p = proxies[i];
+        if (i > 0) os << ',';
+        os << "{\"proxy\":" << escapeJson(p.proxy)
+           << ",\"healthy\":" << (p.healthy ? "true" : "false")
+           << ",\"sockets\":{\"total\":" << p.socketNum
+           << ",\"connected\":" << p.connectedNum
+           << ",\"unconnected\":" << p.unconnectedNum
+           << ",\"inuse\":" << p.inuseNum
+           << ",\"backoff\":" << p.backoffNum
+           << ",\"parked\":" << p.parkedNum << '}'
+           << ",\"waiting\":" << p.waitNum
+           << ",\"idle\":" << p.idleNum
+           << ",\"concurrency_limit\":" << p.concurrencyLimit
+           << ",\"inflight\":" << p.inflightNum
+           << ",\"acquire\":{\"ok\":" << p.counters.acquire_num
+           << ",\"fail\":" << p.counters.acquire_fail_num
+           << ",\"wait_us\":" << p.counters.acquire_wait_us << '}'
+           << ",\"connect\":{\"ok\":" << p.counters.connect_num
+           << ",\"fail\":" << p.counters.connect_fail_num
+           << ",\"reconnect\":" << p.counters.reconnect_num
+           << ",\"backoff_skips\":" << p.counters.backoff_skip_num
+           << ",\"backoff_endpoints\":" << p.backoffEndpointNum << '}'
+           << ",\"bytes\":{\"out\":" << p.counters.bytes_out
+           << ",\"in\":" << p.counters.bytes_in << '}'
+           << ",\"errors\":{";
+        bool first = true;
+        for (int c = 1; c < HPOOL_ERROR_CODE_NUM; ++c) {
+            if (p.counters.error_num[c] == 0) continue;
+            if (!first) os << ',';
+            first = false;
+            os << '"' << clientCodeName(-c) << "\":" << p.counters.error_num[c];
+        }
+        os << "}}";
+    }
+    os << "],\"zk\":{\"children\":" << zkChildrenNum
+       << ",\"last_update_time\":" << zkLastUpdateTime
+       << ",\"updates\":" << zkUpdateNum
+       << ",\"events\":" << zkEventNum
+       << ",\"session_expired\":" << zkSessionExpiredNum
+       << ",\"resync_converge_ms\":" << zkLastResyncConvergeMs << '}'
+       << ",\"zone\":{\"local\":" << escapeJson(localZone)
+       << ",\"routed\":" << zoneRoutedNum
+       << ",\"cross_zone\":" << crossZoneNum << '}'
+       << ",\"overload_reroutes\":" << overloadRerouteNum
+       << ",\"retry\":{\"retries\":" << retryNum
+       << ",\"successes\":" << retrySuccessNum
+       << ",\"budget_exhausted\":" << retryBudgetExhaustedNum << '}'
+       << ",\"hedge\":{\"requests\":" << hedgeRequestNum
+       << ",\"hedges\":" << hedgeNum
+       << ",\"wins\":" << hedgeWinNum
+       << ",\"delay_us\":" << hedgeDelayUs << '}'
+       << ",\"single_flight\":{\"leaders\":" << singleFlightLeaderNum
+       << ",\"shared\":" << singleFlightSharedNum << '}'
+       << ",\"connection_budget\":{\"total\":" << connectionBudget
+       << ",\"allocated\":" << connectionAllocatedNum
+       << ",\"rebalances\":" << budgetRebalanceNum
+       << ",\"resizes\":" << budgetResizeNum << '}'
+       << ",\"latencies\":[";
+    for (size_t i = 0; i < latencies.size(); ++i) {
+        const LatencyStat &l = latencies[i];
+        if (i > 0) os << ',';
+        os << "{\"command\":" << escapeJson(l.command)
+           << ",\"proxy\":" << escapeJson(l.proxy)
+           << ",\"count\":" << l.count
+           << ",\"p50\":" << l.p50
+           << ",\"p90\":" << l.p90
+           << ",\"p99\":" << l.p99
+           << ",\"p999\":" << l.p999
+           << ",\"max\":" << l.max << '}';
+    }
+    os << "],\"trace_phases\":[";
+    for (size_t i = 0; i < tracePhases.size(); ++i) {
+        const PhaseStat &p = tracePhases[i];
+        if (i > 0) os << ',';
+        os << "{\"phase\":" << escapeJson(p.phase)
+           << ",\"count\":" << p.count
+           << ",\"p50\":" << p.p50
+           << ",\"p99\":" << p.p99
+           << ",\"p999\":" << p.p999
+           << ",\"max\":" << p.max << '}';
+    }
+    os << "],\"trace_dropped\":" << traceDroppedNum << '}';
+    return os.str();
+}
@@ -0,0 +1,69 @@
+//
+// Created by admin on 2019-03-11.
+//
+
+#ifndef CPPSERVER_CODISSNAPSHOT_H
+#define CPPSERVER_CODISSNAPSHOT_H
+
+#include "redis_client/RedisClient.h"
+#include "redis_client/LatencyRecorder.h"
+#include "redis_client/RedisTracer.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// CodisSnapshot is the state of a CodisClient at one point in time,
+// see CodisClient::getSnapshot. Counters are totals since start.
+struct CodisSnapshot {
+    std::int64_t time;  // unix seconds when collected
+
+    std::vector<RedisClientStats> proxies;
+
+    size_t zkChildrenNum;
+    std::int64_t zkLastUpdateTime;
+    std::int64_t zkUpdateNum;
+    std::int64_t zkEventNum;  // > zkUpdateNum when bursts were coalesced
+    std::int64_t zkSessionExpiredNum;
+    std::int64_t zkLastResyncConvergeMs;  // session expiry until resynced, -1 if never expired
+
+    std::string localZone;      // empty: routing is not zone-aware
+    std::int64_t zoneRoutedNum;  // requests routed while zone-aware
+    std::int64_t crossZoneNum;   // of which to a proxy in another zone
+
+    std::int64_t overloadRerouteNum;  // commands moved off a pool over its concurrency limit
+
+    std::int64_t retryNum;
+    std::int64_t retrySuccessNum;          // commands that succeeded after a retry
+    std::int64_t retryBudgetExhaustedNum;  // retryable failures not retried for lack of budget
+
+    std::int64_t hedgeRequestNum;
+    std::int64_t hedgeNum;
+    std::int64_t hedgeWinNum;
+    std::int64_t hedgeDelayUs;
+
+    std::int64_t singleFlightLeaderNum;
+    std::int64_t singleFlightSharedNum;
+
+    int connectionBudget;        // 0: no budget, each pool has connPoolSize sockets
+    int connectionAllocatedNum;  // sockets of the routable pools after the last rebalance
+    std::int64_t budgetRebalanceNum;
+    std::int64_t budgetResizeNum;
+
+    std::vector<LatencyStat> latencies;
+
+    std::vector<PhaseStat> tracePhases;  // empty unless tracing is on
+    long traceDroppedNum;
+
+    CodisSnapshot();
+
+    // Prometheus text exposition format (version 0.0.4)
+    std::string toPrometheus() const;
+
+    std::string toJson() const;
+
+    // label of a CLIENT_CODE, e.g. "rwtimeout"
+    static const char *clientCodeName(int code);
+};
+
+
+#endif //CPPSERVER_CODISSNAPSHOT_H
@@ -0,0 +1,212 @@
+//
+// Created by admin on 2019-03-25.
+//
+
+#include "ConnectionBudget.h"
+#include "commen.h"
+#include <algorithm>
+#include <cstdlib>
+#include <string>
+#include <unordered_set>
+
+namespace {
+    const double DEMAND_SMOOTHING = 0.5;  // weight of the last interval
+}
+
+ConnectionBudget::ConnectionBudget(const ConnectionBudgetConfig &config) :
+        config(config),
+        reservedNum(0),
+        lastRebalance(std::chrono::steady_clock::now()),
+        overBudget(false) {
+    ConnectionBudgetConfig &c = this->config;
+    if (c.minPerPool < 1) c.minPerPool = 1;
+    if (c.maxPerPool <= 0 || c.maxPerPool > c.totalConns) c.maxPerPool = c.totalConns;
+    if (c.maxPerPool < c.minPerPool) c.maxPerPool = c.minPerPool;
+    allocatedNum = 0;
+    rebalanceNum = 0;
+    resizeNum = 0;
+}
+
+int ConnectionBudget::sizeOf(const RedisClient &pool) const {
+    int size = pool.getPoolSize();
+    auto it = states.find(&pool);
+    if (it != states.end() && it->second.growTo) size = std::max(size, it->second.growTo->load());
+    return size;
+}
+
+int ConnectionBudget::reserve(size_t proxyNum, const std::vector<std::shared_ptr<RedisClient> > &pools) {
+    std::lock_guard<std::mutex> g(mtx);
+    int used = reservedNum;
+    for (auto &p : pools) used += sizeOf(*p);
+    int share = config.totalConns / (int) std::max(proxyNum, (size_t) 1);
+    int size = std::max(std::min(std::min(share, config.maxPerPool), config.totalConns - used), config.minPerPool);
+    reservedNum += size;
+    return size;
+}
+
+void ConnectionBudget::release(int num) {
+    std::lock_guard<std::mutex> g(mtx);
+    reservedNum -= num;
+}
+
+int ConnectionBudget::getReservedNum() {
+    std::lock_guard<std::mutex> g(mtx);
+    return reservedNum;
+}
+
+std::vector<int> ConnectionBudget::allocate(const std::vector<double> &demands, int total) const {
+    size_t n = demands.size();
+    std::vector<int> sizes(n, config.minPerPool);
+    std::vector<double> weights(demands);
+    double weightSum = 0;
+    for (double w : weights) weightSum += w;
+    // no demand anywhere: even shares
+    if (weightSum <= 0) std::fill(weights.begin(), weights.end(), 1.0);
+
+    int left = total - (int) n * config.minPerPool;
+    std::vector<bool> full(n, false);
+    // share what is left by weight; pools reaching maxPerPool drop out and
+    // their excess goes to the others in the next round
+    while (left > 0) {
+        weightSum = 0;
+        for (size_t i = 0; i < n; ++i) {
+            if (!full[i]) weightSum += weights[i];
+        }
+        if (weightSum <= 0) break;
+
+        int given = 0;
+        for (size_t i = 0; i < n; ++i) {
+            if (full[i]) continue;
+            int add = std::min((int) (left * weights[i] / weightSum), config.maxPerPool - sizes[i]);
+            sizes[i] += add;
+            given += add;
+            if (sizes[i] >= config.maxPerPool) full[i] = true;
+        }
+        left -= given;
+        if (given > 0) continue;
+
+        // only rounding is left: one each to the heaviest pools
+        std::vector<size_t> order;
+        for (size_t i = 0; i < n; ++i) {
+            if (!full[i] && weights[i] > 0) order.push_back(i);
+        }
+        std::sort(order.begin(), order.end(), [&weights](size_t a, size_t b) { return weights[a] > weights[b]; });
+        for (size_t i = 0; i < order.size() && left > 0; ++i, --left) ++sizes[order[i]];
+        break;
+    }
+    return sizes;
+}
+
+void ConnectionBudget::rebalance(const std::vector<std::shared_ptr<RedisClient> > &pools,
+                                 const std::vector<std::shared_ptr<RedisClient> > &routable, const Executor &executor) {
+    std::lock_guard<std::mutex> g(mtx);
+    auto now = std::chrono::steady_clock::now();
+    double intervalUs = (double) std::chrono::duration_cast<std::chrono::microseconds>(now - lastRebalance).count();
+    lastRebalance = now;
+    ++rebalanceNum;
+
+    std::unordered_map<const RedisClient *, PoolState> seen;
+    std::vector<size_t> measured;  // index in pools
+    std::vector<double> demands;
+    std::vector<std::string> names;
+    int total = config.totalConns - reservedNum;
+    std::unordered_set<const RedisClient *> routed;
+    for (auto &p : routable) routed.insert(p.get());
+    for (size_t i = 0; i < pools.size(); ++i) {
+        RedisClientStats stats = pools[i]->getStats();
+        PoolState state = {stats.counters.busy_us, stats.counters.acquire_wait_us, -1,
+                           std::shared_ptr<std::atomic<int> >()};
+        auto it = states.find(pools[i].get());
+        if (it != states.end()) {
+            state.growTo = it->second.growTo;
+            // counters going back: another pool at the same address
+            if (intervalUs > 0 && state.busyUs >= it->second.busyUs && state.waitUs >= it->second.waitUs) {
+                double sample = (state.busyUs - it->second.busyUs + state.waitUs - it->second.waitUs) / intervalUs;
+                state.demand = it->second.demand < 0 ? sample :
+                               DEMAND_SMOOTHING * sample + (1 - DEMAND_SMOOTHING) * it->second.demand;
+            }
+        }
+        bool growing = state.growTo && *state.growTo > 0;
+        if (routed.count(pools[i].get()) == 0) {
+            // offline or weighted out: no traffic, the minimum is enough
+            int from = pools[i]->getPoolSize();
+            if (!growing && from > config.minPerPool) {
+                int size = pools[i]->resizePool(config.minPerPool);
+                ++resizeNum;
+                LOG_SPCL << "connection budget: codis proxy " << stats.proxy << " not routed, sockets: "
+                         << from << " -> " << size;
+            }
+            total -= sizeOf(*pools[i]);
+        } else if (state.demand < 0 || growing) {
+            // a pool being grown keeps its target until the grow is done
+            total -= sizeOf(*pools[i]);
+        } else {
+            measured.push_back(i);
+            demands.push_back(state.demand);
+            names.push_back(stats.proxy);
+        }
+        seen[pools[i].get()] = state;
+    }
+    states.swap(seen);
+
+    bool over = (int) measured.size() * config.minPerPool > total;
+    if (over != overBudget) {
+        overBudget = over;
+        if (over) {
+            LOG_WARN << "connection budget " << config.totalConns << " too small for " << pools.size()
+                     << " codis proxy pools of at least " << config.minPerPool << " sockets";
+        }
+    }
+
+    std::vector<int> sizes = allocate(demands, total);
+    std::vector<int> current(measured.size());
+    std::vector<int> targets(sizes);
+    int allocated = 0;
+    int kept = 0;
+    for (size_t j = 0; j < measured.size(); ++j) {
+        current[j] = pools[measured[j]]->getPoolSize();
+        allocated += sizes[j];
+        bool inBounds = current[j] >= config.minPerPool && current[j] <= config.maxPerPool;
+        if (inBounds && std::abs(sizes[j] - current[j]) * 10 <= current[j]) targets[j] = current[j];
+        kept += targets[j];
+    }
+    // small moves are skipped only while the budget holds
+    if (kept > std::max(total, allocated)) targets = sizes;
+
+    // shrink first, so that the total does not overshoot in between; grows
+    // connect, which may take up to a connect timeout per socket
+    for (size_t j = 0; j < measured.size(); ++j) {
+        if (targets[j] >= current[j]) continue;
+        int size = pools[measured[j]]->resizePool(targets[j]);
+        ++resizeNum;
+        LOG_SPCL << "connection budget: codis proxy " << names[j] << ", demand: " << demands[j]
+                 << ", sockets: " << current[j] << " -> " << size;
+    }
+    for (size_t j = 0; j < measured.size(); ++j) {
+        if (targets[j] <= current[j]) continue;
+        std::shared_ptr<RedisClient> pool = pools[measured[j]];
+        std::shared_ptr<std::atomic<int> > &growTo = states[pool.get()].growTo;
+        if (!growTo) growTo = std::make_shared<std::atomic<int> >(0);
+        *growTo = targets[j];
+        std::shared_ptr<std::atomic<int> > done = growTo;
+        int target = targets[j];
+        int from = current[j];
+        std::string name = names[j];
+        double demand = demands[j];
+        if (!executor([this, pool, done, target, from, name, demand] {
+            int size = pool->resizePool(target);
+            ++resizeNum;
+            *done = 0;
+            LOG_SPCL << "connection budget: codis proxy " << name << ", demand: " << demand
+                     << ", sockets: " << from << " -> " << size;
+        })) {
+            *growTo = 0;
+            LOG_WARN << "connection budget: no thread to grow codis proxy " << name << ", " << from
+                     << " sockets kept";
+        }
+    }
+
+    int sum = 0;
+    for (auto &p : pools) sum += sizeOf(*p);
+    allocatedNum = sum;
+}
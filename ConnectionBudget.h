@@ -0,0 +1,93 @@
+//
+// Created by admin on 2019-03-25.
+//
+
+#ifndef CPPSERVER_CONNECTIONBUDGET_H
+#define CPPSERVER_CONNECTIONBUDGET_H
+
+#include "CodisConfig.h"
+#include "redis_client/RedisClient.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// ConnectionBudget splits totalConns sockets among the proxy pools. The
+// demand of a pool is the average number of requests holding or waiting
+// for one of its sockets since the last rebalance (socket busy time plus
+// acquire wait time over the interval), smoothed over rebalances. Every
+// pool keeps minPerPool sockets and the rest of the budget is shared in
+// proportion to demand, up to maxPerPool. A pool is left alone while its
+// share moves by a tenth or less, so noise does not churn connections.
+// The sockets of a pool being built are reserved before the build starts,
+// so pools built at once do not overshoot the budget between rebalances.
+class ConnectionBudget {
+public:
+    // runs a task off the calling thread; false if it was not taken
+    typedef std::function<bool(const std::function<void()> &)> Executor;
+
+private:
+    struct PoolState {
+        long busyUs;
+        long waitUs;
+        double demand;  // < 0 until the first interval is measured
+        // size a grow running on the executor is bringing the pool to, 0 if none
+        std::shared_ptr<std::atomic<int> > growTo;
+    };
+
+    ConnectionBudgetConfig config;
+    std::mutex mtx;  // states, reservedNum and overBudget
+    std::unordered_map<const RedisClient *, PoolState> states;
+    int reservedNum;  // sockets of the pools being built
+    std::chrono::steady_clock::time_point lastRebalance;
+    bool overBudget;  // minPerPool for every pool exceeds totalConns
+    std::atomic<int> allocatedNum;
+    std::atomic<std::int64_t> rebalanceNum;
+    std::atomic<std::int64_t> resizeNum;
+
+    // sockets a pool holds, or will once its grow is done
+    int sizeOf(const RedisClient &pool) const;
+
+public:
+    explicit ConnectionBudget(const ConnectionBudgetConfig &config);
+
+    const ConnectionBudgetConfig &getConfig() const { return config; }
+
+    // Sockets for a pool about to be built, reserved until release: an even
+    // share among proxyNum proxies (the new one and those with a pool, being
+    // built or queued), within what pools and the other reservations leave.
+    // At least minPerPool: that may go over the budget until the next
+    // rebalance shrinks the other pools.
+    int reserve(size_t proxyNum, const std::vector<std::shared_ptr<RedisClient> > &pools);
+
+    // the build of a reserved pool is over: attached (its pool counts from
+    // now on) or not
+    void release(int num);
+
+    // From the maintenance thread only. pools: every built pool, as counted
+    // by reserve; those not in routable get no traffic and are shrunk to
+    // minPerPool. Pools not seen before keep their size until their demand
+    // is measured. Shrinks are done here, grows (which connect) are handed
+    // to executor.
+    void rebalance(const std::vector<std::shared_ptr<RedisClient> > &pools,
+                   const std::vector<std::shared_ptr<RedisClient> > &routable, const Executor &executor);
+
+    // pool sizes for the demands, within the bounds, summing to at most
+    // total unless the minimums alone exceed it
+    std::vector<int> allocate(const std::vector<double> &demands, int total) const;
+
+    int getAllocatedNum() const { return allocatedNum; }
+
+    int getReservedNum();
+
+    std::int64_t getRebalanceNum() const { return rebalanceNum; }
+
+    std::int64_t getResizeNum() const { return resizeNum; }
+};
+
+
+#endif //CPPSERVER_CONNECTIONBUDGET_H
@@ -0,0 +1,119 @@
+//
+// Created by admin on 2019-03-22.
+//
+
+#include "FileProxyDiscovery.h"
+#include "StaticProxyDiscovery.h"
+#include "commen.h"
+#include <boost/algorithm/string/trim.hpp>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+namespace {
+    // how often the watch thread checks stopping
+    const int POLL_TIMEOUT_MS = 200;
+}
+
+FileProxyDiscovery::FileProxyDiscovery(const std::string &path, int debounceQuietMs, int debounceMaxDelayMs) :
+        path(path),
+        inotifyFd(-1) {
+    stopping = false;
+    eventNum = 0;
+    size_t slash = path.rfind('/');
+    dir = slash == std::string::npos ? "." : (slash == 0 ? "/" : path.substr(0, slash));
+    fileName = slash == std::string::npos ? path : path.substr(slash + 1);
+    if (debounceQuietMs > 0) {
+        debouncer.reset(new Debouncer(debounceQuietMs, debounceMaxDelayMs,
+                                      std::bind(&FileProxyDiscovery::reload, this)));
+    }
+}
+
+FileProxyDiscovery::~FileProxyDiscovery() {
+    stopping = true;
+    if (watchThread.joinable()) watchThread.join();
+    debouncer.reset();
+    if (inotifyFd >= 0) close(inotifyFd);
+}
+
+void FileProxyDiscovery::init() {
+    if (!reload()) LOG_ERROR << "read proxy list file error, path: " << path << ", waiting for it to be written";
+
+    inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotifyFd < 0) {
+        LOG_ERROR << "inotify_init1 error: " << strerror(errno) << ", proxy list file will not be watched";
+        return;
+    }
+    // 监听目录而不是文件：rename 覆盖后文件的 inode 会变
+    if (inotify_add_watch(inotifyFd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE) < 0) {
+        LOG_ERROR << "inotify_add_watch error: " << strerror(errno) << ", dir: " << dir;
+        close(inotifyFd);
+        inotifyFd = -1;
+        return;
+    }
+    watchThread = std::thread(&FileProxyDiscovery::watchLoop, this);
+}
+
+void FileProxyDiscovery::watchLoop() {
+    // inotify_event 按其成员对齐
+    alignas(struct inotify_event) char buffer[4096];
+    struct pollfd pfd;
+    pfd.fd = inotifyFd;
+    pfd.events = POLLIN;
+
+    while (!stopping) {
+        int ret = poll(&pfd, 1, POLL_TIMEOUT_MS);
+        if (ret <= 0) {
+            if (ret < 0 && errno != EINTR) {
+                LOG_ERROR << "poll inotify fd error: " << strerror(errno);
+                return;
+            }
+            continue;
+        }
+
+        bool changed = false;
+        ssize_t len;
+        while ((len = read(inotifyFd, buffer, sizeof(buffer))) > 0) {
+            for (char *p = buffer; p < buffer + len;) {
+                auto *event = reinterpret_cast<struct inotify_event *>(p);
+                if (event->len > 0 && fileName == event->name) changed = true;
+                p += sizeof(struct inotify_event) + event->len;
+            }
+        }
+        if (!changed) continue;
+
+        ++eventNum;
+        LOG_SPCL << "proxy list file changed, path: " << path;
+        if (debouncer) debouncer->trigger();
+        else reload();
+    }
+}
+
+bool FileProxyDiscovery::reload() {
+    std::ifstream in(path.c_str());
+    if (!in) return false;
+
+    std::vector<std::string> newValueList;
+    std::string line;
+    while (std::getline(in, line)) {
+        boost::algorithm::trim(line);
+        if (line.empty() || line[0] == '#') continue;
+        newValueList.push_back(StaticProxyDiscovery::toNodeValue(line));
+    }
+    if (in.bad()) {
+        LOG_ERROR << "read proxy list file error, path: " << path;
+        return false;
+    }
+    // 原地写入时可能读到刚被截断的文件，按暂时性错误处理
+    if (newValueList.empty()) {
+        LOG_WARN << "proxy list file has no proxy, path: " << path << ", keep the current list";
+        return false;
+    }
+
+    LOG_SPCL << "proxy list file: " << path << ", proxy number: " << newValueList.size();
+    publishValueList(newValueList);
+    return true;
+}
@@ -0,0 +1,61 @@
+//
+// Created by admin on 2019-03-22.
+//
+
+#ifndef CPPSERVER_FILEPROXYDISCOVERY_H
+#define CPPSERVER_FILEPROXYDISCOVERY_H
+
+#include "zk_children_watcher/ProxyDiscovery.h"
+#include "zk_children_watcher/Debouncer.h"
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+
+// ProxyDiscovery of a local file, one proxy per line in the format of
+// StaticProxyDiscovery; blank lines and lines starting with '#' are
+// skipped. The directory of the file is watched with inotify, so that
+// both in-place writes and atomic renames over the file are picked up,
+// and the file is read again once a burst of changes settles.
+// A file without any proxy is taken for an in-place write caught between
+// truncate and write, and is not published; prefer atomic renames, which
+// never expose a partly written file.
+class FileProxyDiscovery : public ProxyDiscovery {
+    std::string path;
+    std::string dir;
+    std::string fileName;
+
+    int inotifyFd;
+    std::atomic<bool> stopping;
+    std::atomic<std::int64_t> eventNum;
+
+    // declared after the members the reload uses, stopped in the destructor
+    std::unique_ptr<Debouncer> debouncer;
+    std::thread watchThread;
+
+    // non construct copyable and non copyable
+    FileProxyDiscovery(const FileProxyDiscovery &);
+
+    FileProxyDiscovery &operator=(const FileProxyDiscovery &);
+
+    void watchLoop();
+
+public:
+    FileProxyDiscovery(const std::string &path, int debounceQuietMs, int debounceMaxDelayMs);
+
+    ~FileProxyDiscovery();
+
+    // reads the file once, then watches it
+    void init() override;
+
+    const char *getType() override { return "file"; }
+
+    std::int64_t getEventNum() override { return eventNum; }
+
+    // read the file and publish it; false if it cannot be read or has no
+    // proxy, the current list is kept then
+    bool reload();
+};
+
+
+#endif //CPPSERVER_FILEPROXYDISCOVERY_H
@@ -0,0 +1,140 @@
+//
+// Created by admin on 2019-03-04.
+//
+
+#include "Hedger.h"
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+namespace {
+    const std::int64_t MILLI_TOKENS_PER_HEDGE = 1000;
+    // allows a burst of 10 hedges after a quiet period
+    const std::int64_t MAX_BUDGET_MILLI_TOKENS = 10 * MILLI_TOKENS_PER_HEDGE;
+    // recompute the hedge delay every 256 samples (power of two)
+    const std::int64_t DELAY_REFRESH_INTERVAL = 256;
+    // halve the histogram once it holds this many samples
+    const std::uint64_t DECAY_SAMPLE_NUM = 8192;
+
+    // state shared by the caller and the hedge request, which may
+    // outlive the caller when the primary wins
+    struct HedgeCall {
+        std::mutex mtx;
+        redisReply *reply;
+        int doneFd;  // eventfd, readable once the hedge is done
+
+        HedgeCall() : reply(nullptr), doneFd(-1) {}
+
+        ~HedgeCall() {
+            if (reply) freeReplyObject(reply);
+            if (doneFd >= 0) close(doneFd);
+        }
+    };
+}
+
+Hedger::Hedger(const HedgeConfig &config) :
+        config(config),
+        executor(config.executorThreadNum, config.executorQueueSize) {
+    sampleNum = 0;
+    delayUs = (std::int64_t) config.maxDelayMs * 1000;
+    budgetMilliTokens = MAX_BUDGET_MILLI_TOKENS;
+    requestNum = 0;
+    hedgeNum = 0;
+    hedgeWinNum = 0;
+}
+
+RedisReplyPtr Hedger::execute(const std::shared_ptr<RedisClient> &primary, const PickOtherFunc &pickOther,
+                              const std::vector<std::string> &argv, int *code) {
+    ++requestNum;
+    depositBudget();
+
+    auto call = std::make_shared<HedgeCall>();
+    auto startHedge = [this, &call, &primary, &pickOther, &argv]() -> int {
+        std::shared_ptr<RedisClient> other = pickOther(primary);
+        if (!other || other == primary || !tryWithdrawBudget()) return -1;
+        call->doneFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (call->doneFd < 0) {
+            refundBudget();
+            return -1;
+        }
+        auto args = std::make_shared<const std::vector<std::string> >(argv);
+        std::shared_ptr<HedgeCall> hedgeCall = call;
+        auto run = [hedgeCall, args, other] {
+            RedisReplyPtr reply = other->redisCommandArgv(*args);
+            {
+                std::lock_guard<std::mutex> g(hedgeCall->mtx);
+                hedgeCall->reply = reply.release();
+            }
+            uint64_t one = 1;
+            ssize_t n = write(hedgeCall->doneFd, &one, sizeof(one));
+            (void) n;
+        };
+        if (!executor.trySubmit(run)) {
+            refundBudget();
+            return -1;
+        }
+        ++hedgeNum;
+        return call->doneFd;
+    };
+    auto takeHedge = [&call]() -> redisReply * {
+        std::lock_guard<std::mutex> g(call->mtx);
+        redisReply *reply = call->reply;
+        call->reply = nullptr;
+        return reply;
+    };
+
+    // the primary runs on the caller thread: a read answered within the
+    // hedge delay costs no thread hop
+    auto start = std::chrono::steady_clock::now();
+    bool hedgeWon = false;
+    RedisReplyPtr reply = primary->redisCommandArgvHedged(argv, delayUs.load(), startHedge, takeHedge, code, &hedgeWon);
+    std::int64_t us = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start).count();
+    if (hedgeWon) {
+        ++hedgeWinNum;
+        // censored: the primary would have taken at least this long. Left
+        // out, the slow tail that hedges cut would vanish from the
+        // histogram and pull the delay down, starting ever more hedges.
+        recordLatency(us);
+    } else if (*code == CLIENT_OK) {
+        recordLatency(us);
+    }
+    return reply;
+}
+
+void Hedger::recordLatency(std::int64_t us) {
+    latency.record(us < 0 ? 0 : (std::uint64_t) us);
+    if ((++sampleNum & (DELAY_REFRESH_INTERVAL - 1)) != 0) return;
+
+    HistogramSnapshot snapshot = latency.snapshot();
+    std::int64_t delay = (std::int64_t) snapshot.percentile(config.delayPercentile);
+    delay = std::max(delay, (std::int64_t) config.minDelayMs * 1000);
+    delay = std::min(delay, (std::int64_t) config.maxDelayMs * 1000);
+    delayUs = delay;
+
+    if (snapshot.count >= DECAY_SAMPLE_NUM) latency.decay();
+}
+
+void Hedger::depositBudget() {
+    std::int64_t earn = (std::int64_t) (config.budgetRatio * MILLI_TOKENS_PER_HEDGE);
+    std::int64_t cur = budgetMilliTokens.load();
+    while (cur < MAX_BUDGET_MILLI_TOKENS &&
+           !budgetMilliTokens.compare_exchange_weak(cur, std::min(cur + earn, MAX_BUDGET_MILLI_TOKENS))) {}
+}
+
+void Hedger::refundBudget() {
+    std::int64_t cur = budgetMilliTokens.load();
+    while (cur < MAX_BUDGET_MILLI_TOKENS &&
+           !budgetMilliTokens.compare_exchange_weak(cur, std::min(cur + MILLI_TOKENS_PER_HEDGE,
+                                                                  MAX_BUDGET_MILLI_TOKENS))) {}
+}
+
+bool Hedger::tryWithdrawBudget() {
+    std::int64_t cur = budgetMilliTokens.load();
+    while (cur >= MILLI_TOKENS_PER_HEDGE) {
+        if (budgetMilliTokens.compare_exchange_weak(cur, cur - MILLI_TOKENS_PER_HEDGE)) return true;
+    }
+    return false;
+}
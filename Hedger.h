@@ -0,0 +1,68 @@
+//
+// Created by admin on 2019-03-04.
+//
+
+#ifndef CPPSERVER_HEDGER_H
+#define CPPSERVER_HEDGER_H
+
+#include "CodisConfig.h"
+#include "ThreadPool.h"
+#include "redis_client/RedisClient.h"
+#include "redis_client/LatencyHistogram.h"
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Hedger runs read-only commands (RedisCommands::isReadOnly) with a
+// backup request: if the reply has not arrived after the hedge delay (a
+// percentile of recent read latency), the same command is sent to another
+// proxy and whichever reply comes first is returned. The primary request
+// runs on the caller thread, the hedge on the executor. Extra load is
+// capped by a token budget that earns budgetRatio token per request and
+// spends one per hedge.
+class Hedger {
+public:
+    typedef std::function<std::shared_ptr<RedisClient>(const std::shared_ptr<RedisClient> &)> PickOtherFunc;
+
+private:
+    HedgeConfig config;
+    LatencyHistogram latency;
+    std::atomic<std::int64_t> sampleNum;
+    std::atomic<std::int64_t> delayUs;
+    std::atomic<std::int64_t> budgetMilliTokens;
+    std::atomic<std::int64_t> requestNum;
+    std::atomic<std::int64_t> hedgeNum;
+    std::atomic<std::int64_t> hedgeWinNum;
+    // declared last: joined first on destruction, while the members
+    // above are still alive for the in-flight tasks
+    ThreadPool executor;
+
+    void recordLatency(std::int64_t us);
+
+    void depositBudget();
+
+    bool tryWithdrawBudget();
+
+    // give back the token of a hedge that could not be started
+    void refundBudget();
+
+public:
+    explicit Hedger(const HedgeConfig &config);
+
+    // code is set to the CLIENT_CODE of the primary, CLIENT_OK if the hedge won
+    RedisReplyPtr execute(const std::shared_ptr<RedisClient> &primary, const PickOtherFunc &pickOther,
+                          const std::vector<std::string> &argv, int *code);
+
+    std::int64_t getDelayUs() { return delayUs; }
+
+    std::int64_t getRequestNum() { return requestNum; }
+
+    std::int64_t getHedgeNum() { return hedgeNum; }
+
+    std::int64_t getHedgeWinNum() { return hedgeWinNum; }
+};
+
+
+#endif //CPPSERVER_HEDGER_H
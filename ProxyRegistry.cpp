@@ -0,0 +1,218 @@
+//
+// Created by admin on 2019-03-20.
+//
+
+#include "ProxyRegistry.h"
+#include "commen.h"
+#include <unordered_set>
+
+namespace {
+    int gcd(int a, int b) {
+        while (b != 0) {
+            int t = a % b;
+            a = b;
+            b = t;
+        }
+        return a;
+    }
+}
+
+const int ProxyRegistry::MAX_WEIGHT;
+
+ProxyRegistry::Diff ProxyRegistry::update(const std::vector<CodisProxyInfo> &proxies) {
+    Diff diff;
+    std::unordered_set<std::string> current;
+
+    for (const auto &info : proxies) {
+        const std::string &key = info.key();
+        if (!current.insert(key).second) {
+            LOG_WARN << "duplicated codis proxy: " << key << ", addr: " << info.addr;
+            continue;
+        }
+
+        auto it = entries.find(key);
+        if (it == entries.end()) {
+            it = entries.insert(std::make_pair(key, Entry())).first;
+            it->second.info = info;
+            it->second.gen = ++nextGen;
+            ++diff.added;
+            LOG_SPCL << "new codis proxy: " << key << ", addr: " << info.addr << ", state: " << info.state;
+        } else {
+            Entry &entry = it->second;
+            if (entry.info.addr != info.addr) {
+                LOG_SPCL << "codis proxy " << key << " moved from " << entry.info.addr << " to " << info.addr;
+                // 进行中的建连作废
+                entry.client.reset();
+                entry.weight = 0;
+                entry.building = false;
+                entry.gen = ++nextGen;
+                ++diff.addrChanged;
+            }
+            if (entry.info.state != info.state) {
+                LOG_SPCL << "codis proxy " << key << ", addr: " << info.addr
+                         << ", state: " << entry.info.state << " -> " << info.state;
+                ++diff.stateChanged;
+            }
+            entry.info = info;
+        }
+    }
+
+    for (auto it = entries.begin(); it != entries.end();) {
+        if (current.count(it->first) == 0) {
+            LOG_SPCL << "codis proxy removed: " << it->first << ", addr: " << it->second.info.addr;
+            it = entries.erase(it);
+            ++diff.removed;
+        } else ++it;
+    }
+    return diff;
+}
+
+std::vector<ProxyRegistry::BuildTask> ProxyRegistry::takeBuildTasks() {
+    std::vector<BuildTask> res;
+    // 只为没有连接池的在线proxy建连，已有的连接池复用
+    for (auto &e : entries) {
+        Entry &entry = e.second;
+        if (!entry.info.isOnline() || entry.client || entry.building) continue;
+        entry.building = true;
+        BuildTask task;
+        task.key = e.first;
+        task.info = entry.info;
+        task.gen = entry.gen;
+        res.push_back(task);
+    }
+    return res;
+}
+
+bool ProxyRegistry::attach(const BuildTask &task, const std::shared_ptr<RedisClient> &client) {
+    auto it = entries.find(task.key);
+    if (it == entries.end() || it->second.gen != task.gen) {
+        LOG_SPCL << "codis proxy " << task.key << " changed while connecting to " << task.info.addr
+                 << ", drop the new pool";
+        return false;
+    }
+
+    Entry &entry = it->second;
+    entry.building = false;
+    if (!client) return false;
+    entry.client = client;
+    entry.weight = weightOf(client->getStats());
+    LOG_SPCL << "codis proxy " << task.key << ", addr: " << task.info.addr << " pool ready, weight: " << entry.weight;
+    return entry.info.isOnline();
+}
+
+bool ProxyRegistry::refreshWeights() {
+    bool changed = false;
+    for (auto &e : entries) {
+        Entry &entry = e.second;
+        if (!entry.client) continue;
+        int weight = weightOf(entry.client->getStats());
+        if (weight == entry.weight) continue;
+        LOG_SPCL << "codis proxy " << e.first << ", addr: " << entry.info.addr
+                 << ", weight: " << entry.weight << " -> " << weight;
+        entry.weight = weight;
+        changed |= entry.info.isOnline();
+    }
+    return changed;
+}
+
+int ProxyRegistry::weightOf(const RedisClientStats &stats) {
+    if (stats.socketNum <= 0) return 1;
+    int weight = (MAX_WEIGHT * stats.connectedNum + stats.socketNum - 1) / stats.socketNum;
+    return weight < 1 ? 1 : weight;
+}
+
+ProxyRegistry::RoutingTable ProxyRegistry::getRoutable(const std::string &localZone,
+                                                       double minLocalHealthyRatio) const {
+    RoutingTable res;
+    res.zoneAware = !localZone.empty();
+    PoolList local, remote;
+    std::vector<int> weights, localWeights, remoteWeights;
+    int localWeight = 0;
+    size_t localNum = 0;  // online local proxies, a pool still being built counts with weight 0
+    res.pools.reserve(entries.size());
+    for (const auto &e : entries) {
+        const Entry &entry = e.second;
+        if (!entry.info.isOnline()) continue;
+        bool isLocal = res.zoneAware && entry.info.datacenter == localZone;
+        if (isLocal) ++localNum;
+        if (!entry.client) continue;
+        res.pools.push_back(entry.client);
+        weights.push_back(entry.weight);
+        if (!res.zoneAware) continue;
+        if (isLocal) {
+            local.push_back(entry.client);
+            localWeights.push_back(entry.weight);
+            localWeight += entry.weight;
+        } else {
+            remote.push_back(entry.client);
+            remoteWeights.push_back(entry.weight);
+        }
+    }
+
+    res.slots = buildSlots(res.pools, weights);
+    if (!res.zoneAware) {
+        res.slotIsRemote.assign(res.slots.size(), false);
+        return res;
+    }
+
+    std::unordered_set<RedisClient *> localFinder;
+    for (const auto &p : local) localFinder.insert(p.get());
+    res.slotIsRemote.reserve(res.slots.size());
+    for (const auto &p : res.slots) res.slotIsRemote.push_back(localFinder.count(p.get()) == 0);
+
+    // 本区连接不足一定比例时，按权重分摊到所有区
+    if (!local.empty() && localWeight >= minLocalHealthyRatio * MAX_WEIGHT * localNum) {
+        res.localSlots = buildSlots(local, localWeights);
+    } else if (!local.empty()) {
+        LOG_WARN << "local zone " << localZone << " unhealthy, weight: " << localWeight
+                 << " of " << MAX_WEIGHT * localNum << ", route to all zones";
+    }
+    res.remoteSlots = buildSlots(remote, remoteWeights);
+    return res;
+}
+
+ProxyRegistry::PoolList ProxyRegistry::buildSlots(const PoolList &pools, std::vector<int> weights) {
+    int g = 0;
+    for (int w : weights) g = gcd(g, w);
+    int total = 0;
+    for (int &w : weights) total += (w /= g);
+
+    // smooth weighted round-robin: a heavy pool is spread out, not repeated in a row
+    PoolList res;
+    std::vector<int> current(weights.size(), 0);
+    res.reserve(total);
+    for (int s = 0; s < total; ++s) {
+        size_t best = 0;
+        for (size_t i = 0; i < weights.size(); ++i) {
+            current[i] += weights[i];
+            if (current[i] > current[best]) best = i;
+        }
+        current[best] -= total;
+        res.push_back(pools[best]);
+    }
+    return res;
+}
+
+size_t ProxyRegistry::getBuildingNum() const {
+    size_t res = 0;
+    for (const auto &e : entries) {
+        if (e.second.building) ++res;
+    }
+    return res;
+}
+
+size_t ProxyRegistry::getOnlineNum() const {
+    size_t res = 0;
+    for (const auto &e : entries) {
+        if (e.second.info.isOnline()) ++res;
+    }
+    return res;
+}
+
+ProxyRegistry::PoolList ProxyRegistry::getPools() const {
+    PoolList res;
+    for (const auto &e : entries) {
+        if (e.second.client) res.push_back(e.second.client);
+    }
+    return res;
+}
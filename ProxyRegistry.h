@@ -0,0 +1,119 @@
+//
+// Created by admin on 2019-03-20.
+//
+
+#ifndef CPPSERVER_PROXYREGISTRY_H
+#define CPPSERVER_PROXYREGISTRY_H
+
+#include "CodisProxyInfo.h"
+#include "redis_client/RedisClient.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// ProxyRegistry holds the codis proxies and their connection pools,
+// keyed by proxy token (or addr). update() diffs the registry against
+// the current proxy list: pools of unchanged proxies are kept, a proxy
+// going offline keeps its pool but is no longer routed to, and only new
+// proxies, or proxies with a new addr, need a new pool.
+// Pools are built elsewhere (off the discovery thread): takeBuildTasks()
+// hands out the proxies that need one and attach() installs the result,
+// unless the proxy was removed or moved in the meantime. A pool with only
+// part of its sockets connected is routed to with a lower weight.
+// Not thread safe: CodisClient serializes updates.
+class ProxyRegistry {
+public:
+    typedef std::vector<std::shared_ptr<RedisClient> > PoolList;
+
+    // weight of a fully connected pool
+    static const int MAX_WEIGHT = 8;
+
+    struct Diff {
+        size_t added;
+        size_t removed;
+        size_t stateChanged;
+        size_t addrChanged;
+
+        Diff() : added(0), removed(0), stateChanged(0), addrChanged(0) {}
+
+        bool empty() const { return added == 0 && removed == 0 && stateChanged == 0 && addrChanged == 0; }
+    };
+
+    struct BuildTask {
+        std::string key;
+        CodisProxyInfo info;
+        std::uint64_t gen;  // attach is dropped if the entry changed since
+        int poolSize;       // sockets reserved by CodisClient's connection budget, 0: connPoolSize
+
+        BuildTask() : gen(0), poolSize(0) {}
+    };
+
+    // what CodisClient routes on
+    struct RoutingTable {
+        PoolList pools;  // each routable pool once
+        PoolList slots;  // pools repeated by weight, interleaved (smooth weighted round-robin)
+        std::vector<bool> slotIsRemote;  // by slot: not in the local zone
+        // zone-aware only: local zone slots, empty if the local zone is
+        // unhealthy (then all slots are used), and the other zones' slots
+        PoolList localSlots;
+        PoolList remoteSlots;
+        bool zoneAware;
+
+        RoutingTable() : zoneAware(false) {}
+    };
+
+private:
+    struct Entry {
+        CodisProxyInfo info;
+        std::shared_ptr<RedisClient> client;
+        int weight;
+        bool building;
+        std::uint64_t gen;
+
+        Entry() : weight(0), building(false), gen(0) {}
+    };
+
+    std::unordered_map<std::string, Entry> entries;
+    std::uint64_t nextGen;
+
+    // smooth weighted round-robin order of pools
+    static PoolList buildSlots(const PoolList &pools, std::vector<int> weights);
+
+public:
+    ProxyRegistry() : nextGen(0) {}
+
+    Diff update(const std::vector<CodisProxyInfo> &proxies);
+
+    // online proxies without a pool and no build in flight; marked as building
+    std::vector<BuildTask> takeBuildTasks();
+
+    // Install the pool built for task; a null client just ends the build.
+    // true if the routable pools changed.
+    bool attach(const BuildTask &task, const std::shared_ptr<RedisClient> &client);
+
+    // recompute the weights from the connected sockets; true if any changed
+    bool refreshWeights();
+
+    // MAX_WEIGHT scaled by the connected share of the sockets, at least 1
+    static int weightOf(const RedisClientStats &stats);
+
+    // localZone empty: no zone awareness. The local zone is healthy if its
+    // weight is at least minLocalHealthyRatio of its full weight, online
+    // local proxies whose pool is not built yet counting with weight 0.
+    RoutingTable getRoutable(const std::string &localZone = "", double minLocalHealthyRatio = 0) const;
+
+    size_t size() const { return entries.size(); }
+
+    size_t getBuildingNum() const;
+
+    // online proxies, whether their pool is built, being built or not yet
+    size_t getOnlineNum() const;
+
+    // every built pool, routable or not
+    PoolList getPools() const;
+};
+
+
+#endif //CPPSERVER_PROXYREGISTRY_H
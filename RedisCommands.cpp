@@ -0,0 +1,23 @@
+//
+// Created by admin on 2019-03-25.
+//
+
+#include "RedisCommands.h"
+#include <algorithm>
+#include <cctype>
+#include <unordered_set>
+
+bool RedisCommands::isReadOnly(const std::string &cmd) {
+    static const std::unordered_set<std::string> readOnlyCommands = {
+            "GET", "MGET", "EXISTS", "STRLEN", "GETRANGE", "GETBIT", "BITCOUNT",
+            "HGET", "HMGET", "HGETALL", "HEXISTS", "HLEN", "HKEYS", "HVALS", "HSTRLEN",
+            "LINDEX", "LLEN", "LRANGE",
+            "SCARD", "SISMEMBER", "SMEMBERS",
+            "ZCARD", "ZCOUNT", "ZLEXCOUNT", "ZRANGE", "ZRANGEBYSCORE", "ZRANGEBYLEX",
+            "ZREVRANGE", "ZREVRANGEBYSCORE", "ZRANK", "ZREVRANK", "ZSCORE",
+            "TTL", "PTTL", "TYPE"
+    };
+    std::string upper(cmd);
+    std::transform(upper.begin(), upper.end(), upper.begin(), ::toupper);
+    return readOnlyCommands.count(upper) > 0;
+}
@@ -0,0 +1,20 @@
+//
+// Created by admin on 2019-03-25.
+//
+
+#ifndef CPPSERVER_REDISCOMMANDS_H
+#define CPPSERVER_REDISCOMMANDS_H
+
+#include <string>
+
+// What CodisClient needs to know about redis commands, shared by the
+// hedging and the retry policy.
+class RedisCommands {
+public:
+    // commands without side effects: safe to send twice (hedges, retries);
+    // case-insensitive
+    static bool isReadOnly(const std::string &cmd);
+};
+
+
+#endif //CPPSERVER_REDISCOMMANDS_H
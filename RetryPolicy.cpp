@@ -0,0 +1,52 @@
+//
+// Created by admin on 2019-03-24.
+//
+
+#include "RetryPolicy.h"
+#include "RedisCommands.h"
+#include <algorithm>
+#include <random>
+
+namespace {
+    const std::int64_t MILLI_TOKENS_PER_RETRY = 1000;
+}
+
+RetryPolicy::RetryPolicy(const RetryConfig &config) :
+        config(config),
+        retryableCodes(config.retryableCodes.begin(), config.retryableCodes.end()) {
+    budgetMilliTokens = (std::int64_t) config.budgetBurst * MILLI_TOKENS_PER_RETRY;
+    retryNum = 0;
+    retrySuccessNum = 0;
+    budgetExhaustedNum = 0;
+}
+
+bool RetryPolicy::shouldRetry(const std::string &cmd, int code, int attempt) {
+    if (attempt >= config.maxRetries || retryableCodes.count(code) == 0) return false;
+    if (config.readOnlyOnly && !RedisCommands::isReadOnly(cmd)) return false;
+
+    std::int64_t cur = budgetMilliTokens.load();
+    while (cur >= MILLI_TOKENS_PER_RETRY) {
+        if (budgetMilliTokens.compare_exchange_weak(cur, cur - MILLI_TOKENS_PER_RETRY)) {
+            ++retryNum;
+            return true;
+        }
+    }
+    ++budgetExhaustedNum;
+    return false;
+}
+
+int RetryPolicy::backoffMs(int attempt) {
+    static thread_local std::mt19937 rng(std::random_device{}());
+    std::int64_t cap = (std::int64_t) config.backoffBaseMs << std::min(attempt, 20);
+    cap = std::min(cap, (std::int64_t) config.backoffMaxMs);
+    if (cap <= 0) return 0;
+    return (int) std::uniform_int_distribution<std::int64_t>(0, cap)(rng);
+}
+
+void RetryPolicy::onSuccess(int retries) {
+    if (retries > 0) ++retrySuccessNum;
+    std::int64_t max = (std::int64_t) config.budgetBurst * MILLI_TOKENS_PER_RETRY;
+    std::int64_t earn = (std::int64_t) (config.budgetRatio * MILLI_TOKENS_PER_RETRY);
+    std::int64_t cur = budgetMilliTokens.load();
+    while (cur < max && !budgetMilliTokens.compare_exchange_weak(cur, std::min(cur + earn, max))) {}
+}
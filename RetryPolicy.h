@@ -0,0 +1,50 @@
+//
+// Created by admin on 2019-03-24.
+//
+
+#ifndef CPPSERVER_RETRYPOLICY_H
+#define CPPSERVER_RETRYPOLICY_H
+
+#include "CodisConfig.h"
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <unordered_set>
+
+// RetryPolicy decides whether a failed command is retried and how long
+// to back off first. Only the configured CLIENT_CODEs (and, with
+// readOnlyOnly, read-only commands) are retried, and every retry spends
+// a token of a budget that earns budgetRatio token per successful
+// command, so retries add at most that fraction of load cluster-wide,
+// plus a burst of budgetBurst.
+class RetryPolicy {
+    RetryConfig config;
+    std::unordered_set<int> retryableCodes;
+    std::atomic<std::int64_t> budgetMilliTokens;
+    std::atomic<std::int64_t> retryNum;
+    std::atomic<std::int64_t> retrySuccessNum;
+    std::atomic<std::int64_t> budgetExhaustedNum;
+
+public:
+    explicit RetryPolicy(const RetryConfig &config);
+
+    const RetryConfig &getConfig() const { return config; }
+
+    // attempt: retries done so far. Spends a budget token when true.
+    bool shouldRetry(const std::string &cmd, int code, int attempt);
+
+    // full jitter: uniform in [0, min(backoffMaxMs, backoffBaseMs * 2^attempt)]
+    int backoffMs(int attempt);
+
+    // a command succeeded, retried (retries > 0) or not
+    void onSuccess(int retries);
+
+    std::int64_t getRetryNum() { return retryNum; }
+
+    std::int64_t getRetrySuccessNum() { return retrySuccessNum; }
+
+    std::int64_t getBudgetExhaustedNum() { return budgetExhaustedNum; }
+};
+
+
+#endif //CPPSERVER_RETRYPOLICY_H
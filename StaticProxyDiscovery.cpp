@@ -0,0 +1,24 @@
+//
+// Created by admin on 2019-03-22.
+//
+
+#include "StaticProxyDiscovery.h"
+#include <boost/algorithm/string/trim.hpp>
+
+StaticProxyDiscovery::StaticProxyDiscovery(const std::vector<std::string> &proxies) : proxies(proxies) {}
+
+void StaticProxyDiscovery::init() {
+    std::vector<std::string> newValueList;
+    for (const auto &e : proxies) {
+        std::string value = toNodeValue(e);
+        if (!value.empty()) newValueList.push_back(value);
+    }
+    publishValueList(newValueList);
+}
+
+std::string StaticProxyDiscovery::toNodeValue(const std::string &entry) {
+    std::string value = boost::algorithm::trim_copy(entry);
+    if (value.empty() || value[0] == '{') return value;
+    // addr 同时作为 token，各 proxy 的 key 互不相同
+    return "{\"addr\":\"" + value + "\",\"state\":\"online\"}";
+}
@@ -0,0 +1,30 @@
+//
+// Created by admin on 2019-03-22.
+//
+
+#ifndef CPPSERVER_STATICPROXYDISCOVERY_H
+#define CPPSERVER_STATICPROXYDISCOVERY_H
+
+#include "zk_children_watcher/ProxyDiscovery.h"
+#include <string>
+#include <vector>
+
+// ProxyDiscovery of a fixed list, published once by init. An entry is
+// either the json data of a codis proxy node or a bare "host:port",
+// which stands for an online proxy at that address.
+class StaticProxyDiscovery : public ProxyDiscovery {
+    std::vector<std::string> proxies;
+
+public:
+    explicit StaticProxyDiscovery(const std::vector<std::string> &proxies);
+
+    void init() override;
+
+    const char *getType() override { return "static"; }
+
+    // node data for one entry: json as is, host:port wrapped; "" if blank
+    static std::string toNodeValue(const std::string &entry);
+};
+
+
+#endif //CPPSERVER_STATICPROXYDISCOVERY_H
@@ -0,0 +1,60 @@
+//
+// Created by admin on 2019-03-04.
+//
+
+#include "ThreadPool.h"
+#include "commen.h"
+
+ThreadPool::ThreadPool(size_t threadNum, size_t maxQueueSize) :
+        maxQueueSize(maxQueueSize),
+        stopping(false) {
+    if (threadNum == 0) threadNum = 1;
+    workers.reserve(threadNum);
+    for (size_t i = 0; i < threadNum; ++i) {
+        workers.emplace_back(&ThreadPool::workerLoop, this);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> g(mtx);
+        stopping = true;
+    }
+    cv.notify_all();
+    for (auto &t : workers) {
+        if (t.joinable()) t.join();
+    }
+}
+
+bool ThreadPool::trySubmit(const std::function<void()> &task) {
+    {
+        std::lock_guard<std::mutex> g(mtx);
+        if (stopping || tasks.size() >= maxQueueSize) return false;
+        tasks.push_back(task);
+    }
+    cv.notify_one();
+    return true;
+}
+
+size_t ThreadPool::getQueueSize() {
+    std::lock_guard<std::mutex> g(mtx);
+    return tasks.size();
+}
+
+void ThreadPool::workerLoop() {
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lk(mtx);
+            cv.wait(lk, [this] { return stopping || !tasks.empty(); });
+            if (tasks.empty()) return;
+            task = std::move(tasks.front());
+            tasks.pop_front();
+        }
+        try {
+            task();
+        } catch (const std::exception &e) {
+            LOG_ERROR << "thread pool task exception: " << e.what();
+        }
+    }
+}
@@ -0,0 +1,45 @@
+//
+// Created by admin on 2019-03-04.
+//
+
+#ifndef CPPSERVER_THREADPOOL_H
+#define CPPSERVER_THREADPOOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// ThreadPool is a fixed-size executor for the blocking redis/zk calls
+// that must not run on the caller's (or the zk event) thread.
+// Submission never blocks: a full queue rejects the task instead.
+class ThreadPool {
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()> > tasks;
+    std::mutex mtx;
+    std::condition_variable cv;
+    size_t maxQueueSize;
+    bool stopping;
+
+    // non construct copyable and non copyable
+    ThreadPool(const ThreadPool &);
+
+    ThreadPool &operator=(const ThreadPool &);
+
+    void workerLoop();
+
+public:
+    ThreadPool(size_t threadNum, size_t maxQueueSize);
+
+    // pending tasks are still run before the workers exit
+    ~ThreadPool();
+
+    bool trySubmit(const std::function<void()> &task);
+
+    size_t getQueueSize();
+};
+
+
+#endif //CPPSERVER_THREADPOOL_H
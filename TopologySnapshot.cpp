@@ -0,0 +1,102 @@
+//
+// Created by admin on 2019-03-21.
+//
+
+#include "TopologySnapshot.h"
+#include "commen.h"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <sstream>
+#include <unistd.h>
+
+namespace {
+    const char *HEADER_PREFIX = "# codis proxy snapshot ";
+
+    void appendJsonString(std::ostream &os, const char *key, const std::string &value) {
+        os << '"' << key << "\":\"";
+        for (char c : value) {
+            if (c == '"' || c == '\\') os << '\\' << c;
+            else if ((unsigned char) c < 0x20) os << ' ';
+            else os << c;
+        }
+        os << '"';
+    }
+}
+
+bool TopologySnapshot::save(const std::string &path, const std::vector<CodisProxyInfo> &proxies) {
+    std::string tmpPath = path + ".tmp." + std::to_string(getpid());
+    {
+        std::ofstream ofs(tmpPath.c_str(), std::ios::out | std::ios::trunc);
+        if (!ofs) {
+            LOG_ERROR << "cannot write topology snapshot: " << tmpPath << ", " << strerror(errno);
+            return false;
+        }
+        ofs << HEADER_PREFIX << (std::int64_t) time(nullptr) << '\n';
+        for (const auto &e : proxies) {
+            ofs << '{';
+            appendJsonString(ofs, "token", e.token);
+            ofs << ',';
+            appendJsonString(ofs, "addr", e.addr);
+            ofs << ',';
+            appendJsonString(ofs, "admin_addr", e.adminAddr);
+            ofs << ',';
+            appendJsonString(ofs, "state", e.state);
+            ofs << ',';
+            appendJsonString(ofs, "datacenter", e.datacenter);
+            ofs << ',';
+            appendJsonString(ofs, "start_time", e.startTime);
+            ofs << ",\"pid\":" << e.pid << "}\n";
+        }
+        ofs.flush();
+        if (!ofs) {
+            LOG_ERROR << "write topology snapshot error: " << tmpPath;
+            unlink(tmpPath.c_str());
+            return false;
+        }
+    }
+    if (rename(tmpPath.c_str(), path.c_str()) != 0) {
+        LOG_ERROR << "cannot rename topology snapshot to " << path << ", " << strerror(errno);
+        unlink(tmpPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool TopologySnapshot::load(const std::string &path, int maxAgeSec, std::vector<CodisProxyInfo> &proxies,
+                            std::int64_t *saveTime) {
+    std::ifstream ifs(path.c_str());
+    if (!ifs) {
+        LOG_WARN << "no topology snapshot: " << path;
+        return false;
+    }
+
+    std::string line;
+    size_t prefixLen = strlen(HEADER_PREFIX);
+    if (!std::getline(ifs, line) || line.compare(0, prefixLen, HEADER_PREFIX) != 0) {
+        LOG_ERROR << "bad topology snapshot header: " << path;
+        return false;
+    }
+    std::int64_t savedAt = std::strtoll(line.c_str() + prefixLen, nullptr, 10);
+    std::int64_t age = (std::int64_t) time(nullptr) - savedAt;
+    if (age > maxAgeSec) {
+        LOG_WARN << "topology snapshot too old: " << path << ", age: " << age << "s, max age: " << maxAgeSec << "s";
+        return false;
+    }
+
+    std::vector<CodisProxyInfo> res;
+    while (std::getline(ifs, line)) {
+        if (line.empty()) continue;
+        CodisProxyInfo info;
+        if (!CodisProxyInfo::parse(line, info)) {
+            LOG_ERROR << "bad proxy in topology snapshot: " << line;
+            return false;
+        }
+        res.push_back(info);
+    }
+    proxies.swap(res);
+    if (saveTime) *saveTime = savedAt;
+    return true;
+}
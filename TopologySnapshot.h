@@ -0,0 +1,27 @@
+//
+// Created by admin on 2019-03-21.
+//
+
+#ifndef CPPSERVER_TOPOLOGYSNAPSHOT_H
+#define CPPSERVER_TOPOLOGYSNAPSHOT_H
+
+#include "CodisProxyInfo.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// TopologySnapshot persists the last known codis proxy list, so that a
+// client can start serving before zk answers. The file is a header line
+// with the save time followed by one proxy json per line; it is written
+// to a temporary file and renamed, so readers never see a partial file.
+class TopologySnapshot {
+public:
+    static bool save(const std::string &path, const std::vector<CodisProxyInfo> &proxies);
+
+    // false if the file is missing, unreadable or older than maxAgeSec
+    static bool load(const std::string &path, int maxAgeSec, std::vector<CodisProxyInfo> &proxies,
+                     std::int64_t *saveTime = nullptr);
+};
+
+
+#endif //CPPSERVER_TOPOLOGYSNAPSHOT_H
@@ -0,0 +1,208 @@
+//
+// Created by admin on 2019-03-15.
+//
+
+#include "FakeRedisServer.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cctype>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <random>
+#include <sys/socket.h>
+#include <unistd.h>
+
+FakeRedisServerConfig::FakeRedisServerConfig() {
+    port = 0;
+    latencyUs = 0;
+    jitterUs = 0;
+    valueSize = 64;
+}
+
+FakeRedisServer::FakeRedisServer(const FakeRedisServerConfig &config) :
+        config(config),
+        value(config.valueSize, 'v'),
+        listenFd(-1),
+        port(config.port) {
+    running = false;
+    commandNum = 0;
+}
+
+FakeRedisServer::~FakeRedisServer() {
+    stop();
+}
+
+bool FakeRedisServer::start() {
+    listenFd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listenFd < 0) return false;
+
+    int on = 1;
+    setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons((uint16_t) config.port);
+    if (bind(listenFd, (struct sockaddr *) &addr, sizeof(addr)) != 0 || listen(listenFd, 1024) != 0) {
+        close(listenFd);
+        listenFd = -1;
+        return false;
+    }
+
+    socklen_t len = sizeof(addr);
+    getsockname(listenFd, (struct sockaddr *) &addr, &len);
+    port = ntohs(addr.sin_port);
+
+    running = true;
+    acceptThread = std::thread(&FakeRedisServer::acceptLoop, this);
+    return true;
+}
+
+void FakeRedisServer::stop() {
+    if (!running.exchange(false)) return;
+
+    shutdown(listenFd, SHUT_RDWR);
+    close(listenFd);
+    if (acceptThread.joinable()) acceptThread.join();
+
+    std::vector<std::thread> threads;
+    {
+        std::lock_guard<std::mutex> g(mtx);
+        for (int fd : connFds) shutdown(fd, SHUT_RDWR);
+        threads.swap(connThreads);
+    }
+    for (auto &t : threads) {
+        if (t.joinable()) t.join();
+    }
+}
+
+void FakeRedisServer::acceptLoop() {
+    while (running) {
+        int fd = accept(listenFd, nullptr, nullptr);
+        if (fd < 0) {
+            if (!running) break;
+            continue;
+        }
+        int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+        std::lock_guard<std::mutex> g(mtx);
+        connFds.push_back(fd);
+        connThreads.emplace_back(&FakeRedisServer::serve, this, fd);
+    }
+}
+
+void FakeRedisServer::serve(int fd) {
+    std::mt19937 rng((unsigned) fd);
+    std::string in;
+    std::string out;
+    std::vector<std::string> argv;
+    char buf[16 * 1024];
+
+    while (running) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n <= 0) break;
+        in.append(buf, (size_t) n);
+
+        size_t pos = 0;
+        size_t parsed = 0;
+        while (parseCommand(in, pos, argv)) {
+            reply(argv, out);
+            ++parsed;
+        }
+        in.erase(0, pos);
+        if (parsed == 0) continue;
+        commandNum += (long) parsed;
+
+        int latency = config.latencyUs;
+        if (config.jitterUs > 0) latency += (int) (rng() % (unsigned) (config.jitterUs + 1));
+        if (latency > 0) std::this_thread::sleep_for(std::chrono::microseconds(latency));
+
+        size_t written = 0;
+        while (written < out.size()) {
+            ssize_t w = write(fd, out.data() + written, out.size() - written);
+            if (w <= 0) break;
+            written += (size_t) w;
+        }
+        out.clear();
+    }
+
+    std::lock_guard<std::mutex> g(mtx);
+    connFds.erase(std::remove(connFds.begin(), connFds.end(), fd), connFds.end());
+    close(fd);
+}
+
+bool FakeRedisServer::parseCommand(const std::string &buf, size_t &pos, std::vector<std::string> &argv) {
+    argv.clear();
+    if (pos >= buf.size()) return false;
+
+    size_t cur = pos;
+    if (buf[cur] != '*') {
+        // inline command
+        size_t eol = buf.find("\r\n", cur);
+        if (eol == std::string::npos) return false;
+        size_t i = cur;
+        while (i < eol) {
+            while (i < eol && buf[i] == ' ') ++i;
+            size_t j = i;
+            while (j < eol && buf[j] != ' ') ++j;
+            if (j > i) argv.emplace_back(buf, i, j - i);
+            i = j;
+        }
+        pos = eol + 2;
+        return true;
+    }
+
+    size_t eol = buf.find("\r\n", cur);
+    if (eol == std::string::npos) return false;
+    long argc = strtol(buf.c_str() + cur + 1, nullptr, 10);
+    cur = eol + 2;
+
+    for (long i = 0; i < argc; ++i) {
+        if (cur >= buf.size()) return false;
+        eol = buf.find("\r\n", cur);
+        if (eol == std::string::npos) return false;
+        long len = strtol(buf.c_str() + cur + 1, nullptr, 10);
+        cur = eol + 2;
+        if (len < 0) len = 0;
+        if (buf.size() < cur + (size_t) len + 2) return false;
+        argv.emplace_back(buf, cur, (size_t) len);
+        cur += (size_t) len + 2;
+    }
+    pos = cur;
+    return true;
+}
+
+void FakeRedisServer::reply(const std::vector<std::string> &argv, std::string &out) {
+    if (argv.empty()) {
+        out += "-ERR empty command\r\n";
+        return;
+    }
+
+    std::string cmd(argv[0]);
+    std::transform(cmd.begin(), cmd.end(), cmd.begin(), ::toupper);
+    std::string bulk = "$" + std::to_string(value.size()) + "\r\n" + value + "\r\n";
+
+    if (cmd == "PING") {
+        out += "+PONG\r\n";
+    } else if (cmd == "GET" || cmd == "HGET" || cmd == "LINDEX") {
+        out += bulk;
+    } else if (cmd == "MGET" || cmd == "HMGET") {
+        size_t n = argv.size() > 2 ? argv.size() - (cmd == "MGET" ? 1 : 2) : 1;
+        out += "*" + std::to_string(n) + "\r\n";
+        for (size_t i = 0; i < n; ++i) out += bulk;
+    } else if (cmd == "HGETALL" || cmd == "LRANGE" || cmd == "SMEMBERS") {
+        out += "*2\r\n$5\r\nfield\r\n" + bulk;
+    } else if (cmd == "SET" || cmd == "SETEX" || cmd == "MSET" || cmd == "HMSET") {
+        out += "+OK\r\n";
+    } else if (cmd == "EXISTS" || cmd == "DEL" || cmd == "INCR" || cmd == "EXPIRE" || cmd == "HSET" ||
+               cmd == "SADD" || cmd == "LPUSH" || cmd == "RPUSH" || cmd == "ZADD" || cmd == "TTL") {
+        out += ":1\r\n";
+    } else {
+        out += "+OK\r\n";
+    }
+}
@@ -0,0 +1,70 @@
+//
+// Created by admin on 2019-03-15.
+//
+
+#ifndef CPPSERVER_FAKEREDISSERVER_H
+#define CPPSERVER_FAKEREDISSERVER_H
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class FakeRedisServerConfig {
+public:
+    int port;         // 0: pick a free port, see FakeRedisServer::getPort
+    int latencyUs;    // added once per batch of commands read together
+    int jitterUs;     // uniform extra latency in [0, jitterUs]
+    size_t valueSize; // size of the values returned by GET/MGET/HGETALL
+
+    FakeRedisServerConfig();
+};
+
+// FakeRedisServer is a RESP speaking stand-in for a codis proxy, for
+// benchmarks: it stores nothing, answers reads with fixed-size values,
+// writes with +OK or :1, and simulates server latency with a sleep.
+// One thread per connection, bound to 127.0.0.1.
+class FakeRedisServer {
+    FakeRedisServerConfig config;
+    std::string value;
+    int listenFd;
+    int port;
+    std::atomic<bool> running;
+    std::thread acceptThread;
+    std::mutex mtx;
+    std::vector<std::thread> connThreads;
+    std::vector<int> connFds;
+    std::atomic<long> commandNum;
+
+    // non construct copyable and non copyable
+    FakeRedisServer(const FakeRedisServer &);
+
+    FakeRedisServer &operator=(const FakeRedisServer &);
+
+    void acceptLoop();
+
+    void serve(int fd);
+
+    void reply(const std::vector<std::string> &argv, std::string &out);
+
+public:
+    explicit FakeRedisServer(const FakeRedisServerConfig &config);
+
+    ~FakeRedisServer();
+
+    bool start();
+
+    void stop();
+
+    int getPort() const { return port; }
+
+    long getCommandNum() const { return commandNum; }
+
+    // Parse one RESP multi-bulk (or inline) command from buf at pos.
+    // Returns false if the command is not complete yet.
+    static bool parseCommand(const std::string &buf, size_t &pos, std::vector<std::string> &argv);
+};
+
+
+#endif //CPPSERVER_FAKEREDISSERVER_H
@@ -0,0 +1,284 @@
+//
+// Created by admin on 2019-03-15.
+//
+// End-to-end throughput/latency benchmark of RedisClient against a local
+// RESP stand-in server (FakeRedisServer) or a real server.
+//
+// Usage: bench_codis [--threads N] [--seconds N] [--workload single|pipeline|mixed|fanout]
+//                    [--pipeline N] [--read-ratio R] [--pool N] [--keys N]
+//                    [--server-latency-us N] [--server-jitter-us N] [--value-size N]
+//                    [--server host:port|unix:///path] [--proxies N] [--mux off|epoll|uring]
+//
+// With --proxies N the requests go through a CodisClient with static
+// discovery of N proxies (all on the same server), picked round-robin.
+// fanout sends one pipeline to each of the N pools per request, and reads
+// them one after another (--mux off) or all at once with
+// pipeline::RedisGetReplies over epoll or io_uring.
+// Reports ops/s and p50/p99/p999/max per workload. A pipeline of N
+// commands counts as N ops; its latency is that of the whole pipeline.
+//
+
+#include "FakeRedisServer.h"
+#include "CodisClient.h"
+#include "redis_client/RedisClient.h"
+#include "redis_client/LatencyHistogram.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+    struct BenchOptions {
+        int threads = 8;
+        int seconds = 10;
+        std::string workload = "single";
+        int pipelineDepth = 16;
+        double readRatio = 0.9;
+        int poolSize = 16;
+        int keyNum = 10000;
+        int serverLatencyUs = 0;
+        int serverJitterUs = 0;
+        size_t valueSize = 64;
+        std::string server;  // empty: built-in FakeRedisServer
+        int proxyNum = 0;    // > 0: through CodisClient with static discovery
+        std::string mux = "off";
+    };
+
+    struct WorkerResult {
+        std::unique_ptr<LatencyHistogram> latency;
+        long ops = 0;
+        long errors = 0;
+
+        WorkerResult() : latency(new LatencyHistogram()) {}
+    };
+
+    void usage(const char *prog) {
+        fprintf(stderr, "Usage: %s [--threads N] [--seconds N] [--workload single|pipeline|mixed|fanout]\n"
+                        "          [--pipeline N] [--read-ratio R] [--pool N] [--keys N]\n"
+                        "          [--server-latency-us N] [--server-jitter-us N] [--value-size N]\n"
+                        "          [--server host:port|unix:///path] [--proxies N] [--mux off|epoll|uring]\n",
+                prog);
+    }
+
+    bool parseOptions(int argc, char **argv, BenchOptions &opt) {
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            if (i + 1 >= argc) return false;
+            const char *val = argv[++i];
+            if (arg == "--threads") opt.threads = atoi(val);
+            else if (arg == "--seconds") opt.seconds = atoi(val);
+            else if (arg == "--workload") opt.workload = val;
+            else if (arg == "--pipeline") opt.pipelineDepth = atoi(val);
+            else if (arg == "--read-ratio") opt.readRatio = atof(val);
+            else if (arg == "--pool") opt.poolSize = atoi(val);
+            else if (arg == "--keys") opt.keyNum = atoi(val);
+            else if (arg == "--server-latency-us") opt.serverLatencyUs = atoi(val);
+            else if (arg == "--server-jitter-us") opt.serverJitterUs = atoi(val);
+            else if (arg == "--value-size") opt.valueSize = (size_t) atol(val);
+            else if (arg == "--server") opt.server = val;
+            else if (arg == "--proxies") opt.proxyNum = atoi(val);
+            else if (arg == "--mux") opt.mux = val;
+            else return false;
+        }
+        return opt.threads > 0 && opt.seconds > 0 && opt.pipelineDepth > 0 && opt.keyNum > 0 &&
+               (opt.workload == "single" || opt.workload == "pipeline" || opt.workload == "mixed" ||
+                opt.workload == "fanout") &&
+               (opt.mux == "off" || opt.mux == "epoll" || opt.mux == "uring");
+    }
+
+    uint64_t elapsedUs(const std::chrono::steady_clock::time_point &start) {
+        return (uint64_t) std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - start).count();
+    }
+
+    // one pipeline per pool (the same pool N times without codis)
+    void runFanout(CodisClient *codis, RedisClient *single, const BenchOptions &opt, std::mt19937 &rng,
+                   WorkerResult &res) {
+        int fanout = std::max(opt.proxyNum, 1);
+        std::vector<std::shared_ptr<RedisClient>> picked;
+        std::vector<pipeline> pipelines;
+        char key[32];
+        for (int n = 0; n < fanout; ++n) {
+            RedisClient *client = single;
+            if (codis) {
+                picked.push_back(codis->RoundRobinRedisPool());
+                if (!picked.back()) {
+                    ++res.errors;
+                    return;
+                }
+                client = picked.back().get();
+            }
+            pipelines.push_back(client->pipelined());
+            for (int i = 0; i < opt.pipelineDepth; ++i) {
+                snprintf(key, sizeof(key), "bench:%u", (unsigned) (rng() % opt.keyNum));
+                pipelines.back().RedisAppendCommand("GET %s", key);
+            }
+        }
+        if (opt.mux == "off") {
+            for (auto &p : pipelines) {
+                std::vector<RedisReplyPtr> replies;
+                if (p.RedisGetReply(replies) != CLIENT_OK) ++res.errors;
+            }
+        } else {
+            std::vector<pipeline *> ptrs;
+            for (auto &p : pipelines) ptrs.push_back(&p);
+            std::vector<std::vector<RedisReplyPtr>> replies;
+            std::vector<int> codes;
+            pipeline::RedisGetReplies(ptrs, replies, codes);
+            for (int code : codes) {
+                if (code != CLIENT_OK) ++res.errors;
+            }
+        }
+        res.ops += (long) fanout * opt.pipelineDepth;
+    }
+
+    // codis: pick a pool per request, else use single
+    void runWorker(CodisClient *codis, RedisClient *single, const BenchOptions &opt, const std::string &payload,
+                   const std::atomic<bool> &stop, unsigned seed, WorkerResult &res) {
+        std::mt19937 rng(seed);
+        char key[32];
+
+        while (!stop) {
+            auto start = std::chrono::steady_clock::now();
+            if (opt.workload == "fanout") {
+                runFanout(codis, single, opt, rng, res);
+                res.latency->record(elapsedUs(start));
+                continue;
+            }
+            std::shared_ptr<RedisClient> picked;
+            if (codis && !(picked = codis->RoundRobinRedisPool())) {
+                ++res.errors;
+                continue;
+            }
+            RedisClient &client = codis ? *picked : *single;
+            if (opt.workload == "pipeline") {
+                pipeline p = client.pipelined();
+                for (int i = 0; i < opt.pipelineDepth; ++i) {
+                    snprintf(key, sizeof(key), "bench:%u", (unsigned) (rng() % opt.keyNum));
+                    p.RedisAppendCommand("GET %s", key);
+                }
+                std::vector<RedisReplyPtr> replies;
+                if (p.RedisGetReply(replies) != CLIENT_OK) ++res.errors;
+                res.ops += opt.pipelineDepth;
+            } else {
+                snprintf(key, sizeof(key), "bench:%u", (unsigned) (rng() % opt.keyNum));
+                bool read = opt.workload == "single" ||
+                            (double) rng() / std::mt19937::max() < opt.readRatio;
+                RedisReplyPtr reply = read ? client.redisCommand("GET %s", key)
+                                           : client.redisCommand("SET %s %b", key, payload.data(), payload.size());
+                if (reply.isNull() || reply->type == REDIS_REPLY_ERROR) ++res.errors;
+                ++res.ops;
+            }
+            res.latency->record(elapsedUs(start));
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    BenchOptions opt;
+    if (!parseOptions(argc, argv, opt)) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    std::unique_ptr<FakeRedisServer> server;
+    REDIS_ENDPOINT endpoint;
+    memset(&endpoint, 0, sizeof(endpoint));
+    if (opt.server.empty()) {
+        FakeRedisServerConfig serverConfig;
+        serverConfig.latencyUs = opt.serverLatencyUs;
+        serverConfig.jitterUs = opt.serverJitterUs;
+        serverConfig.valueSize = opt.valueSize;
+        server.reset(new FakeRedisServer(serverConfig));
+        if (!server->start()) {
+            fprintf(stderr, "cannot start fake redis server\n");
+            return 1;
+        }
+        strcpy(endpoint.host, "127.0.0.1");
+        endpoint.port = server->getPort();
+    } else if (opt.server.compare(0, 7, "unix://") == 0) {
+        std::string path = opt.server.substr(7);
+        if (path.empty() || path.size() >= sizeof(endpoint.path)) {
+            usage(argv[0]);
+            return 1;
+        }
+        memcpy(endpoint.path, path.c_str(), path.size());
+    } else {
+        size_t colon = opt.server.rfind(':');
+        if (colon == std::string::npos || colon >= sizeof(endpoint.host)) {
+            usage(argv[0]);
+            return 1;
+        }
+        memcpy(endpoint.host, opt.server.c_str(), colon);
+        endpoint.port = atoi(opt.server.c_str() + colon + 1);
+    }
+
+    REDIS_CONFIG conf;
+    memset(&conf, 0, sizeof(conf));
+    conf.endpoints = &endpoint;
+    conf.num_endpoints = 1;
+    conf.connect_timeout = 1000;
+    conf.net_readwrite_timeout = 1000;
+    conf.num_redis_socks = opt.poolSize;
+    conf.connect_failure_retry_delay = 1;
+    conf.reader_buf_max_size = 1024 * 1024;
+    std::unique_ptr<RedisClient> single;
+    std::unique_ptr<CodisClient> codis;
+    if (opt.proxyNum > 0) {
+        CodisConfig config;
+        config.redisConfig.connTimeout = conf.connect_timeout;
+        config.redisConfig.socketTimeout = conf.net_readwrite_timeout;
+        config.redisConfig.connPoolSize = opt.poolSize;
+        config.discoveryConfig.type = "static";
+        std::string addr = RedisClient::endpointName(endpoint);
+        for (int i = 0; i < opt.proxyNum; ++i) {
+            config.discoveryConfig.staticProxies.push_back(
+                    "{\"token\":\"bench-" + std::to_string(i) + "\",\"addr\":\"" + addr + "\",\"state\":\"online\"}");
+        }
+        config.socketConfig.ioUring = opt.mux == "uring";
+        codis.reset(new CodisClient(config));
+        codis->init();
+    } else {
+        single.reset(new RedisClient(conf));
+        single->setMuxPreferUring(opt.mux == "uring");
+    }
+
+    std::string payload(opt.valueSize, 'p');
+    std::atomic<bool> stop(false);
+    std::vector<WorkerResult> results(opt.threads);
+    std::vector<std::thread> workers;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < opt.threads; ++i) {
+        workers.emplace_back(runWorker, codis.get(), single.get(), std::cref(opt), std::cref(payload), std::cref(stop),
+                             (unsigned) i + 1, std::ref(results[i]));
+    }
+    std::this_thread::sleep_for(std::chrono::seconds(opt.seconds));
+    stop = true;
+    for (auto &t : workers) t.join();
+    double seconds = elapsedUs(start) / 1e6;
+
+    HistogramSnapshot latency;
+    long ops = 0;
+    long errors = 0;
+    for (auto &r : results) {
+        latency.merge(r.latency->snapshot());
+        ops += r.ops;
+        errors += r.errors;
+    }
+
+    printf("%-10s %8s %8s %12s %10s %10s %10s %10s %8s\n",
+           "workload", "threads", "pool", "ops/s", "p50(us)", "p99(us)", "p999(us)", "max(us)", "errors");
+    printf("%-10s %8d %8d %12.0f %10lu %10lu %10lu %10lu %8ld\n",
+           opt.workload.c_str(), opt.threads, opt.poolSize, ops / seconds,
+           (unsigned long) latency.percentile(50), (unsigned long) latency.percentile(99),
+           (unsigned long) latency.percentile(99.9), (unsigned long) latency.max(), errors);
+    return 0;
+}
@@ -0,0 +1,37 @@
+//
+// Created by admin on 2019-03-25.
+//
+// libFuzzer target of CodisProxyInfo::parse, the parser of the proxy node
+// data read from zk, a file or a snapshot.
+//
+// Build (in benchmark/):
+//   clang++ -std=c++11 -g -O1 -fsanitize=fuzzer,address,undefined -I.. fuzz_proxy_info.cpp ../CodisProxyInfo.cpp
+// Usage: fuzz_proxy_info [libFuzzer flags] [corpus dir]
+//
+// Besides memory errors, it checks that a successful parse has an addr
+// and that parsing into a reused CodisProxyInfo gives the same fields as
+// parsing into a fresh one.
+//
+
+#include "CodisProxyInfo.h"
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    // reused across inputs, as in CodisClient::initRoundRobinRedisPool
+    static CodisProxyInfo reused;
+    CodisProxyInfo fresh;
+
+    bool ok = CodisProxyInfo::parse((const char *) data, size, fresh);
+    bool reusedOk = CodisProxyInfo::parse((const char *) data, size, reused);
+    if (ok != reusedOk) abort();
+    if (!ok) return 0;
+    if (fresh.addr.empty()) abort();
+    if (fresh.token != reused.token || fresh.addr != reused.addr || fresh.adminAddr != reused.adminAddr ||
+        fresh.state != reused.state || fresh.datacenter != reused.datacenter ||
+        fresh.startTime != reused.startTime || fresh.pid != reused.pid) {
+        abort();
+    }
+    return 0;
+}
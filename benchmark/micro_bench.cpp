@@ -0,0 +1,345 @@
+//
+// Created by admin on 2019-03-18.
+//
+// Microbenchmarks (Google Benchmark) of the client hot paths:
+// pool acquire/release under contention and occupancy, RedisReplyPtr
+// lifecycle, pipeline reply assembly, command coalescing, round-robin pool selection,
+// latency recording and proxy node parsing. Sockets connect to an in-process FakeRedisServer.
+//
+// Usage: micro_bench [google benchmark flags, e.g. --benchmark_out=a.json --benchmark_out_format=json]
+//        micro_bench --compare base.json new.json [threshold_percent]
+//
+// --compare diffs two JSON result files by benchmark name and exits with 1
+// if any benchmark got slower (real time) by more than threshold_percent
+// (default 5).
+//
+
+#include "FakeRedisServer.h"
+#include "CodisClient.h"
+#include "CodisProxyInfo.h"
+#include "redis_client/RedisClient.h"
+#include "redis_client/SingleFlight.h"
+#include "redis_client/LatencyRecorder.h"
+#include <benchmark/benchmark.h>
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/thread/shared_mutex.hpp>
+#include <boost/thread/locks.hpp>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+    const int POOL_SIZE = 64;
+
+    FakeRedisServer &fakeServer() {
+        static FakeRedisServer *server = nullptr;
+        static std::once_flag once;
+        std::call_once(once, [] {
+            FakeRedisServerConfig config;
+            config.valueSize = 64;
+            server = new FakeRedisServer(config);
+            if (!server->start()) {
+                fprintf(stderr, "cannot start fake redis server\n");
+                exit(1);
+            }
+        });
+        return *server;
+    }
+
+    REDIS_CONFIG makeConfig(REDIS_ENDPOINT &endpoint, int poolSize) {
+        memset(&endpoint, 0, sizeof(endpoint));
+        strcpy(endpoint.host, "127.0.0.1");
+        endpoint.port = fakeServer().getPort();
+
+        REDIS_CONFIG conf;
+        memset(&conf, 0, sizeof(conf));
+        conf.endpoints = &endpoint;
+        conf.num_endpoints = 1;
+        conf.connect_timeout = 1000;
+        conf.net_readwrite_timeout = 1000;
+        conf.num_redis_socks = poolSize;
+        conf.connect_failure_retry_delay = 1;
+        conf.reader_buf_max_size = 1024 * 1024;
+        return conf;
+    }
+
+    // A pool with occupancy percent of its sockets held for good, so that
+    // acquisition has to scan past busy sockets. Created once per level.
+    REDIS_INSTANCE *occupiedPool(int occupancy) {
+        static std::mutex mtx;
+        static std::map<int, REDIS_INSTANCE *> pools;
+        std::lock_guard<std::mutex> g(mtx);
+        auto it = pools.find(occupancy);
+        if (it != pools.end()) return it->second;
+
+        REDIS_ENDPOINT endpoint;
+        REDIS_CONFIG conf = makeConfig(endpoint, POOL_SIZE);
+        REDIS_INSTANCE *inst = nullptr;
+        if (redis_pool_create(&conf, &inst) < 0) exit(1);
+        for (int i = 0; i < POOL_SIZE * occupancy / 100; ++i) {
+            redis_get_socket(inst);
+        }
+        pools[occupancy] = inst;
+        return inst;
+    }
+
+    RedisClient &sharedClient() {
+        static RedisClient *client = nullptr;
+        static std::once_flag once;
+        std::call_once(once, [] {
+            REDIS_ENDPOINT endpoint;
+            REDIS_CONFIG conf = makeConfig(endpoint, POOL_SIZE);
+            client = new RedisClient(conf);
+        });
+        return *client;
+    }
+
+    redisReply *makeReply(size_t elements, size_t valueSize) {
+        std::string value(valueSize, 'v');
+        redisReply str;
+        memset(&str, 0, sizeof(str));
+        str.type = REDIS_REPLY_STRING;
+        str.str = &value[0];
+        str.len = value.size();
+        if (elements == 0) return SingleFlight::cloneReply(&str);
+
+        std::vector<redisReply *> children(elements, &str);
+        redisReply arr;
+        memset(&arr, 0, sizeof(arr));
+        arr.type = REDIS_REPLY_ARRAY;
+        arr.elements = elements;
+        arr.element = children.data();
+        return SingleFlight::cloneReply(&arr);
+    }
+}
+
+// redis_get_socket + redis_release_socket; arg: percent of sockets held elsewhere
+static void BM_GetReleaseSocket(benchmark::State &state) {
+    REDIS_INSTANCE *inst = occupiedPool((int) state.range(0));
+    long misses = 0;
+    for (auto _ : state) {
+        REDIS_SOCKET *sock = redis_get_socket(inst);
+        if (sock == nullptr) ++misses;
+        redis_release_socket(inst, sock);
+    }
+    state.counters["miss_rate"] = benchmark::Counter((double) misses, benchmark::Counter::kAvgIterations);
+}
+BENCHMARK(BM_GetReleaseSocket)->Arg(0)->Arg(50)->Arg(90)->ThreadRange(1, 64)->UseRealTime();
+
+// RedisReplyPtr construction and destruction (freeReplyObject)
+static void BM_RedisReplyPtrLifecycle(benchmark::State &state) {
+    redisReply *tmpl = makeReply((size_t) state.range(0), 64);
+    for (auto _ : state) {
+        state.PauseTiming();
+        redisReply *r = SingleFlight::cloneReply(tmpl);
+        state.ResumeTiming();
+        RedisReplyPtr p(r);
+        benchmark::DoNotOptimize(p.get());
+    }
+    freeReplyObject(tmpl);
+}
+BENCHMARK(BM_RedisReplyPtrLifecycle)->Arg(0)->Arg(16)->Arg(128);
+
+// the ownership transfers pipeline::RedisGetReply does per reply
+static void BM_RedisReplyPtrVectorAssembly(benchmark::State &state) {
+    size_t n = (size_t) state.range(0);
+    redisReply *tmpl = makeReply(0, 64);
+    std::vector<redisReply *> replies(n);
+    for (auto _ : state) {
+        state.PauseTiming();
+        for (size_t i = 0; i < n; ++i) replies[i] = SingleFlight::cloneReply(tmpl);
+        state.ResumeTiming();
+        std::vector<RedisReplyPtr> v;
+        v.resize(n);
+        for (size_t i = 0; i < n; ++i) v[i].setReplyPtr(replies[i]);
+        benchmark::DoNotOptimize(v.data());
+    }
+    freeReplyObject(tmpl);
+}
+BENCHMARK(BM_RedisReplyPtrVectorAssembly)->Arg(16)->Arg(128)->Arg(1024);
+
+// SingleFlight::execute around a command that only builds its reply.
+// Arg(0): every thread has its own key, the leader path without waiters;
+// Arg(1): all threads share one key.
+static void BM_SingleFlightExecute(benchmark::State &state) {
+    static SingleFlight singleFlight(std::vector<std::string>{"GET"});
+    static redisReply *tmpl = makeReply(0, 64);
+    std::vector<std::string> argv{"GET", state.range(0) ? std::string("user:shared")
+                                                         : "user:" + std::to_string(state.thread_index())};
+    auto func = [] { return RedisReplyPtr(SingleFlight::cloneReply(tmpl)); };
+    for (auto _ : state) {
+        RedisReplyPtr reply = singleFlight.execute(argv, func);
+        benchmark::DoNotOptimize(reply.get());
+    }
+}
+BENCHMARK(BM_SingleFlightExecute)->Arg(0)->Arg(1)->ThreadRange(1, 16)->UseRealTime();
+
+// pipeline append + RedisGetReply round trip over loopback; arg: commands
+static void BM_PipelineGetReply(benchmark::State &state) {
+    RedisClient &client = sharedClient();
+    int n = (int) state.range(0);
+    for (auto _ : state) {
+        pipeline p = client.pipelined();
+        for (int i = 0; i < n; ++i) p.RedisAppendCommand("GET bench:%d", i);
+        std::vector<RedisReplyPtr> replies;
+        if (p.RedisGetReply(replies) != CLIENT_OK) state.SkipWithError("pipeline failed");
+    }
+    state.SetItemsProcessed(state.iterations() * n);
+}
+BENCHMARK(BM_PipelineGetReply)->Arg(1)->Arg(16)->Arg(128)->ThreadRange(1, 16)->UseRealTime();
+
+// CodisClient::RoundRobinRedisPool over 16 proxies from static discovery
+// (distinct tokens, all on the fake server), so no zk is needed.
+// BM_RoundRobinSharedMutex is the former locking.
+static void BM_RoundRobinRedisPool(benchmark::State &state) {
+    static CodisClient *client = nullptr;
+    static std::once_flag once;
+    std::call_once(once, [] {
+        CodisConfig config;
+        config.redisConfig.connTimeout = 1000;
+        config.redisConfig.socketTimeout = 1000;
+        config.redisConfig.connPoolSize = 2;
+        config.discoveryConfig.type = "static";
+        for (int i = 0; i < 16; ++i) {
+            config.discoveryConfig.staticProxies.push_back(
+                    "{\"token\":\"bench-" + std::to_string(i) + "\",\"addr\":\"127.0.0.1:" +
+                    std::to_string(fakeServer().getPort()) + "\",\"state\":\"online\"}");
+        }
+        client = new CodisClient(config);
+        client->init();
+    });
+
+    for (auto _ : state) {
+        std::shared_ptr<RedisClient> res = client->RoundRobinRedisPool();
+        benchmark::DoNotOptimize(res.get());
+    }
+}
+BENCHMARK(BM_RoundRobinRedisPool)->ThreadRange(1, 64)->UseRealTime();
+
+static void BM_RoundRobinSharedMutex(benchmark::State &state) {
+    static boost::shared_mutex smtx;
+    static std::atomic<std::int64_t> index(-1);
+    static std::vector<std::shared_ptr<int> > pools;
+    static std::once_flag once;
+    std::call_once(once, [] {
+        for (int i = 0; i < 16; ++i) pools.push_back(std::make_shared<int>(i));
+    });
+
+    for (auto _ : state) {
+        std::shared_ptr<int> res;
+        {
+            boost::shared_lock<boost::shared_mutex> g(smtx);
+            res = pools[++index % pools.size()];
+        }
+        benchmark::DoNotOptimize(res.get());
+    }
+}
+BENCHMARK(BM_RoundRobinSharedMutex)->ThreadRange(1, 64)->UseRealTime();
+
+static void BM_LatencyRecorderRecord(benchmark::State &state) {
+    LatencyRecorder &recorder = LatencyRecorder::getInstance();
+    int proxyId = recorder.registerProxy("bench:0");
+    uint64_t us = 1;
+    for (auto _ : state) {
+        recorder.record(proxyId, LatencyRecorder::commandName("get"), us);
+        us = (us * 7 + 13) & 0xffff;
+    }
+}
+BENCHMARK(BM_LatencyRecorderRecord)->ThreadRange(1, 64)->UseRealTime();
+
+namespace {
+    // node data as written by codis, with the padding seen in zk
+    const std::string PROXY_NODE_DATA =
+            "{\"token\":\"f1a3c5e7b9d2f4a6c8e0b2d4f6a8c0e2\",\"start\":\"2019-03-20 10:00:00.123456789 +0800 CST\","
+            "\"admin\":\"10.20.30.40:11080\",\"addr\":\"10.20.30.40:19000\",\"state\":\"online\"}\n";
+}
+
+static void BM_ParseProxyInfo(benchmark::State &state) {
+    CodisProxyInfo info;
+    for (auto _ : state) {
+        if (!CodisProxyInfo::parse(PROXY_NODE_DATA, info)) state.SkipWithError("parse failed");
+        benchmark::DoNotOptimize(info.addr.data());
+    }
+}
+BENCHMARK(BM_ParseProxyInfo);
+
+// the former path: trim to '}', then boost::property_tree through a stringstream
+static void BM_ParseProxyInfoPtree(benchmark::State &state) {
+    boost::property_tree::ptree pt;
+    for (auto _ : state) {
+        std::string value = PROXY_NODE_DATA;
+        while (value.back() != '}') value.pop_back();
+        std::stringstream ss;
+        ss << value;
+        boost::property_tree::read_json(ss, pt);
+        std::string addr = pt.get<std::string>("addr");
+        bool online = pt.get<std::string>("state") == "online";
+        benchmark::DoNotOptimize(addr.data());
+        benchmark::DoNotOptimize(online);
+    }
+}
+BENCHMARK(BM_ParseProxyInfoPtree);
+
+namespace {
+    bool loadResults(const char *file, std::map<std::string, double> &res) {
+        try {
+            boost::property_tree::ptree pt;
+            boost::property_tree::read_json(file, pt);
+            for (auto &e : pt.get_child("benchmarks")) {
+                const boost::property_tree::ptree &b = e.second;
+                if (b.get<std::string>("run_type", "iteration") == "aggregate") continue;
+                res[b.get<std::string>("name")] = b.get<double>("real_time");
+            }
+        } catch (const std::exception &e) {
+            fprintf(stderr, "cannot read %s: %s\n", file, e.what());
+            return false;
+        }
+        return true;
+    }
+
+    int compareResults(const char *baseFile, const char *newFile, double threshold) {
+        std::map<std::string, double> base, current;
+        if (!loadResults(baseFile, base) || !loadResults(newFile, current)) return 2;
+
+        int regressions = 0;
+        printf("%-60s %14s %14s %9s\n", "benchmark", "base", "new", "change");
+        for (auto &e : current) {
+            auto it = base.find(e.first);
+            if (it == base.end()) {
+                printf("%-60s %14s %14.1f %9s\n", e.first.c_str(), "-", e.second, "new");
+                continue;
+            }
+            double change = it->second > 0 ? (e.second - it->second) / it->second * 100 : 0;
+            bool regressed = change > threshold;
+            if (regressed) ++regressions;
+            printf("%-60s %14.1f %14.1f %+8.1f%%%s\n", e.first.c_str(), it->second, e.second, change,
+                   regressed ? "  REGRESSION" : "");
+        }
+        for (auto &e : base) {
+            if (current.count(e.first) == 0) printf("%-60s %14.1f %14s %9s\n", e.first.c_str(), e.second, "-", "gone");
+        }
+        printf("%d regression(s) over %.1f%%\n", regressions, threshold);
+        return regressions > 0 ? 1 : 0;
+    }
+}
+
+int main(int argc, char **argv) {
+    if (argc >= 4 && strcmp(argv[1], "--compare") == 0) {
+        return compareResults(argv[2], argv[3], argc >= 5 ? atof(argv[4]) : 5.0);
+    }
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) return 1;
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
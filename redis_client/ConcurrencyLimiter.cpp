@@ -0,0 +1,77 @@
+//
+// Created by admin on 2019-03-23.
+//
+
+#include "ConcurrencyLimiter.h"
+#include <algorithm>
+#include <limits>
+
+const int ConcurrencyLimiter::RTT_WINDOW;
+const int ConcurrencyLimiter::RTT_TOLERANCE;
+const int ConcurrencyLimiter::RTT_SLACK_US;
+const int ConcurrencyLimiter::BACKOFF_PERCENT;
+const int ConcurrencyLimiter::BASE_RISE_DIVISOR;
+
+ConcurrencyLimiter::ConcurrencyLimiter(int minLimit, int maxLimit) :
+        minLimit(std::max(1, minLimit)),
+        maxLimit(std::max(std::max(1, minLimit), maxLimit)) {
+    inflight = 0;
+    limitMilli = (std::int64_t) this->maxLimit * 1000;
+    sampleNum = 0;
+    lastDecreaseSample = 0;
+    windowMinRttUs = std::numeric_limits<std::uint64_t>::max();
+    baseRttUs = 0;
+    rejectNum = 0;
+}
+
+bool ConcurrencyLimiter::tryAcquire() {
+    int limit = getLimit();
+    int cur = inflight.load(std::memory_order_relaxed);
+    do {
+        if (cur >= limit) {
+            rejectNum.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+    } while (!inflight.compare_exchange_weak(cur, cur + 1, std::memory_order_relaxed));
+    return true;
+}
+
+void ConcurrencyLimiter::cancel() {
+    inflight.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void ConcurrencyLimiter::release(std::uint64_t rttUs, bool dropped) {
+    int inflightBefore = inflight.fetch_sub(1, std::memory_order_relaxed);
+    std::int64_t n = sampleNum.fetch_add(1, std::memory_order_relaxed) + 1;
+
+    std::uint64_t windowMin = windowMinRttUs.load(std::memory_order_relaxed);
+    while (!dropped && rttUs < windowMin &&
+           !windowMinRttUs.compare_exchange_weak(windowMin, rttUs, std::memory_order_relaxed)) {}
+    if ((n & (RTT_WINDOW - 1)) == 0) {
+        // 每个窗口更新基线：下降立即跟随，上升只追 1/BASE_RISE_DIVISOR，
+        // 避免几个慢窗口就把拥塞当成常态
+        std::uint64_t last = windowMinRttUs.exchange(std::numeric_limits<std::uint64_t>::max());
+        if (last != std::numeric_limits<std::uint64_t>::max()) {
+            last = std::max<std::uint64_t>(last, 1);  // 0 means no baseline
+            std::uint64_t base = baseRttUs.load(std::memory_order_relaxed);
+            if (base == 0 || last <= base) baseRttUs = last;
+            else baseRttUs = base + std::max<std::uint64_t>((last - base) / BASE_RISE_DIVISOR, 1);
+        }
+    }
+
+    // 首个窗口完成前没有基线，只按超时判断拥塞
+    std::uint64_t base = baseRttUs.load(std::memory_order_relaxed);
+    bool congested = dropped || (base > 0 && rttUs > base * RTT_TOLERANCE + RTT_SLACK_US);
+
+    std::int64_t cur = limitMilli.load(std::memory_order_relaxed);
+    if (congested) {
+        std::int64_t last = lastDecreaseSample.load(std::memory_order_relaxed);
+        if (n - last < cur / 1000 || !lastDecreaseSample.compare_exchange_strong(last, n)) return;
+        std::int64_t next = std::max((std::int64_t) minLimit * 1000, cur * BACKOFF_PERCENT / 100);
+        limitMilli.compare_exchange_strong(cur, next);
+    } else if (inflightBefore * 2 >= cur / 1000 && cur < (std::int64_t) maxLimit * 1000) {
+        // 加性增：约每 limit 个样本加 1
+        std::int64_t next = std::min((std::int64_t) maxLimit * 1000, cur + 1000 * 1000 / cur);
+        limitMilli.compare_exchange_weak(cur, next, std::memory_order_relaxed);
+    }
+}
@@ -0,0 +1,73 @@
+//
+// Created by admin on 2019-03-23.
+//
+
+#ifndef CPPSERVER_CONCURRENCYLIMITER_H
+#define CPPSERVER_CONCURRENCYLIMITER_H
+
+#include <atomic>
+#include <cstdint>
+
+// ConcurrencyLimiter caps the in-flight requests of one pool with an
+// AIMD limit driven by round-trip time. The baseline RTT is the minimum
+// of a window of samples: it follows a lower window minimum at once, and
+// a higher one by 1 / BASE_RISE_DIVISOR of the gap per window, so that a
+// few slow windows do not make slowness the norm. Until the first window
+// is complete only timeouts count as congestion. A request finishing well
+// above the baseline, or timing out, shrinks the limit by BACKOFF, at most once per limit
+// samples; a fast request while the limit is in use grows it by about
+// one per limit samples. Requests over the limit are rejected at once,
+// so the caller can shed or re-route them instead of queueing on a
+// degraded proxy. Lock-free.
+class ConcurrencyLimiter {
+public:
+    static const int RTT_WINDOW = 1024;         // samples per baseline window, power of two
+    static const int RTT_TOLERANCE = 2;         // congested above RTT_TOLERANCE * baseline + RTT_SLACK_US
+    static const int RTT_SLACK_US = 500;
+    static const int BACKOFF_PERCENT = 90;
+    static const int BASE_RISE_DIVISOR = 8;
+
+private:
+    const int minLimit;
+    const int maxLimit;
+    std::atomic<int> inflight;
+    std::atomic<std::int64_t> limitMilli;  // limit * 1000, for fractional increases
+    std::atomic<std::int64_t> sampleNum;
+    std::atomic<std::int64_t> lastDecreaseSample;
+    std::atomic<std::uint64_t> windowMinRttUs;
+    std::atomic<std::uint64_t> baseRttUs;  // 0 until the first window is complete
+    std::atomic<std::int64_t> rejectNum;
+
+    // non construct copyable and non copyable
+    ConcurrencyLimiter(const ConcurrencyLimiter &);
+
+    ConcurrencyLimiter &operator=(const ConcurrencyLimiter &);
+
+public:
+    // starts at maxLimit
+    ConcurrencyLimiter(int minLimit, int maxLimit);
+
+    // false if the limit is reached
+    bool tryAcquire();
+
+    // after an acquired request; dropped: timed out or failed on the network
+    void release(std::uint64_t rttUs, bool dropped);
+
+    // after an acquired request that made no round trip to measure, e.g. a
+    // pipeline whose replies were never read or came from SingleFlight
+    void cancel();
+
+    int getLimit() const { return (int) (limitMilli.load(std::memory_order_relaxed) / 1000); }
+
+    int getInflight() const { return inflight.load(std::memory_order_relaxed); }
+
+    bool hasCapacity() const { return getInflight() < getLimit(); }
+
+    std::int64_t getRejectNum() const { return rejectNum; }
+
+    // 0 until the first window is complete
+    std::uint64_t getBaseRttUs() const { return baseRttUs.load(std::memory_order_relaxed); }
+};
+
+
+#endif //CPPSERVER_CONCURRENCYLIMITER_H
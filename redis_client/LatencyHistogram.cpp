@@ -0,0 +1,70 @@
+//
+// Created by admin on 2019-03-04.
+//
+
+#include "LatencyHistogram.h"
+
+HistogramSnapshot::HistogramSnapshot() : buckets(LatencyHistogram::BUCKET_NUM, 0), count(0) {}
+
+void HistogramSnapshot::merge(const HistogramSnapshot &other) {
+    for (size_t i = 0; i < buckets.size() && i < other.buckets.size(); ++i) {
+        buckets[i] += other.buckets[i];
+    }
+    count += other.count;
+}
+
+uint64_t HistogramSnapshot::percentile(double q) const {
+    if (count == 0) return 0;
+    if (q < 0) q = 0;
+    if (q > 100) q = 100;
+
+    uint64_t rank = (uint64_t) (q / 100.0 * count + 0.5);
+    if (rank == 0) rank = 1;
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < buckets.size(); ++i) {
+        seen += buckets[i];
+        if (seen >= rank) return LatencyHistogram::bucketValue((int) i);
+    }
+    return max();
+}
+
+uint64_t HistogramSnapshot::max() const {
+    for (size_t i = buckets.size(); i > 0; --i) {
+        if (buckets[i - 1] > 0) return LatencyHistogram::bucketValue((int) i - 1);
+    }
+    return 0;
+}
+
+LatencyHistogram::LatencyHistogram() {
+    reset();
+}
+
+uint64_t LatencyHistogram::bucketValue(int idx) {
+    if (idx < SUB_BUCKET_NUM) return (uint64_t) idx;
+    int shift = idx / SUB_BUCKET_NUM - 1;
+    uint64_t sub = (uint64_t) (idx % SUB_BUCKET_NUM);
+    return ((SUB_BUCKET_NUM + sub + 1) << shift) - 1;
+}
+
+HistogramSnapshot LatencyHistogram::snapshot() const {
+    HistogramSnapshot res;
+    for (int i = 0; i < BUCKET_NUM; ++i) {
+        res.buckets[i] = buckets[i].load(std::memory_order_relaxed);
+        res.count += res.buckets[i];
+    }
+    return res;
+}
+
+void LatencyHistogram::decay() {
+    for (int i = 0; i < BUCKET_NUM; ++i) {
+        uint64_t n = buckets[i].load(std::memory_order_relaxed);
+        if (n > 0) buckets[i].fetch_sub(n - n / 2, std::memory_order_relaxed);
+    }
+}
+
+void LatencyHistogram::reset() {
+    for (int i = 0; i < BUCKET_NUM; ++i) {
+        buckets[i].store(0, std::memory_order_relaxed);
+    }
+}
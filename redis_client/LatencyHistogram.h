@@ -0,0 +1,74 @@
+//
+// Created by admin on 2019-03-04.
+//
+
+#ifndef CPPSERVER_LATENCYHISTOGRAM_H
+#define CPPSERVER_LATENCYHISTOGRAM_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// HistogramSnapshot is a plain copy of a LatencyHistogram, used for
+// percentile queries and for merging histograms recorded elsewhere.
+struct HistogramSnapshot {
+    std::vector<uint64_t> buckets;
+    uint64_t count;
+
+    HistogramSnapshot();
+
+    void merge(const HistogramSnapshot &other);
+
+    // value (us) at percentile q, q in [0, 100]; 0 if empty
+    uint64_t percentile(double q) const;
+
+    uint64_t max() const;
+};
+
+// LatencyHistogram is a log-bucketed (HDR-style) histogram of latencies
+// in microseconds. Every power of two is split into 16 linear sub-buckets,
+// so percentiles are off by at most ~6% over [0, 2^40) us with a fixed
+// footprint. Recording is one relaxed atomic increment.
+class LatencyHistogram {
+public:
+    static const int SUB_BUCKET_BITS = 4;
+    static const int SUB_BUCKET_NUM = 1 << SUB_BUCKET_BITS;
+    static const int MAX_SHIFT = 40 - SUB_BUCKET_BITS - 1;
+    static const int BUCKET_NUM = (MAX_SHIFT + 2) * SUB_BUCKET_NUM;
+
+private:
+    std::atomic<uint64_t> buckets[BUCKET_NUM];
+
+    // non construct copyable and non copyable
+    LatencyHistogram(const LatencyHistogram &);
+
+    LatencyHistogram &operator=(const LatencyHistogram &);
+
+public:
+    LatencyHistogram();
+
+    static int bucketIndex(uint64_t us) {
+        if (us < (uint64_t) SUB_BUCKET_NUM) return (int) us;
+        int shift = 63 - __builtin_clzll(us) - SUB_BUCKET_BITS;
+        if (shift > MAX_SHIFT) return BUCKET_NUM - 1;
+        return (shift + 1) * SUB_BUCKET_NUM + (int) ((us >> shift) - SUB_BUCKET_NUM);
+    }
+
+    // highest value (us) that falls into bucket idx
+    static uint64_t bucketValue(int idx);
+
+    void record(uint64_t us) {
+        buckets[bucketIndex(us)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    HistogramSnapshot snapshot() const;
+
+    // halve every bucket, so that older samples fade out
+    void decay();
+
+    void reset();
+};
+
+
+#endif //CPPSERVER_LATENCYHISTOGRAM_H
@@ -0,0 +1,146 @@
+//
+// Created by admin on 2019-03-08.
+//
+
+#include "LatencyRecorder.h"
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <unordered_set>
+
+namespace {
+    const int NAME_CACHE_SIZE = 64;
+
+    // per thread, so that commandName takes no lock once a name was seen
+    struct NameCache {
+        uint64_t hash[NAME_CACHE_SIZE];
+        const char *name[NAME_CACHE_SIZE];
+    };
+
+    const char *intern(const char *name, size_t len) {
+        // never destroyed, like the recorder
+        static std::mutex *mtx = new std::mutex();
+        static std::unordered_set<std::string> *names = new std::unordered_set<std::string>();
+        std::lock_guard<std::mutex> g(*mtx);
+        auto it = names->find(std::string(name, len));
+        if (it == names->end()) {
+            if (names->size() >= LatencyRecorder::MAX_COMMAND_NUM) it = names->insert("OTHER").first;
+            else it = names->insert(std::string(name, len)).first;
+        }
+        return it->c_str();
+    }
+}
+
+LatencyRecorder &LatencyRecorder::getInstance() {
+    static LatencyRecorder *instance = new LatencyRecorder();
+    return *instance;
+}
+
+LatencyRecorder::ThreadHolder::~ThreadHolder() {
+    if (histograms) LatencyRecorder::getInstance().retire(histograms);
+}
+
+LatencyRecorder::ThreadHistograms &LatencyRecorder::local() {
+    static thread_local ThreadHolder holder;
+    if (!holder.histograms) {
+        holder.histograms = std::make_shared<ThreadHistograms>();
+        std::lock_guard<std::mutex> g(mtx);
+        threads.push_back(holder.histograms);
+    }
+    return *holder.histograms;
+}
+
+void LatencyRecorder::retire(const std::shared_ptr<ThreadHistograms> &histograms) {
+    std::lock_guard<std::mutex> g(mtx);
+    {
+        std::lock_guard<std::mutex> tg(histograms->mtx);
+        for (auto &e : histograms->histograms) {
+            retired[std::make_pair(e.first.first, std::string(e.first.second))].merge(e.second->snapshot());
+        }
+    }
+    threads.erase(std::remove(threads.begin(), threads.end(), histograms), threads.end());
+}
+
+int LatencyRecorder::registerProxy(const std::string &proxy) {
+    std::lock_guard<std::mutex> g(mtx);
+    for (size_t i = 0; i < proxyNames.size(); ++i) {
+        if (proxyNames[i] == proxy) return (int) i;
+    }
+    proxyNames.push_back(proxy);
+    return (int) proxyNames.size() - 1;
+}
+
+void LatencyRecorder::record(int proxyId, const char *command, uint64_t us) {
+    ThreadHistograms &th = local();
+    Key key(proxyId, command);
+    auto it = th.histograms.find(key);
+    if (it == th.histograms.end()) {
+        std::lock_guard<std::mutex> g(th.mtx);
+        it = th.histograms.emplace(key, std::unique_ptr<LatencyHistogram>(new LatencyHistogram())).first;
+    }
+    it->second->record(us);
+}
+
+std::vector<LatencyStat> LatencyRecorder::snapshot() {
+    std::map<std::pair<int, std::string>, HistogramSnapshot> merged;
+    std::vector<std::string> names;
+    {
+        std::lock_guard<std::mutex> g(mtx);
+        merged = retired;
+        names = proxyNames;
+        for (auto &th : threads) {
+            std::lock_guard<std::mutex> tg(th->mtx);
+            for (auto &e : th->histograms) {
+                merged[std::make_pair(e.first.first, std::string(e.first.second))].merge(e.second->snapshot());
+            }
+        }
+    }
+
+    std::vector<LatencyStat> res;
+    res.reserve(merged.size());
+    for (auto &e : merged) {
+        LatencyStat stat;
+        stat.command = e.first.second;
+        stat.proxy = (e.first.first >= 0 && (size_t) e.first.first < names.size()) ? names[e.first.first] : "";
+        stat.count = e.second.count;
+        stat.p50 = e.second.percentile(50);
+        stat.p90 = e.second.percentile(90);
+        stat.p99 = e.second.percentile(99);
+        stat.p999 = e.second.percentile(99.9);
+        stat.max = e.second.max();
+        stat.histogram = std::move(e.second);
+        res.push_back(std::move(stat));
+    }
+    return res;
+}
+
+const char *LatencyRecorder::commandName(const char *format) {
+    static thread_local NameCache cache;
+    char name[MAX_COMMAND_LEN + 1];
+    size_t len = 0;
+    if (format != nullptr) {
+        while (*format == ' ') ++format;
+        for (const char *p = format; *p != '\0' && *p != ' '; ++p) {
+            if (len == MAX_COMMAND_LEN) return intern("OTHER", 5);
+            name[len++] = (char) toupper((unsigned char) *p);
+        }
+        if (len == 0 || name[0] == '%') {
+            memcpy(name, "FORMATTED", 9);
+            len = 9;
+        }
+    }
+    name[len] = '\0';
+
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; ++i) {
+        h ^= (unsigned char) name[i];
+        h *= 1099511628211ULL;
+    }
+    h |= 1;  // 0 marks an empty slot
+    int slot = (int) (h % NAME_CACHE_SIZE);
+    if (cache.hash[slot] == h && strcmp(cache.name[slot], name) == 0) return cache.name[slot];
+    const char *res = intern(name, len);
+    cache.hash[slot] = h;
+    cache.name[slot] = res;
+    return res;
+}
@@ -0,0 +1,90 @@
+//
+// Created by admin on 2019-03-08.
+//
+
+#ifndef CPPSERVER_LATENCYRECORDER_H
+#define CPPSERVER_LATENCYRECORDER_H
+
+#include "LatencyHistogram.h"
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// percentiles (us) of one command on one proxy
+struct LatencyStat {
+    std::string command;
+    std::string proxy;
+    uint64_t count;
+    uint64_t p50;
+    uint64_t p90;
+    uint64_t p99;
+    uint64_t p999;
+    uint64_t max;
+    HistogramSnapshot histogram;
+};
+
+// LatencyRecorder keeps one LatencyHistogram per (thread, proxy, command).
+// Recording only touches histograms owned by the calling thread, so the
+// hot path takes no lock and shares no cache line with other threads.
+// snapshot() merges all threads, including threads that have exited.
+class LatencyRecorder {
+public:
+    typedef std::pair<int, const char *> Key;  // (proxy id, interned command name)
+
+private:
+    struct KeyHash {
+        size_t operator()(const Key &key) const {
+            return std::hash<const char *>()(key.second) * 31 + (size_t) key.first;
+        }
+    };
+
+    struct ThreadHistograms {
+        // taken by the owner thread only to insert, and by snapshot()
+        std::mutex mtx;
+        std::unordered_map<Key, std::unique_ptr<LatencyHistogram>, KeyHash> histograms;
+    };
+
+    struct ThreadHolder {
+        std::shared_ptr<ThreadHistograms> histograms;
+
+        ~ThreadHolder();
+    };
+
+    std::mutex mtx;
+    std::vector<std::string> proxyNames;
+    std::vector<std::shared_ptr<ThreadHistograms> > threads;
+    std::map<std::pair<int, std::string>, HistogramSnapshot> retired;
+
+    LatencyRecorder() = default;
+
+    ThreadHistograms &local();
+
+    void retire(const std::shared_ptr<ThreadHistograms> &histograms);
+
+public:
+    // never destroyed, so that threads exiting late can still retire
+    static LatencyRecorder &getInstance();
+
+    // id used to record latencies of the given proxy address
+    int registerProxy(const std::string &proxy);
+
+    // command: a name returned by commandName
+    void record(int proxyId, const char *command, uint64_t us);
+
+    std::vector<LatencyStat> snapshot();
+
+    // upper-cased first word of a command format string, e.g. "GET %s" -> "GET",
+    // interned: the same pointer for the same name, valid forever. Names
+    // longer than MAX_COMMAND_LEN and names past MAX_COMMAND_NUM are "OTHER".
+    static const char *commandName(const char *format);
+
+    static const size_t MAX_COMMAND_LEN = 31;
+    static const size_t MAX_COMMAND_NUM = 512;
+};
+
+
+#endif //CPPSERVER_LATENCYRECORDER_H
@@ -2,13 +2,24 @@
 #include "clockUtil.h"
 #include "reportUtil.h"
 #include "Utils.h"
+#include "LatencyRecorder.h"
+#include "hiredispool_mux.h"
+#include "SingleFlight.h"
 #include <stdarg.h>
 #include <cstring>
 #include <thread>
 #include <functional>
+#include <chrono>
+#include <algorithm>
+#include <atomic>
 
 using namespace std;
 
+static uint64_t elapsedUs(const std::chrono::steady_clock::time_point &start) {
+    return (uint64_t) std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start).count();
+}
+
 std::map<int, std::string> REDIS_ERROR = {
         {REDIS_ERR_IO,       "REDIS_ERR_IO"}, /* Error in read or write */
         {REDIS_ERR_EOF,      "REDIS_ERR_EOF"}, /* End of file */
@@ -61,21 +72,61 @@ int RedisClient::checkError(REDIS_SOCKET *redisSocket) {
         exceptionMsg = "redisSocket->conn is nullptr!";
         if (c) {
             exceptionMsg = REDIS_ERROR[c->err] + ": " + c->errstr + ", " + Utils::ptrToString(strerror(errno));
-            log_(HPOOL_ERROR_LEVEL | HPOOL_CONS_LEVEL, "%s : exception!!! %s", __func__, exceptionMsg.c_str());
+            log_limited(HPOOL_ERROR_LEVEL | HPOOL_CONS_LEVEL, "%s : exception!!! %s", __func__, exceptionMsg.c_str());
             if (c->err == REDIS_ERR_IO && errno == EAGAIN)
                 return CLIENT_RWTIMEOUT;
             else
                 return CLIENT_ERROR;
         } else {
-            log_(HPOOL_ERROR_LEVEL | HPOOL_CONS_LEVEL, "%s : exception!!! %s", __func__, exceptionMsg.c_str());
+            log_limited(HPOOL_ERROR_LEVEL | HPOOL_CONS_LEVEL, "%s : exception!!! %s", __func__, exceptionMsg.c_str());
             return CLIENT_ERROR;
         }
     } else {
-        log_(HPOOL_ERROR_LEVEL | HPOOL_CONS_LEVEL, "%s : exception!!! %s", __func__, exceptionMsg.c_str());
+        log_limited(HPOOL_ERROR_LEVEL | HPOOL_CONS_LEVEL, "%s : exception!!! %s", __func__, exceptionMsg.c_str());
         return CLIENT_ERROR;
     }
 }
 
+void RedisClient::countError(REDIS_INSTANCE *inst, int code) {
+    if (inst != nullptr && code < 0 && -code < HPOOL_ERROR_CODE_NUM) {
+        __sync_fetch_and_add(&(inst->stats.error_num[-code]), 1);
+    }
+}
+
+RedisClientStats RedisClient::getStats() {
+    RedisClientStats res;
+    res.proxy = proxyName;
+    res.healthy = isConnectedTo;
+    res.socketNum = 0;
+    res.parkedNum = 0;
+    res.connectedNum = 0;
+    res.inuseNum = 0;
+    res.unconnectedNum = 0;
+    res.backoffNum = 0;
+    res.backoffEndpointNum = 0;
+    long nowMs = redis_monotonic_us() / 1000;
+    for (REDIS_SOCKET *p = inst->redis_pool; p != nullptr; p = p->next) {
+        if (p->id >= inst->socks_limit) {
+            ++res.parkedNum;
+            continue;
+        }
+        ++res.socketNum;
+        if (p->state == redis_socket::sockconnected) ++res.connectedNum;
+        else ++res.unconnectedNum;
+        if (p->state == redis_socket::sockunconnected && p->backoff.retry_after_ms > nowMs) ++res.backoffNum;
+        if (p->inuse) ++res.inuseNum;
+    }
+    for (int i = 0; i < inst->config->num_endpoints; ++i) {
+        if (inst->endpoint_backoff[i].retry_after_ms > nowMs) ++res.backoffEndpointNum;
+    }
+    res.waitNum = inst->wait_num;
+    res.idleNum = inst->idle_num;
+    res.concurrencyLimit = limiter ? limiter->getLimit() : 0;
+    res.inflightNum = limiter ? limiter->getInflight() : 0;
+    res.counters = inst->stats;
+    return res;
+}
+
 RedisReplyPtr RedisClient::redisCommand(const char *format, ...) {
     RedisReplyPtr reply;
     va_list ap;
@@ -88,19 +139,209 @@ RedisReplyPtr RedisClient::redisCommand(const char *format, ...) {
 }
 
 RedisReplyPtr RedisClient::redisvCommand(const char *format, va_list ap) {
+    const char *command = LatencyRecorder::commandName(format);
+    if (singleFlight && singleFlight->isEnabled(command)) {
+        // the encoded command is the key, and what the leader sends
+        char *cmd;
+        int len = redisvFormatCommand(&cmd, format, ap);
+        if (len < 0) {
+            log_(HPOOL_ERROR_LEVEL | HPOOL_CONS_LEVEL, "%s: Failed to format command: %s", __func__, format);
+            countError(inst, CLIENT_ERROR);
+            return RedisReplyPtr();
+        }
+        RedisReplyPtr reply = singleFlight->execute(cmd, (size_t) len, [this, command, cmd, len]() {
+            return sendCommand(command, [this, cmd, len](REDIS_SOCKET *sock) {
+                return redis_formatted_command(sock, inst, cmd, (size_t) len);
+            });
+        });
+        redisFreeCommand(cmd);
+        return reply;
+    }
+    return sendCommand(command, [this, format, &ap](REDIS_SOCKET *sock) {
+        return redis_vcommand(sock, inst, format, ap);
+    });
+}
+
+RedisReplyPtr RedisClient::sendCommand(const char *command, const std::function<void *(REDIS_SOCKET *)> &send) {
+    auto start = std::chrono::steady_clock::now();
+    int traced = hpool_trace_begin();
+    int code = CLIENT_OK;
     void *reply = nullptr;
+    if (limiter && !limiter->tryAcquire()) {
+        countError(inst, CLIENT_OVERLOAD);
+        if (traced) hpool_trace_end(command, proxyName.c_str(), CLIENT_OVERLOAD);
+        return RedisReplyPtr();
+    }
     PooledSocket socket(inst);
 
     if (socket.notNull()) {
-        reply = redis_vcommand(socket, inst, format, ap);
+        reply = send(socket);
     } else {
-        log_(HPOOL_ERROR_LEVEL | HPOOL_CONS_LEVEL,
-             "%s : Can not get socket from redis connection pool, server down? or not enough connection?", __func__);
-        checkError(socket);
+        log_limited(HPOOL_ERROR_LEVEL | HPOOL_CONS_LEVEL,
+                    "%s : Can not get socket from redis connection pool, server down? or not enough connection?", __func__);
     }
 
-    if (reply == nullptr) checkError(socket);
+    if (reply == nullptr) {
+        code = checkError(socket);
+        countError(inst, code);
+    }
 
+    if (traced) hpool_trace_end(command, proxyName.c_str(), code);
+    uint64_t us = elapsedUs(start);
+    if (limiter) limiter->release(us, code == CLIENT_RWTIMEOUT || code == CLIENT_ERROR);
+    LatencyRecorder::getInstance().record(proxyId, command, us);
+    return RedisReplyPtr(reply);
+}
+
+RedisReplyPtr RedisClient::redisCommandArgv(const std::vector<std::string> &argv, int *code, bool inlineRetry) {
+    return commandArgv(argv, 0, inlineRetry, code);
+}
+
+RedisReplyPtr RedisClient::redisCommandArgv(const std::vector<std::string> &argv,
+                                            const std::chrono::steady_clock::time_point &deadline, int *code,
+                                            bool inlineRetry) {
+    long deadlineUs = toMonotonicUs(deadline);
+    if (redis_monotonic_us() >= deadlineUs) {
+        // nothing was sent, and the pool is not to blame
+        if (code) *code = CLIENT_RWTIMEOUT;
+        return RedisReplyPtr();
+    }
+    return commandArgv(argv, deadlineUs, inlineRetry, code);
+}
+
+long RedisClient::toMonotonicUs(const std::chrono::steady_clock::time_point &deadline) {
+    return redis_monotonic_us() + (long) std::chrono::duration_cast<std::chrono::microseconds>(
+            deadline - std::chrono::steady_clock::now()).count();
+}
+
+// deadlineUs: 0 for none
+RedisReplyPtr RedisClient::commandArgv(const std::vector<std::string> &argv, long deadlineUs, bool inlineRetry,
+                                       int *code) {
+    auto start = std::chrono::steady_clock::now();
+    int traced = hpool_trace_begin();
+    int res = CLIENT_OK;
+    int timedOut = 0;
+    void *reply = nullptr;
+    if (limiter && !limiter->tryAcquire()) {
+        countError(inst, CLIENT_OVERLOAD);
+        if (traced) {
+            hpool_trace_end(LatencyRecorder::commandName(argv.empty() ? nullptr : argv[0].c_str()),
+                            proxyName.c_str(), CLIENT_OVERLOAD);
+        }
+        if (code) *code = CLIENT_OVERLOAD;
+        return RedisReplyPtr();
+    }
+    PooledSocket socket(inst, deadlineUs);
+
+    if (socket.notNull()) {
+        std::vector<const char *> args(argv.size());
+        std::vector<size_t> argLens(argv.size());
+        for (size_t i = 0; i < argv.size(); ++i) {
+            args[i] = argv[i].data();
+            argLens[i] = argv[i].size();
+        }
+        if (deadlineUs > 0 && inlineRetry) {
+            reply = redis_command_argv_deadline(socket, inst, (int) argv.size(), args.data(), argLens.data(),
+                                                deadlineUs, &timedOut);
+        } else if (deadlineUs > 0) {
+            reply = redis_command_argv_deadline_noretry(socket, inst, (int) argv.size(), args.data(),
+                                                        argLens.data(), deadlineUs, &timedOut);
+        } else if (inlineRetry) {
+            reply = redis_command_argv(socket, inst, (int) argv.size(), args.data(), argLens.data());
+        } else {
+            reply = redis_command_argv_noretry(socket, inst, (int) argv.size(), args.data(), argLens.data());
+        }
+    } else if (deadlineUs > 0 && redis_monotonic_us() >= deadlineUs) {
+        // every socket stayed busy until the deadline
+        timedOut = 1;
+    } else {
+        log_limited(HPOOL_ERROR_LEVEL | HPOOL_CONS_LEVEL,
+                    "%s : Can not get socket from redis connection pool, server down? or not enough connection?", __func__);
+    }
+
+    if (reply == nullptr) {
+        res = timedOut ? CLIENT_RWTIMEOUT : checkError(socket);
+        countError(inst, res);
+    }
+
+    const char *command = LatencyRecorder::commandName(argv.empty() ? nullptr : argv[0].c_str());
+    if (traced) hpool_trace_end(command, proxyName.c_str(), res);
+    uint64_t us = elapsedUs(start);
+    // a caller's deadline may be much tighter than what the proxy can do: not a drop
+    if (limiter) limiter->release(us, res == CLIENT_ERROR || (res == CLIENT_RWTIMEOUT && !timedOut));
+    LatencyRecorder::getInstance().record(proxyId, command, us);
+    if (code) *code = res;
+    return RedisReplyPtr(reply);
+}
+
+RedisReplyPtr RedisClient::redisCommandArgvHedged(const std::vector<std::string> &argv, long delayUs,
+                                                  const std::function<int()> &startHedge,
+                                                  const std::function<redisReply *()> &takeHedge,
+                                                  int *code, bool *hedgeWon) {
+    // without a socket timeout the wait still ends at some point
+    static const long NO_TIMEOUT_US = 60L * 1000 * 1000;
+
+    auto start = std::chrono::steady_clock::now();
+    int traced = hpool_trace_begin();
+    int res = CLIENT_OK;
+    redisReply *reply = nullptr;
+    *hedgeWon = false;
+    const char *command = LatencyRecorder::commandName(argv.empty() ? nullptr : argv[0].c_str());
+    if (limiter && !limiter->tryAcquire()) {
+        countError(inst, CLIENT_OVERLOAD);
+        if (traced) hpool_trace_end(command, proxyName.c_str(), CLIENT_OVERLOAD);
+        *code = CLIENT_OVERLOAD;
+        return RedisReplyPtr();
+    }
+    PooledSocket socket(inst);
+
+    if (socket.notNull()) {
+        std::vector<const char *> args(argv.size());
+        std::vector<size_t> argLens(argv.size());
+        for (size_t i = 0; i < argv.size(); ++i) {
+            args[i] = argv[i].data();
+            argLens[i] = argv[i].size();
+        }
+        long startUs = redis_monotonic_us();
+        long timeoutUs = inst->config->net_readwrite_timeout > 0 ?
+                         (long) inst->config->net_readwrite_timeout * 1000 : NO_TIMEOUT_US;
+        long deadlineUs = startUs + timeoutUs;
+        void *r = nullptr;
+        int status = HPOOL_WAIT_ERROR;
+        if (redis_append_command_argv(socket, inst, (int) argv.size(), args.data(), argLens.data()) == REDIS_OK) {
+            redis_wait_reply(socket, inst, &r, std::min(startUs + delayUs, deadlineUs), -1, &status);
+            if (status == HPOOL_WAIT_TIMEOUT && redis_monotonic_us() < deadlineUs) {
+                redis_wait_reply(socket, inst, &r, deadlineUs, startHedge(), &status);
+                if (status == HPOOL_WAIT_WOKEN) {
+                    reply = takeHedge();
+                    // the hedge failed: wait for this one alone
+                    if (reply == nullptr) redis_wait_reply(socket, inst, &r, deadlineUs, -1, &status);
+                }
+            }
+        }
+        if (reply != nullptr) {
+            *hedgeWon = true;
+            redis_drop_connection(socket);
+        } else if (status == HPOOL_WAIT_OK) {
+            reply = (redisReply *) r;
+        } else {
+            // a late reply must not be read by the next request
+            if (((REDIS_SOCKET *) socket)->conn != nullptr) redis_drop_connection(socket);
+            res = status == HPOOL_WAIT_TIMEOUT ? CLIENT_RWTIMEOUT : CLIENT_ERROR;
+        }
+    } else {
+        log_limited(HPOOL_ERROR_LEVEL | HPOOL_CONS_LEVEL,
+                    "%s : Can not get socket from redis connection pool, server down? or not enough connection?", __func__);
+        res = checkError(socket);
+    }
+    if (res != CLIENT_OK) countError(inst, res);
+
+    if (traced) hpool_trace_end(command, proxyName.c_str(), res);
+    uint64_t us = elapsedUs(start);
+    if (limiter) limiter->release(us, res == CLIENT_ERROR || res == CLIENT_RWTIMEOUT);
+    // abandoned for the hedge: its latency is not known
+    if (!*hedgeWon) LatencyRecorder::getInstance().record(proxyId, command, us);
+    *code = res;
     return RedisReplyPtr(reply);
 }
 
@@ -181,6 +422,15 @@ void RedisClient::pingToServer() {
 RedisClient::RedisClient(const REDIS_CONFIG &conf) {
     if (redis_pool_create(&conf, &inst) < 0)
         throw std::runtime_error("Can't create connection pool");
+    for (int i = 0; i < conf.num_endpoints; ++i) {
+        if (i > 0) proxyName += ',';
+        proxyName += endpointName(conf.endpoints[i]);
+    }
+    proxyId = LatencyRecorder::getInstance().registerProxy(proxyName);
+    muxPreferUring = false;
+    if (conf.min_concurrency_limit > 0) {
+        limiter.reset(new ConcurrencyLimiter(conf.min_concurrency_limit, conf.num_redis_socks));
+    }
 //        else{
 //            roundRobinIndex = -1;
 //            pipelineList.reserve(conf.num_redis_socks);
@@ -238,6 +488,24 @@ RedisClient::RedisClient(const REDIS_CONFIG &conf) {
 //    return res;
 //}
 
+struct pipeline::LimiterSlot {
+    ConcurrencyLimiter *limiter;  // null once given back
+
+    explicit LimiterSlot(ConcurrencyLimiter *limiter) : limiter(limiter) {}
+
+    ~LimiterSlot() { cancel(); }
+
+    void release(uint64_t rttUs, bool dropped) {
+        if (limiter) limiter->release(rttUs, dropped);
+        limiter = nullptr;
+    }
+
+    void cancel() {
+        if (limiter) limiter->cancel();
+        limiter = nullptr;
+    }
+};
+
 int pipeline::RedisAppendCommand(const char *format, ...) {
     int reply;
     va_list ap;
@@ -251,26 +519,93 @@ int pipeline::RedisAppendCommand(const char *format, ...) {
 
 int pipeline::RedisVAppendCommand(const char *format, va_list ap) {
     int reply = -1;
-    if (socket->notNull()) {
+    if (overloaded) return reply;  // counted once, by RedisClient::pipelined
+    if (singleFlight && coalescable) coalescable = singleFlight->isEnabled(LatencyRecorder::commandName(format));
+    // the connection is closed after a pipeline timed out
+    if (socket->notNull() && ((REDIS_SOCKET *) *socket)->conn != nullptr) {
         reply = redis_vappend_command(*socket, inst, format, ap);
     } else {
-        log_(HPOOL_ERROR_LEVEL | HPOOL_CONS_LEVEL,
-             "%s : Can not get pipeline socket from redis connection pool, server down? or not enough connection?",
-             __func__);
+        log_limited(HPOOL_ERROR_LEVEL | HPOOL_CONS_LEVEL,
+                    "%s : Can not get pipeline socket from redis connection pool, server down? or not enough connection?",
+                    __func__);
         RedisClient::checkError(*socket);
     }
     if (reply == REDIS_OK) ++cmdNum;
-    else
-        log_(HPOOL_ERROR_LEVEL | HPOOL_CONS_LEVEL, "%s : redis appendCommand error!", __func__);
+    else {
+        log_limited(HPOOL_ERROR_LEVEL | HPOOL_CONS_LEVEL, "%s : redis appendCommand error!", __func__);
+        RedisClient::countError(inst, CLIENT_ERROR);
+    }
     return reply;
 }
 
+namespace {
+    // the replies of a pipeline as one array reply, the form SingleFlight shares;
+    // v is left as is if that can not be allocated
+    redisReply *packReplies(std::vector<RedisReplyPtr> &v) {
+        redisReply *r = (redisReply *) calloc(1, sizeof(redisReply));
+        if (r == nullptr) return nullptr;
+        r->type = REDIS_REPLY_ARRAY;
+        r->element = (redisReply **) calloc(v.size(), sizeof(redisReply *));
+        if (r->element == nullptr) {
+            free(r);
+            return nullptr;
+        }
+        r->elements = v.size();
+        for (size_t i = 0; i < v.size(); ++i) r->element[i] = v[i].release();
+        return r;
+    }
+
+    void unpackReplies(RedisReplyPtr &packed, std::vector<RedisReplyPtr> &v) {
+        v.clear();
+        v.resize(packed->elements);
+        for (size_t i = 0; i < packed->elements; ++i) v[i].setReplyPtr(packed->element[i]);
+        packed->elements = 0;
+    }
+}
+
 int pipeline::RedisGetReply(std::vector<RedisReplyPtr> &v) {
+    if (!singleFlight || !coalescable || cmdNum <= 0 || socket->isNull() ||
+        ((REDIS_SOCKET *) *socket)->conn == nullptr) {
+        return getReplies(v);
+    }
+
+    // nothing is written before the first read: the whole pipeline is still in the output buffer
+    redisContext *c = (redisContext *) ((REDIS_SOCKET *) *socket)->conn;
+    std::string cmds(c->obuf, sdslen(c->obuf));
+    bool leader = false;
+    int code = CLIENT_OK;
+    RedisReplyPtr shared = singleFlight->execute(cmds.data(), cmds.size(), [this, &v, &leader, &code]() {
+        leader = true;
+        code = getReplies(v);
+        return RedisReplyPtr(code == CLIENT_OK ? packReplies(v) : nullptr);
+    });
+    if (leader) {
+        // shared is null if packReplies failed, and v still holds the replies then
+        if (code == CLIENT_OK && shared.notNull()) unpackReplies(shared, v);
+        return code;
+    }
+    if (shared.isNull()) return getReplies(v);  // the leader failed
+
+    sdsrange(c->obuf, 1, 0);  // never sent
+    cmdNum = 0;
+    if (limiterSlot) limiterSlot->cancel();
+    unpackReplies(shared, v);
+    return CLIENT_OK;
+}
+
+int pipeline::getReplies(std::vector<RedisReplyPtr> &v) {
     static reportUtil *reportPtr = reportUtil::getInstance();
     static std::string getFirstReply("getFirstReply");
     static std::string getAllRemainReply("getAllRemainReply");
+    static const char *pipelineCommand = LatencyRecorder::commandName("PIPELINE");
 
+    if (overloaded) return CLIENT_OVERLOAD;
     if (cmdNum <= 0) {
+        if (limiterSlot) limiterSlot->cancel();
+        if (deadlineUs > 0 && socket->isNull() && redis_monotonic_us() >= deadlineUs) {
+            RedisClient::countError(inst, CLIENT_RWTIMEOUT);
+            return CLIENT_RWTIMEOUT;
+        }
         LOG_ERROR << "pipeline does not have commands!";
         return CLIENT_OTHER;
     }
@@ -278,55 +613,201 @@ int pipeline::RedisGetReply(std::vector<RedisReplyPtr> &v) {
     int code = CLIENT_OK;
     size_t tmpCmdNum = cmdNum;
     cmdNum = 0;
-
+    int traced = hpool_trace_begin();
+    int timedOut = 0;
+    auto getReply = [this, &timedOut](redisReply **r) {
+        if (deadlineUs > 0) redis_get_reply_deadline(*socket, inst, (void **) r, deadlineUs, &timedOut);
+        else redis_get_reply(*socket, inst, (void **) r);
+    };
+
+    auto start = std::chrono::steady_clock::now();
     try {
         redisReply *r = nullptr;
         clockUtil stepWatch;
-        redis_get_reply(*socket, inst, (void **) &r);
+        getReply(&r);
         reportPtr->sendLatencyReport(getFirstReply, stepWatch.elapsedX());
 
         if (r == nullptr) {
-            return RedisClient::checkError(*socket);
-        }
-
-        v.resize(tmpCmdNum);
-        v[0].setReplyPtr(r);
-
-        for (size_t i = 1; i < v.size(); ++i) {
-            r = nullptr;
-            redis_get_reply(*socket, inst, (void **) &r);
-            if (r == nullptr) {
-                code = RedisClient::checkError(*socket);
-                break;
+            code = timedOut ? CLIENT_RWTIMEOUT : RedisClient::checkError(*socket);
+            RedisClient::countError(inst, code);
+        } else {
+            v.resize(tmpCmdNum);
+            v[0].setReplyPtr(r);
+
+            for (size_t i = 1; i < v.size(); ++i) {
+                r = nullptr;
+                getReply(&r);
+                if (r == nullptr) {
+                    code = timedOut ? CLIENT_RWTIMEOUT : RedisClient::checkError(*socket);
+                    RedisClient::countError(inst, code);
+                    break;
+                }
+                v[i].setReplyPtr(r);
             }
-            v[i].setReplyPtr(r);
+            reportPtr->sendLatencyReport(getAllRemainReply, stepWatch.elapsed());
         }
-        reportPtr->sendLatencyReport(getAllRemainReply, stepWatch.elapsed());
     } catch (const std::exception &e) {
         LOG_ERROR << "RedisGetReply exception: " << e.what();
         code = CLIENT_OTHER;
+        RedisClient::countError(inst, code);
+    }
+    uint64_t us = elapsedUs(start);
+    // a caller's deadline may be much tighter than what the proxy can do: not a drop
+    if (limiterSlot) limiterSlot->release(us, code == CLIENT_ERROR || (code == CLIENT_RWTIMEOUT && !timedOut));
+    // failures and timeouts too, as for single commands
+    if (proxyId >= 0) LatencyRecorder::getInstance().record(proxyId, pipelineCommand, us);
+    if (traced) {
+        std::string proxy = proxyName ? proxyName : RedisClient::endpointName(inst->config->endpoints[0]);
+        hpool_trace_end(pipelineCommand, proxy.c_str(), code);
     }
     return code;
 }
 
-pipeline::pipeline(REDIS_INSTANCE *inst) :
+namespace {
+    const int MUX_MAX_CONNS = 64;
+
+    // one mux per thread and backend, its buffers and ring are reused across calls
+    struct ThreadMux {
+        HPOOL_MUX *mux = nullptr;
+        bool tried = false;
+
+        ~ThreadMux() {
+            if (mux) hpool_mux_destroy(mux);
+        }
+    };
+}
+
+void pipeline::RedisGetReplies(const std::vector<pipeline *> &pipelines,
+                               std::vector<std::vector<RedisReplyPtr>> &replies, std::vector<int> &codes) {
+    static const char *pipelineCommand = LatencyRecorder::commandName("PIPELINE");
+    static thread_local ThreadMux threadMuxes[2];  // epoll, io_uring preferred
+
+    replies.clear();
+    replies.resize(pipelines.size());
+    codes.assign(pipelines.size(), CLIENT_OK);
+    bool uring = !pipelines.empty();
+    for (pipeline *p : pipelines) uring = uring && p->muxPreferUring;
+    ThreadMux &threadMux = threadMuxes[uring ? 1 : 0];
+    if (!threadMux.tried) {
+        threadMux.tried = true;
+        threadMux.mux = hpool_mux_create(MUX_MAX_CONNS, uring ? 1 : 0);
+    }
+
+    std::vector<HPOOL_MUX_REQ> reqs;
+    std::vector<size_t> owner;  // reqs[j] belongs to pipelines[owner[j]]
+    std::vector<std::vector<void *>> raw;
+    for (size_t i = 0; i < pipelines.size(); ++i) {
+        pipeline *p = pipelines[i];
+        // nothing to read, or no mux: the single pipeline path has the error handling
+        if (threadMux.mux == nullptr || p->cmdNum <= 0) {
+            codes[i] = p->RedisGetReply(replies[i]);
+            continue;
+        }
+        owner.push_back(i);
+        raw.emplace_back(p->cmdNum, nullptr);
+    }
+    if (owner.empty()) return;
+
+    reqs.resize(owner.size());
+    for (size_t j = 0; j < owner.size(); ++j) {
+        pipeline *p = pipelines[owner[j]];
+        memset(&reqs[j], 0, sizeof(HPOOL_MUX_REQ));
+        reqs[j].sock = *p->socket;
+        reqs[j].inst = p->inst;
+        reqs[j].reply_num = (int) p->cmdNum;
+        reqs[j].deadline_us = p->deadlineUs;
+        reqs[j].replies = raw[j].data();
+        p->cmdNum = 0;
+    }
+
+    int traced = hpool_trace_begin();
+    long traceMark = hpool_trace_clock();
+    auto start = std::chrono::steady_clock::now();
+    hpool_mux_run(threadMux.mux, reqs.data(), (int) reqs.size());
+    uint64_t us = elapsedUs(start);
+    // writes, waits and parses of the pipelines interleave: all of it is WAIT
+    hpool_trace_phase(HPOOL_PHASE_WAIT, traceMark);
+
+    std::vector<std::string> proxies;
+    std::vector<const char *> traceProxies;
+    std::vector<int> traceCodes;
+    for (size_t j = 0; j < owner.size(); ++j) {
+        pipeline *p = pipelines[owner[j]];
+        std::vector<RedisReplyPtr> &v = replies[owner[j]];
+        v.resize(raw[j].size());
+        for (int k = 0; k < reqs[j].done; ++k) v[k].setReplyPtr((redisReply *) raw[j][k]);
+
+        int code = CLIENT_OK;
+        if (reqs[j].status == HPOOL_MUX_TIMEOUT) code = CLIENT_RWTIMEOUT;
+        else if (reqs[j].status != HPOOL_MUX_OK) code = CLIENT_ERROR;
+        if (code != CLIENT_OK) RedisClient::countError(p->inst, code);
+        if (p->limiterSlot) {
+            // timeouts of a pipeline with a deadline are the caller's, as in getReplies
+            p->limiterSlot->release(us, code == CLIENT_ERROR || (code == CLIENT_RWTIMEOUT && p->deadlineUs == 0));
+        }
+        // failures and timeouts too, as for single pipelines
+        if (p->proxyId >= 0) LatencyRecorder::getInstance().record(p->proxyId, pipelineCommand, us);
+        codes[owner[j]] = code;
+        if (traced) {
+            proxies.push_back(p->proxyName ? p->proxyName : RedisClient::endpointName(p->inst->config->endpoints[0]));
+            traceCodes.push_back(code);
+        }
+    }
+    if (traced) {
+        for (const std::string &proxy : proxies) traceProxies.push_back(proxy.c_str());
+        hpool_trace_end_n(pipelineCommand, traceProxies.data(), traceCodes.data(), (int) traceProxies.size());
+    }
+}
+
+pipeline::pipeline(REDIS_INSTANCE *inst, int proxyId, long deadlineUs, bool overloaded) :
         cmdNum(0),
         inst(inst),
-        socket(std::make_shared<PooledSocket>(inst)) {
-    if (socket->isNull()) {
+        socket(overloaded ? std::make_shared<PooledSocket>(inst, nullptr)
+                          : std::make_shared<PooledSocket>(inst, deadlineUs)),
+        proxyId(proxyId),
+        proxyName(nullptr),
+        deadlineUs(deadlineUs),
+        coalescable(true),
+        overloaded(overloaded),
+        muxPreferUring(false) {
+    if (socket->isNull() && !overloaded) {
         RedisClient::checkError(*socket);
     }
 }
 
+pipeline RedisClient::newPipeline(long deadlineUs) {
+    bool overloaded = limiter && !limiter->tryAcquire();
+    if (overloaded) countError(inst, CLIENT_OVERLOAD);
+    pipeline p(inst, proxyId, deadlineUs, overloaded);
+    p.proxyName = proxyName.c_str();
+    p.muxPreferUring = muxPreferUring;
+    if (limiter && !overloaded) p.limiterSlot = std::make_shared<pipeline::LimiterSlot>(limiter.get());
+    return p;
+}
+
 pipeline RedisClient::pipelined() {
-    return pipeline(inst);
+    pipeline p = newPipeline(0);
+    p.singleFlight = singleFlight;
+    return p;
 //    boost::shared_lock<boost::shared_mutex> g(pipelineListSMtx);
 //    return pipelineList[++roundRobinIndex % pipelineList.size()];
 }
 
+pipeline RedisClient::pipelined(const std::chrono::steady_clock::time_point &deadline) {
+    // a deadline already passed gets a null socket, whose commands fail
+    pipeline p = newPipeline(std::max(toMonotonicUs(deadline), 1L));
+    // not coalesced: a follower would wait for the leader past its own deadline
+    return p;
+}
+
+std::string RedisClient::endpointName(const REDIS_ENDPOINT &endpoint) {
+    if (endpoint.path[0] != '\0') return std::string("unix://") + endpoint.path;
+    return std::string(endpoint.host) + ':' + std::to_string(endpoint.port);
+}
+
 bool RedisClient::checkAllSocketConnected() {
     for (REDIS_SOCKET *p = inst->redis_pool; p != nullptr; p = p->next)
-        if (p->state == redis_socket::sockunconnected) return false;
+        if (p->id < inst->socks_limit && p->state == redis_socket::sockunconnected) return false;
     return true;
 }
 
@@ -2,7 +2,7 @@
  * Date:     2017-2
  * Revision: 0.1
  * Function: Thread-safe redis client
- * Usage:    see test_RedisClient.cpp
+ * Usage:    see benchmark/bench_codis.cpp
  */
 
 #ifndef REDISCLIENT_H
@@ -13,8 +13,11 @@
 
 #include "hiredispool.h"
 #include "hiredispool_log.h"
+#include "hiredispool_trace.h"
+#include "ConcurrencyLimiter.h"
 #include <hiredis/hiredis.h>
 
+#include <chrono>
 #include <cstring>
 #include <string>
 #include <vector>
@@ -22,6 +25,7 @@
 #include <memory>
 #include <vector>
 #include <exception>
+#include <functional>
 #include <map>
 #include <unistd.h>
 //#include <atomic>
@@ -44,6 +48,15 @@ public:
         sock = redis_get_socket(inst);
     }
 
+    // Wait for a socket until deadlineUs (redis_monotonic_us clock) if all
+    // are busy; deadlineUs 0 is no deadline, as above.
+    PooledSocket(REDIS_INSTANCE *_inst, long deadlineUs) : inst(_inst) {
+        sock = deadlineUs > 0 ? redis_get_socket_deadline(inst, deadlineUs) : redis_get_socket(inst);
+    }
+
+    // Hold no socket, e.g. for a request rejected before it took one
+    PooledSocket(REDIS_INSTANCE *_inst, std::nullptr_t) : inst(_inst), sock(NULL) {}
+
     // Release the socket to pool
     ~PooledSocket() {
         redis_release_socket(inst, sock);
@@ -137,19 +150,58 @@ private:
     redisReply *p;
 };
 
+class SingleFlight;
+
 // ---begin---
 struct pipeline {
     REDIS_INSTANCE *inst;
     std::shared_ptr<PooledSocket> socket;
     size_t cmdNum;
+    int proxyId;  // LatencyRecorder id, -1 if not recorded
+    const char *proxyName;  // trace label, RedisClient::getProxyName; null: the first endpoint
+    long deadlineUs;  // redis_monotonic_us clock, 0: no deadline
+    // identical pipelines of coalesced commands only (RedisClient::setSingleFlight)
+    // share one round trip, see RedisGetReply
+    std::shared_ptr<SingleFlight> singleFlight;
+    bool coalescable;  // every command appended so far is coalesced
+    // rejected by the ConcurrencyLimiter: holds no socket, appends fail and
+    // RedisGetReply returns CLIENT_OVERLOAD
+    bool overloaded;
+
+    bool muxPreferUring;  // RedisClient::setMuxPreferUring of its client
+
+    // the ConcurrencyLimiter slot taken by RedisClient::pipelined, given back
+    // with the round trip time when the replies are read (or without a
+    // sample, when the pipeline and its copies go away unread)
+    struct LimiterSlot;
+    std::shared_ptr<LimiterSlot> limiterSlot;
 
     int RedisAppendCommand(const char *format, ...);
 
     int RedisVAppendCommand(const char *format, va_list ap);
 
+    // with a deadline, returns CLIENT_RWTIMEOUT once it passes, and the
+    // replies not read by then are dropped with the connection.
+    // With a SingleFlight, a pipeline whose commands are all coalesced and
+    // encode to the same bytes as one in flight is not sent: it gets copies
+    // of that pipeline's replies, or is sent after all if that one failed.
     int RedisGetReply(std::vector<RedisReplyPtr> &v);
 
-    pipeline(REDIS_INSTANCE *inst);
+    pipeline(REDIS_INSTANCE *inst, int proxyId = -1, long deadlineUs = 0, bool overloaded = false);
+
+    // Read the replies of several pipelines (e.g. one per proxy pool) on one
+    // thread at once, over io_uring or epoll (hiredispool_mux.h), instead of
+    // one RedisGetReply after another. replies[i] and codes[i] belong to
+    // pipelines[i]; a pipeline with a deadline times out at its own, the
+    // others being read on. io_uring is used if the clients of all the
+    // pipelines prefer it. These reads are not coalesced; each pipeline is
+    // traced and recorded as a PIPELINE of its proxy, taking the time of the
+    // whole read.
+    static void RedisGetReplies(const std::vector<pipeline *> &pipelines,
+                                std::vector<std::vector<RedisReplyPtr>> &replies, std::vector<int> &codes);
+
+private:
+    int getReplies(std::vector<RedisReplyPtr> &v);
 };
 
 class RWTIMEOUT_EXCEPTION : public std::exception {
@@ -215,15 +267,39 @@ enum CLIENT_CODE {
     CLIENT_RWTIMEOUT = -1,  // 读写超时
     CLIENT_ERROR = -2,      // RedisReplyPtr结构为空，命令执行失败
     CLIENT_OTHER = -3,      // catch到异常，传入的key为空，redisClientPtr为空
-    CLIENT_INVALID_REPLY = -4 // RedisReplyPtr中的reply type为空类型，不是需要的类型，不是期望的值
+    CLIENT_INVALID_REPLY = -4, // RedisReplyPtr中的reply type为空类型，不是需要的类型，不是期望的值
+    CLIENT_OVERLOAD = -5    // 超过自适应并发上限，请求未发出
 };
 // ---end---
 
+// Point-in-time state of one pool, see RedisClient::getStats
+struct RedisClientStats {
+    std::string proxy;
+    bool healthy;
+    int socketNum;      // usable, see redis_pool_resize
+    int parkedNum;
+    int connectedNum;   // connected, in use or idle
+    int inuseNum;
+    int unconnectedNum;
+    int backoffNum;         // unconnected, waiting for their reconnect backoff
+    int backoffEndpointNum; // endpoints in reconnect backoff
+    long waitNum;
+    long idleNum;
+    int concurrencyLimit;  // 0: no limiter
+    int inflightNum;       // requests holding the limiter
+    REDIS_STATS counters;
+};
+
 // RedisClient provides a threadsafe redis client
 class RedisClient {
 private:
     bool running;
     bool isConnectedTo;
+    std::string proxyName;
+    int proxyId;
+    std::unique_ptr<ConcurrencyLimiter> limiter;  // null unless conf.min_concurrency_limit > 0
+    std::shared_ptr<SingleFlight> singleFlight;     // see setSingleFlight
+    bool muxPreferUring;                            // see setMuxPreferUring
 
     // non construct copyable and non copyable
     RedisClient(const RedisClient &);
@@ -232,6 +308,14 @@ private:
 
     void pingToServer();
 
+    // a pipeline holding a limiter slot, or an overloaded one
+    pipeline newPipeline(long deadlineUs);
+
+    RedisReplyPtr commandArgv(const std::vector<std::string> &argv, long deadlineUs, bool inlineRetry, int *code);
+
+    // limiter, socket, error counting, trace and latency around send
+    RedisReplyPtr sendCommand(const char *command, const std::function<void *(REDIS_SOCKET *)> &send);
+
 public:
     RedisClient(const REDIS_CONFIG &conf);
 
@@ -262,14 +346,70 @@ public:
 
     RedisReplyPtr redisvCommand(const char *format, va_list ap);
 
+    // redisCommandArgv is the binary-safe variant taking the command as
+    // an argument vector. Unlike a format string with its va_list, the
+    // argument vector can be copied and replayed on another pool, which
+    // is what hedging and retries in CodisClient rely on.
+    // code, if given, is set to the CLIENT_CODE of the call. inlineRetry
+    // false: a command failing on the network is not resent on the
+    // reconnected socket, whatever the pool's disable_inline_retry, for
+    // callers running their own retries.
+    RedisReplyPtr redisCommandArgv(const std::vector<std::string> &argv, int *code = nullptr,
+                                   bool inlineRetry = true);
+
+    // redisCommandArgv bounded by an absolute deadline, e.g. the caller's
+    // RPC deadline: waiting for a socket, reconnecting, writing, reading and
+    // the inline retry all stop there, and CLIENT_RWTIMEOUT is returned
+    // right away. Independent of the pool's net_readwrite_timeout.
+    RedisReplyPtr redisCommandArgv(const std::vector<std::string> &argv,
+                                   const std::chrono::steady_clock::time_point &deadline, int *code = nullptr,
+                                   bool inlineRetry = true);
+
+    // Primary request of a hedged read, run on the caller thread. If no
+    // reply has come within delayUs, startHedge() is called once; when it
+    // returns a fd, the wait also ends as soon as that fd turns readable,
+    // and a reply from takeHedge() is then returned instead (*hedgeWon),
+    // this request being abandoned with its connection.
+    RedisReplyPtr redisCommandArgvHedged(const std::vector<std::string> &argv, long delayUs,
+                                         const std::function<int()> &startHedge,
+                                         const std::function<redisReply *()> &takeHedge,
+                                         int *code, bool *hedgeWon);
+
 //    std::vector<RedisReplyPtr> doPipeline(std::vector<std::string> &pipelineCmds);
     //自定义
+    // A pipeline takes one slot of the ConcurrencyLimiter, if any, until its
+    // replies are read; over the limit it is overloaded (see pipeline).
     pipeline pipelined();
 
+    // pipeline whose socket acquire and RedisGetReply stop at deadline,
+    // never coalesced by singleFlight
+    pipeline pipelined(const std::chrono::steady_clock::time_point &deadline);
+
+    // deadline on the clock of the hiredispool deadline calls
+    static long toMonotonicUs(const std::chrono::steady_clock::time_point &deadline);
+
+    // Coalesce identical concurrent redisCommand calls and pipelines of the
+    // commands enabled in singleFlight, e.g. across the pools of a CodisClient
+    // (pipelines without a deadline only).
+    // Set before the client is shared; redisCommandArgv is coalesced by the caller.
+    void setSingleFlight(const std::shared_ptr<SingleFlight> &singleFlight) {
+        this->singleFlight = singleFlight;
+    }
+
+    // pipeline::RedisGetReplies of this client's pipelines over io_uring,
+    // when built in (hiredispool_mux.h). Set before the client is shared.
+    void setMuxPreferUring(bool prefer) { muxPreferUring = prefer; }
+
 //    static void checkError(REDIS_SOCKET *redisSocket, bool needToThrow = true);
 
     static int checkError(REDIS_SOCKET *redisSocket);
 
+    // count a CLIENT_CODE error in the pool counters
+    static void countError(REDIS_INSTANCE *inst, int code);
+
+    // cheap: walks the socket list without taking any lock
+    RedisClientStats getStats();
+
     bool checkAllSocketConnected();
 
     long getWaitingNum() {
@@ -280,10 +420,32 @@ public:
         return inst->idle_num;
     }
 
+    int getPoolSize() const {
+        return inst->socks_limit;
+    }
+
+    // see redis_pool_resize; returns the new pool size
+    int resizePool(int num) {
+        return redis_pool_resize(inst, num);
+    }
+
     bool isHealthy() {
         return isConnectedTo;
     }
 
+    // below the concurrency limit, or no limiter; a hint, the command may still get CLIENT_OVERLOAD
+    bool hasCapacity() const {
+        return !limiter || limiter->hasCapacity();
+    }
+
+    // "host:port" or "unix://path"
+    static std::string endpointName(const REDIS_ENDPOINT &endpoint);
+
+    // "host:port" of the endpoint(s), the proxy label of latency stats
+    const std::string &getProxyName() const {
+        return proxyName;
+    }
+
 private:
     REDIS_INSTANCE *inst;
 };
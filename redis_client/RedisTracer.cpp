@@ -0,0 +1,108 @@
+//
+// Created by admin on 2019-03-13.
+//
+
+#include "RedisTracer.h"
+#include <chrono>
+#include <thread>
+
+RedisTracer::RedisTracer() : maxSlowRequestNum(128), slowThresholdUs(100 * 1000), drainIntervalMs(100) {}
+
+RedisTracer &RedisTracer::getInstance() {
+    static RedisTracer *instance = new RedisTracer();
+    return *instance;
+}
+
+const char *RedisTracer::phaseName(int phase) {
+    switch (phase) {
+        case HPOOL_PHASE_ACQUIRE:
+            return "acquire";
+        case HPOOL_PHASE_FORMAT:
+            return "format";
+        case HPOOL_PHASE_WRITE:
+            return "write";
+        case HPOOL_PHASE_WAIT:
+            return "wait";
+        case HPOOL_PHASE_PARSE:
+            return "parse";
+        case HPOOL_PHASE_RECONNECT:
+            return "reconnect";
+        default:
+            return "total";
+    }
+}
+
+void RedisTracer::setSlowThreshold(uint64_t us, size_t maxNum) {
+    std::lock_guard<std::mutex> g(mtx);
+    slowThresholdUs = us;
+    maxSlowRequestNum = maxNum;
+    while (slowRequests.size() > maxSlowRequestNum) slowRequests.pop_front();
+}
+
+void RedisTracer::drain() {
+    HPOOL_TRACE_RECORD records[64];
+    int n;
+    while ((n = hpool_trace_drain(records, 64)) > 0) {
+        for (int i = 0; i < n; ++i) {
+            const HPOOL_TRACE_RECORD &r = records[i];
+            for (int p = 0; p < HPOOL_PHASE_NUM; ++p) {
+                phases[p].record(r.phase_ns[p] > 0 ? (uint64_t) r.phase_ns[p] / 1000 : 0);
+            }
+            uint64_t totalUs = (uint64_t) r.total_ns / 1000;
+            total.record(totalUs);
+
+            if (totalUs < slowThresholdUs || maxSlowRequestNum == 0) continue;
+            SlowRequest slow;
+            slow.startTimeMs = r.start_time_ms;
+            slow.command = r.command;
+            slow.proxy = r.proxy;
+            slow.code = r.code;
+            slow.totalUs = totalUs;
+            for (int p = 0; p < HPOOL_PHASE_NUM; ++p) {
+                slow.phaseUs[p] = r.phase_ns[p] > 0 ? (uint64_t) r.phase_ns[p] / 1000 : 0;
+            }
+            if (slowRequests.size() >= maxSlowRequestNum) slowRequests.pop_front();
+            slowRequests.push_back(slow);
+        }
+    }
+}
+
+void RedisTracer::startDrainer() {
+    // the tracer is never destroyed, neither is its drainer
+    std::call_once(drainerOnce, [this] { std::thread(&RedisTracer::drainLoop, this).detach(); });
+}
+
+void RedisTracer::drainLoop() {
+    while (true) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(drainIntervalMs.load()));
+        if (hpool_trace_get_sample_rate() <= 0) continue;
+        std::lock_guard<std::mutex> g(mtx);
+        drain();
+    }
+}
+
+std::vector<PhaseStat> RedisTracer::getPhaseStats() {
+    std::lock_guard<std::mutex> g(mtx);
+    drain();
+
+    std::vector<PhaseStat> res;
+    for (int p = 0; p <= HPOOL_PHASE_NUM; ++p) {
+        HistogramSnapshot snapshot = p < HPOOL_PHASE_NUM ? phases[p].snapshot() : total.snapshot();
+        PhaseStat stat;
+        stat.phase = phaseName(p);
+        stat.count = snapshot.count;
+        stat.p50 = snapshot.percentile(50);
+        stat.p90 = snapshot.percentile(90);
+        stat.p99 = snapshot.percentile(99);
+        stat.p999 = snapshot.percentile(99.9);
+        stat.max = snapshot.max();
+        res.push_back(stat);
+    }
+    return res;
+}
+
+std::vector<SlowRequest> RedisTracer::getSlowRequests() {
+    std::lock_guard<std::mutex> g(mtx);
+    drain();
+    return std::vector<SlowRequest>(slowRequests.begin(), slowRequests.end());
+}
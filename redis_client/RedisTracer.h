@@ -0,0 +1,91 @@
+//
+// Created by admin on 2019-03-13.
+//
+
+#ifndef CPPSERVER_REDISTRACER_H
+#define CPPSERVER_REDISTRACER_H
+
+#include "hiredispool_trace.h"
+#include "LatencyHistogram.h"
+#include <atomic>
+#include <cstdint>
+#include <algorithm>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// percentiles (us) of one phase over the sampled requests
+struct PhaseStat {
+    std::string phase;
+    uint64_t count;
+    uint64_t p50;
+    uint64_t p90;
+    uint64_t p99;
+    uint64_t p999;
+    uint64_t max;
+};
+
+// one sampled request slower than the slow threshold
+struct SlowRequest {
+    std::int64_t startTimeMs;
+    std::string command;
+    std::string proxy;
+    int code;
+    uint64_t totalUs;
+    uint64_t phaseUs[HPOOL_PHASE_NUM];
+};
+
+// RedisTracer aggregates the sampled traces of hiredispool_trace:
+// per-phase histograms, plus the latest slow requests with their phase
+// breakdown. The ring buffer is drained on every query, and while tracing
+// is on by a background thread every drainIntervalMs, so that it does not
+// overflow between queries.
+class RedisTracer {
+    std::mutex mtx;
+    LatencyHistogram phases[HPOOL_PHASE_NUM];
+    LatencyHistogram total;
+    std::deque<SlowRequest> slowRequests;
+    size_t maxSlowRequestNum;
+    uint64_t slowThresholdUs;
+    std::atomic<int> drainIntervalMs;
+    std::once_flag drainerOnce;
+
+    RedisTracer();
+
+    void drain();
+
+    void startDrainer();
+
+    void drainLoop();
+
+public:
+    static RedisTracer &getInstance();
+
+    static const char *phaseName(int phase);
+
+    // trace one in oneInN requests, 0 turns tracing off; can be changed at runtime
+    static void setSampleRate(int oneInN) {
+        hpool_trace_set_sample_rate(oneInN);
+        if (oneInN > 0) getInstance().startDrainer();
+    }
+
+    static int getSampleRate() { return hpool_trace_get_sample_rate(); }
+
+    void setSlowThreshold(uint64_t us, size_t maxNum);
+
+    // the ring buffer holds HPOOL_TRACE_RING_SIZE traces, keep intervalMs
+    // below that many sampled requests' time
+    void setDrainInterval(int intervalMs) { drainIntervalMs = std::max(intervalMs, 1); }
+
+    // one entry per phase, then "total"
+    std::vector<PhaseStat> getPhaseStats();
+
+    std::vector<SlowRequest> getSlowRequests();
+
+    // traces lost because the ring buffer was full
+    long getDroppedNum() { return hpool_trace_dropped(); }
+};
+
+
+#endif //CPPSERVER_REDISTRACER_H
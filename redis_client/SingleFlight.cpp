@@ -0,0 +1,158 @@
+//
+// Created by admin on 2019-03-06.
+//
+
+#include "SingleFlight.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <strings.h>
+
+namespace {
+    const uint64_t FNV_OFFSET = 14695981039346656037ULL;
+    const uint64_t FNV_PRIME = 1099511628211ULL;
+
+    uint64_t fnv1a(uint64_t h, const void *data, size_t len) {
+        const unsigned char *p = (const unsigned char *) data;
+        for (size_t i = 0; i < len; ++i) {
+            h ^= p[i];
+            h *= FNV_PRIME;
+        }
+        return h;
+    }
+}
+
+SingleFlight::SingleFlight(const std::vector<std::string> &commands) {
+    for (auto cmd : commands) {
+        std::transform(cmd.begin(), cmd.end(), cmd.begin(), ::toupper);
+        if (std::find(this->commands.begin(), this->commands.end(), cmd) == this->commands.end()) {
+            this->commands.push_back(cmd);
+        }
+    }
+    leaderNum = 0;
+    sharedNum = 0;
+}
+
+bool SingleFlight::isEnabled(const char *cmd, size_t len) const {
+    for (auto &c : commands) {
+        if (c.size() == len && strncasecmp(c.data(), cmd, len) == 0) return true;
+    }
+    return false;
+}
+
+bool SingleFlight::sameCommand(const Key &a, const Key &b) {
+    if (a.hash != b.hash) return false;
+    if (a.argv != nullptr) return b.argv != nullptr && *a.argv == *b.argv;
+    return b.argv == nullptr && a.len == b.len && memcmp(a.cmd, b.cmd, a.len) == 0;
+}
+
+RedisReplyPtr SingleFlight::execute(const std::vector<std::string> &argv, const ExecuteFunc &func) {
+    // length-prefixed, so that binary arguments can not collide
+    uint64_t h = FNV_OFFSET;
+    for (auto &arg : argv) {
+        uint64_t size = arg.size();
+        h = fnv1a(h, &size, sizeof(size));
+        h = fnv1a(h, arg.data(), arg.size());
+    }
+    Key key = {(size_t) h, &argv, nullptr, 0};
+    return run(key, func);
+}
+
+RedisReplyPtr SingleFlight::execute(const char *cmd, size_t len, const ExecuteFunc &func) {
+    Key key = {(size_t) fnv1a(FNV_OFFSET, cmd, len), nullptr, cmd, len};
+    return run(key, func);
+}
+
+RedisReplyPtr SingleFlight::run(const Key &key, const ExecuteFunc &func) {
+    Shard &shard = shards[key.hash % SHARD_NUM];
+
+    std::shared_ptr<Call> call;
+    {
+        std::lock_guard<std::mutex> g(shard.mtx);
+        for (auto &flight : shard.flights) {
+            if (!sameCommand(flight.key, key)) continue;
+            if (!flight.call) flight.call = std::make_shared<Call>();
+            call = flight.call;
+            ++call->waiters;
+            break;
+        }
+        if (!call) shard.flights.push_back(Flight{key, nullptr});
+    }
+
+    if (call) {
+        // waiter: the leader fills call->reply, which is immutable once done
+        std::unique_lock<std::mutex> lk(call->mtx);
+        call->cv.wait(lk, [&call] { return call->done; });
+        return RedisReplyPtr(cloneReply(call->reply));
+    }
+
+    ++leaderNum;
+    // unlist the leader's flight, nobody can join afterwards; returns its call, if any waiter joined
+    auto finish = [&shard, &key]() {
+        std::lock_guard<std::mutex> g(shard.mtx);
+        for (auto it = shard.flights.begin(); it != shard.flights.end(); ++it) {
+            if (it->key.argv != key.argv || it->key.cmd != key.cmd) continue;
+            std::shared_ptr<Call> c = std::move(it->call);
+            if (&*it != &shard.flights.back()) *it = std::move(shard.flights.back());
+            shard.flights.pop_back();
+            return c;
+        }
+        return std::shared_ptr<Call>();
+    };
+
+    RedisReplyPtr reply;
+    try {
+        reply = func();
+    } catch (...) {
+        call = finish();
+        if (call) {
+            std::lock_guard<std::mutex> cg(call->mtx);
+            call->done = true;
+            call->cv.notify_all();
+        }
+        throw;
+    }
+
+    call = finish();
+    if (!call) return reply;
+
+    sharedNum += call->waiters;
+    {
+        std::lock_guard<std::mutex> g(call->mtx);
+        call->reply = reply.release();
+        call->done = true;
+    }
+    call->cv.notify_all();
+    return RedisReplyPtr(cloneReply(call->reply));
+}
+
+redisReply *SingleFlight::cloneReply(const redisReply *r) {
+    if (r == nullptr) return nullptr;
+
+    redisReply *res = (redisReply *) calloc(1, sizeof(redisReply));
+    if (res == nullptr) return nullptr;
+    *res = *r;
+    res->str = nullptr;
+    res->element = nullptr;
+
+    if (r->str != nullptr) {
+        res->str = (char *) malloc(r->len + 1);
+        if (res->str != nullptr) {
+            memcpy(res->str, r->str, r->len);
+            res->str[r->len] = '\0';
+        }
+    }
+    if (r->element != nullptr && r->elements > 0) {
+        res->element = (redisReply **) calloc(r->elements, sizeof(redisReply *));
+        if (res->element != nullptr) {
+            for (size_t i = 0; i < r->elements; ++i) {
+                res->element[i] = cloneReply(r->element[i]);
+            }
+        } else {
+            res->elements = 0;
+        }
+    }
+    return res;
+}
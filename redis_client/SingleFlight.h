@@ -0,0 +1,111 @@
+//
+// Created by admin on 2019-03-06.
+//
+
+#ifndef CPPSERVER_SINGLEFLIGHT_H
+#define CPPSERVER_SINGLEFLIGHT_H
+
+#include "RedisClient.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// SingleFlight coalesces concurrent identical read commands: the first
+// caller (leader) executes the command, callers arriving with the same
+// command before it finishes wait for the leader and get a deep copy of
+// its reply. Only the configured commands are coalesced, and a leader
+// without waiters returns its reply as is, without any copy.
+//
+// A command is either an argument vector (CodisClient::redisCommandArgv)
+// or its RESP encoding (RedisClient::redisCommand, whole pipelines). The
+// leader's command is referenced, not copied, while it is in flight, and
+// the shared state of a flight is only allocated once a waiter joins.
+class SingleFlight {
+public:
+    typedef std::function<RedisReplyPtr()> ExecuteFunc;
+
+private:
+    struct Call {
+        std::mutex mtx;
+        std::condition_variable cv;
+        bool done;
+        int waiters;  // guarded by the shard mutex
+        redisReply *reply;
+
+        Call() : done(false), waiters(0), reply(nullptr) {}
+
+        ~Call() {
+            if (reply) freeReplyObject(reply);
+        }
+    };
+
+    // the leader's command, valid while its flight is listed
+    struct Key {
+        std::size_t hash;
+        const std::vector<std::string> *argv;  // argument vector, or
+        const char *cmd;                        // RESP encoded command(s)
+        std::size_t len;
+    };
+
+    struct Flight {
+        Key key;
+        std::shared_ptr<Call> call;  // null until a waiter joins
+    };
+
+    // a few flights per shard at most: a flat vector beats a node based map
+    struct Shard {
+        std::mutex mtx;
+        std::vector<Flight> flights;
+    };
+
+    static const int SHARD_NUM = 64;
+    Shard shards[SHARD_NUM];
+    std::vector<std::string> commands;  // upper case
+    std::atomic<std::int64_t> leaderNum;
+    std::atomic<std::int64_t> sharedNum;
+
+    // non construct copyable and non copyable
+    SingleFlight(const SingleFlight &);
+
+    SingleFlight &operator=(const SingleFlight &);
+
+    static bool sameCommand(const Key &a, const Key &b);
+
+    RedisReplyPtr run(const Key &key, const ExecuteFunc &func);
+
+public:
+    // commands: names of the commands to coalesce, case insensitive
+    explicit SingleFlight(const std::vector<std::string> &commands);
+
+    bool isEnabled(const std::string &cmd) const {
+        return isEnabled(cmd.data(), cmd.size());
+    }
+
+    bool isEnabled(const char *cmd) const {
+        return isEnabled(cmd, strlen(cmd));
+    }
+
+    bool isEnabled(const char *cmd, std::size_t len) const;
+
+    // argv must stay unchanged until execute returns
+    RedisReplyPtr execute(const std::vector<std::string> &argv, const ExecuteFunc &func);
+
+    // cmd: RESP encoded command(s), unchanged until execute returns
+    RedisReplyPtr execute(const char *cmd, std::size_t len, const ExecuteFunc &func);
+
+    // deep copy, allocated so that freeReplyObject can release it
+    static redisReply *cloneReply(const redisReply *r);
+
+    std::int64_t getLeaderNum() { return leaderNum; }
+
+    std::int64_t getSharedNum() { return sharedNum; }
+};
+
+
+#endif //CPPSERVER_SINGLEFLIGHT_H
@@ -1,4 +1,10 @@
 #include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <stdlib.h>
 #include <stdarg.h>
 #include <string.h>
@@ -7,6 +13,7 @@
 
 #include "hiredispool.h"
 #include "hiredispool_log.h"
+#include "hiredispool_trace.h"
 
 #include <hiredis/hiredis.h>
 
@@ -14,12 +21,72 @@
 
 static int redis_init_socketpool(REDIS_INSTANCE *inst);
 
+static REDIS_SOCKET *new_socket(REDIS_INSTANCE *inst, int id);
+
 static void redis_poolfree(REDIS_INSTANCE *inst);
 
 static int connect_single_socket(REDIS_SOCKET *redisocket, REDIS_INSTANCE *inst);
 
+static int connect_socket_timeout(REDIS_SOCKET *redisocket, REDIS_INSTANCE *inst, int connect_timeout);
+
+static REDIS_SOCKET *get_socket(REDIS_INSTANCE *inst, long deadline_us);
+
+static void backoff_failed(REDIS_INSTANCE *inst, REDIS_BACKOFF *backoff);
+
+static void backoff_reset(REDIS_BACKOFF *backoff);
+
+static int backoff_active(REDIS_BACKOFF *backoff, long now_ms);
+
+static void set_socket_options(int fd, const REDIS_ENDPOINT *endpoint);
+
 static int redis_close_socket(REDIS_INSTANCE *inst, REDIS_SOCKET *redisocket);
 
+static int traced_get_reply(redisContext *c, void **reply);
+
+static long monotonic_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static long monotonic_ms(void) {
+    return monotonic_us() / 1000;
+}
+
+static size_t digits_num(long long v) {
+    size_t n = v < 0 ? 2 : 1;
+    while (v >= 10 || v <= -10) {
+        v /= 10;
+        n++;
+    }
+    return n;
+}
+
+/* Size of the reply in RESP encoding, i.e. the bytes read for it */
+static size_t reply_wire_size(const redisReply *r) {
+    size_t i, size;
+
+    if (r == NULL)
+        return 0;
+
+    switch (r->type) {
+        case REDIS_REPLY_STRING:
+            return 1 + digits_num((long long) r->len) + 2 + r->len + 2;
+        case REDIS_REPLY_STATUS:
+        case REDIS_REPLY_ERROR:
+            return 1 + r->len + 2;
+        case REDIS_REPLY_INTEGER:
+            return 1 + digits_num(r->integer) + 2;
+        case REDIS_REPLY_ARRAY:
+            size = 1 + digits_num((long long) r->elements) + 2;
+            for (i = 0; i < r->elements; i++)
+                size += reply_wire_size(r->element[i]);
+            return size;
+        default:
+            return 5; /* $-1\r\n */
+    }
+}
+
 int redis_pool_create(const REDIS_CONFIG *config, REDIS_INSTANCE **instance) {
     int i;
     char *host;
@@ -28,6 +95,17 @@ int redis_pool_create(const REDIS_CONFIG *config, REDIS_INSTANCE **instance) {
 
     inst = malloc(sizeof(REDIS_INSTANCE));
     memset(inst, 0, sizeof(REDIS_INSTANCE));
+    // 自定义 begin
+    pthread_mutex_init(&inst->resize_mutex, NULL);
+    {
+        pthread_condattr_t attr;
+        pthread_condattr_init(&attr);
+        pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        pthread_cond_init(&inst->release_cond, &attr);
+        pthread_condattr_destroy(&attr);
+        pthread_mutex_init(&inst->release_mutex, NULL);
+    }
+    // 自定义 end
 
     inst->config = malloc(sizeof(REDIS_CONFIG));
     memset(inst->config, 0, sizeof(REDIS_CONFIG));
@@ -47,6 +125,10 @@ int redis_pool_create(const REDIS_CONFIG *config, REDIS_INSTANCE **instance) {
     inst->config->num_redis_socks = config->num_redis_socks;
     inst->config->connect_failure_retry_delay = config->connect_failure_retry_delay;
     inst->config->reader_buf_max_size = config->reader_buf_max_size;
+    inst->config->min_concurrency_limit = config->min_concurrency_limit;
+    inst->config->disable_inline_retry = config->disable_inline_retry;
+    inst->config->reconnect_backoff_base_ms = config->reconnect_backoff_base_ms;
+    inst->config->reconnect_backoff_max_ms = config->reconnect_backoff_max_ms;
 
     /* Check config */
     if (inst->config->num_redis_socks > MAX_REDIS_SOCKS) {
@@ -64,8 +146,27 @@ int redis_pool_create(const REDIS_CONFIG *config, REDIS_INSTANCE **instance) {
         inst->config->net_readwrite_timeout = 0;
     if (inst->config->connect_failure_retry_delay <= 0)
         inst->config->connect_failure_retry_delay = -1;
+    // 自定义 begin
+    if (inst->config->reconnect_backoff_base_ms <= 0)
+        inst->config->reconnect_backoff_base_ms = inst->config->connect_failure_retry_delay > 0 ?
+                                                  inst->config->connect_failure_retry_delay * 1000 : 0;
+    if (inst->config->reconnect_backoff_max_ms < inst->config->reconnect_backoff_base_ms)
+        inst->config->reconnect_backoff_max_ms = inst->config->reconnect_backoff_base_ms;
+    // 自定义 end
 
     for (i = 0; i < inst->config->num_endpoints; i++) {
+        // 自定义 begin
+        host = inst->config->endpoints[i].path;
+        if (host[0] != '\0') {
+            if (strnlen(host, sizeof(inst->config->endpoints[i].path)) == sizeof(inst->config->endpoints[i].path)) {
+                log_(HPOOL_ERROR_LEVEL | HPOOL_CONS_LEVEL, "%s: Invalid unix socket path @%d", __func__, i);
+                redis_pool_destroy(inst);
+                return -1;
+            }
+            log_(HPOOL_INFO_LEVEL, "%s: Got redis endpoint @%d: unix://%s", __func__, i, host);
+            continue;
+        }
+        // 自定义 end
         host = inst->config->endpoints[i].host;
         port = inst->config->endpoints[i].port;
         if (host == NULL || strlen(host) == 0 || port <= 0 || port > 65535) {
@@ -76,6 +177,10 @@ int redis_pool_create(const REDIS_CONFIG *config, REDIS_INSTANCE **instance) {
         log_(HPOOL_INFO_LEVEL, "%s: Got redis endpoint @%d: %s:%d", __func__, i, host, port);
     }
 
+    // 自定义 begin
+    inst->endpoint_backoff = calloc((size_t) inst->config->num_endpoints, sizeof(REDIS_BACKOFF));
+    // 自定义 end
+
     log_(HPOOL_INFO_LEVEL, "%s: Attempting to connect to above endpoints "
                            "with connect_timeout %d net_readwrite_timeout %d",
          __func__,
@@ -89,6 +194,8 @@ int redis_pool_create(const REDIS_CONFIG *config, REDIS_INSTANCE **instance) {
     // 自定义 begin
     inst->wait_num = 0;
     inst->idle_num = inst->config->num_redis_socks;
+    inst->socks_num = inst->config->num_redis_socks;
+    inst->socks_limit = inst->config->num_redis_socks;
     // 自定义 end
 
     *instance = inst;
@@ -115,6 +222,12 @@ int redis_pool_destroy(REDIS_INSTANCE *instance) {
         free(inst->config);
         inst->config = NULL;
     }
+    // 自定义 begin
+    free(inst->endpoint_backoff);
+    pthread_mutex_destroy(&inst->resize_mutex);
+    pthread_cond_destroy(&inst->release_cond);
+    pthread_mutex_destroy(&inst->release_mutex);
+    // 自定义 end
 
     free(inst);
 
@@ -122,39 +235,26 @@ int redis_pool_destroy(REDIS_INSTANCE *instance) {
 }
 
 static int redis_init_socketpool(REDIS_INSTANCE *inst) {
-    int i, rcode;
+    int i;
     int success = 0;
     REDIS_SOCKET *redisocket;
 
-    inst->connect_after = 0;
     inst->redis_pool = NULL;
 
     for (i = 0; i < inst->config->num_redis_socks; i++) {
         HPOOL_DEBUG("%s: starting %d", __func__, i);
 
-        redisocket = malloc(sizeof(REDIS_SOCKET));
-        redisocket->conn = NULL;
-        redisocket->id = i;
-        redisocket->backup = i % inst->config->num_endpoints;
-        redisocket->state = sockunconnected;
-        redisocket->inuse = 0;
-
-        rcode = pthread_mutex_init(&redisocket->mutex, NULL);
-        if (rcode != 0) {
-            log_(HPOOL_ERROR_LEVEL | HPOOL_CONS_LEVEL, "%s: "
-                                                       "Failed to init lock: returns (%d)", __func__, rcode);
-            free(redisocket);
+        redisocket = new_socket(inst, i);
+        if (redisocket == NULL) {
             return -1;
         }
 
-        if (time(NULL) > inst->connect_after) {
-            /*
-             *  This sets the redisocket->state, and
-             *  possibly also inst->connect_after
-             */
-            if (connect_single_socket(redisocket, inst) == 0) {
-                success = 1;
-            }
+        /*
+         *  This sets the redisocket->state. Once an endpoint
+         *  failed, the next sockets skip it during its backoff.
+         */
+        if (connect_single_socket(redisocket, inst) == 0) {
+            success = 1;
         }
 
         /* Add this socket to the list of sockets */
@@ -171,6 +271,31 @@ static int redis_init_socketpool(REDIS_INSTANCE *inst) {
     return 0;
 }
 
+static REDIS_SOCKET *new_socket(REDIS_INSTANCE *inst, int id) {
+    int rcode;
+    REDIS_SOCKET *redisocket;
+
+    redisocket = malloc(sizeof(REDIS_SOCKET));
+    redisocket->conn = NULL;
+    redisocket->id = id;
+    redisocket->backup = id % inst->config->num_endpoints;
+    redisocket->state = sockunconnected;
+    redisocket->inuse = 0;
+    redisocket->next = NULL;
+    redisocket->connect_num = 0;
+    redisocket->acquired_us = 0;
+    backoff_reset(&redisocket->backoff);
+
+    rcode = pthread_mutex_init(&redisocket->mutex, NULL);
+    if (rcode != 0) {
+        log_(HPOOL_ERROR_LEVEL | HPOOL_CONS_LEVEL, "%s: "
+                                                   "Failed to init lock: returns (%d)", __func__, rcode);
+        free(redisocket);
+        return NULL;
+    }
+    return redisocket;
+}
+
 static void redis_poolfree(REDIS_INSTANCE *inst) {
     REDIS_SOCKET *cur;
     REDIS_SOCKET *next;
@@ -191,20 +316,34 @@ static void redis_poolfree(REDIS_INSTANCE *inst) {
  * impolite to a server that may be having other issues).  If
  * successful in connecting, set state to sockconnected.
  * - hh
+ *
+ * The grace period is a jittered exponential backoff, kept per socket
+ * and per endpoint (an endpoint in backoff is skipped for the backups),
+ * so that the sockets of a pool do not all retry a recovering server at once.
  */
 static int connect_single_socket(REDIS_SOCKET *redisocket, REDIS_INSTANCE *inst) {
+    return connect_socket_timeout(redisocket, inst, inst->config->connect_timeout);
+}
+
+static int connect_socket_timeout(REDIS_SOCKET *redisocket, REDIS_INSTANCE *inst, int connect_timeout) {
     int i;
-    redisContext *c;
+    redisContext *c = NULL;
     struct timeval timeout[2];
     char *host;
     int port;
+    long trace_mark = hpool_trace_clock();
+    // 自定义 begin
+    const REDIS_ENDPOINT *endpoint;
+    REDIS_BACKOFF *backoff;
+    int skipped = 0;
+    // 自定义 end
 
     HPOOL_DEBUG("%s: Attempting to connect #%d @%d",
                 __func__, redisocket->id, redisocket->backup);
 
     /* convert timeout (ms) to timeval */
-    timeout[0].tv_sec = inst->config->connect_timeout / 1000;
-    timeout[0].tv_usec = 1000 * (inst->config->connect_timeout % 1000);
+    timeout[0].tv_sec = connect_timeout / 1000;
+    timeout[0].tv_usec = 1000 * (connect_timeout % 1000);
     timeout[1].tv_sec = inst->config->net_readwrite_timeout / 1000;
     timeout[1].tv_usec = 1000 * (inst->config->net_readwrite_timeout % 1000);
 
@@ -215,7 +354,26 @@ static int connect_single_socket(REDIS_SOCKET *redisocket, REDIS_INSTANCE *inst)
         host = inst->config->endpoints[redisocket->backup].host;
         port = inst->config->endpoints[redisocket->backup].port;
 
-        c = redisConnectWithTimeout(host, port, timeout[0]);
+        // 自定义 begin
+        endpoint = &inst->config->endpoints[redisocket->backup];
+        if (endpoint->path[0] != '\0')
+            host = (char *) endpoint->path;
+        backoff = &inst->endpoint_backoff[redisocket->backup];
+        if (backoff_active(backoff, monotonic_ms())) {
+            HPOOL_DEBUG("%s: Skip endpoint @%d in reconnect backoff", __func__, redisocket->backup);
+            __sync_fetch_and_add(&(inst->stats.backoff_skip_num), 1);
+            skipped++;
+            redisocket->backup = (redisocket->backup + 1) % inst->config->num_endpoints;
+            continue;
+        }
+        // 自定义 end
+
+        // 自定义 begin
+        if (endpoint->path[0] != '\0')
+            c = redisConnectUnixWithTimeout(endpoint->path, timeout[0]);
+        else
+            c = redisConnectWithTimeout(host, port, timeout[0]);
+        // 自定义 end
         if (c && c->err == 0) {
             HPOOL_DEBUG("%s: Connected new redis handle #%d @%d",
                         __func__, redisocket->id, redisocket->backup);
@@ -228,6 +386,13 @@ static int connect_single_socket(REDIS_SOCKET *redisocket, REDIS_INSTANCE *inst)
             //自定义 end
             redisocket->conn = c;
             redisocket->state = sockconnected;
+            // 自定义 begin
+            __sync_fetch_and_add(&(inst->stats.connect_num), 1);
+            if (redisocket->connect_num++ > 0)
+                __sync_fetch_and_add(&(inst->stats.reconnect_num), 1);
+            backoff_reset(backoff);
+            backoff_reset(&redisocket->backoff);
+            // 自定义 end
             if (inst->config->num_endpoints > 1) {
                 /* Select the next _random_ endpoint as the new backup */
                 redisocket->backup = (redisocket->backup + (1 +
@@ -236,29 +401,42 @@ static int connect_single_socket(REDIS_SOCKET *redisocket, REDIS_INSTANCE *inst)
             }
 
             if (redisSetTimeout(c, timeout[1]) != REDIS_OK) {
-                log_(HPOOL_WARN_LEVEL | HPOOL_CONS_LEVEL, "%s: Failed to set timeout: blocking-mode: %d, %s",
-                     __func__, (c->flags & REDIS_BLOCK), c->errstr);
+                log_limited(HPOOL_WARN_LEVEL | HPOOL_CONS_LEVEL, "%s: Failed to set timeout: blocking-mode: %d, %s",
+                            __func__, (c->flags & REDIS_BLOCK), c->errstr);
             }
 
-            if (redisEnableKeepAlive(c) != REDIS_OK) {
-                log_(HPOOL_WARN_LEVEL | HPOOL_CONS_LEVEL, "%s: Failed to enable keepalive: %s", __func__, c->errstr);
+            // 自定义 begin
+            /* keepalive and the socket options are TCP only */
+            if (endpoint->path[0] == '\0') {
+                if (redisEnableKeepAlive(c) != REDIS_OK) {
+                    log_limited(HPOOL_WARN_LEVEL | HPOOL_CONS_LEVEL, "%s: Failed to enable keepalive: %s",
+                                __func__, c->errstr);
+                }
+                set_socket_options(c->fd, endpoint);
             }
+            // 自定义 end
 
+            hpool_trace_phase(HPOOL_PHASE_RECONNECT, trace_mark);
             return 0;
         }
 
+        // 自定义 begin
+        backoff_failed(inst, backoff);
+        // 自定义 end
+
         /* We have tried the last one but still fail */
         if (i == inst->config->num_endpoints - 1)
             break;
 
         /* We have more backups to try */
         if (c) {
-            log_(HPOOL_WARN_LEVEL | HPOOL_CONS_LEVEL, "%s: Failed to connect redis handle #%d @%d: %s, trying backup",
-                 __func__, redisocket->id, redisocket->backup, c->errstr);
+            log_limited(HPOOL_WARN_LEVEL | HPOOL_CONS_LEVEL, "%s: Failed to connect redis handle #%d @%d: %s, trying backup",
+                        __func__, redisocket->id, redisocket->backup, c->errstr);
             redisFree(c);
+            c = NULL;
         } else {
-            log_(HPOOL_WARN_LEVEL | HPOOL_CONS_LEVEL, "%s: can't allocate redis handle #%d @%d, trying backup",
-                 __func__, redisocket->id, redisocket->backup);
+            log_limited(HPOOL_WARN_LEVEL | HPOOL_CONS_LEVEL, "%s: can't allocate redis handle #%d @%d, trying backup",
+                        __func__, redisocket->id, redisocket->backup);
         }
         redisocket->backup = (redisocket->backup + 1) % inst->config->num_endpoints;
     }
@@ -267,19 +445,27 @@ static int connect_single_socket(REDIS_SOCKET *redisocket, REDIS_INSTANCE *inst)
      *  Error, or SERVER_DOWN.
      */
     if (c) {
-        log_(HPOOL_WARN_LEVEL | HPOOL_CONS_LEVEL, "%s: Failed to connect redis handle #%d @%d: %s",
-             __func__, redisocket->id, redisocket->backup, c->errstr);
+        log_limited(HPOOL_WARN_LEVEL | HPOOL_CONS_LEVEL, "%s: Failed to connect redis handle #%d @%d: %s",
+                    __func__, redisocket->id, redisocket->backup, c->errstr);
         redisFree(c);
+    } else if (skipped == inst->config->num_endpoints) {
+        HPOOL_DEBUG("%s: All endpoints of redis handle #%d in reconnect backoff", __func__, redisocket->id);
     } else {
-        log_(HPOOL_WARN_LEVEL | HPOOL_CONS_LEVEL, "%s: can't allocate redis handle #%d @%d",
-             __func__, redisocket->id, redisocket->backup);
+        log_limited(HPOOL_WARN_LEVEL | HPOOL_CONS_LEVEL, "%s: can't allocate redis handle #%d @%d",
+                    __func__, redisocket->id, redisocket->backup);
     }
     redisocket->conn = NULL;
     redisocket->state = sockunconnected;
     redisocket->backup = (redisocket->backup + 1) % inst->config->num_endpoints;
+    // 自定义 begin
+    /* nothing was tried: no failure, the endpoints' backoff gates the next attempt */
+    if (skipped < inst->config->num_endpoints) {
+        __sync_fetch_and_add(&(inst->stats.connect_fail_num), 1);
+        backoff_failed(inst, &redisocket->backoff);
+    }
+    // 自定义 end
 
-    inst->connect_after = time(NULL) + inst->config->connect_failure_retry_delay;
-
+    hpool_trace_phase(HPOOL_PHASE_RECONNECT, trace_mark);
     return -1;
 }
 
@@ -309,9 +495,154 @@ static int redis_close_socket(REDIS_INSTANCE *inst, REDIS_SOCKET *redisocket) {
     return 0;
 }
 
+// 自定义 begin
+/* longest wait for a release while unconnected sockets were skipped: their
+ * reconnect backoff may end before any busy socket comes back */
+#define ACQUIRE_RECHECK_US 10000
+
+long redis_monotonic_us(void) {
+    return monotonic_us();
+}
+
+/* wake one deadline acquire waiting in wait_release (all of them if all is set) */
+static void notify_release(REDIS_INSTANCE *inst, int all) {
+    /* pairs with the barrier of the waiter's increment: a waiter that registered
+     * before our release either sees the socket on its scan or a new release_seq */
+    __sync_synchronize();
+    if (*(volatile int *) &inst->deadline_waiters == 0)
+        return;
+    pthread_mutex_lock(&inst->release_mutex);
+    inst->release_seq++;
+    if (all)
+        pthread_cond_broadcast(&inst->release_cond);
+    else
+        pthread_cond_signal(&inst->release_cond);
+    pthread_mutex_unlock(&inst->release_mutex);
+}
+
+/* block until release_seq moves past seq (read before the failed scan) or until_us */
+static void wait_release(REDIS_INSTANCE *inst, long seq, long until_us) {
+    struct timespec ts;
+
+    ts.tv_sec = until_us / 1000000;
+    ts.tv_nsec = (until_us % 1000000) * 1000;
+    pthread_mutex_lock(&inst->release_mutex);
+    while (inst->release_seq == seq) {
+        if (pthread_cond_timedwait(&inst->release_cond, &inst->release_mutex, &ts) == ETIMEDOUT)
+            break;
+    }
+    pthread_mutex_unlock(&inst->release_mutex);
+}
+
+/* connect timeout (ms) cut to what is left before the deadline, at least 1ms */
+static int deadline_connect_timeout(REDIS_INSTANCE *inst, long deadline_us) {
+    long left_ms = (deadline_us - monotonic_us() + 999) / 1000;
+    if (left_ms < 1) left_ms = 1;
+    if (inst->config->connect_timeout > 0 && inst->config->connect_timeout < left_ms)
+        return inst->config->connect_timeout;
+    return (int) left_ms;
+}
+// 自定义 end
+
+// 自定义 begin
+/* next reconnect delay (ms) after fail_num consecutive failures, in [d/2, d] */
+static long backoff_delay_ms(const REDIS_CONFIG *config, long fail_num) {
+    long delay = config->reconnect_backoff_base_ms;
+
+    while (--fail_num > 0 && delay < config->reconnect_backoff_max_ms)
+        delay *= 2;
+    if (delay > config->reconnect_backoff_max_ms)
+        delay = config->reconnect_backoff_max_ms;
+    if (delay <= 1)
+        return delay;
+    return delay / 2 + rand() % (delay - delay / 2 + 1);
+}
+
+/*
+ * A connect failed. Sockets connecting to an endpoint at the same time
+ * fail together: only the first failure of a backoff window counts, so
+ * that a burst of failures does not escalate the backoff at once.
+ * Endpoint backoffs are shared by all the sockets: the failure claiming
+ * the window is picked with a CAS, so fail_num is bumped once per window.
+ */
+static void backoff_failed(REDIS_INSTANCE *inst, REDIS_BACKOFF *backoff) {
+    long now = monotonic_ms();
+    long after = __sync_fetch_and_add(&backoff->retry_after_ms, 0);
+    long fail_num;
+
+    if (after > now)
+        return;
+    /* in backoff until the delay is known: concurrent failures see the window taken */
+    if (!__sync_bool_compare_and_swap(&backoff->retry_after_ms, after, now + 1))
+        return;
+    fail_num = __sync_add_and_fetch(&backoff->fail_num, 1);
+    __sync_bool_compare_and_swap(&backoff->retry_after_ms, now + 1,
+                                 now + backoff_delay_ms(inst->config, fail_num));
+}
+
+static void backoff_reset(REDIS_BACKOFF *backoff) {
+    __sync_lock_test_and_set(&backoff->fail_num, 0);
+    __sync_lock_test_and_set(&backoff->retry_after_ms, 0);
+}
+
+static int backoff_active(REDIS_BACKOFF *backoff, long now_ms) {
+    return __sync_fetch_and_add(&backoff->retry_after_ms, 0) > now_ms;
+}
+// 自定义 end
+
+// 自定义 begin
+static void set_socket_option(int fd, int level, int name, int value, const char *label) {
+    if (setsockopt(fd, level, name, &value, sizeof(value)) < 0) {
+        log_limited(HPOOL_WARN_LEVEL, "%s: Failed to set %s to %d: %s", __func__, label, value, strerror(errno));
+    }
+}
+
+static void set_socket_options(int fd, const REDIS_ENDPOINT *endpoint) {
+    if (endpoint->tcp_nodelay != 0)
+        set_socket_option(fd, IPPROTO_TCP, TCP_NODELAY, endpoint->tcp_nodelay > 0, "TCP_NODELAY");
+    if (endpoint->sndbuf > 0)
+        set_socket_option(fd, SOL_SOCKET, SO_SNDBUF, endpoint->sndbuf, "SO_SNDBUF");
+    if (endpoint->rcvbuf > 0)
+        set_socket_option(fd, SOL_SOCKET, SO_RCVBUF, endpoint->rcvbuf, "SO_RCVBUF");
+#ifdef SO_BUSY_POLL
+    if (endpoint->busy_poll_us > 0)
+        set_socket_option(fd, SOL_SOCKET, SO_BUSY_POLL, endpoint->busy_poll_us, "SO_BUSY_POLL");
+#endif
+}
+// 自定义 end
+
+/* account acquire time, without the reconnects done meanwhile (already traced) */
+static void trace_acquire_done(long mark, long reconnect_ns) {
+    if (hpool_trace_cur) {
+        hpool_trace_phase(HPOOL_PHASE_ACQUIRE, mark);
+        hpool_trace_cur->phase_ns[HPOOL_PHASE_ACQUIRE] -=
+                hpool_trace_cur->phase_ns[HPOOL_PHASE_RECONNECT] - reconnect_ns;
+    }
+}
+
 REDIS_SOCKET *redis_get_socket(REDIS_INSTANCE *inst) {
+    return get_socket(inst, 0);
+}
+
+// 自定义 begin
+REDIS_SOCKET *redis_get_socket_deadline(REDIS_INSTANCE *inst, long deadline_us) {
+    if (monotonic_us() >= deadline_us)
+        return NULL;
+    return get_socket(inst, deadline_us);
+}
+// 自定义 end
+
+/* deadline_us > 0: wait for a busy socket until then, instead of failing at once */
+static REDIS_SOCKET *get_socket(REDIS_INSTANCE *inst, long deadline_us) {
     // 自定义 begin
+    long start_us = monotonic_us();
+    long trace_mark = hpool_trace_clock();
+    long trace_reconnect_ns = hpool_trace_cur ? hpool_trace_cur->phase_ns[HPOOL_PHASE_RECONNECT] : 0;
     __sync_fetch_and_add(&(inst->wait_num), 1);
+    long release_seq = 0;
+    int scan_unconnected;
+    if (deadline_us > 0)
+        __sync_fetch_and_add(&(inst->deadline_waiters), 1);
     // 自定义 end
     REDIS_SOCKET *cur, *start;
     int tried_to_connect = 0;
@@ -321,6 +652,12 @@ REDIS_SOCKET *redis_get_socket(REDIS_INSTANCE *inst) {
     /*
      *  Start at the last place we left off.
      */
+    scan:
+    // 自定义 begin
+    if (deadline_us > 0)
+        release_seq = __sync_fetch_and_add(&(inst->release_seq), 0);
+    scan_unconnected = unconnected;
+    // 自定义 end
     start = inst->last_used;
     if (!start) start = inst->redis_pool;
 
@@ -357,25 +694,45 @@ REDIS_SOCKET *redis_get_socket(REDIS_INSTANCE *inst) {
             cur->inuse = 1;
         }
 
+        // 自定义 begin
+        /* parked by redis_pool_resize: never handed out, its connection is closed */
+        if (cur->id >= inst->socks_limit) {
+            if (cur->state == sockconnected)
+                redis_drop_connection(cur);
+            cur->inuse = 0;
+            if ((rcode = pthread_mutex_unlock(&cur->mutex)) != 0) {
+                log_(HPOOL_FATAL_LEVEL | HPOOL_CONS_LEVEL, "%s: "
+                                                           "Can not release lock with handle %d: returns (%d)",
+                     __func__, cur->id, rcode);
+            }
+            goto next;
+        }
+        // 自定义 end
+
         /*
         *  If we happen upon an unconnected socket, and
         *  this instance's grace period on
         *  (re)connecting has expired, then try to
         *  connect it.  This should be really rare.
         */
-        if ((cur->state == sockunconnected) && (time(NULL) > inst->connect_after)) {
-            log_(HPOOL_WARN_LEVEL, "%s: "
-                                   "Trying to (re)connect unconnected handle %d ...",
-                 __func__, cur->id);
+        if ((cur->state == sockunconnected) && (cur->backoff.retry_after_ms <= monotonic_ms())) {
+            log_limited(HPOOL_WARN_LEVEL, "%s: "
+                                          "Trying to (re)connect unconnected handle %d ...",
+                        __func__, cur->id);
             tried_to_connect++;
-            connect_single_socket(cur, inst);
+            // 自定义 begin
+            if (deadline_us > 0)
+                connect_socket_timeout(cur, inst, deadline_connect_timeout(inst, deadline_us));
+            else
+                connect_single_socket(cur, inst);
+            // 自定义 end
         }
 
         /* if we still aren't connected, ignore this handle */
         if (cur->state == sockunconnected) {
-            log_(HPOOL_WARN_LEVEL, "%s: "
-                                   "still unconnected, ignoring unconnected handle %d ...",
-                 __func__, cur->id);
+            log_limited(HPOOL_WARN_LEVEL, "%s: "
+                                          "still unconnected, ignoring unconnected handle %d ...",
+                        __func__, cur->id);
             unconnected++;
 
             cur->inuse = 0;
@@ -396,15 +753,21 @@ REDIS_SOCKET *redis_get_socket(REDIS_INSTANCE *inst) {
                     __func__, cur->id);
 
         if (unconnected != 0 || tried_to_connect != 0) {
-            log_(HPOOL_WARN_LEVEL, "%s: "
-                                   "got socket %d after skipping %d unconnected handles, "
-                                   "tried to reconnect %d though",
-                 __func__, cur->id, unconnected, tried_to_connect);
+            log_limited(HPOOL_WARN_LEVEL, "%s: "
+                                          "got socket %d after skipping %d unconnected handles, "
+                                          "tried to reconnect %d though",
+                        __func__, cur->id, unconnected, tried_to_connect);
         }
 
         // 自定义 begin
+        cur->acquired_us = monotonic_us();
         __sync_fetch_and_sub(&(inst->wait_num), 1);
+        if (deadline_us > 0)
+            __sync_fetch_and_sub(&(inst->deadline_waiters), 1);
         __sync_fetch_and_sub(&(inst->idle_num), 1);
+        __sync_fetch_and_add(&(inst->stats.acquire_num), 1);
+        __sync_fetch_and_add(&(inst->stats.acquire_wait_us), cur->acquired_us - start_us);
+        trace_acquire_done(trace_mark, trace_reconnect_ns);
         // 自定义 end
 
         /*
@@ -446,11 +809,27 @@ REDIS_SOCKET *redis_get_socket(REDIS_INSTANCE *inst) {
 
     /* We get here if every redis handle is unconnected and
      * unconnectABLE, or in use */
-    log_(HPOOL_WARN_LEVEL, "%s: "
-                           "There are no redis handles to use! skipped %d, tried to connect %d",
-         __func__, unconnected, tried_to_connect);
+    // 自定义 begin
+    if (deadline_us > 0) {
+        long now_us = monotonic_us();
+        if (now_us < deadline_us) {
+            long until_us = deadline_us;
+            if (unconnected > scan_unconnected && until_us - now_us > ACQUIRE_RECHECK_US)
+                until_us = now_us + ACQUIRE_RECHECK_US;
+            wait_release(inst, release_seq, until_us);
+            goto scan;
+        }
+        __sync_fetch_and_sub(&(inst->deadline_waiters), 1);
+    }
+    // 自定义 end
+    log_limited(HPOOL_WARN_LEVEL, "%s: "
+                                  "There are no redis handles to use! skipped %d, tried to connect %d",
+                __func__, unconnected, tried_to_connect);
     // 自定义 begin
     __sync_fetch_and_sub(&(inst->wait_num), 1);
+    __sync_fetch_and_add(&(inst->stats.acquire_fail_num), 1);
+    __sync_fetch_and_add(&(inst->stats.acquire_wait_us), monotonic_us() - start_us);
+    trace_acquire_done(trace_mark, trace_reconnect_ns);
     // 自定义 end
     return NULL;
 }
@@ -467,6 +846,9 @@ int redis_release_socket(REDIS_INSTANCE *inst, REDIS_SOCKET *redisocket) {
         log_(HPOOL_FATAL_LEVEL | HPOOL_CONS_LEVEL, "%s: I'm NOT in use. Bug?", __func__);
     }
     redisocket->inuse = 0;
+    // 自定义 begin
+    __sync_fetch_and_add(&(inst->stats.busy_us), monotonic_us() - redisocket->acquired_us);
+    // 自定义 end
 
     if ((rcode = pthread_mutex_unlock(&redisocket->mutex)) != 0) {
         log_(HPOOL_FATAL_LEVEL | HPOOL_CONS_LEVEL, "%s: "
@@ -476,6 +858,7 @@ int redis_release_socket(REDIS_INSTANCE *inst, REDIS_SOCKET *redisocket) {
         HPOOL_TRACE("%s: Released lock with handle %d", __func__, redisocket->id);
         // 自定义 begin
         __sync_fetch_and_add(&(inst->idle_num), 1);
+        notify_release(inst, 0);
         // 自定义 end
     }
 
@@ -494,16 +877,79 @@ void *redis_command(REDIS_SOCKET *redisocket, REDIS_INSTANCE *inst, const char *
 }
 
 void *redis_vcommand(REDIS_SOCKET *redisocket, REDIS_INSTANCE *inst, const char *format, va_list ap) {
-    va_list ap2;
+    char *cmd;
+    int len;
     void *reply;
-    redisContext *c;
+    long trace_mark = hpool_trace_clock();
+
+    /* format once, so that a retry does not need to replay the va_list */
+    len = redisvFormatCommand(&cmd, format, ap);
+    hpool_trace_phase(HPOOL_PHASE_FORMAT, trace_mark);
+    if (len < 0) {
+        log_(HPOOL_ERROR_LEVEL | HPOOL_CONS_LEVEL, "%s: Failed to format command: %s", __func__, format);
+        return NULL;
+    }
+    HPOOL_DEBUG("%s: execute command: %s", __func__, format);
+
+    reply = redis_formatted_command(redisocket, inst, cmd, (size_t) len);
+    redisFreeCommand(cmd);
+    return reply;
+}
 
-    va_copy(ap2, ap);
+// 自定义 begin
+static void *formatted_command(REDIS_SOCKET *redisocket, REDIS_INSTANCE *inst, const char *cmd, size_t len,
+                               int inline_retry);
+
+/* redis_command_argv, inline_retry: resend once on the reconnected socket */
+static void *command_argv(REDIS_SOCKET *redisocket, REDIS_INSTANCE *inst,
+                          int argc, const char **argv, const size_t *argvlen, int inline_retry) {
+    char *cmd;
+    long long len;
+    void *reply;
+    long trace_mark = hpool_trace_clock();
+
+    len = redisFormatCommandArgv(&cmd, argc, argv, argvlen);
+    hpool_trace_phase(HPOOL_PHASE_FORMAT, trace_mark);
+    if (len < 0) {
+        log_(HPOOL_ERROR_LEVEL | HPOOL_CONS_LEVEL, "%s: Failed to format command", __func__);
+        return NULL;
+    }
+    HPOOL_DEBUG("%s: execute command: %.*s", __func__,
+                argc > 0 ? (int) argvlen[0] : 0, argc > 0 ? argv[0] : "");
+
+    reply = formatted_command(redisocket, inst, cmd, (size_t) len, inline_retry);
+    redisFreeCommand(cmd);
+    return reply;
+}
+
+void *redis_command_argv_noretry(REDIS_SOCKET *redisocket, REDIS_INSTANCE *inst,
+                                 int argc, const char **argv, const size_t *argvlen) {
+    return command_argv(redisocket, inst, argc, argv, argvlen, 0);
+}
+// 自定义 end
+
+void *redis_command_argv(REDIS_SOCKET *redisocket, REDIS_INSTANCE *inst,
+                         int argc, const char **argv, const size_t *argvlen) {
+    return command_argv(redisocket, inst, argc, argv, argvlen, !inst->config->disable_inline_retry);
+}
+
+void *redis_formatted_command(REDIS_SOCKET *redisocket, REDIS_INSTANCE *inst, const char *cmd, size_t len) {
+    return formatted_command(redisocket, inst, cmd, len, !inst->config->disable_inline_retry);
+}
+
+/*
+ * Send a formatted command and block for its reply, i.e. what redisvCommand
+ * does after formatting. On failure the socket is reconnected and the command
+ * is sent once more, if inline_retry is set.
+ */
+static void *formatted_command(REDIS_SOCKET *redisocket, REDIS_INSTANCE *inst, const char *cmd, size_t len,
+                               int inline_retry) {
+    void *reply = NULL;
+    redisContext *c;
 
-    /* forward to hiredis API */
     c = redisocket->conn;
-    reply = redisvCommand(c, format, ap);
-    HPOOL_DEBUG("%s: execute command: %s", __func__, format);
+    if (redisAppendFormattedCommand(c, cmd, len) == REDIS_OK)
+        traced_get_reply(c, &reply);
 
     if (reply == NULL) {
         /* Once an error is returned the context cannot be reused and you shoud
@@ -514,40 +960,102 @@ void *redis_vcommand(REDIS_SOCKET *redisocket, REDIS_INSTANCE *inst, const char
         redisFree(c);
 
         /* reconnect the socket */
-        log_(HPOOL_ERROR_LEVEL | HPOOL_CONS_LEVEL, "%s: Reconnect the socket", __func__);
+        log_limited(HPOOL_ERROR_LEVEL | HPOOL_CONS_LEVEL, "%s: Reconnect the socket", __func__);
         if (connect_single_socket(redisocket, inst) < 0) {
-            log_(HPOOL_ERROR_LEVEL | HPOOL_CONS_LEVEL, "%s: Reconnect failed, server down?", __func__);
-            goto quit;
+            log_limited(HPOOL_ERROR_LEVEL | HPOOL_CONS_LEVEL, "%s: Reconnect failed, server down?", __func__);
+            return NULL;
         }
 
+        // 自定义 begin
+        /* the caller decides whether to retry, and where */
+        if (!inline_retry)
+            return NULL;
+        // 自定义 end
+
         /* retry on the newly connected socket */
         c = redisocket->conn;
-        reply = redisvCommand(c, format, ap2);
-        HPOOL_DEBUG("%s: execute command again: %s", __func__, format);
+        if (redisAppendFormattedCommand(c, cmd, len) == REDIS_OK)
+            traced_get_reply(c, &reply);
+        HPOOL_DEBUG("%s: execute command again", __func__);
 
         if (reply == NULL) {
-            log_(HPOOL_ERROR_LEVEL, "%s: Failed after reconnect: %s (%d)", __func__, c->errstr, c->err);
+            log_limited(HPOOL_ERROR_LEVEL, "%s: Failed after reconnect: %s (%d)", __func__, c->errstr, c->err);
 
             /* do not need clean up here because the next caller will retry. */
-            goto quit;
+            return NULL;
         }
     }
 
-    quit:
-    va_end(ap2);
+    // 自定义 begin
+    __sync_fetch_and_add(&(inst->stats.bytes_out), (long) len);
+    __sync_fetch_and_add(&(inst->stats.bytes_in), (long) reply_wire_size(reply));
+    // 自定义 end
     return reply;
 }
 
+/*
+ * redisGetReply of a blocking context, with the write, wait and parse
+ * phases accounted to the active trace. Untraced requests go to hiredis.
+ */
+static int traced_get_reply(redisContext *c, void **reply) {
+    void *aux = NULL;
+    int wdone = 0;
+    int first_read = 1;
+    long mark;
+
+    if (!hpool_trace_cur)
+        return redisGetReply(c, reply);
+
+    /* a reply may already be buffered */
+    mark = hpool_trace_clock();
+    if (redisGetReplyFromReader(c, &aux) == REDIS_ERR)
+        return REDIS_ERR;
+    hpool_trace_phase(HPOOL_PHASE_PARSE, mark);
+
+    if (aux == NULL) {
+        mark = hpool_trace_clock();
+        do {
+            if (redisBufferWrite(c, &wdone) == REDIS_ERR)
+                return REDIS_ERR;
+        } while (!wdone);
+        hpool_trace_phase(HPOOL_PHASE_WRITE, mark);
+
+        mark = hpool_trace_clock();
+        do {
+            if (redisBufferRead(c) == REDIS_ERR)
+                return REDIS_ERR;
+            if (first_read) {
+                hpool_trace_phase(HPOOL_PHASE_WAIT, mark);
+                mark = hpool_trace_clock();
+                first_read = 0;
+            }
+            if (redisGetReplyFromReader(c, &aux) == REDIS_ERR)
+                return REDIS_ERR;
+        } while (aux == NULL);
+        hpool_trace_phase(HPOOL_PHASE_PARSE, mark);
+    }
+
+    *reply = aux;
+    return REDIS_OK;
+}
+
 int redis_vappend_command(REDIS_SOCKET *redisocket, REDIS_INSTANCE *inst, const char *format, va_list ap) {
-    va_list ap2;
+    char *cmd;
+    int len;
     int reply;
     redisContext *c;
+    long trace_mark = hpool_trace_clock();
 
-    va_copy(ap2, ap);
+    len = redisvFormatCommand(&cmd, format, ap);
+    hpool_trace_phase(HPOOL_PHASE_FORMAT, trace_mark);
+    if (len < 0) {
+        log_(HPOOL_ERROR_LEVEL | HPOOL_CONS_LEVEL, "%s: Failed to format command: %s", __func__, format);
+        return REDIS_ERR;
+    }
 
     /* forward to hiredis API */
     c = redisocket->conn;
-    reply = redisvAppendCommand(c, format, ap);
+    reply = redisAppendFormattedCommand(c, cmd, (size_t) len);
     HPOOL_DEBUG("%s: Pipeline append command: %s", __func__, format);
 
     if (reply != REDIS_OK) {
@@ -559,69 +1067,88 @@ int redis_vappend_command(REDIS_SOCKET *redisocket, REDIS_INSTANCE *inst, const
         redisFree(c);
 
         /* reconnect the socket */
-        log_(HPOOL_ERROR_LEVEL | HPOOL_CONS_LEVEL, "%s: Reconnect the socket", __func__);
+        log_limited(HPOOL_ERROR_LEVEL | HPOOL_CONS_LEVEL, "%s: Reconnect the socket", __func__);
         if (connect_single_socket(redisocket, inst) < 0) {
-            log_(HPOOL_ERROR_LEVEL | HPOOL_CONS_LEVEL, "%s: Reconnect failed, server down?", __func__);
+            log_limited(HPOOL_ERROR_LEVEL | HPOOL_CONS_LEVEL, "%s: Reconnect failed, server down?", __func__);
             goto quit;
         }
 
         /* retry on the newly connected socket */
         c = redisocket->conn;
-        reply = redisvAppendCommand(c, format, ap2);
+        reply = redisAppendFormattedCommand(c, cmd, (size_t) len);
         HPOOL_DEBUG("%s: Pipeline append command again: %s", __func__, format);
 
         if (reply != REDIS_OK) {
-            log_(HPOOL_ERROR_LEVEL, "%s: Failed after reconnect: %s (%d)", __func__, c->errstr, c->err);
+            log_limited(HPOOL_ERROR_LEVEL, "%s: Failed after reconnect: %s (%d)", __func__, c->errstr, c->err);
 
             /* do not need clean up here because the next caller will retry. */
             goto quit;
         }
     }
 
+    // 自定义 begin
+    __sync_fetch_and_add(&(inst->stats.bytes_out), (long) len);
+    // 自定义 end
+
     quit:
-    va_end(ap2);
+    redisFreeCommand(cmd);
     return reply;
 }
 
 void redis_get_reply(REDIS_SOCKET *redisocket, REDIS_INSTANCE *inst, void **reply) {
-    if (REDIS_ERR == redisGetReply(redisocket->conn, reply)) {
+    if (REDIS_OK == traced_get_reply(redisocket->conn, reply)) {
+        // 自定义 begin
+        __sync_fetch_and_add(&(inst->stats.bytes_in), (long) reply_wire_size(*reply));
+        // 自定义 end
+    } else {
         redisContext *c = redisocket->conn;
-        log_(HPOOL_ERROR_LEVEL,
-             "%s: Pipeline get reply failed! %s (%d), client status: %d, commands: %s, *reply: %d",
-             __func__, c->errstr, c->err, c->flags, c->obuf, *reply);
+        log_limited(HPOOL_ERROR_LEVEL,
+                    "%s: Pipeline get reply failed! %s (%d), client status: %d, commands: %s, *reply: %d",
+                    __func__, c->errstr, c->err, c->flags, c->obuf, *reply);
         if (*reply == NULL) {
             // 当发生get reply failed后，尝试重连
             // 当重连成功c->obuf中有数据(命令)，则重新执行命令，
             // 需要将原连接c->obuf缓冲中的内容，拷贝到新连接的obuf缓冲区中
             size_t len = sdslen(c->obuf);
+            // 自定义 begin
+            if (inst->config->disable_inline_retry) {
+                /* reconnect only, the caller retries the pipeline if it wants to */
+                redisFree(c);
+                log_limited(HPOOL_WARN_LEVEL, "%s: Reconnect the socket, %zu bytes of commands not resent",
+                            __func__, len);
+                if (connect_single_socket(redisocket, inst) < 0)
+                    log_limited(HPOOL_ERROR_LEVEL, "%s: Reconnect failed, server down?", __func__);
+                return;
+            }
+            // 自定义 end
             if(len > 0) {
-                log_(HPOOL_WARN_LEVEL, "%s: try to malloc %d bytes!", __func__, len);
+                log_limited(HPOOL_WARN_LEVEL, "%s: try to malloc %d bytes!", __func__, len);
                 void *tmpBuf = NULL;
                 tmpBuf = sds_malloc(len);
                 if (tmpBuf) {
-                    log_(HPOOL_WARN_LEVEL, "%s: copy %d bytes!", __func__, len);
+                    log_limited(HPOOL_WARN_LEVEL, "%s: copy %d bytes!", __func__, len);
                     memcpy(tmpBuf, c->obuf, len);
                 }else{
-                    log_(HPOOL_ERROR_LEVEL, "%s: malloc %d bytes failed!", __func__, len);
+                    log_limited(HPOOL_ERROR_LEVEL, "%s: malloc %d bytes failed!", __func__, len);
                 }
 
                 redisFree(c);
 
                 // reconnect the socket
-                log_(HPOOL_WARN_LEVEL, "%s: Reconnect the socket", __func__);
+                log_limited(HPOOL_WARN_LEVEL, "%s: Reconnect the socket", __func__);
                 int ret = connect_single_socket(redisocket, inst);
                 if (redisocket) {
                     c = redisocket->conn;
                     if (ret < 0) {
-                        log_(HPOOL_ERROR_LEVEL, "%s: Reconnect failed, server down?", __func__);
+                        log_limited(HPOOL_ERROR_LEVEL, "%s: Reconnect failed, server down?", __func__);
                         // 连接失败 connect_single_socket中会清理c，因此c的obuf不会堆积命令
                         if (c) {
-                            log_(HPOOL_ERROR_LEVEL,
-                                 "%s: Reconnect failed, but redisContext not NULL", __func__);
+                            log_limited(HPOOL_ERROR_LEVEL,
+                                        "%s: Reconnect failed, but redisContext not NULL", __func__);
                             sdsfree(c->obuf);
                             c->obuf = sdsempty();
-                            log_(HPOOL_WARN_LEVEL,
-                                 "%s: clear obuf of redisContext after reconnecting failed", __func__);
+                            log_limited(HPOOL_WARN_LEVEL,
+                                        "%s: clear obuf of redisContext after reconnecting failed", __func__);
                         }
                     } else {
                         // 连接成功 c不会为无效指针
@@ -633,34 +1160,371 @@ void redis_get_reply(REDIS_SOCKET *redisocket, REDIS_INSTANCE *inst, void **repl
                                 sds_free(tmpBuf);
                                 tmpBuf = NULL;
 
-                                log_(HPOOL_WARN_LEVEL, "%s: execute pipeline get reply again!", __func__);
+                                log_limited(HPOOL_WARN_LEVEL, "%s: execute pipeline get reply again!", __func__);
                                 if (REDIS_ERR == redisGetReply(c, reply)) {
-                                    log_(HPOOL_ERROR_LEVEL, "%s: Pipeline get reply failed again!", __func__);
+                                    log_limited(HPOOL_ERROR_LEVEL, "%s: Pipeline get reply failed again!", __func__);
                                     // getReply再次失败 要保证c的obuf不堆积命令
                                     sdsfree(c->obuf);
                                     c->obuf = sdsempty();
                                     if (*reply == NULL) {
-                                        log_(HPOOL_ERROR_LEVEL,
-                                             "%s: Failed after reconnect: %s (%d), client status: %d, *reply: %d",
-                                             __func__, c->errstr, c->err, c->flags, *reply);
+                                        log_limited(HPOOL_ERROR_LEVEL,
+                                                    "%s: Failed after reconnect: %s (%d), client status: %d, *reply: %d",
+                                                    __func__, c->errstr, c->err, c->flags, *reply);
                                     }
                                 }
                                 //else (第一次)getReply成功后会清理c的obuf
                             }else{
-                                log_(HPOOL_ERROR_LEVEL,
-                                     "%s: obuf empty, will not get reply again!", __func__);
+                                log_limited(HPOOL_ERROR_LEVEL,
+                                            "%s: obuf empty, will not get reply again!", __func__);
                             }
                         } else {
-                            log_(HPOOL_ERROR_LEVEL, "%s: Reconnect ok, but redisContext is NULL", __func__);
+                            log_limited(HPOOL_ERROR_LEVEL, "%s: Reconnect ok, but redisContext is NULL", __func__);
                         }
                     }
                 }
                 if (tmpBuf) sds_free(tmpBuf);
             }
         } else {
-            log_(HPOOL_ERROR_LEVEL | HPOOL_CONS_LEVEL,
-                 "%s: Pipeline get reply failed, but *reply is not NULL!", __func__);
+            log_limited(HPOOL_ERROR_LEVEL | HPOOL_CONS_LEVEL,
+                        "%s: Pipeline get reply failed, but *reply is not NULL!", __func__);
             *reply = NULL;
         }
     }
 }
+
+// 自定义 begin
+/* deadline_get_reply: the deadline passed before the reply was complete */
+#define DEADLINE_EXCEEDED (-2)
+#define WOKEN_UP (-3)
+
+/*
+ * Wait until fd is ready for events or the deadline passes.
+ * Returns 1 if ready, 0 on deadline, -1 on error.
+ */
+/* 1: fd ready, 2: wake_fd (if >= 0) readable, 0: deadline passed, -1: error */
+static int wait_fd_wake(int fd, short events, long deadline_us, int wake_fd) {
+    struct pollfd pfd[2];
+    long left_us;
+    int rc;
+
+    for (;;) {
+        left_us = deadline_us - monotonic_us();
+        if (left_us <= 0)
+            return 0;
+
+        pfd[0].fd = fd;
+        pfd[0].events = events;
+        pfd[0].revents = 0;
+        pfd[1].fd = wake_fd;
+        pfd[1].events = POLLIN;
+        pfd[1].revents = 0;
+        /* rounded up, so the deadline is overshot by less than 1ms */
+        rc = poll(pfd, wake_fd >= 0 ? 2 : 1, (int) ((left_us + 999) / 1000));
+        if (rc > 0)
+            return pfd[0].revents != 0 ? 1 : 2;
+        if (rc < 0 && errno != EINTR)
+            return -1;
+    }
+}
+
+static int wait_fd(int fd, short events, long deadline_us) {
+    return wait_fd_wake(fd, events, deadline_us, -1);
+}
+
+/*
+ * redisGetReply bounded by a deadline: the socket is switched to
+ * non-blocking mode for the call and every write and read waits in poll
+ * with the time left, whatever SO_RCVTIMEO/SO_SNDTIMEO are set to.
+ * While waiting for the reply, wake_fd (if >= 0) turning readable ends
+ * the call with WOKEN_UP.
+ */
+static int deadline_get_reply_wake(redisContext *c, void **reply, long deadline_us, int wake_fd) {
+    void *aux = NULL;
+    int wdone = 0;
+    int rc = REDIS_ERR;
+    int ready;
+    int fl;
+    long mark;
+
+    /* a reply may already be buffered */
+    if (redisGetReplyFromReader(c, &aux) == REDIS_ERR)
+        return REDIS_ERR;
+    if (aux != NULL) {
+        *reply = aux;
+        return REDIS_OK;
+    }
+
+    fl = fcntl(c->fd, F_GETFL);
+    if (fl < 0 || fcntl(c->fd, F_SETFL, fl | O_NONBLOCK) < 0)
+        return REDIS_ERR;
+    c->flags &= ~REDIS_BLOCK;
+
+    mark = hpool_trace_clock();
+    for (;;) {
+        if (redisBufferWrite(c, &wdone) == REDIS_ERR)
+            goto quit;
+        if (wdone)
+            break;
+        if ((ready = wait_fd(c->fd, POLLOUT, deadline_us)) <= 0) {
+            rc = ready == 0 ? DEADLINE_EXCEEDED : REDIS_ERR;
+            goto quit;
+        }
+    }
+    hpool_trace_phase(HPOOL_PHASE_WRITE, mark);
+
+    mark = hpool_trace_clock();
+    do {
+        if ((ready = wait_fd_wake(c->fd, POLLIN, deadline_us, wake_fd)) != 1) {
+            rc = ready == 0 ? DEADLINE_EXCEEDED : ready == 2 ? WOKEN_UP : REDIS_ERR;
+            goto quit;
+        }
+        if (redisBufferRead(c) == REDIS_ERR)
+            goto quit;
+        if (redisGetReplyFromReader(c, &aux) == REDIS_ERR)
+            goto quit;
+    } while (aux == NULL);
+    hpool_trace_phase(HPOOL_PHASE_WAIT, mark);
+
+    *reply = aux;
+    rc = REDIS_OK;
+
+    quit:
+    c->flags |= REDIS_BLOCK;
+    fcntl(c->fd, F_SETFL, fl);
+    return rc;
+}
+
+static int deadline_get_reply(redisContext *c, void **reply, long deadline_us) {
+    return deadline_get_reply_wake(c, reply, deadline_us, -1);
+}
+
+void redis_drop_connection(REDIS_SOCKET *redisocket) {
+    redisFree(redisocket->conn);
+    redisocket->conn = NULL;
+    redisocket->state = sockunconnected;
+}
+
+/* publish a new socks_limit, the sockets it unparks (or parks) count as idle (or not) */
+static void set_socks_limit(REDIS_INSTANCE *inst, int num) {
+    int dif = num - inst->socks_limit;
+
+    if (dif == 0)
+        return;
+    inst->socks_limit = num;
+    __sync_synchronize();
+    __sync_fetch_and_add(&(inst->idle_num), dif);
+}
+
+/*
+ * Readers walk redis_pool without locks, so sockets are only ever added
+ * (at the head, once complete) and never freed before the pool: shrinking
+ * parks the sockets from num up, growing reuses them first.
+ */
+int redis_pool_resize(REDIS_INSTANCE *inst, int num) {
+    REDIS_SOCKET *cur;
+    int old, connected = 0, closed = 0;
+
+    if (num < 1)
+        num = 1;
+    if (num > MAX_REDIS_SOCKS)
+        num = MAX_REDIS_SOCKS;
+
+    pthread_mutex_lock(&inst->resize_mutex);
+    old = inst->socks_limit;
+    while (inst->socks_num < num) {
+        cur = new_socket(inst, inst->socks_num);
+        if (cur == NULL)
+            break;
+        if (connect_single_socket(cur, inst) == 0)
+            connected++;
+        /* usable before it is linked: a reader meeting it must not take it for parked */
+        set_socks_limit(inst, cur->id + 1);
+        cur->next = inst->redis_pool;
+        __sync_synchronize();
+        inst->redis_pool = cur;
+        inst->socks_num++;
+    }
+    if (num > inst->socks_num)
+        num = inst->socks_num;
+    set_socks_limit(inst, num);
+    if (num > old)
+        notify_release(inst, 1);
+
+    for (cur = inst->redis_pool; cur; cur = cur->next) {
+        if (pthread_mutex_trylock(&cur->mutex) != 0)
+            continue;
+        if (!cur->inuse) {
+            if (cur->id >= num && cur->state == sockconnected) {
+                redis_drop_connection(cur);
+                closed++;
+            } else if (cur->id < num && cur->id >= old && cur->state == sockunconnected &&
+                       cur->backoff.retry_after_ms <= monotonic_ms()) {
+                /* unparked: connect now rather than on a request */
+                if (connect_single_socket(cur, inst) == 0)
+                    connected++;
+            }
+        }
+        pthread_mutex_unlock(&cur->mutex);
+    }
+    pthread_mutex_unlock(&inst->resize_mutex);
+
+    if (num != old) {
+        log_(HPOOL_INFO_LEVEL, "%s: redis sockets %d -> %d, connected %d, closed %d",
+             __func__, old, num, connected, closed);
+    }
+    return num;
+}
+
+/*
+ * redis_formatted_command bounded by a deadline: on a network error the
+ * socket is reconnected (connect cut to the time left) and the command
+ * sent once more, if inline_retry is set.
+ */
+static void *deadline_formatted_command(REDIS_SOCKET *redisocket, REDIS_INSTANCE *inst, const char *cmd, size_t len,
+                                        long deadline_us, int inline_retry, int *timed_out) {
+    void *reply = NULL;
+    int attempt, rc;
+    redisContext *c;
+
+    *timed_out = 0;
+    for (attempt = 0;; attempt++) {
+        c = redisocket->conn;
+        rc = redisAppendFormattedCommand(c, cmd, len);
+        if (rc == REDIS_OK)
+            rc = deadline_get_reply(c, &reply, deadline_us);
+        if (rc == REDIS_OK)
+            break;
+
+        redis_drop_connection(redisocket);
+        if (rc == DEADLINE_EXCEEDED || monotonic_us() >= deadline_us) {
+            log_limited(HPOOL_WARN_LEVEL, "%s: Deadline exceeded, socket %d closed", __func__, redisocket->id);
+            *timed_out = 1;
+            return NULL;
+        }
+        if (attempt > 0) {
+            log_limited(HPOOL_ERROR_LEVEL, "%s: Failed after reconnect", __func__);
+            return NULL;
+        }
+
+        log_limited(HPOOL_ERROR_LEVEL | HPOOL_CONS_LEVEL, "%s: Reconnect the socket", __func__);
+        if (connect_socket_timeout(redisocket, inst, deadline_connect_timeout(inst, deadline_us)) < 0) {
+            log_limited(HPOOL_ERROR_LEVEL | HPOOL_CONS_LEVEL, "%s: Reconnect failed, server down?", __func__);
+            *timed_out = monotonic_us() >= deadline_us;
+            return NULL;
+        }
+        if (!inline_retry)
+            return NULL;
+    }
+
+    __sync_fetch_and_add(&(inst->stats.bytes_out), (long) len);
+    __sync_fetch_and_add(&(inst->stats.bytes_in), (long) reply_wire_size(reply));
+    return reply;
+}
+
+static void *command_argv_deadline(REDIS_SOCKET *redisocket, REDIS_INSTANCE *inst,
+                                   int argc, const char **argv, const size_t *argvlen,
+                                   long deadline_us, int inline_retry, int *timed_out) {
+    char *cmd;
+    long long len;
+    void *reply;
+    long trace_mark = hpool_trace_clock();
+
+    *timed_out = 0;
+    if (redisocket->conn == NULL)
+        return NULL;
+
+    len = redisFormatCommandArgv(&cmd, argc, argv, argvlen);
+    hpool_trace_phase(HPOOL_PHASE_FORMAT, trace_mark);
+    if (len < 0) {
+        log_(HPOOL_ERROR_LEVEL | HPOOL_CONS_LEVEL, "%s: Failed to format command", __func__);
+        return NULL;
+    }
+
+    reply = deadline_formatted_command(redisocket, inst, cmd, (size_t) len, deadline_us, inline_retry, timed_out);
+    redisFreeCommand(cmd);
+    return reply;
+}
+
+void *redis_command_argv_deadline(REDIS_SOCKET *redisocket, REDIS_INSTANCE *inst,
+                                  int argc, const char **argv, const size_t *argvlen,
+                                  long deadline_us, int *timed_out) {
+    return command_argv_deadline(redisocket, inst, argc, argv, argvlen, deadline_us,
+                                 !inst->config->disable_inline_retry, timed_out);
+}
+
+void *redis_command_argv_deadline_noretry(REDIS_SOCKET *redisocket, REDIS_INSTANCE *inst,
+                                          int argc, const char **argv, const size_t *argvlen,
+                                          long deadline_us, int *timed_out) {
+    return command_argv_deadline(redisocket, inst, argc, argv, argvlen, deadline_us, 0, timed_out);
+}
+
+void redis_get_reply_deadline(REDIS_SOCKET *redisocket, REDIS_INSTANCE *inst, void **reply,
+                              long deadline_us, int *timed_out) {
+    int rc;
+
+    *timed_out = 0;
+    if (redisocket->conn == NULL)
+        return;
+
+    rc = deadline_get_reply(redisocket->conn, reply, deadline_us);
+    if (rc == REDIS_OK) {
+        __sync_fetch_and_add(&(inst->stats.bytes_in), (long) reply_wire_size(*reply));
+        return;
+    }
+
+    /* the rest of the pipeline is dropped with the connection, not resent:
+       the caller knows whether there is time left to retry it */
+    *reply = NULL;
+    *timed_out = rc == DEADLINE_EXCEEDED;
+    log_limited(HPOOL_WARN_LEVEL, "%s: Pipeline get reply %s, socket %d closed", __func__,
+                *timed_out ? "timed out" : "failed", redisocket->id);
+    redis_drop_connection(redisocket);
+}
+
+int redis_append_command_argv(REDIS_SOCKET *redisocket, REDIS_INSTANCE *inst,
+                              int argc, const char **argv, const size_t *argvlen) {
+    char *cmd;
+    long long len;
+    int rc;
+
+    if (redisocket->conn == NULL)
+        return REDIS_ERR;
+
+    len = redisFormatCommandArgv(&cmd, argc, argv, argvlen);
+    if (len < 0) {
+        log_(HPOOL_ERROR_LEVEL | HPOOL_CONS_LEVEL, "%s: Failed to format command", __func__);
+        return REDIS_ERR;
+    }
+    rc = redisAppendFormattedCommand(redisocket->conn, cmd, (size_t) len);
+    if (rc == REDIS_OK)
+        __sync_fetch_and_add(&(inst->stats.bytes_out), (long) len);
+    redisFreeCommand(cmd);
+    return rc;
+}
+
+void redis_wait_reply(REDIS_SOCKET *redisocket, REDIS_INSTANCE *inst, void **reply,
+                      long deadline_us, int wake_fd, int *status) {
+    int rc;
+
+    *reply = NULL;
+    if (redisocket->conn == NULL) {
+        *status = HPOOL_WAIT_ERROR;
+        return;
+    }
+
+    rc = deadline_get_reply_wake(redisocket->conn, reply, deadline_us, wake_fd);
+    if (rc == REDIS_OK) {
+        __sync_fetch_and_add(&(inst->stats.bytes_in), (long) reply_wire_size(*reply));
+        *status = HPOOL_WAIT_OK;
+    } else if (rc == DEADLINE_EXCEEDED) {
+        *status = HPOOL_WAIT_TIMEOUT;
+    } else if (rc == WOKEN_UP) {
+        *status = HPOOL_WAIT_WOKEN;
+    } else {
+        *reply = NULL;
+        *status = HPOOL_WAIT_ERROR;
+        log_limited(HPOOL_WARN_LEVEL, "%s: Get reply failed, socket %d closed", __func__, redisocket->id);
+        redis_drop_connection(redisocket);
+    }
+}
+// 自定义 end
@@ -12,6 +12,8 @@
 #define HIREDISPOOL_H
 
 #include <stdarg.h>
+#include <stddef.h>
+#include <pthread.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -28,6 +30,15 @@ extern "C" {
 typedef struct redis_endpoint {
     char host[128];
     int port;
+    // 自定义 begin
+    /* Unix domain socket of a proxy on this host; if set, host and port are not used */
+    char path[108];
+    /* TCP socket options, 0 keeps the default */
+    int tcp_nodelay;    /* > 0: on (as hiredis does), < 0: off */
+    int sndbuf;         /* SO_SNDBUF, bytes */
+    int rcvbuf;         /* SO_RCVBUF, bytes */
+    int busy_poll_us;   /* SO_BUSY_POLL, needs CAP_NET_ADMIN */
+    // 自定义 end
 } REDIS_ENDPOINT;
 
 typedef struct redis_config {
@@ -39,9 +50,27 @@ typedef struct redis_config {
     int connect_failure_retry_delay;
     // 自定义 begin
     int reader_buf_max_size;
+    /* > 0: RedisClient limits in-flight requests adaptively, between this and num_redis_socks */
+    int min_concurrency_limit;
+    /* != 0: a command failing on the network is not resent on the reconnected socket,
+       retries are left to the caller. Per call: redis_command_argv_noretry */
+    int disable_inline_retry;
+    /* Reconnect backoff (ms) of an endpoint, and of a socket, after failed connects:
+       min(max, base * 2^(failures - 1)), half of it jittered. base <= 0: the legacy
+       connect_failure_retry_delay (s), max < base: base */
+    int reconnect_backoff_base_ms;
+    int reconnect_backoff_max_ms;
     // 自定义 end
 } REDIS_CONFIG;
 
+// 自定义 begin
+/* Reconnect backoff state of an endpoint or a socket, reset by a successful connect */
+typedef struct redis_backoff {
+    long fail_num;        /* consecutive failed connects */
+    long retry_after_ms;  /* redis_monotonic_us() / 1000, no connect before */
+} REDIS_BACKOFF;
+// 自定义 end
+
 typedef struct redis_socket {
     int id;
     int backup;
@@ -50,16 +79,50 @@ typedef struct redis_socket {
     struct redis_socket* next;
     enum { sockunconnected, sockconnected } state;
     void* conn;
+    // 自定义 begin
+    long connect_num;
+    REDIS_BACKOFF backoff;
+    long acquired_us;  /* redis_monotonic_us() when the current holder got it */
+    // 自定义 end
 } REDIS_SOCKET;
 
+// 自定义 begin
+/* Counters of a pool, updated atomically, read without locking */
+#define HPOOL_ERROR_CODE_NUM 8
+
+typedef struct redis_stats {
+    long acquire_num;       /* redis_get_socket returned a socket */
+    long acquire_fail_num;  /* redis_get_socket returned NULL */
+    long acquire_wait_us;   /* total time spent in redis_get_socket */
+    long connect_num;
+    long connect_fail_num;
+    long reconnect_num;     /* successful connects of a socket connected before */
+    long bytes_out;         /* formatted commands sent */
+    long bytes_in;          /* RESP size of replies received */
+    long backoff_skip_num;  /* connects not tried: endpoint in reconnect backoff */
+    long busy_us;           /* total time sockets were held, acquire to release */
+    long error_num[HPOOL_ERROR_CODE_NUM]; /* indexed by -CLIENT_CODE (RedisClient.h) */
+} REDIS_STATS;
+// 自定义 end
+
 typedef struct redis_instance {
-    time_t connect_after;
     REDIS_SOCKET* redis_pool;
     REDIS_SOCKET* last_used;
     REDIS_CONFIG* config;
     // 自定义 begin
     long wait_num;
     long idle_num;
+    REDIS_STATS stats;
+    REDIS_BACKOFF* endpoint_backoff;  /* one per config->endpoints */
+    int socks_num;    /* sockets in redis_pool, freed with the pool only */
+    int socks_limit;  /* sockets with a lower id are used, the others are parked */
+    pthread_mutex_t resize_mutex;
+    /* deadline acquires finding no free socket wait on release_cond (CLOCK_MONOTONIC)
+     * until a release bumps release_seq; releases only signal while there are waiters */
+    pthread_mutex_t release_mutex;
+    pthread_cond_t release_cond;
+    long release_seq;
+    int deadline_waiters;
     // 自定义 end
 } REDIS_INSTANCE;
 
@@ -72,10 +135,65 @@ int redis_release_socket(REDIS_INSTANCE* instance, REDIS_SOCKET* redisocket);
 
 void* redis_command(REDIS_SOCKET* redisocket, REDIS_INSTANCE* instance, const char* format, ...);
 void* redis_vcommand(REDIS_SOCKET* redisocket, REDIS_INSTANCE* instance, const char* format, va_list ap);
+void* redis_command_argv(REDIS_SOCKET* redisocket, REDIS_INSTANCE* instance,
+                         int argc, const char** argv, const size_t* argvlen);
 
 int redis_vappend_command(REDIS_SOCKET* redisocket, REDIS_INSTANCE* instance, const char* format, va_list ap);
 void redis_get_reply(REDIS_SOCKET* redisocket, REDIS_INSTANCE* inst, void **reply);
 
+// 自定义 begin
+/* Deadline-aware calls. deadline_us is absolute, on the redis_monotonic_us clock.
+ * Acquire waits for a busy socket, connect, write, read and the inline retry all
+ * stop at the deadline; then *timed_out is set and the socket's connection is
+ * closed, so that a late reply is never read by the next request. */
+long redis_monotonic_us(void);
+
+REDIS_SOCKET* redis_get_socket_deadline(REDIS_INSTANCE* instance, long deadline_us);
+void* redis_command_argv_deadline(REDIS_SOCKET* redisocket, REDIS_INSTANCE* instance,
+                                  int argc, const char** argv, const size_t* argvlen,
+                                  long deadline_us, int* timed_out);
+void redis_get_reply_deadline(REDIS_SOCKET* redisocket, REDIS_INSTANCE* inst, void **reply,
+                              long deadline_us, int* timed_out);
+
+/* Close the connection of a socket whose request failed or timed out, so that
+ * a late reply is not read as the reply of the next request. The socket is
+ * reconnected by the next redis_get_socket. */
+void redis_drop_connection(REDIS_SOCKET* redisocket);
+
+/* Use num sockets from now on. Sockets added are connected before they are
+ * published; sockets over num are parked: their idle connections are closed
+ * here, the busy ones by a later redis_get_socket, and they are reused when
+ * the pool grows back. Growing blocks on the connects: call it off the
+ * request and maintenance threads. Returns the new number of usable sockets. */
+int redis_pool_resize(REDIS_INSTANCE* instance, int num);
+
+/* Hedged reads: a command is appended, then its reply waited for in steps.
+ * A wait ended by the deadline or by wake_fd turning readable keeps the
+ * command in flight, so it can be waited for again; redis_drop_connection
+ * abandons it. On error the connection is closed. */
+#define HPOOL_WAIT_OK 0
+#define HPOOL_WAIT_ERROR 1
+#define HPOOL_WAIT_TIMEOUT 2
+#define HPOOL_WAIT_WOKEN 3
+
+int redis_append_command_argv(REDIS_SOCKET* redisocket, REDIS_INSTANCE* instance,
+                              int argc, const char** argv, const size_t* argvlen);
+void redis_wait_reply(REDIS_SOCKET* redisocket, REDIS_INSTANCE* inst, void **reply,
+                      long deadline_us, int wake_fd, int* status);
+
+/* redis_command for a command already RESP encoded, e.g. by redisFormatCommand */
+void* redis_formatted_command(REDIS_SOCKET* redisocket, REDIS_INSTANCE* instance, const char* cmd, size_t len);
+
+/* redis_command_argv(_deadline) that never resends a failed command, whatever
+ * disable_inline_retry: the socket is reconnected and NULL returned, for
+ * callers running their own retries. */
+void* redis_command_argv_noretry(REDIS_SOCKET* redisocket, REDIS_INSTANCE* instance,
+                                 int argc, const char** argv, const size_t* argvlen);
+void* redis_command_argv_deadline_noretry(REDIS_SOCKET* redisocket, REDIS_INSTANCE* instance,
+                                          int argc, const char** argv, const size_t* argvlen,
+                                          long deadline_us, int* timed_out);
+// 自定义 end
+
 #ifdef __cplusplus
 }
 #endif
@@ -3,9 +3,14 @@
 #include <time.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdarg.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
 #include <syslog.h>
+#include <unistd.h>
 
 #include "hiredispool_log.h"
 
@@ -93,32 +98,24 @@ static void _set_logfile(const char* filename)
     C.file[sizeof(C.file) - 1] = '\0';
 }
 
-static void convert_logfilename(const char* origin, char* converted, size_t namelen)
+static void convert_logfilename(const char* origin, const struct tm* m, char* converted, size_t namelen)
 {
     char* p;
     int len;
-    struct tm m;
-    time_t now;
 
     len = strlen(origin);
     if(namelen < (size_t)len+10)
         goto cannot_convert;
 
-    now = time(NULL);
-    if(now == (time_t)-1)
-        goto cannot_convert;
-
-    localtime_r(&now, &m);
-
     p = strrchr(origin, '.');
     if(p == NULL) {
         sprintf(converted, "%s.%04d%02d%02d",
-                origin, m.tm_year+1900, m.tm_mon+1, m.tm_mday);
+                origin, m->tm_year+1900, m->tm_mon+1, m->tm_mday);
     } else {
         len = p - origin;
         memcpy(converted, origin, len);
         sprintf(converted+len, ".%04d%02d%02d",
-                m.tm_year+1900, m.tm_mon+1, m.tm_mday);
+                m->tm_year+1900, m->tm_mon+1, m->tm_mday);
         strcat(converted, p);
     }
 
@@ -129,213 +126,404 @@ cannot_convert:
     converted[namelen-1] = '\0';
 }
 
-/*
- *  Log the message to the logfile. Include the severity and
- *  a time stamp.
- */
-int vlog(int lvl, const char *fmt, va_list ap)
+static int syslog_level(int lvl)
 {
-    FILE *msgfd = NULL;
-    char *p;
-    char buffer[8192];
-    char namebuf[1024];
-    int len, len0;
+    if(lvl > 0 && lvl <= HPOOL_DEBUG_LEVEL) {
+        return LOG_DEBUG;
 
-    /*
-     *  Filter out by level_hold
-     */
-    if(C.level_hold > (lvl & ~HPOOL_CONS_LEVEL)) {
-        return 0;
-    }
+    } else if(lvl > HPOOL_DEBUG_LEVEL && lvl <= HPOOL_INFO_LEVEL) {
+        return LOG_NOTICE;
 
-    /*
-     *  NOT debugging, and trying to log debug messages.
-     *
-     *  Throw the message away.
-     */
-    if ((C.verbose == 0) && ((lvl & ~HPOOL_CONS_LEVEL) <= HPOOL_DEBUG_LEVEL)) {
-        return 0;
-    }
+    } else if(lvl > HPOOL_INFO_LEVEL && lvl <= HPOOL_WARN_LEVEL) {
+        return LOG_WARNING;
 
-    /*
-     *  If we don't want any messages, then
-     *  throw them away.
-     */
-    if (C.dest == LOG_DEST_NULL) {
-        return 0;
+    } else if(lvl > HPOOL_WARN_LEVEL && lvl <= HPOOL_ERROR_LEVEL) {
+        return LOG_ERR;
+
+    } else if(lvl > HPOOL_ERROR_LEVEL && lvl <= HPOOL_FATAL_LEVEL) {
+        return LOG_CRIT;
+
+    } else if(lvl > HPOOL_FATAL_LEVEL) {
+        return LOG_ALERT;
     }
 
-    if (C.dest == LOG_DEST_STDOUT) {
-            msgfd = stdout;
+    return LOG_EMERG;
+}
 
-    } else if (C.dest == LOG_DEST_STDERR) {
-            msgfd = stderr;
-
-    } else if (C.dest != LOG_DEST_SYSLOG) {
-        /*
-         *  No log file set.  It must go to stdout.
-         */
-        if (C.file[0] == '\0') {
-            msgfd = stdout;
-
-            /*
-             *  Else try to open the file.
-             */
-        } else {
-            convert_logfilename(C.file, namebuf, sizeof(namebuf));
+/*
+ * Asynchronous logging.
+ *
+ * Callers only format the message text into a slot of a bounded
+ * lock-free queue (D. Vyukov, as in hiredispool_trace.c) together with
+ * the time of the call. A single writer thread adds the timestamp and
+ * level, filters the characters, and writes whole batches to a log file
+ * that it keeps open, reopening it when the date in its name changes.
+ * When the queue is full the message is dropped and counted; the writer
+ * reports the count in the log. Callers never block on the log file.
+ */
+typedef struct log_slot {
+    unsigned long seq_off;  /* sequence - index, all-zero is the empty queue */
+    int lvl;
+    int len;
+    struct timeval tv;
+    char msg[LOG_MSG_SIZE];
+} LOG_SLOT;
+
+#define RING_MASK (LOG_RING_SIZE - 1)
+#define BATCH_SIZE 65536
+#define WRITER_IDLE_US 10000
+
+static LOG_SLOT ring[LOG_RING_SIZE];
+static unsigned long enqueue_pos = 0;
+static unsigned long dequeue_pos = 0;   /* under writer_lock */
+static long dropped = 0;
+
+static pthread_once_t writer_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t writer_lock = PTHREAD_MUTEX_INITIALIZER;
+static int writer_running = 0;
+
+/* Writer state, under writer_lock */
+typedef struct log_writer {
+    int fd;
+    int yday;               /* date of the open file, -1 if none */
+    int config_gen;         /* C changed since the file was opened */
+    int open_failed;
+    time_t last_sec;        /* cached timestamp prefix */
+    int last_print_millisec;
+    char prefix[32];
+    int prefix_len;
+    long dropped_reported;
+    int buf_len;
+    char buf[BATCH_SIZE];
+} LOG_WRITER;
+
+static LOG_WRITER W = { -1, -1, 0, 0, (time_t) -1, 0, "", 0, 0, 0, "" };
+static int config_gen = 0;
+
+static unsigned long slot_seq(unsigned long idx) {
+    return __atomic_load_n(&ring[idx].seq_off, __ATOMIC_ACQUIRE) + idx;
+}
 
-            if ((msgfd = fopen(namebuf, "a+")) == NULL) {
-                fprintf(stderr, "%s: Couldn't open %s for logging: %s\n",
-                        C.progname, namebuf, strerror(errno));
+static void set_slot_seq(unsigned long idx, unsigned long seq) {
+    __atomic_store_n(&ring[idx].seq_off, seq - idx, __ATOMIC_RELEASE);
+}
 
-                fprintf(stderr, "  (");
-                vfprintf(stderr, fmt, ap);  /* the message that caused the log */
-                fprintf(stderr, ")\n");
-                return -1;
-            }
+static int ring_push(int lvl, const char *fmt, va_list ap) {
+    unsigned long pos, idx;
+    long dif;
+    int len;
+
+    pos = __atomic_load_n(&enqueue_pos, __ATOMIC_RELAXED);
+    for (;;) {
+        idx = pos & RING_MASK;
+        dif = (long) slot_seq(idx) - (long) pos;
+        if (dif == 0) {
+            if (__atomic_compare_exchange_n(&enqueue_pos, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if (dif < 0) {
+            /* full: never block the caller */
+            __sync_fetch_and_add(&dropped, 1);
+            return -1;
+        } else {
+            pos = __atomic_load_n(&enqueue_pos, __ATOMIC_RELAXED);
         }
     }
-    if (C.dest == LOG_DEST_SYSLOG) {
-        *buffer = '\0';
-        len0 = 0;
+
+    ring[idx].lvl = lvl;
+    gettimeofday(&ring[idx].tv, NULL);
+    len = vsnprintf(ring[idx].msg, sizeof(ring[idx].msg), fmt, ap);
+    if (len < 0)
         len = 0;
-    } else
+    else if (len >= (int) sizeof(ring[idx].msg))
+        len = sizeof(ring[idx].msg) - 1;
+    ring[idx].len = len;
+    set_slot_seq(idx, pos + 1);
+    return 0;
+}
 
-    if(C.print_millisec)
-    {
-        const char* s;
-        struct timeval tv;
-        struct tm local;
-        char deflvl[8];
+static int write_all(int fd, const char* buf, int len)
+{
+    ssize_t n;
+
+    while (len > 0) {
+        n = write(fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
 
-        gettimeofday(&tv, NULL);
-        localtime_r(&tv.tv_sec, &local);
+/* Make W.fd the file for the date m */
+static int writer_open(const struct tm* m)
+{
+    char namebuf[1024];
 
-        sprintf(buffer, "%04d/%02d/%02d %02d:%02d:%02d,%03d",
-                local.tm_year+1900, local.tm_mon+1, local.tm_mday,
-                local.tm_hour, local.tm_min, local.tm_sec,
-                (int)tv.tv_usec/1000);
+    if (W.fd >= 0 && W.yday == m->tm_yday && W.config_gen == config_gen)
+        return W.fd;
+
+    if (W.fd >= 0)
+        close(W.fd);
+
+    W.yday = m->tm_yday;
+    W.config_gen = config_gen;
+    convert_logfilename(C.file, m, namebuf, sizeof(namebuf));
+    W.fd = open(namebuf, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (W.fd < 0) {
+        if (!W.open_failed)
+            fprintf(stderr, "%s: Couldn't open %s for logging: %s\n",
+                    C.progname, namebuf, strerror(errno));
+        W.open_failed = 1;
+    } else {
+        W.open_failed = 0;
+    }
+    return W.fd;
+}
+
+static void writer_flush_buf()
+{
+    int fd;
 
-        sprintf(deflvl, " L%04X ", (lvl & ~HPOOL_CONS_LEVEL));
-        s = _int2str(L, (lvl & ~HPOOL_CONS_LEVEL), deflvl);
+    if (W.buf_len == 0)
+        return;
 
-        len0 = strlen(buffer);
-        strcat(buffer, s);
-        len = strlen(buffer);
+    if (C.dest == LOG_DEST_STDOUT || (C.dest == LOG_DEST_FILES && C.file[0] == '\0')) {
+        fd = STDOUT_FILENO;
+    } else if (C.dest == LOG_DEST_STDERR) {
+        fd = STDERR_FILENO;
+    } else {
+        /* file already opened by writer_append for this date */
+        fd = W.fd >= 0 ? W.fd : STDERR_FILENO;
     }
-    else
-    {
-        const char *s;
-        time_t tv;
-        struct tm local;
-        char deflvl[8];
-
-        tv = time(NULL);
-        localtime_r(&tv, &local);
-        sprintf(buffer, "%04d/%02d/%02d %02d:%02d:%02d",
-                local.tm_year+1900, local.tm_mon+1, local.tm_mday,
-                local.tm_hour, local.tm_min, local.tm_sec);
-
-        sprintf(deflvl, " L%04X ", (lvl & ~HPOOL_CONS_LEVEL));
-        s = _int2str(L, (lvl & ~HPOOL_CONS_LEVEL), deflvl);
-
-        len0 = strlen(buffer);
-        strcat(buffer, s);
-        len = strlen(buffer);
+
+    write_all(fd, W.buf, W.buf_len);
+    W.buf_len = 0;
+}
+
+/* Format one message into the batch buffer, or hand it to syslog */
+static void writer_append(int lvl, const struct timeval* tv, const char* msg, int msg_len)
+{
+    struct tm local;
+    char deflvl[8];
+    const char* s;
+    char* p;
+    char* body;
+    int len;
+
+    lvl &= ~HPOOL_CONS_LEVEL;
+
+    if (tv->tv_sec != W.last_sec || C.print_millisec != W.last_print_millisec || C.print_millisec) {
+        localtime_r(&tv->tv_sec, &local);
+
+        if (C.dest == LOG_DEST_FILES && C.file[0] != '\0' &&
+            (W.fd < 0 || W.yday != local.tm_yday || W.config_gen != config_gen)) {
+            /* rotation: what is buffered belongs to the previous file */
+            writer_flush_buf();
+            writer_open(&local);
+        }
+
+        if (C.print_millisec)
+            W.prefix_len = sprintf(W.prefix, "%04d/%02d/%02d %02d:%02d:%02d,%03d",
+                                   local.tm_year+1900, local.tm_mon+1, local.tm_mday,
+                                   local.tm_hour, local.tm_min, local.tm_sec,
+                                   (int)tv->tv_usec/1000);
+        else
+            W.prefix_len = sprintf(W.prefix, "%04d/%02d/%02d %02d:%02d:%02d",
+                                   local.tm_year+1900, local.tm_mon+1, local.tm_mday,
+                                   local.tm_hour, local.tm_min, local.tm_sec);
+        W.last_sec = tv->tv_sec;
+        W.last_print_millisec = C.print_millisec;
     }
 
-    vsnprintf(buffer + len, sizeof(buffer) - len - 1, fmt, ap);
-    buffer[sizeof(buffer) - 2] = '\0';
+    if (W.buf_len + W.prefix_len + 8 + msg_len + 1 > BATCH_SIZE)
+        writer_flush_buf();
+
+    p = W.buf + W.buf_len;
+
+    /*
+     *   If we're debugging, for small values of debug, then
+     *   we don't do timestamps. Syslog has its own.
+     */
+    if (C.verbose != 1 && C.dest != LOG_DEST_SYSLOG) {
+        memcpy(p, W.prefix, W.prefix_len);
+        p += W.prefix_len;
+    }
+    if (C.dest != LOG_DEST_SYSLOG) {
+        sprintf(deflvl, " L%04X ", lvl);
+        s = _int2str(L, lvl, deflvl);
+        len = strlen(s);
+        memcpy(p, s, len);
+        p += len;
+    }
 
     /*
      *  Filter out characters not in Latin-1.
      */
-    for (p = buffer; *p != '\0'; p++) {
+    body = p;
+    for (len = 0; len < msg_len; len++, p++) {
+        *p = msg[len];
         if (*p == '\r' || *p == '\n')
             *p = ' ';
         else if ((*p >=0 && *p < 32) || (/**p >= -128 &&*/ *p < 0))
             *p = '?';
     }
-    strcat(buffer, "\n");
 
-    /*
-     *   If we're debugging, for small values of debug, then
-     *   we don't do timestamps.
-     */
-    if (C.verbose == 1) {
-        p = buffer + len0;
+    if (C.dest == LOG_DEST_SYSLOG) {
+        *p = '\0';
+        syslog(syslog_level(lvl), "%s", body);
+        return;
+    }
 
-    } else {
-        /*
-         *  No debugging, or lots of debugging.  Print
-         *  the time stamps.
-         */
-        p = buffer;
+    *p++ = '\n';
+    W.buf_len = p - W.buf;
+}
+
+/* Write out everything queued so far, returns the number of messages */
+static int writer_drain()
+{
+    unsigned long idx;
+    long lost;
+    int n = 0;
+    char note[64];
+    struct timeval now;
+
+    for (;;) {
+        idx = dequeue_pos & RING_MASK;
+        if (slot_seq(idx) != dequeue_pos + 1)
+            break;
+        if (C.dest != LOG_DEST_NULL)
+            writer_append(ring[idx].lvl, &ring[idx].tv, ring[idx].msg, ring[idx].len);
+        set_slot_seq(idx, dequeue_pos + LOG_RING_SIZE);
+        ++dequeue_pos;
+        ++n;
     }
 
-    if (C.dest != LOG_DEST_SYSLOG)
-    {
-        fputs(p, msgfd);
-        if (msgfd == stdout) {
-            fflush(stdout);
-        } else if (msgfd == stderr) {
-            fflush(stderr);
-        } else {
-            fclose(msgfd);
-/*
-            if(lvl & HPOOL_CONS_LEVEL) {
-                if((lvl & ~HPOOL_CONS_LEVEL) < HPOOL_WARN_LEVEL) {
-                    fputs(p, stdout);
-                    fflush(stdout);
-                } else {
-                    fputs(p, stderr);
-                    fflush(stderr);
-                }
-*/
-
-                /*
-                 * IF debugging, also to console but no flush
-                 */
-/*
-            } else if(C.verbose) {
-                if((lvl & ~HPOOL_CONS_LEVEL) < HPOOL_WARN_LEVEL) {
-                    fputs(p, stdout);
-                } else {
-                    fputs(p, stderr);
-                }
-            }
-*/
-        }
+    lost = __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+    if (lost != W.dropped_reported && C.dest != LOG_DEST_NULL) {
+        gettimeofday(&now, NULL);
+        snprintf(note, sizeof(note), "log queue full, dropped %ld messages",
+                 lost - W.dropped_reported);
+        writer_append(HPOOL_WARN_LEVEL, &now, note, strlen(note));
+        W.dropped_reported = lost;
     }
-    else {          /* it was syslog */
-        lvl = (lvl & ~HPOOL_CONS_LEVEL);
 
-        if(lvl > 0 && lvl <= HPOOL_DEBUG_LEVEL) {
-            lvl = LOG_DEBUG;
+    writer_flush_buf();
+    return n;
+}
 
-        } else if(lvl > HPOOL_DEBUG_LEVEL && lvl <= HPOOL_INFO_LEVEL) {
-            lvl = LOG_NOTICE;
+static void* writer_main(void* arg)
+{
+    int n;
+    (void) arg;
+
+    for (;;) {
+        pthread_mutex_lock(&writer_lock);
+        n = writer_drain();
+        pthread_mutex_unlock(&writer_lock);
+        if (n == 0)
+            usleep(WRITER_IDLE_US);
+    }
+    return NULL;
+}
 
-        } else if(lvl > HPOOL_INFO_LEVEL && lvl <= HPOOL_WARN_LEVEL) {
-            lvl = LOG_WARNING;
+static void writer_atfork_prepare()
+{
+    pthread_mutex_lock(&writer_lock);
+}
 
-        } else if(lvl > HPOOL_WARN_LEVEL && lvl <= HPOOL_ERROR_LEVEL) {
-            lvl = LOG_ERR;
+static void writer_atfork_parent()
+{
+    pthread_mutex_unlock(&writer_lock);
+}
 
-        } else if(lvl > HPOOL_ERROR_LEVEL && lvl <= HPOOL_FATAL_LEVEL) {
-            lvl = LOG_CRIT;
+static void writer_atfork_child()
+{
+    /* the writer thread does not exist in the child: write synchronously */
+    writer_running = 0;
+    pthread_mutex_unlock(&writer_lock);
+}
 
-        } else if(lvl > HPOOL_FATAL_LEVEL) {
-            lvl = LOG_ALERT;
+static void writer_start()
+{
+    pthread_t tid;
+    pthread_attr_t attr;
+    sigset_t all, old;
+
+    atexit(log_flush);
+    pthread_atfork(writer_atfork_prepare, writer_atfork_parent, writer_atfork_child);
+
+    /* keep signals off the writer thread */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&tid, &attr, writer_main, NULL) == 0)
+        writer_running = 1;
+    else
+        fprintf(stderr, "%s: Couldn't start log writer thread, logging synchronously\n", C.progname);
+    pthread_attr_destroy(&attr);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
 
-        } else {
-            lvl = LOG_EMERG;
+void log_flush(void)
+{
+    pthread_mutex_lock(&writer_lock);
+    writer_drain();
+    pthread_mutex_unlock(&writer_lock);
+}
 
-        }
+long log_dropped()
+{
+    return __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+}
 
-        syslog(lvl, "%s", buffer + len0); /* don't print timestamp */
+/*
+ *  Queue the message for the log writer. The writer adds
+ *  the severity and a time stamp.
+ */
+int vlog(int lvl, const char *fmt, va_list ap)
+{
+    /*
+     *  Filter out by level_hold
+     */
+    if(C.level_hold > (lvl & ~HPOOL_CONS_LEVEL)) {
+        return 0;
     }
 
+    /*
+     *  NOT debugging, and trying to log debug messages.
+     *
+     *  Throw the message away.
+     */
+    if ((C.verbose == 0) && ((lvl & ~HPOOL_CONS_LEVEL) <= HPOOL_DEBUG_LEVEL)) {
+        return 0;
+    }
+
+    /*
+     *  If we don't want any messages, then
+     *  throw them away.
+     */
+    if (C.dest == LOG_DEST_NULL) {
+        return 0;
+    }
+
+    pthread_once(&writer_once, writer_start);
+
+    if (ring_push(lvl, fmt, ap) < 0)
+        return -1;
+
+    /*
+     *  The process may not survive a fatal message, and without
+     *  a writer thread everything is written by the caller.
+     */
+    if (!writer_running || (lvl & ~HPOOL_CONS_LEVEL) >= HPOOL_FATAL_LEVEL)
+        log_flush();
+
     return 0;
 }
 
@@ -375,8 +563,34 @@ int log_(int lvl, const char *msg, ...)
 	return r;
 }
 
+int log_limit_allow(LOG_LIMIT* limit, int lvl)
+{
+    struct timespec ts;
+    long window, suppressed;
+
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    window = __atomic_load_n(&limit->window, __ATOMIC_RELAXED);
+    if (ts.tv_sec != window &&
+        __atomic_compare_exchange_n(&limit->window, &window, (long) ts.tv_sec, 0,
+                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&limit->allowed, 0, __ATOMIC_RELAXED);
+        suppressed = __atomic_exchange_n(&limit->suppressed, 0, __ATOMIC_RELAXED);
+        if (suppressed > 0)
+            log_(lvl, "%s:%d: suppressed %ld similar messages",
+                 limit->file, limit->line, suppressed);
+    }
+
+    if (__sync_add_and_fetch(&limit->allowed, 1) <= HPOOL_LOG_BURST)
+        return 1;
+
+    __sync_fetch_and_add(&limit->suppressed, 1);
+    return 0;
+}
+
 void log_set_config(const LOG_CONFIG* config)
 {
+    /* the writer must not see a half-updated config */
+    pthread_mutex_lock(&writer_lock);
     C.verbose = config->verbose;
     C.dest = config->dest;
     _set_logfile(config->file);
@@ -385,6 +599,11 @@ void log_set_config(const LOG_CONFIG* config)
 
     strncpy(C.progname, config->progname, sizeof(C.progname));
     C.progname[sizeof(C.progname) - 1] = '\0';
+
+    ++config_gen;
+    W.open_failed = 0;
+    W.last_sec = (time_t) -1;
+    pthread_mutex_unlock(&writer_lock);
 }
 
 int log_get_verbose()
@@ -2,6 +2,8 @@
  * Date:     2017-2
  * Revision: 0.1
  * Function: Simple lightweight logging interface
+ *     + Messages are queued and written by a background thread,
+ *       callers never wait for the log file
  * Usage:
  */
 
@@ -22,6 +24,9 @@ extern "C" {
 #define HPOOL_FATAL_LEVEL     16384      /* 0x00004000 */
 #define HPOOL_CONS_LEVEL      32768      /* 0x00008000 */
 
+#define LOG_RING_SIZE         2048       /* queued messages, power of two */
+#define LOG_MSG_SIZE          1024       /* longer messages are truncated */
+
 /* Types */
 typedef enum _log_dest_t {
   LOG_DEST_FILES = 0,
@@ -53,6 +58,27 @@ int log_trace(const char *msg, ...);
 void log_set_config(const LOG_CONFIG* config);
 int log_get_verbose();
 
+/* Write out all queued messages on the calling thread; also runs at exit */
+void log_flush(void);
+/* Messages dropped because the log queue was full */
+long log_dropped();
+
+/*
+ * Levels below HPOOL_MIN_LOG_LEVEL are compiled out: their arguments
+ * are not evaluated and no call is made. Release builds (NDEBUG) keep
+ * INFO and above unless HPOOL_MIN_LOG_LEVEL is given.
+ */
+#ifndef HPOOL_MIN_LOG_LEVEL
+#ifdef NDEBUG
+#define HPOOL_MIN_LOG_LEVEL HPOOL_INFO_LEVEL
+#else
+#define HPOOL_MIN_LOG_LEVEL HPOOL_TRACE_LEVEL
+#endif
+#endif
+
+#define HPOOL_LOG_ENABLED(lvl) ((((lvl) & ~HPOOL_CONS_LEVEL)) >= HPOOL_MIN_LOG_LEVEL)
+
+#if HPOOL_MIN_LOG_LEVEL <= HPOOL_DEBUG_LEVEL
 #define HPOOL_DEBUG  (log_get_verbose() == 0) ?                           \
     0 : log_debug
 #define DEBUG2 (log_get_verbose() >= 0 && log_get_verbose() <= 1) ? \
@@ -63,7 +89,15 @@ int log_get_verbose();
     0 : log_debug
 #define DEBUG5 (log_get_verbose() >= 0 && log_get_verbose() <= 4) ? \
     0 : log_debug
+#else
+#define HPOOL_DEBUG(...) ((void) 0)
+#define DEBUG2(...) ((void) 0)
+#define DEBUG3(...) ((void) 0)
+#define DEBUG4(...) ((void) 0)
+#define DEBUG5(...) ((void) 0)
+#endif
 
+#if HPOOL_MIN_LOG_LEVEL <= HPOOL_TRACE_LEVEL
 #define HPOOL_TRACE  (log_get_verbose() >= -1) ? \
     0 : log_trace
 #define TRACE2 (log_get_verbose() >= -2) ? \
@@ -74,7 +108,40 @@ int log_get_verbose();
     0 : log_trace
 #define TRACE5 (log_get_verbose() >= -5) ? \
     0 : log_trace
+#else
+#define HPOOL_TRACE(...) ((void) 0)
+#define TRACE2(...) ((void) 0)
+#define TRACE3(...) ((void) 0)
+#define TRACE4(...) ((void) 0)
+#define TRACE5(...) ((void) 0)
+#endif
+
+/*
+ * Per call site rate limit, for messages that repeat on every request
+ * while a server is down. A call site logs at most HPOOL_LOG_BURST
+ * messages per second; the rest are counted and reported as
+ * "suppressed N similar messages" with the next message let through.
+ */
+#define HPOOL_LOG_BURST 5
+
+typedef struct log_limit {
+    const char* file;
+    int line;
+    long window;      /* current one second window */
+    long allowed;     /* messages let through in the window */
+    long suppressed;  /* not reported yet */
+} LOG_LIMIT;
+
+/* Returns 1 if the message may be logged */
+int log_limit_allow(LOG_LIMIT* limit, int lvl);
 
+#define log_limited(lvl, ...) do {                                        \
+    if (HPOOL_LOG_ENABLED(lvl)) {                                         \
+        static LOG_LIMIT _hpool_log_limit = { __FILE__, __LINE__, 0, 0, 0 }; \
+        if (log_limit_allow(&_hpool_log_limit, (lvl)))                    \
+            log_((lvl), __VA_ARGS__);                                     \
+    }                                                                     \
+} while (0)
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,536 @@
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "hiredispool_mux.h"
+#include "hiredispool_log.h"
+
+#include <hiredis/hiredis.h>
+
+#ifdef HPOOL_HAVE_LIBURING
+#include <liburing.h>
+
+/* user_data of an sqe: request index << 2 | op */
+#define OP_READ 0
+#define OP_SEND 1
+#define OP_CANCEL 2
+#define OP_DATA(i, op) (((uint64_t) (i) << 2) | (op))
+#endif
+
+struct hpool_mux {
+    int backend;
+    int max_conns;
+    char *bufs;                 /* max_conns read buffers of HPOOL_MUX_BUF_SIZE */
+    int *active;                /* request of the chunk still running */
+    int epfd;
+    struct epoll_event *events;
+    int *fl;                    /* file status flags to restore, epoll backend */
+#ifdef HPOOL_HAVE_LIBURING
+    struct io_uring ring;
+    struct iovec *iovecs;       /* the registered bufs */
+    struct io_uring_cqe **cqes;
+    int cqe_num;
+    int *inflight;              /* read/send ops in flight per request */
+#endif
+};
+
+static char *req_buf(HPOOL_MUX *mux, int i) {
+    return mux->bufs + (size_t) i * HPOOL_MUX_BUF_SIZE;
+}
+
+/* Move the parsed replies out of the reader. Returns 1 once all are read, 0 if more are expected, -1 on error */
+static int collect_replies(HPOOL_MUX_REQ *req) {
+    redisContext *c = req->sock->conn;
+    void *reply;
+
+    while (req->done < req->reply_num) {
+        reply = NULL;
+        if (redisGetReplyFromReader(c, &reply) == REDIS_ERR)
+            return -1;
+        if (reply == NULL)
+            return 0;
+        req->replies[req->done++] = reply;
+    }
+    return 1;
+}
+
+static int feed_replies(HPOOL_MUX_REQ *req, const char *buf, size_t len) {
+    redisContext *c = req->sock->conn;
+
+    if (redisReaderFeed(c->reader, buf, len) != REDIS_OK)
+        return -1;
+    __sync_fetch_and_add(&(req->inst->stats.bytes_in), (long) len);
+    return collect_replies(req);
+}
+
+static int expired(const HPOOL_MUX_REQ *req, long now_us) {
+    return req->deadline_us > 0 && req->deadline_us <= now_us;
+}
+
+/* the earliest deadline of the requests still running, 0 for none */
+static long next_deadline(const HPOOL_MUX *mux, const HPOOL_MUX_REQ *reqs, int n) {
+    long next = 0;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        if (mux->active[i] && reqs[i].deadline_us > 0 && (next == 0 || reqs[i].deadline_us < next))
+            next = reqs[i].deadline_us;
+    }
+    return next;
+}
+
+/* ---------------- epoll ---------------- */
+
+static void epoll_finish(HPOOL_MUX *mux, HPOOL_MUX_REQ *req, int i, int status) {
+    redisContext *c = req->sock->conn;
+
+    epoll_ctl(mux->epfd, EPOLL_CTL_DEL, c->fd, NULL);
+    c->flags |= REDIS_BLOCK;
+    fcntl(c->fd, F_SETFL, mux->fl[i]);
+    mux->active[i] = 0;
+    req->status = status;
+    if (status != HPOOL_MUX_OK)
+        redis_drop_connection(req->sock);
+}
+
+static int run_epoll(HPOOL_MUX *mux, HPOOL_MUX_REQ *reqs, int n) {
+    struct epoll_event ev;
+    HPOOL_MUX_REQ *req;
+    redisContext *c;
+    int i, k, nev, rc, wdone, timeout;
+    int pending = 0;
+    long now, next;
+    ssize_t len;
+
+    for (i = 0; i < n; i++) {
+        if (!mux->active[i])
+            continue;
+        req = &reqs[i];
+        c = req->sock->conn;
+
+        mux->fl[i] = fcntl(c->fd, F_GETFL);
+        if (mux->fl[i] < 0 || fcntl(c->fd, F_SETFL, mux->fl[i] | O_NONBLOCK) < 0) {
+            mux->active[i] = 0;
+            req->status = HPOOL_MUX_ERROR;
+            redis_drop_connection(req->sock);
+            continue;
+        }
+        c->flags &= ~REDIS_BLOCK;
+
+        wdone = 0;
+        ev.events = EPOLLIN;
+        ev.data.u32 = (uint32_t) i;
+        if (redisBufferWrite(c, &wdone) == REDIS_ERR) {
+            epoll_finish(mux, req, i, HPOOL_MUX_ERROR);
+            continue;
+        }
+        if (!wdone)
+            ev.events |= EPOLLOUT;
+        if (epoll_ctl(mux->epfd, EPOLL_CTL_ADD, c->fd, &ev) < 0) {
+            epoll_finish(mux, req, i, HPOOL_MUX_ERROR);
+            continue;
+        }
+        pending++;
+    }
+
+    while (pending > 0) {
+        now = redis_monotonic_us();
+        for (i = 0; i < n; i++) {
+            if (mux->active[i] && expired(&reqs[i], now)) {
+                epoll_finish(mux, &reqs[i], i, HPOOL_MUX_TIMEOUT);
+                pending--;
+            }
+        }
+        if (pending == 0)
+            break;
+        timeout = -1;
+        /* rounded up, so a deadline is overshot by less than 1ms */
+        if ((next = next_deadline(mux, reqs, n)) > 0)
+            timeout = (int) ((next - now + 999) / 1000);
+
+        nev = epoll_wait(mux->epfd, mux->events, n, timeout);
+        if (nev < 0) {
+            if (errno == EINTR)
+                continue;
+            log_limited(HPOOL_ERROR_LEVEL, "%s: epoll_wait failed: %s", __func__, strerror(errno));
+            break;
+        }
+
+        for (k = 0; k < nev; k++) {
+            i = (int) mux->events[k].data.u32;
+            if (!mux->active[i])
+                continue;
+            req = &reqs[i];
+            c = req->sock->conn;
+            rc = 0;
+
+            if (mux->events[k].events & EPOLLOUT) {
+                wdone = 0;
+                if (redisBufferWrite(c, &wdone) == REDIS_ERR) {
+                    rc = -1;
+                } else if (wdone) {
+                    ev.events = EPOLLIN;
+                    ev.data.u32 = (uint32_t) i;
+                    epoll_ctl(mux->epfd, EPOLL_CTL_MOD, c->fd, &ev);
+                }
+            }
+            if (rc == 0 && (mux->events[k].events & (EPOLLIN | EPOLLERR | EPOLLHUP))) {
+                len = read(c->fd, req_buf(mux, i), HPOOL_MUX_BUF_SIZE);
+                if (len > 0)
+                    rc = feed_replies(req, req_buf(mux, i), (size_t) len);
+                else if (len == 0 || (errno != EAGAIN && errno != EINTR))
+                    rc = -1;
+            }
+
+            if (rc != 0) {
+                epoll_finish(mux, req, i, rc > 0 ? HPOOL_MUX_OK : HPOOL_MUX_ERROR);
+                pending--;
+            }
+        }
+    }
+
+    /* epoll failed */
+    now = redis_monotonic_us();
+    for (i = 0; i < n; i++) {
+        if (mux->active[i])
+            epoll_finish(mux, &reqs[i], i, expired(&reqs[i], now) ? HPOOL_MUX_TIMEOUT : HPOOL_MUX_ERROR);
+    }
+    return 0;
+}
+
+/* ---------------- io_uring ---------------- */
+
+#ifdef HPOOL_HAVE_LIBURING
+static struct io_uring_sqe *get_sqe(HPOOL_MUX *mux) {
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&mux->ring);
+
+    if (sqe == NULL) {
+        /* submission queue full: flush it */
+        io_uring_submit(&mux->ring);
+        sqe = io_uring_get_sqe(&mux->ring);
+    }
+    return sqe;
+}
+
+static int submit_send(HPOOL_MUX *mux, HPOOL_MUX_REQ *req, int i) {
+    redisContext *c = req->sock->conn;
+    struct io_uring_sqe *sqe = get_sqe(mux);
+
+    if (sqe == NULL)
+        return -1;
+    io_uring_prep_send(sqe, c->fd, c->obuf, sdslen(c->obuf), MSG_NOSIGNAL);
+    io_uring_sqe_set_data64(sqe, OP_DATA(i, OP_SEND));
+    mux->inflight[i]++;
+    return 0;
+}
+
+static int submit_read(HPOOL_MUX *mux, HPOOL_MUX_REQ *req, int i) {
+    redisContext *c = req->sock->conn;
+    struct io_uring_sqe *sqe = get_sqe(mux);
+
+    if (sqe == NULL)
+        return -1;
+    io_uring_prep_read_fixed(sqe, c->fd, req_buf(mux, i), HPOOL_MUX_BUF_SIZE, 0, i);
+    io_uring_sqe_set_data64(sqe, OP_DATA(i, OP_READ));
+    mux->inflight[i]++;
+    return 0;
+}
+
+static void submit_cancel(HPOOL_MUX *mux, int i, int op) {
+    struct io_uring_sqe *sqe = get_sqe(mux);
+
+    if (sqe == NULL)
+        return;
+    io_uring_prep_cancel64(sqe, OP_DATA(i, op), 0);
+    io_uring_sqe_set_data64(sqe, OP_DATA(i, OP_CANCEL));
+}
+
+/*
+ * Handle one completion. Sends are accounted even for a finished request:
+ * what was sent must leave the output buffer. Returns the new state of
+ * the request as collect_replies does.
+ */
+static int uring_complete(HPOOL_MUX *mux, HPOOL_MUX_REQ *reqs, struct io_uring_cqe *cqe) {
+    int i = (int) (cqe->user_data >> 2);
+    int op = (int) (cqe->user_data & 3);
+    HPOOL_MUX_REQ *req = &reqs[i];
+    redisContext *c = req->sock->conn;
+    int rc = 0;
+
+    if (op == OP_CANCEL)
+        return 0;
+    mux->inflight[i]--;
+
+    if (op == OP_SEND) {
+        if (cqe->res < 0)
+            return mux->active[i] ? -1 : 0;
+        sdsrange(c->obuf, cqe->res, -1);
+        if (mux->active[i] && sdslen(c->obuf) > 0 && submit_send(mux, req, i) < 0)
+            rc = -1;
+        return rc;
+    }
+
+    if (!mux->active[i])
+        return 0;
+    if (cqe->res <= 0)
+        return -1;
+    rc = feed_replies(req, req_buf(mux, i), (size_t) cqe->res);
+    if (rc == 0 && submit_read(mux, req, i) < 0)
+        rc = -1;
+    return rc;
+}
+
+/*
+ * Give up io_uring for epoll. Unregistering waits for the requests still
+ * using the buffers, and exiting the ring cancels the others, so the
+ * buffers are free to go: epoll gets new ones.
+ */
+static void exit_uring(HPOOL_MUX *mux) {
+    io_uring_unregister_buffers(&mux->ring);
+    io_uring_queue_exit(&mux->ring);
+    free(mux->iovecs);
+    mux->iovecs = NULL;
+    free(mux->bufs);
+    mux->bufs = malloc((size_t) mux->max_conns * HPOOL_MUX_BUF_SIZE);
+    memset(mux->inflight, 0, sizeof(int) * mux->max_conns);
+    mux->backend = HPOOL_MUX_EPOLL;
+}
+
+static int run_uring(HPOOL_MUX *mux, HPOOL_MUX_REQ *reqs, int n) {
+    struct io_uring_cqe *cqe;
+    struct __kernel_timespec ts;
+    HPOOL_MUX_REQ *req;
+    int i, k, rc, cnt, busy;
+    int pending = 0;
+    long now, next, left;
+
+    /* the sends and first reads of all connections go in one submission */
+    for (i = 0; i < n; i++)
+        mux->inflight[i] = 0;
+    for (i = 0; i < n; i++) {
+        if (!mux->active[i])
+            continue;
+        req = &reqs[i];
+        if ((sdslen(((redisContext *) req->sock->conn)->obuf) > 0 && submit_send(mux, req, i) < 0) ||
+            submit_read(mux, req, i) < 0) {
+            mux->active[i] = 0;
+            req->status = HPOOL_MUX_ERROR;
+            continue;
+        }
+        pending++;
+    }
+    io_uring_submit(&mux->ring);
+
+    while (pending > 0) {
+        /* the ops of an expired request are cancelled with those of the failed ones, below */
+        now = redis_monotonic_us();
+        for (i = 0; i < n; i++) {
+            if (mux->active[i] && expired(&reqs[i], now)) {
+                mux->active[i] = 0;
+                reqs[i].status = HPOOL_MUX_TIMEOUT;
+                pending--;
+            }
+        }
+        if (pending == 0)
+            break;
+        if ((next = next_deadline(mux, reqs, n)) > 0) {
+            left = next - now;
+            ts.tv_sec = left / 1000000;
+            ts.tv_nsec = (left % 1000000) * 1000;
+        }
+        rc = io_uring_wait_cqe_timeout(&mux->ring, &cqe, next > 0 ? &ts : NULL);
+        if (rc == -ETIME || rc == -EINTR)
+            continue;
+        if (rc < 0) {
+            log_limited(HPOOL_ERROR_LEVEL, "%s: io_uring wait failed: %s", __func__, strerror(-rc));
+            break;
+        }
+
+        /* reap all available completions at once */
+        cnt = (int) io_uring_peek_batch_cqe(&mux->ring, mux->cqes, (unsigned) mux->cqe_num);
+        for (k = 0; k < cnt; k++) {
+            i = (int) (mux->cqes[k]->user_data >> 2);
+            rc = uring_complete(mux, reqs, mux->cqes[k]);
+            if (rc != 0 && mux->active[i]) {
+                mux->active[i] = 0;
+                reqs[i].status = rc > 0 ? HPOOL_MUX_OK : HPOOL_MUX_ERROR;
+                pending--;
+            }
+        }
+        io_uring_cq_advance(&mux->ring, (unsigned) cnt);
+        io_uring_submit(&mux->ring);
+    }
+
+    /* io_uring failed */
+    now = redis_monotonic_us();
+    for (i = 0; i < n; i++) {
+        if (mux->active[i]) {
+            mux->active[i] = 0;
+            reqs[i].status = expired(&reqs[i], now) ? HPOOL_MUX_TIMEOUT : HPOOL_MUX_ERROR;
+        }
+    }
+
+    /* the kernel may still use the buffers of failed requests: cancel and wait for them */
+    for (i = 0; i < n; i++) {
+        if (mux->inflight[i] > 0 && reqs[i].status != HPOOL_MUX_OK) {
+            submit_cancel(mux, i, OP_READ);
+            submit_cancel(mux, i, OP_SEND);
+        }
+    }
+    for (;;) {
+        busy = 0;
+        for (i = 0; i < n; i++)
+            busy += mux->inflight[i];
+        if (busy == 0)
+            break;
+        io_uring_submit(&mux->ring);
+        rc = io_uring_wait_cqe_timeout(&mux->ring, &cqe, NULL);
+        if (rc < 0 && rc != -EINTR) {
+            log_(HPOOL_ERROR_LEVEL | HPOOL_CONS_LEVEL, "%s: io_uring drain failed: %s, using epoll",
+                 __func__, strerror(-rc));
+            exit_uring(mux);
+            break;
+        }
+        cnt = (int) io_uring_peek_batch_cqe(&mux->ring, mux->cqes, (unsigned) mux->cqe_num);
+        for (k = 0; k < cnt; k++)
+            uring_complete(mux, reqs, mux->cqes[k]);
+        io_uring_cq_advance(&mux->ring, (unsigned) cnt);
+    }
+
+    /* the requests failed before the run are closed already */
+    for (i = 0; i < n; i++) {
+        if (reqs[i].status != HPOOL_MUX_OK && reqs[i].sock != NULL && reqs[i].sock->conn != NULL)
+            redis_drop_connection(reqs[i].sock);
+    }
+    return 0;
+}
+
+static int init_uring(HPOOL_MUX *mux) {
+    int i, rc;
+
+    rc = io_uring_queue_init((unsigned) (4 * mux->max_conns), &mux->ring, 0);
+    if (rc < 0) {
+        log_(HPOOL_WARN_LEVEL, "%s: io_uring unavailable: %s, using epoll", __func__, strerror(-rc));
+        return -1;
+    }
+
+    mux->iovecs = malloc(sizeof(struct iovec) * mux->max_conns);
+    for (i = 0; i < mux->max_conns; i++) {
+        mux->iovecs[i].iov_base = req_buf(mux, i);
+        mux->iovecs[i].iov_len = HPOOL_MUX_BUF_SIZE;
+    }
+    rc = io_uring_register_buffers(&mux->ring, mux->iovecs, (unsigned) mux->max_conns);
+    if (rc < 0) {
+        log_(HPOOL_WARN_LEVEL, "%s: io_uring cannot register buffers: %s, using epoll", __func__, strerror(-rc));
+        io_uring_queue_exit(&mux->ring);
+        free(mux->iovecs);
+        mux->iovecs = NULL;
+        return -1;
+    }
+
+    /* a read and a send per connection, and their cancels */
+    mux->cqe_num = 4 * mux->max_conns;
+    mux->cqes = malloc(sizeof(struct io_uring_cqe *) * mux->cqe_num);
+    mux->inflight = calloc((size_t) mux->max_conns, sizeof(int));
+    return 0;
+}
+#endif
+
+/* ---------------- common ---------------- */
+
+HPOOL_MUX *hpool_mux_create(int max_conns, int prefer_uring) {
+    HPOOL_MUX *mux = calloc(1, sizeof(HPOOL_MUX));
+
+    mux->max_conns = max_conns > 0 ? max_conns : 1;
+    mux->bufs = malloc((size_t) mux->max_conns * HPOOL_MUX_BUF_SIZE);
+    mux->active = calloc((size_t) mux->max_conns, sizeof(int));
+    mux->events = malloc(sizeof(struct epoll_event) * mux->max_conns);
+    mux->fl = calloc((size_t) mux->max_conns, sizeof(int));
+    mux->backend = HPOOL_MUX_EPOLL;
+    mux->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (mux->epfd < 0) {
+        log_(HPOOL_ERROR_LEVEL | HPOOL_CONS_LEVEL, "%s: epoll_create1 failed: %s", __func__, strerror(errno));
+        hpool_mux_destroy(mux);
+        return NULL;
+    }
+
+#ifdef HPOOL_HAVE_LIBURING
+    if (prefer_uring && init_uring(mux) == 0)
+        mux->backend = HPOOL_MUX_URING;
+#else
+    if (prefer_uring)
+        log_(HPOOL_INFO_LEVEL, "%s: built without io_uring (HPOOL_HAVE_LIBURING), using epoll", __func__);
+#endif
+    return mux;
+}
+
+void hpool_mux_destroy(HPOOL_MUX *mux) {
+    if (mux == NULL)
+        return;
+#ifdef HPOOL_HAVE_LIBURING
+    if (mux->backend == HPOOL_MUX_URING)
+        io_uring_queue_exit(&mux->ring);
+    free(mux->iovecs);
+    free(mux->cqes);
+    free(mux->inflight);
+#endif
+    if (mux->epfd >= 0)
+        close(mux->epfd);
+    free(mux->fl);
+    free(mux->events);
+    free(mux->active);
+    free(mux->bufs);
+    free(mux);
+}
+
+int hpool_mux_backend(const HPOOL_MUX *mux) {
+    return mux->backend;
+}
+
+int hpool_mux_run(HPOOL_MUX *mux, HPOOL_MUX_REQ *reqs, int n) {
+    HPOOL_MUX_REQ *chunk;
+    int i, off, num, rc;
+    int ok = 0;
+
+    for (off = 0; off < n; off += mux->max_conns) {
+        chunk = reqs + off;
+        num = n - off < mux->max_conns ? n - off : mux->max_conns;
+        /* the backends run the requests marked active */
+        for (i = 0; i < num; i++) {
+            chunk[i].done = 0;
+            chunk[i].status = HPOOL_MUX_OK;
+            mux->active[i] = 0;
+            if (chunk[i].sock == NULL || chunk[i].sock->conn == NULL) {
+                chunk[i].status = HPOOL_MUX_ERROR;
+                continue;
+            }
+            /* replies of this socket may be buffered already */
+            rc = collect_replies(&chunk[i]);
+            if (rc < 0) {
+                chunk[i].status = HPOOL_MUX_ERROR;
+                redis_drop_connection(chunk[i].sock);
+            } else if (rc == 0) {
+                mux->active[i] = 1;
+            }
+        }
+
+#ifdef HPOOL_HAVE_LIBURING
+        if (mux->backend == HPOOL_MUX_URING)
+            run_uring(mux, chunk, num);
+        else
+#endif
+            run_epoll(mux, chunk, num);
+
+        for (i = 0; i < num; i++) {
+            if (chunk[i].status == HPOOL_MUX_OK)
+                ok++;
+        }
+    }
+    return ok;
+}
@@ -0,0 +1,66 @@
+/* Function: Multiplexed pipeline I/O over the sockets of several pools
+ *     + One thread drives the pipelines of many connections at once: the
+ *       commands of all of them are sent, then replies are read from
+ *       whichever connection has them
+ *     + io_uring backend (built with HPOOL_HAVE_LIBURING): sends and reads
+ *       of all connections go in one submission, completions are reaped in
+ *       batches, reads land in registered buffers
+ *     + epoll backend otherwise, or when the kernel refuses io_uring
+ * Usage:    see pipeline::RedisGetReplies in RedisClient.h
+ */
+
+#ifndef HIREDISPOOL_MUX_H
+#define HIREDISPOOL_MUX_H
+
+#include "hiredispool.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* Constants */
+#define HPOOL_MUX_BUF_SIZE (16 * 1024)  /* read buffer per connection */
+
+typedef enum hpool_mux_backend {
+    HPOOL_MUX_EPOLL = 0,
+    HPOOL_MUX_URING
+} hpool_mux_backend_t;
+
+typedef enum hpool_mux_status {
+    HPOOL_MUX_OK = 0,
+    HPOOL_MUX_ERROR,    /* network or protocol error, the connection is closed */
+    HPOOL_MUX_TIMEOUT   /* its deadline passed, the connection is closed */
+} hpool_mux_status_t;
+
+/* Types */
+typedef struct hpool_mux_req {
+    REDIS_SOCKET* sock;    /* in: acquired socket, commands appended (redis_vappend_command) */
+    REDIS_INSTANCE* inst;
+    int reply_num;         /* in: replies expected */
+    long deadline_us;      /* in: absolute, redis_monotonic_us clock, 0 for none */
+    void** replies;        /* out: reply_num slots */
+    int done;              /* out: replies read */
+    int status;            /* out: hpool_mux_status_t */
+} HPOOL_MUX_REQ;
+
+typedef struct hpool_mux HPOOL_MUX;
+
+/* Functions */
+
+/* max_conns: connections driven at once, larger runs go in chunks.
+ * prefer_uring: io_uring if built in and allowed by the kernel, else epoll. */
+HPOOL_MUX* hpool_mux_create(int max_conns, int prefer_uring);
+void hpool_mux_destroy(HPOOL_MUX* mux);
+int hpool_mux_backend(const HPOOL_MUX* mux);
+
+/* Send the pending commands of all requests and read their replies, each
+ * request ending at its own deadline while the others go on.
+ * Returns the number of requests with status HPOOL_MUX_OK. */
+int hpool_mux_run(HPOOL_MUX* mux, HPOOL_MUX_REQ* reqs, int n);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif/*HIREDISPOOL_MUX_H*/
@@ -0,0 +1,168 @@
+#include <sys/time.h>
+#include <string.h>
+
+#include "hiredispool_trace.h"
+
+#define RING_MASK (HPOOL_TRACE_RING_SIZE - 1)
+
+/*
+ * Bounded MPMC queue (D. Vyukov). Each slot stores its sequence number
+ * as an offset from its index, so that the all-zero static state is the
+ * initialized, empty queue.
+ */
+typedef struct trace_slot {
+    unsigned long seq_off;
+    HPOOL_TRACE_RECORD rec;
+} TRACE_SLOT;
+
+static TRACE_SLOT ring[HPOOL_TRACE_RING_SIZE];
+static unsigned long enqueue_pos = 0;
+static unsigned long dequeue_pos = 0;
+static long dropped = 0;
+
+static int sample_rate = 0;
+
+__thread HPOOL_TRACE_RECORD* hpool_trace_cur = NULL;
+static __thread HPOOL_TRACE_RECORD cur_record;
+static __thread unsigned long request_num = 0;
+
+static unsigned long slot_seq(unsigned long idx) {
+    return __atomic_load_n(&ring[idx].seq_off, __ATOMIC_ACQUIRE) + idx;
+}
+
+static void set_slot_seq(unsigned long idx, unsigned long seq) {
+    __atomic_store_n(&ring[idx].seq_off, seq - idx, __ATOMIC_RELEASE);
+}
+
+static int ring_push(const HPOOL_TRACE_RECORD* rec) {
+    unsigned long pos, idx;
+    long dif;
+
+    pos = __atomic_load_n(&enqueue_pos, __ATOMIC_RELAXED);
+    for (;;) {
+        idx = pos & RING_MASK;
+        dif = (long) slot_seq(idx) - (long) pos;
+        if (dif == 0) {
+            if (__atomic_compare_exchange_n(&enqueue_pos, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if (dif < 0) {
+            /* full: never block the request path */
+            __sync_fetch_and_add(&dropped, 1);
+            return -1;
+        } else {
+            pos = __atomic_load_n(&enqueue_pos, __ATOMIC_RELAXED);
+        }
+    }
+
+    ring[idx].rec = *rec;
+    set_slot_seq(idx, pos + 1);
+    return 0;
+}
+
+static int ring_pop(HPOOL_TRACE_RECORD* rec) {
+    unsigned long pos, idx;
+    long dif;
+
+    pos = __atomic_load_n(&dequeue_pos, __ATOMIC_RELAXED);
+    for (;;) {
+        idx = pos & RING_MASK;
+        dif = (long) slot_seq(idx) - (long) (pos + 1);
+        if (dif == 0) {
+            if (__atomic_compare_exchange_n(&dequeue_pos, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if (dif < 0) {
+            return -1; /* empty */
+        } else {
+            pos = __atomic_load_n(&dequeue_pos, __ATOMIC_RELAXED);
+        }
+    }
+
+    *rec = ring[idx].rec;
+    set_slot_seq(idx, pos + HPOOL_TRACE_RING_SIZE);
+    return 0;
+}
+
+void hpool_trace_set_sample_rate(int one_in_n)
+{
+    __atomic_store_n(&sample_rate, one_in_n > 0 ? one_in_n : 0, __ATOMIC_RELAXED);
+}
+
+int hpool_trace_get_sample_rate()
+{
+    return __atomic_load_n(&sample_rate, __ATOMIC_RELAXED);
+}
+
+int hpool_trace_begin()
+{
+    struct timeval tv;
+    int rate = __atomic_load_n(&sample_rate, __ATOMIC_RELAXED);
+
+    if (rate == 0 || hpool_trace_cur != NULL)
+        return 0;
+    if (++request_num % (unsigned long) rate != 0)
+        return 0;
+
+    memset(&cur_record, 0, sizeof(cur_record));
+    gettimeofday(&tv, NULL);
+    cur_record.start_time_ms = (long) tv.tv_sec * 1000 + tv.tv_usec / 1000;
+    cur_record.start_ns = hpool_trace_now_ns();
+    hpool_trace_cur = &cur_record;
+    return 1;
+}
+
+void hpool_trace_end(const char* command, const char* proxy, int code)
+{
+    if (hpool_trace_cur == NULL)
+        return;
+
+    cur_record.total_ns = hpool_trace_now_ns() - cur_record.start_ns;
+    cur_record.code = code;
+    if (command) {
+        strncpy(cur_record.command, command, sizeof(cur_record.command) - 1);
+    }
+    if (proxy) {
+        strncpy(cur_record.proxy, proxy, sizeof(cur_record.proxy) - 1);
+    }
+    hpool_trace_cur = NULL;
+
+    ring_push(&cur_record);
+}
+
+void hpool_trace_end_n(const char* command, const char* const* proxies, const int* codes, int n)
+{
+    int i;
+
+    if (hpool_trace_cur == NULL)
+        return;
+
+    cur_record.total_ns = hpool_trace_now_ns() - cur_record.start_ns;
+    if (command) {
+        strncpy(cur_record.command, command, sizeof(cur_record.command) - 1);
+    }
+    hpool_trace_cur = NULL;
+
+    for (i = 0; i < n; i++) {
+        cur_record.code = codes[i];
+        memset(cur_record.proxy, 0, sizeof(cur_record.proxy));
+        if (proxies[i]) {
+            strncpy(cur_record.proxy, proxies[i], sizeof(cur_record.proxy) - 1);
+        }
+        ring_push(&cur_record);
+    }
+}
+
+int hpool_trace_drain(HPOOL_TRACE_RECORD* out, int max)
+{
+    int n = 0;
+
+    while (n < max && ring_pop(&out[n]) == 0)
+        n++;
+    return n;
+}
+
+long hpool_trace_dropped()
+{
+    return __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,88 @@
+/* Function: Sampled per-request phase tracing for hiredispool
+ *     + One in N requests records the time spent in each phase
+ *     + Records go to a lock-free ring buffer, drained by RedisTracer
+ *     + When sampling is off the cost is one thread-local load per phase
+ * Usage:    see RedisTracer.h
+ */
+
+#ifndef HIREDISPOOL_TRACE_H
+#define HIREDISPOOL_TRACE_H
+
+#include <stddef.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* Constants */
+#define HPOOL_TRACE_RING_SIZE 1024  /* power of two */
+#define HPOOL_TRACE_CMD_SIZE 16
+#define HPOOL_TRACE_PROXY_SIZE 64
+
+typedef enum hpool_phase {
+    HPOOL_PHASE_ACQUIRE = 0,  /* redis_get_socket */
+    HPOOL_PHASE_FORMAT,       /* command formatting */
+    HPOOL_PHASE_WRITE,        /* socket write */
+    HPOOL_PHASE_WAIT,         /* write done until the first reply bytes are read */
+    HPOOL_PHASE_PARSE,        /* reading the rest and parsing the reply */
+    HPOOL_PHASE_RECONNECT,    /* connect_single_socket */
+    HPOOL_PHASE_NUM
+} hpool_phase_t;
+
+/* Types */
+typedef struct hpool_trace_record {
+    long start_time_ms;  /* wall clock, for slow request records */
+    long start_ns;       /* monotonic */
+    long total_ns;
+    long phase_ns[HPOOL_PHASE_NUM];
+    int code;
+    char command[HPOOL_TRACE_CMD_SIZE];
+    char proxy[HPOOL_TRACE_PROXY_SIZE];
+} HPOOL_TRACE_RECORD;
+
+/* Active trace of this thread, NULL if the current request is not sampled */
+extern __thread HPOOL_TRACE_RECORD* hpool_trace_cur;
+
+/* Functions */
+
+/* Trace one in one_in_n requests, 0 turns tracing off */
+void hpool_trace_set_sample_rate(int one_in_n);
+int hpool_trace_get_sample_rate();
+
+/* Start a request; returns 1 if it is sampled, then hpool_trace_end must follow */
+int hpool_trace_begin();
+void hpool_trace_end(const char* command, const char* proxy, int code);
+
+/* End a request sent to n proxies at once: one record per proxy, with the same phases */
+void hpool_trace_end_n(const char* command, const char* const* proxies, const int* codes, int n);
+
+/* Move up to max records out of the ring buffer, returns the number moved */
+int hpool_trace_drain(HPOOL_TRACE_RECORD* out, int max);
+/* Records dropped because the ring buffer was full */
+long hpool_trace_dropped();
+
+static inline long hpool_trace_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long) ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+/* Phase start mark: 0 unless the current request is sampled */
+static inline long hpool_trace_clock(void) {
+    return hpool_trace_cur ? hpool_trace_now_ns() : 0;
+}
+
+/* Account the time since mark to phase */
+static inline void hpool_trace_phase(int phase, long mark) {
+    if (hpool_trace_cur)
+        hpool_trace_cur->phase_ns[phase] += hpool_trace_now_ns() - mark;
+}
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif/*HIREDISPOOL_TRACE_H*/
@@ -0,0 +1,91 @@
+//
+// Created by admin on 2019-03-25.
+//
+// Unit tests (Google Test) of CodisProxyInfo::parse.
+//
+
+#include "CodisProxyInfo.h"
+#include <gtest/gtest.h>
+#include <string>
+
+TEST(CodisProxyInfoTest, ParsesCodisNode) {
+    CodisProxyInfo info;
+    ASSERT_TRUE(CodisProxyInfo::parse(
+            "{\"token\":\"f1a3\",\"start\":\"2019-03-20 10:00:00\",\"admin\":\"10.0.0.1:11080\","
+            "\"addr\":\"10.0.0.1:19000\",\"state\":\"online\",\"datacenter\":\"dc1\",\"pid\":4242}", info));
+    EXPECT_EQ("f1a3", info.token);
+    EXPECT_EQ("10.0.0.1:19000", info.addr);
+    EXPECT_EQ("10.0.0.1:11080", info.adminAddr);
+    EXPECT_EQ("online", info.state);
+    EXPECT_EQ("dc1", info.datacenter);
+    EXPECT_EQ("2019-03-20 10:00:00", info.startTime);
+    EXPECT_EQ(4242, info.pid);
+    EXPECT_TRUE(info.isOnline());
+    EXPECT_EQ("f1a3", info.key());
+}
+
+TEST(CodisProxyInfoTest, AcceptsOlderFieldNames) {
+    CodisProxyInfo info;
+    ASSERT_TRUE(CodisProxyInfo::parse(
+            "{\"proxy_addr\":\"10.0.0.2:19000\",\"admin_addr\":\"10.0.0.2:11080\",\"start_time\":\"t\"}", info));
+    EXPECT_EQ("10.0.0.2:19000", info.addr);
+    EXPECT_EQ("10.0.0.2:11080", info.adminAddr);
+    EXPECT_EQ("t", info.startTime);
+    EXPECT_TRUE(info.token.empty());
+    EXPECT_EQ("10.0.0.2:19000", info.key());
+    EXPECT_FALSE(info.isOnline());
+}
+
+TEST(CodisProxyInfoTest, SkipsUnknownFieldsOfAnyType) {
+    CodisProxyInfo info;
+    ASSERT_TRUE(CodisProxyInfo::parse(
+            " { \"x\" : {\"a\":[1, 2.5e3, -3, true, false, null, {\"b\":\"}\"}]}, \"y\":[],"
+            " \"addr\" : \"h:1\" , \"z\":\"\\\"\" } ", info));
+    EXPECT_EQ("h:1", info.addr);
+}
+
+TEST(CodisProxyInfoTest, IgnoresTrailingBytes) {
+    CodisProxyInfo info;
+    EXPECT_TRUE(CodisProxyInfo::parse("{\"addr\":\"h:1\"}\n\0\0garbage", info));
+    EXPECT_EQ("h:1", info.addr);
+}
+
+TEST(CodisProxyInfoTest, UnescapesStrings) {
+    CodisProxyInfo info;
+    ASSERT_TRUE(CodisProxyInfo::parse("{\"addr\":\"h:1\",\"datacenter\":\"a\\/b\\\\c\\\"d\\u00e9\\u4e2d\\n\"}", info));
+    EXPECT_EQ("a/b\\c\"d\xc3\xa9\xe4\xb8\xad\n", info.datacenter);
+}
+
+TEST(CodisProxyInfoTest, RejectsInvalidData) {
+    CodisProxyInfo info;
+    EXPECT_FALSE(CodisProxyInfo::parse("", info));
+    EXPECT_FALSE(CodisProxyInfo::parse("[]", info));
+    EXPECT_FALSE(CodisProxyInfo::parse("{}", info));  // no addr
+    EXPECT_FALSE(CodisProxyInfo::parse("{\"addr\":\"\"}", info));
+    EXPECT_FALSE(CodisProxyInfo::parse("{\"addr\":\"h:1\"", info));
+    EXPECT_FALSE(CodisProxyInfo::parse("{\"addr\":\"h:1", info));
+    EXPECT_FALSE(CodisProxyInfo::parse("{\"addr\":\"h:1\",}", info));
+    EXPECT_FALSE(CodisProxyInfo::parse("{\"addr\" \"h:1\"}", info));
+    EXPECT_FALSE(CodisProxyInfo::parse("{\"addr\":\"h\\x:1\"}", info));
+    EXPECT_FALSE(CodisProxyInfo::parse("{\"addr\":\"h:1\",\"datacenter\":\"\\u12\"}", info));
+    EXPECT_FALSE(CodisProxyInfo::parse("{\"addr\":\"h:1\",\"x\":tru}", info));
+    EXPECT_FALSE(CodisProxyInfo::parse("{\"addr\":\"h:1\",\"pid\":-}", info));
+}
+
+TEST(CodisProxyInfoTest, RejectsTooDeepNesting) {
+    std::string deep = "{\"addr\":\"h:1\",\"x\":" + std::string(100, '[') + std::string(100, ']') + "}";
+    CodisProxyInfo info;
+    EXPECT_FALSE(CodisProxyInfo::parse(deep, info));
+}
+
+TEST(CodisProxyInfoTest, ReusedInfoIsReset) {
+    CodisProxyInfo info;
+    ASSERT_TRUE(CodisProxyInfo::parse("{\"token\":\"t\",\"addr\":\"h:1\",\"state\":\"online\",\"pid\":7}", info));
+    ASSERT_TRUE(CodisProxyInfo::parse("{\"addr\":\"h:2\"}", info));
+    EXPECT_EQ("h:2", info.addr);
+    EXPECT_TRUE(info.token.empty());
+    EXPECT_TRUE(info.state.empty());
+    EXPECT_EQ(0, info.pid);
+    EXPECT_FALSE(CodisProxyInfo::parse("{\"token\":\"t\"}", info));
+    EXPECT_TRUE(info.addr.empty());
+}
@@ -0,0 +1,140 @@
+//
+// Created by admin on 2019-03-25.
+//
+// Unit tests (Google Test) of ConcurrencyLimiter.
+//
+
+#include "redis_client/ConcurrencyLimiter.h"
+#include <gtest/gtest.h>
+#include <cstdint>
+
+namespace {
+    // one complete baseline window of samples at rttUs, with nothing in flight
+    void fillWindow(ConcurrencyLimiter &limiter, std::uint64_t rttUs) {
+        for (int i = 0; i < ConcurrencyLimiter::RTT_WINDOW; ++i) {
+            ASSERT_TRUE(limiter.tryAcquire());
+            limiter.release(rttUs, false);
+        }
+    }
+}
+
+TEST(ConcurrencyLimiterTest, RejectsOverTheLimit) {
+    ConcurrencyLimiter limiter(1, 4);
+    EXPECT_EQ(4, limiter.getLimit());
+    for (int i = 0; i < 4; ++i) EXPECT_TRUE(limiter.tryAcquire());
+    EXPECT_FALSE(limiter.hasCapacity());
+    EXPECT_FALSE(limiter.tryAcquire());
+    EXPECT_EQ(1, limiter.getRejectNum());
+    EXPECT_EQ(4, limiter.getInflight());
+
+    limiter.release(100, false);
+    EXPECT_TRUE(limiter.tryAcquire());
+}
+
+TEST(ConcurrencyLimiterTest, NoRttCongestionBeforeTheFirstWindow) {
+    ConcurrencyLimiter limiter(1, 100);
+    // the first samples of a pool would otherwise be compared with no baseline
+    for (int i = 0; i < ConcurrencyLimiter::RTT_WINDOW - 1; ++i) {
+        ASSERT_TRUE(limiter.tryAcquire());
+        limiter.release(i % 2 ? 10 : 1000000, false);
+    }
+    EXPECT_EQ(0u, limiter.getBaseRttUs());
+    EXPECT_EQ(100, limiter.getLimit());
+}
+
+TEST(ConcurrencyLimiterTest, TimeoutsShrinkTheLimitOncePerLimitSamples) {
+    ConcurrencyLimiter limiter(10, 100);
+    for (int i = 0; i < 100; ++i) {
+        ASSERT_TRUE(limiter.tryAcquire());
+        limiter.release(100, true);
+    }
+    EXPECT_EQ(90, limiter.getLimit());
+
+    for (int i = 0; i < 10000; ++i) {
+        ASSERT_TRUE(limiter.tryAcquire());
+        limiter.release(100, true);
+    }
+    EXPECT_EQ(10, limiter.getLimit());  // never below minLimit
+}
+
+TEST(ConcurrencyLimiterTest, SlowRequestsShrinkTheLimit) {
+    ConcurrencyLimiter limiter(1, 100);
+    fillWindow(limiter, 100);
+    EXPECT_EQ(100u, limiter.getBaseRttUs());
+    EXPECT_EQ(100, limiter.getLimit());
+
+    ASSERT_TRUE(limiter.tryAcquire());
+    limiter.release(100 * ConcurrencyLimiter::RTT_TOLERANCE + ConcurrencyLimiter::RTT_SLACK_US, false);
+    EXPECT_EQ(100, limiter.getLimit());  // at the tolerance: not congested
+
+    ASSERT_TRUE(limiter.tryAcquire());
+    limiter.release(10000, false);
+    EXPECT_EQ(90, limiter.getLimit());
+}
+
+TEST(ConcurrencyLimiterTest, BaselineFallsAtOnceAndRisesSlowly) {
+    ConcurrencyLimiter limiter(1, 100);
+    fillWindow(limiter, 1000);
+    EXPECT_EQ(1000u, limiter.getBaseRttUs());
+
+    fillWindow(limiter, 200);
+    EXPECT_EQ(200u, limiter.getBaseRttUs());
+
+    // a slow window moves the baseline by 1/BASE_RISE_DIVISOR of the gap
+    fillWindow(limiter, 200 + 800 * ConcurrencyLimiter::BASE_RISE_DIVISOR);
+    EXPECT_EQ(1000u, limiter.getBaseRttUs());
+
+    // it converges after enough slow windows
+    for (int i = 0; i < 100; ++i) fillWindow(limiter, 50000);
+    EXPECT_GT(limiter.getBaseRttUs(), 49000u);
+    EXPECT_LE(limiter.getBaseRttUs(), 50000u);
+}
+
+TEST(ConcurrencyLimiterTest, GrowsBackWhileInUse) {
+    ConcurrencyLimiter limiter(1, 20);
+    for (int i = 0; i < 20 * 5; ++i) {
+        ASSERT_TRUE(limiter.tryAcquire());
+        limiter.release(100, true);
+    }
+    int shrunk = limiter.getLimit();
+    ASSERT_LT(shrunk, 20);
+
+    // fast requests with the limit half in use
+    for (int i = 0; i < 10000; ++i) {
+        int n = limiter.getLimit() / 2 + 1;
+        for (int j = 0; j < n; ++j) ASSERT_TRUE(limiter.tryAcquire());
+        for (int j = 0; j < n; ++j) limiter.release(10, false);
+    }
+    EXPECT_EQ(20, limiter.getLimit());
+}
+
+TEST(ConcurrencyLimiterTest, IdleDoesNotGrow) {
+    ConcurrencyLimiter limiter(1, 20);
+    for (int i = 0; i < 20 * 5; ++i) {
+        ASSERT_TRUE(limiter.tryAcquire());
+        limiter.release(100, true);
+    }
+    int shrunk = limiter.getLimit();
+    // one request at a time does not use the limit
+    for (int i = 0; i < 10000; ++i) {
+        ASSERT_TRUE(limiter.tryAcquire());
+        limiter.release(10, false);
+    }
+    EXPECT_EQ(shrunk, limiter.getLimit());
+}
+
+TEST(ConcurrencyLimiterTest, CancelFreesTheSlotWithoutASample) {
+    ConcurrencyLimiter limiter(1, 2);
+    for (int i = 0; i < ConcurrencyLimiter::RTT_WINDOW - 1; ++i) {
+        ASSERT_TRUE(limiter.tryAcquire());
+        limiter.release(100, false);
+    }
+    ASSERT_TRUE(limiter.tryAcquire());
+    ASSERT_TRUE(limiter.tryAcquire());
+    limiter.cancel();
+    EXPECT_EQ(1, limiter.getInflight());
+    EXPECT_EQ(0u, limiter.getBaseRttUs());  // the window still misses a sample
+
+    limiter.release(100, false);
+    EXPECT_EQ(100u, limiter.getBaseRttUs());
+}
@@ -0,0 +1,223 @@
+//
+// Created by admin on 2019-03-25.
+//
+// Unit tests (Google Test) of ConnectionBudget, on pools connected to a
+// LocalListener.
+//
+
+#include "ConnectionBudget.h"
+#include "tests/LocalListener.h"
+#include <gtest/gtest.h>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <numeric>
+#include <thread>
+#include <vector>
+
+namespace {
+    ConnectionBudgetConfig budgetConfig(int totalConns, int minPerPool, int maxPerPool) {
+        ConnectionBudgetConfig config;
+        config.totalConns = totalConns;
+        config.minPerPool = minPerPool;
+        config.maxPerPool = maxPerPool;
+        return config;
+    }
+
+    int sum(const std::vector<int> &sizes) {
+        return std::accumulate(sizes.begin(), sizes.end(), 0);
+    }
+
+    class ConnectionBudgetPoolTest : public ::testing::Test {
+    protected:
+        LocalListener listener;
+
+        void SetUp() override {
+            ASSERT_TRUE(listener.start());
+        }
+
+        std::shared_ptr<RedisClient> makePool(int size) {
+            return std::make_shared<RedisClient>(listener.poolConfig(size));
+        }
+
+        static int poolSizes(const std::vector<std::shared_ptr<RedisClient> > &pools) {
+            int n = 0;
+            for (auto &p : pools) n += p->getPoolSize();
+            return n;
+        }
+    };
+}
+
+TEST(ConnectionBudgetTest, AllocateSharesByDemandOverTheMinimums) {
+    ConnectionBudget budget(budgetConfig(20, 2, 0));
+    std::vector<int> sizes = budget.allocate({1, 3}, 20);
+    ASSERT_EQ(2u, sizes.size());
+    EXPECT_EQ(6, sizes[0]);
+    EXPECT_EQ(14, sizes[1]);
+}
+
+TEST(ConnectionBudgetTest, AllocateGivesTheExcessOverMaxToOthers) {
+    ConnectionBudget budget(budgetConfig(20, 2, 8));
+    std::vector<int> sizes = budget.allocate({10, 1, 1}, 20);
+    EXPECT_EQ(8, sizes[0]);
+    EXPECT_EQ(sizes[1], sizes[2]);
+    EXPECT_EQ(20, sum(sizes));
+}
+
+TEST(ConnectionBudgetTest, AllocateWithoutDemandSharesEvenly) {
+    ConnectionBudget budget(budgetConfig(20, 2, 0));
+    EXPECT_EQ(std::vector<int>({5, 5, 5, 5}), budget.allocate({0, 0, 0, 0}, 20));
+}
+
+TEST(ConnectionBudgetTest, AllocateNeverGoesUnderTheMinimum) {
+    ConnectionBudget budget(budgetConfig(4, 2, 0));
+    EXPECT_EQ(std::vector<int>({2, 2, 2}), budget.allocate({1, 5, 0}, 4));
+}
+
+TEST(ConnectionBudgetTest, AllocateStaysWithinTheTotal) {
+    ConnectionBudget budget(budgetConfig(100, 1, 30));
+    for (int n = 1; n <= 40; ++n) {
+        std::vector<double> demands;
+        for (int i = 0; i < n; ++i) demands.push_back((i * 7) % 5);
+        std::vector<int> sizes = budget.allocate(demands, 100);
+        EXPECT_LE(sum(sizes), std::max(100, n)) << n << " pools";
+        for (int size : sizes) {
+            EXPECT_GE(size, 1);
+            EXPECT_LE(size, 30);
+        }
+    }
+}
+
+TEST(ConnectionBudgetTest, ProxiesStartingAtOnceShareTheBudget) {
+    for (size_t n = 1; n <= 15; ++n) {
+        ConnectionBudget budget(budgetConfig(30, 2, 0));
+        std::vector<int> sizes;
+        // every reservation is made before any pool is built
+        for (size_t i = 0; i < n; ++i) sizes.push_back(budget.reserve(n, {}));
+        EXPECT_LE(sum(sizes), 30) << n << " proxies";
+        EXPECT_EQ(sum(sizes), budget.getReservedNum());
+        for (int size : sizes) EXPECT_GE(size, 2);
+
+        for (int size : sizes) budget.release(size);
+        EXPECT_EQ(0, budget.getReservedNum());
+    }
+}
+
+TEST(ConnectionBudgetTest, ReserveIsCappedByMaxPerPool) {
+    ConnectionBudget budget(budgetConfig(100, 2, 10));
+    EXPECT_EQ(10, budget.reserve(2, {}));
+}
+
+TEST_F(ConnectionBudgetPoolTest, BuildsStayWithinTheBudget) {
+    ConnectionBudget budget(budgetConfig(24, 2, 0));
+    const size_t proxyNum = 3;
+    std::vector<int> reserved;
+    std::vector<std::shared_ptr<RedisClient> > pools;
+    for (size_t i = 0; i < proxyNum; ++i) reserved.push_back(budget.reserve(proxyNum, pools));
+
+    // builds end one by one: attached, then released
+    for (size_t i = 0; i < proxyNum; ++i) {
+        pools.push_back(makePool(reserved[i]));
+        budget.release(reserved[i]);
+        EXPECT_LE(poolSizes(pools) + budget.getReservedNum(), 24);
+    }
+    EXPECT_EQ(0, budget.getReservedNum());
+    EXPECT_EQ(24, poolSizes(pools));
+}
+
+TEST_F(ConnectionBudgetPoolTest, LateProxyGetsWhatIsLeft) {
+    ConnectionBudget budget(budgetConfig(20, 2, 0));
+    std::vector<std::shared_ptr<RedisClient> > pools;
+    pools.push_back(makePool(budget.reserve(2, pools)));
+    budget.release(pools[0]->getPoolSize());
+    ASSERT_EQ(10, pools[0]->getPoolSize());
+
+    // a third proxy joins while the second is still being built
+    int second = budget.reserve(2, pools);
+    EXPECT_EQ(10, second);
+    EXPECT_EQ(2, budget.reserve(3, pools));  // nothing is left: the minimum, over the budget
+}
+
+TEST_F(ConnectionBudgetPoolTest, RebalanceShrinksInlineAndGrowsOnTheExecutor) {
+    ConnectionBudget budget(budgetConfig(16, 2, 0));
+    std::vector<std::shared_ptr<RedisClient> > pools = {makePool(8), makePool(8)};
+    std::vector<std::function<void()> > tasks;
+    ConnectionBudget::Executor executor = [&tasks](const std::function<void()> &task) {
+        tasks.push_back(task);
+        return true;
+    };
+
+    budget.rebalance(pools, pools, executor);  // first sight: nothing measured yet
+    EXPECT_EQ(8, pools[0]->getPoolSize());
+    EXPECT_EQ(8, pools[1]->getPoolSize());
+
+    {
+        // the first pool is busy, the second idle
+        std::vector<pipeline> held;
+        for (int i = 0; i < 4; ++i) held.push_back(pools[0]->pipelined());
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    budget.rebalance(pools, pools, executor);
+    EXPECT_EQ(2, pools[1]->getPoolSize());
+    ASSERT_EQ(1u, tasks.size());
+    EXPECT_EQ(8, pools[0]->getPoolSize());  // not grown until the task runs
+    EXPECT_EQ(16, budget.getAllocatedNum());
+
+    tasks[0]();
+    EXPECT_EQ(14, pools[0]->getPoolSize());
+    EXPECT_EQ(2, budget.getResizeNum());
+}
+
+TEST_F(ConnectionBudgetPoolTest, RebalanceKeepsReservedSocketsFree) {
+    ConnectionBudget budget(budgetConfig(16, 2, 0));
+    std::vector<std::shared_ptr<RedisClient> > pools = {makePool(8)};
+    std::vector<std::function<void()> > tasks;
+    ConnectionBudget::Executor executor = [&tasks](const std::function<void()> &task) {
+        tasks.push_back(task);
+        return true;
+    };
+
+    budget.rebalance(pools, pools, executor);
+    int reserved = budget.reserve(2, pools);
+    EXPECT_EQ(8, reserved);
+    {
+        std::vector<pipeline> held;
+        for (int i = 0; i < 4; ++i) held.push_back(pools[0]->pipelined());
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+    budget.rebalance(pools, pools, executor);
+    // the pool being built keeps its reservation: no room to grow
+    EXPECT_TRUE(tasks.empty());
+    EXPECT_EQ(8, pools[0]->getPoolSize());
+}
+
+TEST_F(ConnectionBudgetPoolTest, RebalanceShrinksPoolsNotRouted) {
+    ConnectionBudget budget(budgetConfig(16, 2, 0));
+    std::vector<std::shared_ptr<RedisClient> > pools = {makePool(8), makePool(8)};
+    std::vector<std::shared_ptr<RedisClient> > routable = {pools[0]};
+    std::vector<std::function<void()> > tasks;
+    ConnectionBudget::Executor executor = [&tasks](const std::function<void()> &task) {
+        tasks.push_back(task);
+        return true;
+    };
+
+    // the offline pool is shrunk at once, measured or not
+    budget.rebalance(pools, routable, executor);
+    EXPECT_EQ(2, pools[1]->getPoolSize());
+    EXPECT_EQ(10, budget.getAllocatedNum());
+    // and counts at its minimum for the proxies being built
+    EXPECT_EQ(6, budget.reserve(2, pools));
+
+    {
+        std::vector<pipeline> held;
+        for (int i = 0; i < 4; ++i) held.push_back(pools[0]->pipelined());
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+    budget.release(6);
+    budget.rebalance(pools, routable, executor);
+    // the routed pool gets what the other one does not hold
+    ASSERT_EQ(1u, tasks.size());
+    tasks[0]();
+    EXPECT_EQ(14, pools[0]->getPoolSize());
+    EXPECT_EQ(2, pools[1]->getPoolSize());
+}
@@ -0,0 +1,98 @@
+//
+// Created by admin on 2019-03-25.
+//
+// Unit tests (Google Test) of Debouncer. Timing based, with margins
+// wide enough for a loaded machine.
+//
+
+#include "zk_children_watcher/Debouncer.h"
+#include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <stdexcept>
+#include <thread>
+
+namespace {
+    // poll until pred holds or timeoutMs passes
+    bool waitFor(const std::function<bool()> &pred, int timeoutMs) {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+        while (!pred()) {
+            if (std::chrono::steady_clock::now() >= deadline) return false;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return true;
+    }
+}
+
+TEST(DebouncerTest, BurstRunsOnce) {
+    std::atomic<int> runs(0);
+    Debouncer debouncer(50, 1000, [&runs] { ++runs; });
+    for (int i = 0; i < 20; ++i) debouncer.trigger();
+
+    ASSERT_TRUE(waitFor([&runs] { return runs > 0; }, 2000));
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    EXPECT_EQ(1, runs.load());
+    EXPECT_EQ(20, debouncer.getEventNum());
+    EXPECT_EQ(1, debouncer.getRunNum());
+}
+
+TEST(DebouncerTest, WaitsForQuietPeriod) {
+    std::atomic<int> runs(0);
+    Debouncer debouncer(200, 5000, [&runs] { ++runs; });
+    auto start = std::chrono::steady_clock::now();
+    debouncer.trigger();
+
+    ASSERT_TRUE(waitFor([&runs] { return runs > 0; }, 5000));
+    EXPECT_GE(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(200));
+}
+
+TEST(DebouncerTest, MaxDelayBoundsEndlessBurst) {
+    std::atomic<int> runs(0);
+    Debouncer debouncer(100, 300, [&runs] { ++runs; });
+    // an event every 20ms never leaves 100ms of quiet
+    auto end = std::chrono::steady_clock::now() + std::chrono::milliseconds(1500);
+    while (std::chrono::steady_clock::now() < end) {
+        debouncer.trigger();
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+    EXPECT_GE(runs.load(), 2);
+}
+
+TEST(DebouncerTest, EventDuringRunRunsAgain) {
+    std::atomic<int> runs(0);
+    std::atomic<bool> release(false);
+    Debouncer debouncer(10, 100, [&runs, &release] {
+        ++runs;
+        while (runs == 1 && !release) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    });
+    debouncer.trigger();
+    ASSERT_TRUE(waitFor([&runs] { return runs == 1; }, 2000));
+    debouncer.trigger();
+    debouncer.trigger();
+    release = true;
+
+    ASSERT_TRUE(waitFor([&runs] { return runs == 2; }, 2000));
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    EXPECT_EQ(2, runs.load());
+}
+
+TEST(DebouncerTest, DestructionDropsPendingRun) {
+    std::atomic<int> runs(0);
+    {
+        Debouncer debouncer(10000, 10000, [&runs] { ++runs; });
+        debouncer.trigger();
+    }
+    EXPECT_EQ(0, runs.load());
+}
+
+TEST(DebouncerTest, ActionExceptionKeepsWorker) {
+    std::atomic<int> runs(0);
+    Debouncer debouncer(10, 100, [&runs] {
+        if (++runs == 1) throw std::runtime_error("first run fails");
+    });
+    debouncer.trigger();
+    ASSERT_TRUE(waitFor([&runs] { return runs == 1; }, 2000));
+    debouncer.trigger();
+    EXPECT_TRUE(waitFor([&runs] { return runs == 2; }, 2000));
+}
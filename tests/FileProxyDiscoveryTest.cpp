@@ -0,0 +1,131 @@
+//
+// Created by admin on 2019-03-25.
+//
+// Unit tests (Google Test) of FileProxyDiscovery, on files in a
+// temporary directory.
+//
+
+#include "FileProxyDiscovery.h"
+#include "StaticProxyDiscovery.h"
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+    class FileProxyDiscoveryTest : public ::testing::Test {
+    protected:
+        std::string dir;
+        std::string path;
+
+        void SetUp() override {
+            char tmpl[] = "/tmp/file_proxy_discovery_XXXXXX";
+            ASSERT_NE(nullptr, mkdtemp(tmpl));
+            dir = tmpl;
+            path = dir + "/proxies";
+        }
+
+        void TearDown() override {
+            unlink(path.c_str());
+            unlink((path + ".tmp").c_str());
+            rmdir(dir.c_str());
+        }
+
+        void write(const std::string &file, const std::string &content) {
+            std::ofstream out(file.c_str(), std::ios::trunc);
+            out << content;
+        }
+
+        // write to a temporary file, then rename it over path
+        void replace(const std::string &content) {
+            write(path + ".tmp", content);
+            ASSERT_EQ(0, rename((path + ".tmp").c_str(), path.c_str()));
+        }
+
+        static std::vector<std::string> nodeValues(const std::vector<std::string> &entries) {
+            std::vector<std::string> res;
+            for (auto &e : entries) res.push_back(StaticProxyDiscovery::toNodeValue(e));
+            return res;
+        }
+
+        static bool waitFor(const std::function<bool()> &pred, int timeoutMs) {
+            auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+            while (!pred()) {
+                if (std::chrono::steady_clock::now() >= deadline) return false;
+                std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            }
+            return true;
+        }
+    };
+}
+
+TEST_F(FileProxyDiscoveryTest, ReloadSkipsBlankAndCommentLines) {
+    write(path, "# proxies\n10.0.0.1:19000\n\n  10.0.0.2:19000  \n#10.0.0.3:19000\n"
+                "{\"addr\":\"10.0.0.4:19000\",\"state\":\"online\"}\n");
+    FileProxyDiscovery discovery(path, 0, 0);
+    ASSERT_TRUE(discovery.reload());
+    EXPECT_EQ(nodeValues({"10.0.0.1:19000", "10.0.0.2:19000", "{\"addr\":\"10.0.0.4:19000\",\"state\":\"online\"}"}),
+              discovery.getValueList());
+    EXPECT_EQ(1, discovery.getUpdateNum());
+}
+
+TEST_F(FileProxyDiscoveryTest, ReloadPublishesTheDiff) {
+    write(path, "10.0.0.1:19000\n10.0.0.2:19000\n");
+    FileProxyDiscovery discovery(path, 0, 0);
+    ASSERT_TRUE(discovery.reload());
+
+    write(path, "10.0.0.2:19000\n10.0.0.3:19000\n");
+    ASSERT_TRUE(discovery.reload());
+    EXPECT_EQ(nodeValues({"10.0.0.1:19000"}), discovery.deletedValueList);
+    std::vector<std::string> values = discovery.getValueList();
+    std::sort(values.begin(), values.end());
+    EXPECT_EQ(nodeValues({"10.0.0.2:19000", "10.0.0.3:19000"}), values);
+}
+
+TEST_F(FileProxyDiscoveryTest, EmptyFileKeepsTheList) {
+    write(path, "10.0.0.1:19000\n");
+    FileProxyDiscovery discovery(path, 0, 0);
+    ASSERT_TRUE(discovery.reload());
+
+    write(path, "");
+    EXPECT_FALSE(discovery.reload());
+    write(path, "# nothing yet\n\n");
+    EXPECT_FALSE(discovery.reload());
+    EXPECT_EQ(nodeValues({"10.0.0.1:19000"}), discovery.getValueList());
+    EXPECT_EQ(1, discovery.getUpdateNum());
+}
+
+TEST_F(FileProxyDiscoveryTest, MissingFileKeepsTheList) {
+    write(path, "10.0.0.1:19000\n");
+    FileProxyDiscovery discovery(path, 0, 0);
+    ASSERT_TRUE(discovery.reload());
+
+    unlink(path.c_str());
+    EXPECT_FALSE(discovery.reload());
+    EXPECT_EQ(nodeValues({"10.0.0.1:19000"}), discovery.getValueList());
+}
+
+TEST_F(FileProxyDiscoveryTest, WatchPicksUpRenameAndWrite) {
+    write(path, "10.0.0.1:19000\n");
+    FileProxyDiscovery discovery(path, 20, 200);
+    std::atomic<int> changes(0);
+    discovery.setChildrenWatcher([&changes] { ++changes; });
+    discovery.init();
+    ASSERT_EQ(1, changes.load());
+
+    replace("10.0.0.2:19000\n");
+    ASSERT_TRUE(waitFor([&discovery] { return discovery.getValueList() == nodeValues({"10.0.0.2:19000"}); },
+                        5000));
+
+    write(path, "10.0.0.2:19000\n10.0.0.3:19000\n");
+    ASSERT_TRUE(waitFor([&discovery] { return discovery.getChildrenNum() == 2; }, 5000));
+    EXPECT_GE(discovery.getEventNum(), 2);
+}
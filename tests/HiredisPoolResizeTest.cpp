@@ -0,0 +1,138 @@
+//
+// Created by admin on 2019-03-25.
+//
+// Unit tests (Google Test) of redis_pool_resize, on pools connected to a
+// LocalListener.
+//
+
+#include "redis_client/hiredispool.h"
+#include "tests/LocalListener.h"
+#include <gtest/gtest.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace {
+    class HiredisPoolResizeTest : public ::testing::Test {
+    protected:
+        LocalListener listener;
+        REDIS_INSTANCE *inst = nullptr;
+
+        void SetUp() override {
+            ASSERT_TRUE(listener.start());
+        }
+
+        void TearDown() override {
+            if (inst) redis_pool_destroy(inst);
+        }
+
+        void createPool(int size) {
+            REDIS_CONFIG conf = listener.poolConfig(size);
+            ASSERT_EQ(0, redis_pool_create(&conf, &inst));
+        }
+
+        // take every socket the pool hands out, and give them back
+        int acquireAll() {
+            std::vector<REDIS_SOCKET *> held;
+            for (REDIS_SOCKET *s; (s = redis_get_socket(inst)) != nullptr;) held.push_back(s);
+            for (REDIS_SOCKET *s : held) redis_release_socket(inst, s);
+            return (int) held.size();
+        }
+
+        int connectedNum() {
+            int n = 0;
+            for (REDIS_SOCKET *p = inst->redis_pool; p != nullptr; p = p->next) {
+                if (p->state == redis_socket::sockconnected) ++n;
+            }
+            return n;
+        }
+    };
+}
+
+TEST_F(HiredisPoolResizeTest, ShrinkParksAndClosesIdleSockets) {
+    createPool(4);
+    ASSERT_EQ(4, connectedNum());
+
+    EXPECT_EQ(2, redis_pool_resize(inst, 2));
+    EXPECT_EQ(2, inst->socks_limit);
+    EXPECT_EQ(4, inst->socks_num);  // parked, not freed
+    EXPECT_EQ(2, inst->idle_num);
+    EXPECT_EQ(2, connectedNum());
+    EXPECT_EQ(2, acquireAll());
+}
+
+TEST_F(HiredisPoolResizeTest, BusySocketIsClosedWhenMetParked) {
+    createPool(2);
+    REDIS_SOCKET *a = redis_get_socket(inst);
+    REDIS_SOCKET *b = redis_get_socket(inst);
+    ASSERT_NE(nullptr, a);
+    ASSERT_NE(nullptr, b);
+    REDIS_SOCKET *parked = a->id == 1 ? a : b;
+
+    EXPECT_EQ(1, redis_pool_resize(inst, 1));
+    // busy: still connected until it is released and met again
+    EXPECT_EQ(redis_socket::sockconnected, parked->state);
+    redis_release_socket(inst, a);
+    redis_release_socket(inst, b);
+
+    EXPECT_EQ(1, acquireAll());
+    EXPECT_EQ(redis_socket::sockunconnected, parked->state);
+    EXPECT_EQ(1, connectedNum());
+}
+
+TEST_F(HiredisPoolResizeTest, GrowUnparksBeforeAddingSockets) {
+    createPool(4);
+    ASSERT_EQ(2, redis_pool_resize(inst, 2));
+
+    EXPECT_EQ(3, redis_pool_resize(inst, 3));
+    EXPECT_EQ(4, inst->socks_num);  // the parked socket is reused
+    EXPECT_EQ(3, connectedNum());
+    EXPECT_EQ(3, acquireAll());
+
+    EXPECT_EQ(6, redis_pool_resize(inst, 6));
+    EXPECT_EQ(6, inst->socks_num);
+    EXPECT_EQ(6, inst->idle_num);
+    EXPECT_EQ(6, connectedNum());
+    EXPECT_EQ(6, acquireAll());
+}
+
+TEST_F(HiredisPoolResizeTest, GrownSocketsAreAllUsable) {
+    createPool(1);
+    REDIS_SOCKET *held = redis_get_socket(inst);
+    ASSERT_NE(nullptr, held);
+
+    ASSERT_EQ(8, redis_pool_resize(inst, 8));
+    // none of the new sockets was taken for parked and closed
+    std::vector<REDIS_SOCKET *> got;
+    for (REDIS_SOCKET *s; (s = redis_get_socket(inst)) != nullptr;) got.push_back(s);
+    EXPECT_EQ(7u, got.size());
+    for (REDIS_SOCKET *s : got) {
+        EXPECT_EQ(redis_socket::sockconnected, s->state);
+        redis_release_socket(inst, s);
+    }
+    redis_release_socket(inst, held);
+    EXPECT_EQ(8, connectedNum());
+}
+
+TEST_F(HiredisPoolResizeTest, ReadersDuringAGrowDoNotCloseNewSockets) {
+    createPool(1);
+    std::atomic<bool> stop(false);
+    std::thread reader([this, &stop] {
+        while (!stop) {
+            REDIS_SOCKET *s = redis_get_socket(inst);
+            if (s) redis_release_socket(inst, s);
+        }
+    });
+    for (int size = 2; size <= 32; ++size) ASSERT_EQ(size, redis_pool_resize(inst, size));
+    stop = true;
+    reader.join();
+
+    EXPECT_EQ(32, connectedNum());
+    EXPECT_EQ(32, inst->idle_num);
+}
+
+TEST_F(HiredisPoolResizeTest, ClampsToOneSocket) {
+    createPool(2);
+    EXPECT_EQ(1, redis_pool_resize(inst, 0));
+    EXPECT_EQ(1, acquireAll());
+}
@@ -0,0 +1,73 @@
+//
+// Created by admin on 2019-03-25.
+//
+// Test helper: a listening socket on 127.0.0.1 for the pools under test to
+// connect to. Connects complete in the kernel's backlog, so no redis server
+// is needed as long as no command is sent.
+//
+
+#ifndef CPPSERVER_LOCALLISTENER_H
+#define CPPSERVER_LOCALLISTENER_H
+
+#include "redis_client/hiredispool.h"
+#include <arpa/inet.h>
+#include <cstring>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+class LocalListener {
+    int fd;
+    REDIS_ENDPOINT endpoint;
+
+    // non construct copyable and non copyable
+    LocalListener(const LocalListener &);
+
+    LocalListener &operator=(const LocalListener &);
+
+public:
+    LocalListener() : fd(-1) {
+        memset(&endpoint, 0, sizeof(endpoint));
+    }
+
+    ~LocalListener() {
+        if (fd >= 0) close(fd);
+    }
+
+    // listen on an ephemeral port; false on error
+    bool start() {
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0) return false;
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t len = sizeof(addr);
+        if (bind(fd, (sockaddr *) &addr, sizeof(addr)) != 0 || listen(fd, SOMAXCONN) != 0 ||
+            getsockname(fd, (sockaddr *) &addr, &len) != 0) {
+            return false;
+        }
+        strcpy(endpoint.host, "127.0.0.1");
+        endpoint.port = ntohs(addr.sin_port);
+        return true;
+    }
+
+    const REDIS_ENDPOINT &getEndpoint() const { return endpoint; }
+
+    // config of a pool of size sockets to the listener, which must outlive the pool
+    REDIS_CONFIG poolConfig(int size) {
+        REDIS_CONFIG conf;
+        memset(&conf, 0, sizeof(conf));
+        conf.endpoints = &endpoint;
+        conf.num_endpoints = 1;
+        conf.connect_timeout = 1000;
+        conf.net_readwrite_timeout = 1000;
+        conf.num_redis_socks = size;
+        conf.connect_failure_retry_delay = 1;
+        conf.reader_buf_max_size = -1;
+        return conf;
+    }
+};
+
+
+#endif //CPPSERVER_LOCALLISTENER_H
@@ -0,0 +1,133 @@
+//
+// Created by admin on 2019-03-25.
+//
+// Unit tests (Google Test) of ProxyRegistry: diffs of the proxy list and
+// what becomes of the pools, built on a LocalListener.
+//
+
+#include "ProxyRegistry.h"
+#include "tests/LocalListener.h"
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace {
+    CodisProxyInfo proxy(const std::string &token, const std::string &addr, const std::string &state = "online") {
+        CodisProxyInfo info;
+        info.token = token;
+        info.addr = addr;
+        info.state = state;
+        return info;
+    }
+
+    class ProxyRegistryTest : public ::testing::Test {
+    protected:
+        LocalListener listener;
+        ProxyRegistry registry;
+
+        void SetUp() override {
+            ASSERT_TRUE(listener.start());
+        }
+
+        std::shared_ptr<RedisClient> makePool() {
+            return std::make_shared<RedisClient>(listener.poolConfig(2));
+        }
+
+        // build and attach a pool for every build task
+        std::vector<std::shared_ptr<RedisClient> > buildAll() {
+            std::vector<std::shared_ptr<RedisClient> > res;
+            for (auto &task : registry.takeBuildTasks()) {
+                res.push_back(makePool());
+                EXPECT_TRUE(registry.attach(task, res.back())) << task.key;
+            }
+            return res;
+        }
+    };
+}
+
+TEST_F(ProxyRegistryTest, AddAndRemove) {
+    ProxyRegistry::Diff diff = registry.update({proxy("a", "10.0.0.1:19000"), proxy("b", "10.0.0.2:19000")});
+    EXPECT_EQ(2u, diff.added);
+    EXPECT_EQ(2u, registry.size());
+    EXPECT_EQ(2u, registry.getOnlineNum());
+
+    diff = registry.update({proxy("b", "10.0.0.2:19000")});
+    EXPECT_EQ(0u, diff.added);
+    EXPECT_EQ(1u, diff.removed);
+    EXPECT_EQ(1u, registry.size());
+    std::vector<ProxyRegistry::BuildTask> tasks = registry.takeBuildTasks();
+    ASSERT_EQ(1u, tasks.size());
+    EXPECT_EQ("b", tasks[0].key);
+
+    EXPECT_TRUE(registry.update({proxy("b", "10.0.0.2:19000")}).empty());
+}
+
+TEST_F(ProxyRegistryTest, OfflineKeepsThePoolOutOfRouting) {
+    registry.update({proxy("a", "10.0.0.1:19000")});
+    std::vector<std::shared_ptr<RedisClient> > pools = buildAll();
+    ASSERT_EQ(1u, pools.size());
+    ASSERT_EQ(1u, registry.getRoutable().pools.size());
+
+    ProxyRegistry::Diff diff = registry.update({proxy("a", "10.0.0.1:19000", "offline")});
+    EXPECT_EQ(1u, diff.stateChanged);
+    EXPECT_EQ(0u, diff.added + diff.removed + diff.addrChanged);
+    EXPECT_TRUE(registry.getRoutable().pools.empty());
+    ASSERT_EQ(1u, registry.getPools().size());
+    EXPECT_EQ(pools[0], registry.getPools()[0]);
+    EXPECT_EQ(0u, registry.getOnlineNum());
+
+    // back online: the same pool is routed to again, nothing to build
+    diff = registry.update({proxy("a", "10.0.0.1:19000")});
+    EXPECT_EQ(1u, diff.stateChanged);
+    EXPECT_TRUE(registry.takeBuildTasks().empty());
+    ASSERT_EQ(1u, registry.getRoutable().pools.size());
+    EXPECT_EQ(pools[0], registry.getRoutable().pools[0]);
+}
+
+TEST_F(ProxyRegistryTest, AddrChangeUnderTheSameTokenNeedsANewPool) {
+    registry.update({proxy("a", "10.0.0.1:19000")});
+    std::vector<ProxyRegistry::BuildTask> stale = registry.takeBuildTasks();
+    ASSERT_EQ(1u, stale.size());
+
+    // moved while its first pool was being built
+    ProxyRegistry::Diff diff = registry.update({proxy("a", "10.0.0.9:19000")});
+    EXPECT_EQ(1u, diff.addrChanged);
+    EXPECT_EQ(0u, diff.added + diff.removed);
+    EXPECT_FALSE(registry.attach(stale[0], makePool()));
+    EXPECT_TRUE(registry.getPools().empty());
+
+    std::vector<ProxyRegistry::BuildTask> tasks = registry.takeBuildTasks();
+    ASSERT_EQ(1u, tasks.size());
+    EXPECT_EQ("10.0.0.9:19000", tasks[0].info.addr);
+    std::shared_ptr<RedisClient> pool = makePool();
+    EXPECT_TRUE(registry.attach(tasks[0], pool));
+    ASSERT_EQ(1u, registry.getRoutable().pools.size());
+    EXPECT_EQ(pool, registry.getRoutable().pools[0]);
+
+    // and once built, moving again drops that pool too
+    registry.update({proxy("a", "10.0.0.1:19000")});
+    EXPECT_TRUE(registry.getPools().empty());
+    EXPECT_EQ(1u, registry.takeBuildTasks().size());
+}
+
+TEST_F(ProxyRegistryTest, UnchangedProxiesKeepTheirPools) {
+    registry.update({proxy("a", "10.0.0.1:19000"), proxy("b", "10.0.0.2:19000")});
+    std::vector<std::shared_ptr<RedisClient> > pools = buildAll();
+    ASSERT_EQ(2u, pools.size());
+
+    // a new proxy joins: only it needs a pool
+    ProxyRegistry::Diff diff = registry.update(
+            {proxy("a", "10.0.0.1:19000"), proxy("b", "10.0.0.2:19000"), proxy("c", "10.0.0.3:19000")});
+    EXPECT_EQ(1u, diff.added);
+    std::vector<ProxyRegistry::BuildTask> tasks = registry.takeBuildTasks();
+    ASSERT_EQ(1u, tasks.size());
+    EXPECT_EQ("c", tasks[0].key);
+
+    ProxyRegistry::PoolList kept = registry.getPools();
+    ASSERT_EQ(2u, kept.size());
+    for (auto &pool : pools) {
+        EXPECT_NE(kept.end(), std::find(kept.begin(), kept.end(), pool));
+    }
+}
@@ -0,0 +1,135 @@
+//
+// Created by admin on 2019-03-25.
+//
+// Unit tests (Google Test) of RetryPolicy and its retry budget.
+//
+
+#include "RetryPolicy.h"
+#include "redis_client/RedisClient.h"
+#include <gtest/gtest.h>
+#include <atomic>
+#include <random>
+#include <thread>
+#include <vector>
+
+namespace {
+    RetryConfig makeConfig(double budgetRatio, int budgetBurst) {
+        RetryConfig config;
+        config.enable = true;
+        config.maxRetries = 3;
+        config.budgetRatio = budgetRatio;
+        config.budgetBurst = budgetBurst;
+        return config;
+    }
+
+    // one command as CodisClient::routeCommandArgv drives it: retried while
+    // the policy allows, each attempt failing with probability failRate
+    void runCommand(RetryPolicy &policy, std::mt19937 &rng, double failRate, std::int64_t *attempts) {
+        std::bernoulli_distribution fails(failRate);
+        for (int attempt = 0;; ++attempt) {
+            ++*attempts;
+            if (!fails(rng)) {
+                policy.onSuccess(attempt);
+                return;
+            }
+            if (!policy.shouldRetry("GET", CLIENT_ERROR, attempt)) return;
+        }
+    }
+}
+
+TEST(RetryPolicyTest, RetriesOnlyRetryableCodes) {
+    RetryPolicy policy(makeConfig(0.1, 10));
+    EXPECT_TRUE(policy.shouldRetry("GET", CLIENT_ERROR, 0));
+    EXPECT_TRUE(policy.shouldRetry("GET", CLIENT_OVERLOAD, 0));
+    EXPECT_FALSE(policy.shouldRetry("GET", CLIENT_RWTIMEOUT, 0));
+    EXPECT_FALSE(policy.shouldRetry("GET", CLIENT_OTHER, 0));
+    EXPECT_EQ(2, policy.getRetryNum());
+}
+
+TEST(RetryPolicyTest, RetriesOnlyReadsWithReadOnlyOnly) {
+    RetryPolicy policy(makeConfig(0.1, 10));
+    EXPECT_TRUE(policy.shouldRetry("get", CLIENT_ERROR, 0));
+    EXPECT_FALSE(policy.shouldRetry("SET", CLIENT_ERROR, 0));
+    EXPECT_FALSE(policy.shouldRetry("INCR", CLIENT_ERROR, 0));
+
+    RetryConfig config = makeConfig(0.1, 10);
+    config.readOnlyOnly = false;
+    RetryPolicy writes(config);
+    EXPECT_TRUE(writes.shouldRetry("SET", CLIENT_ERROR, 0));
+}
+
+TEST(RetryPolicyTest, StopsAtMaxRetries) {
+    RetryPolicy policy(makeConfig(0.1, 10));
+    EXPECT_TRUE(policy.shouldRetry("GET", CLIENT_ERROR, 2));
+    EXPECT_FALSE(policy.shouldRetry("GET", CLIENT_ERROR, 3));
+}
+
+TEST(RetryPolicyTest, BurstThenExhausted) {
+    RetryPolicy policy(makeConfig(0.1, 5));
+    for (int i = 0; i < 5; ++i) EXPECT_TRUE(policy.shouldRetry("GET", CLIENT_ERROR, 0));
+    EXPECT_FALSE(policy.shouldRetry("GET", CLIENT_ERROR, 0));
+    EXPECT_EQ(1, policy.getBudgetExhaustedNum());
+
+    // budgetRatio 0.1: ten successes earn one retry
+    for (int i = 0; i < 9; ++i) policy.onSuccess(0);
+    EXPECT_FALSE(policy.shouldRetry("GET", CLIENT_ERROR, 0));
+    for (int i = 0; i < 10; ++i) policy.onSuccess(0);
+    EXPECT_TRUE(policy.shouldRetry("GET", CLIENT_ERROR, 0));
+    EXPECT_FALSE(policy.shouldRetry("GET", CLIENT_ERROR, 0));
+}
+
+TEST(RetryPolicyTest, BudgetIsCappedAtBurst) {
+    RetryPolicy policy(makeConfig(0.5, 3));
+    for (int i = 0; i < 1000; ++i) policy.onSuccess(0);
+    int retries = 0;
+    while (policy.shouldRetry("GET", CLIENT_ERROR, 0)) ++retries;
+    EXPECT_EQ(3, retries);
+}
+
+TEST(RetryPolicyTest, BackoffIsBounded) {
+    RetryConfig config = makeConfig(0.1, 10);
+    config.backoffBaseMs = 2;
+    config.backoffMaxMs = 50;
+    RetryPolicy policy(config);
+    for (int i = 0; i < 1000; ++i) {
+        EXPECT_LE(policy.backoffMs(0), 2);
+        EXPECT_LE(policy.backoffMs(3), 16);
+        int b = policy.backoffMs(30);
+        EXPECT_GE(b, 0);
+        EXPECT_LE(b, 50);
+    }
+}
+
+TEST(RetryPolicyTest, TotalFailureStormStaysWithinBurst) {
+    RetryPolicy policy(makeConfig(0.1, 10));
+    std::mt19937 rng(1);
+    std::int64_t attempts = 0;
+    for (int i = 0; i < 100000; ++i) runCommand(policy, rng, 1.0, &attempts);
+    EXPECT_EQ(10, policy.getRetryNum());
+    EXPECT_EQ(100000 + 10, attempts);
+}
+
+TEST(RetryPolicyTest, PartialFailureStormStaysWithinBudgetRatio) {
+    const double ratio = 0.1;
+    const int burst = 10;
+    const int threads = 8;
+    const int commands = 20000;  // per thread
+    RetryPolicy policy(makeConfig(ratio, burst));
+    std::atomic<std::int64_t> attempts(0);
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&policy, &attempts, t] {
+            std::mt19937 rng(t + 1);
+            std::int64_t n = 0;
+            for (int i = 0; i < commands; ++i) runCommand(policy, rng, 0.5, &n);
+            attempts += n;
+        });
+    }
+    for (auto &w : workers) w.join();
+
+    std::int64_t total = (std::int64_t) threads * commands;
+    // each success earns ratio token: retries <= burst + ratio * successes <= burst + ratio * commands
+    EXPECT_LE(policy.getRetryNum(), burst + (std::int64_t) (ratio * total));
+    EXPECT_LE(attempts.load() - total, burst + (std::int64_t) (ratio * total));
+    EXPECT_GT(policy.getBudgetExhaustedNum(), 0);
+}
@@ -0,0 +1,213 @@
+//
+// Created by admin on 2019-03-25.
+//
+// Unit tests (Google Test) of SingleFlight: deep copies of replies, released
+// by freeReplyObject, and how waiters share the leader's reply.
+//
+
+#include "redis_client/SingleFlight.h"
+#include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+    // allocated the way hiredis does, so that freeReplyObject releases it
+    redisReply *stringReply(int type, const std::string &s) {
+        redisReply *r = (redisReply *) calloc(1, sizeof(redisReply));
+        r->type = type;
+        r->len = s.size();
+        r->str = (char *) malloc(s.size() + 1);
+        memcpy(r->str, s.data(), s.size());
+        r->str[s.size()] = '\0';
+        return r;
+    }
+
+    redisReply *integerReply(long long n) {
+        redisReply *r = (redisReply *) calloc(1, sizeof(redisReply));
+        r->type = REDIS_REPLY_INTEGER;
+        r->integer = n;
+        return r;
+    }
+
+    redisReply *arrayReply(const std::vector<redisReply *> &elements) {
+        redisReply *r = (redisReply *) calloc(1, sizeof(redisReply));
+        r->type = REDIS_REPLY_ARRAY;
+        r->elements = elements.size();
+        r->element = (redisReply **) calloc(elements.size(), sizeof(redisReply *));
+        for (size_t i = 0; i < elements.size(); ++i) r->element[i] = elements[i];
+        return r;
+    }
+
+    // the same content, held in other memory
+    void expectDeepCopy(const redisReply *a, const redisReply *b) {
+        ASSERT_NE(nullptr, b);
+        ASSERT_NE(a, b);
+        EXPECT_EQ(a->type, b->type);
+        EXPECT_EQ(a->integer, b->integer);
+        ASSERT_EQ(a->len, b->len);
+        if (a->str == nullptr) {
+            EXPECT_EQ(nullptr, b->str);
+        } else {
+            ASSERT_NE(a->str, b->str);
+            EXPECT_EQ(std::string(a->str, a->len), std::string(b->str, b->len));
+            EXPECT_EQ('\0', b->str[b->len]);
+        }
+        ASSERT_EQ(a->elements, b->elements);
+        for (size_t i = 0; i < a->elements; ++i) expectDeepCopy(a->element[i], b->element[i]);
+    }
+
+    // a GET whose leader blocks until released
+    class Gate {
+    public:
+        std::atomic<int> calls;
+        std::atomic<bool> open;
+
+        Gate() : calls(0), open(false) {}
+
+        void wait() {
+            ++calls;
+            while (!open) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    };
+}
+
+TEST(SingleFlightTest, CloneStringAndErrorReplies) {
+    std::string value("va\0lue", 6);  // binary safe
+    RedisReplyPtr str(stringReply(REDIS_REPLY_STRING, value));
+    RedisReplyPtr err(stringReply(REDIS_REPLY_ERROR, "ERR wrong number of arguments"));
+
+    RedisReplyPtr strCopy(SingleFlight::cloneReply(str.get()));
+    RedisReplyPtr errCopy(SingleFlight::cloneReply(err.get()));
+    expectDeepCopy(str.get(), strCopy.get());
+    expectDeepCopy(err.get(), errCopy.get());
+    EXPECT_EQ(nullptr, SingleFlight::cloneReply(nullptr));
+}
+
+TEST(SingleFlightTest, CloneNestedArrays) {
+    RedisReplyPtr arr(arrayReply({
+            stringReply(REDIS_REPLY_STRING, "a"),
+            arrayReply({integerReply(42), stringReply(REDIS_REPLY_ERROR, "ERR"), arrayReply({})}),
+            stringReply(REDIS_REPLY_STATUS, "OK"),
+    }));
+
+    redisReply *copy = SingleFlight::cloneReply(arr.get());
+    expectDeepCopy(arr.get(), copy);
+    // the copy outlives the original, and both are released on their own
+    freeReplyObject(arr.release());
+    EXPECT_EQ("a", std::string(copy->element[0]->str));
+    EXPECT_EQ(42, copy->element[1]->element[0]->integer);
+    freeReplyObject(copy);
+}
+
+TEST(SingleFlightTest, WaitersGetTheirOwnCopy) {
+    SingleFlight singleFlight({"get"});
+    const std::vector<std::string> argv = {"GET", "key"};
+    const int callers = 4;
+    Gate gate;
+    auto func = [&gate]() {
+        gate.wait();
+        return RedisReplyPtr(stringReply(REDIS_REPLY_STRING, "value"));
+    };
+
+    std::vector<redisReply *> replies(callers, nullptr);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < callers; ++i) {
+        threads.emplace_back([&, i] { replies[i] = singleFlight.execute(argv, func).release(); });
+    }
+    // the leader is in flight, the others join it
+    while (gate.calls == 0) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    gate.open = true;
+    for (auto &t : threads) t.join();
+
+    EXPECT_EQ(1, gate.calls);
+    EXPECT_EQ(1, singleFlight.getLeaderNum());
+    EXPECT_EQ(callers - 1, singleFlight.getSharedNum());
+    for (int i = 0; i < callers; ++i) {
+        ASSERT_NE(nullptr, replies[i]);
+        EXPECT_EQ("value", std::string(replies[i]->str, replies[i]->len));
+        for (int j = 0; j < i; ++j) EXPECT_NE(replies[j], replies[i]);
+    }
+    for (auto r : replies) freeReplyObject(r);
+}
+
+TEST(SingleFlightTest, WaitersFallBackWhenTheLeaderFails) {
+    SingleFlight singleFlight({"GET"});
+    const std::vector<std::string> argv = {"GET", "key"};
+    Gate gate;
+    auto failed = [&gate]() {
+        gate.wait();
+        return RedisReplyPtr();
+    };
+    std::atomic<int> fallbacks(0);
+    auto fallback = [&fallbacks]() {
+        ++fallbacks;
+        return RedisReplyPtr(stringReply(REDIS_REPLY_STRING, "value"));
+    };
+
+    RedisReplyPtr waiterReply;
+    std::thread leader([&] { EXPECT_TRUE(singleFlight.execute(argv, failed).isNull()); });
+    while (gate.calls == 0) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    std::thread waiter([&] {
+        RedisReplyPtr r = singleFlight.execute(argv, failed);
+        // a null reply is shared as null: the waiter sends the command itself
+        if (r.isNull()) r = singleFlight.execute(argv, fallback);
+        waiterReply = r;
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    gate.open = true;
+    leader.join();
+    waiter.join();
+
+    EXPECT_EQ(1, gate.calls);
+    EXPECT_EQ(1, fallbacks);
+    ASSERT_TRUE(waiterReply.notNull());
+    EXPECT_EQ("value", std::string(waiterReply.get()->str));
+}
+
+TEST(SingleFlightTest, WaitersGetNullWhenTheLeaderThrows) {
+    SingleFlight singleFlight({"GET"});
+    const std::vector<std::string> argv = {"GET", "key"};
+    Gate gate;
+    auto func = [&gate]() -> RedisReplyPtr {
+        gate.wait();
+        throw std::runtime_error("connection lost");
+    };
+
+    std::thread leader([&] { EXPECT_THROW(singleFlight.execute(argv, func), std::runtime_error); });
+    while (gate.calls == 0) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    bool waiterNull = false;
+    std::thread waiter([&] { waiterNull = singleFlight.execute(argv, func).isNull(); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    gate.open = true;
+    leader.join();
+    waiter.join();
+
+    EXPECT_EQ(1, gate.calls);
+    EXPECT_TRUE(waiterNull);
+}
+
+TEST(SingleFlightTest, DifferentCommandsAreNotShared) {
+    SingleFlight singleFlight({"GET"});
+    int calls = 0;
+    auto func = [&calls]() {
+        ++calls;
+        return RedisReplyPtr(integerReply(calls));
+    };
+    EXPECT_TRUE(singleFlight.isEnabled("get"));
+    EXPECT_FALSE(singleFlight.isEnabled("SET"));
+
+    // length-prefixed arguments: {"ab", "c"} is not {"a", "bc"}
+    const std::vector<std::string> a = {"GET", "ab", "c"};
+    const std::vector<std::string> b = {"GET", "a", "bc"};
+    EXPECT_EQ(1, singleFlight.execute(a, func).get()->integer);
+    EXPECT_EQ(2, singleFlight.execute(b, func).get()->integer);
+    EXPECT_EQ(2, singleFlight.getLeaderNum());
+    EXPECT_EQ(0, singleFlight.getSharedNum());
+}
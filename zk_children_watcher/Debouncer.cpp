@@ -0,0 +1,66 @@
+//
+// Created by admin on 2019-03-19.
+//
+
+#include "Debouncer.h"
+#include "commen.h"
+#include <algorithm>
+
+Debouncer::Debouncer(int quietMs, int maxDelayMs, const std::function<void()> &action) :
+        action(action),
+        quiet(quietMs),
+        maxDelay(std::max(quietMs, maxDelayMs)),
+        pending(false),
+        stopping(false),
+        worker() {
+    eventNum = 0;
+    runNum = 0;
+    worker = std::thread(&Debouncer::workerLoop, this);
+}
+
+Debouncer::~Debouncer() {
+    {
+        std::lock_guard<std::mutex> g(mtx);
+        stopping = true;
+    }
+    cv.notify_all();
+    if (worker.joinable()) worker.join();
+}
+
+void Debouncer::trigger() {
+    ++eventNum;
+    {
+        std::lock_guard<std::mutex> g(mtx);
+        lastEventTime = std::chrono::steady_clock::now();
+        if (!pending) {
+            pending = true;
+            firstEventTime = lastEventTime;
+        }
+    }
+    cv.notify_one();
+}
+
+void Debouncer::workerLoop() {
+    std::unique_lock<std::mutex> lk(mtx);
+    while (!stopping) {
+        if (!pending) {
+            cv.wait(lk);
+            continue;
+        }
+        auto deadline = std::min(lastEventTime + quiet, firstEventTime + maxDelay);
+        if (std::chrono::steady_clock::now() < deadline) {
+            cv.wait_until(lk, deadline);
+            continue;
+        }
+
+        pending = false;
+        lk.unlock();
+        try {
+            action();
+        } catch (const std::exception &e) {
+            LOG_ERROR << "debounced action exception: " << e.what();
+        }
+        ++runNum;
+        lk.lock();
+    }
+}
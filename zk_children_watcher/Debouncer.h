@@ -0,0 +1,58 @@
+//
+// Created by admin on 2019-03-19.
+//
+
+#ifndef CPPSERVER_DEBOUNCER_H
+#define CPPSERVER_DEBOUNCER_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+// Debouncer coalesces bursts of events into one run of an action, on its
+// own thread. The action runs once no event has come for quietMs, but at
+// most maxDelayMs after the first event of the burst. Events that come
+// while the action is running cause one more run afterwards.
+class Debouncer {
+    std::function<void()> action;
+    std::chrono::milliseconds quiet;
+    std::chrono::milliseconds maxDelay;
+
+    std::mutex mtx;
+    std::condition_variable cv;
+    bool pending;
+    bool stopping;
+    std::chrono::steady_clock::time_point firstEventTime;
+    std::chrono::steady_clock::time_point lastEventTime;
+
+    std::atomic<std::int64_t> eventNum;
+    std::atomic<std::int64_t> runNum;
+
+    std::thread worker;  // declared last: started once the members above exist
+
+    // non construct copyable and non copyable
+    Debouncer(const Debouncer &);
+
+    Debouncer &operator=(const Debouncer &);
+
+    void workerLoop();
+
+public:
+    Debouncer(int quietMs, int maxDelayMs, const std::function<void()> &action);
+
+    // a pending run is dropped
+    ~Debouncer();
+
+    void trigger();
+
+    std::int64_t getEventNum() { return eventNum; }
+
+    std::int64_t getRunNum() { return runNum; }
+};
+
+
+#endif //CPPSERVER_DEBOUNCER_H
@@ -0,0 +1,101 @@
+//
+// Created by admin on 2019-03-22.
+//
+
+#include "ProxyDiscovery.h"
+#include "commen.h"
+#include <ctime>
+#include <iterator>
+
+ProxyDiscovery::ProxyDiscovery() {
+    roundRobinIndex = -1;
+    lastUpdateTime = 0;
+    updateNum = 0;
+    funcOnChildrenChange = nullptr;
+}
+
+void ProxyDiscovery::publishValueList(const std::vector<std::string> &newValueList) {
+    std::lock_guard<std::mutex> publishGuard(publishMtx);
+    additionalValueList = vectorMinus(newValueList, valueList);
+    deletedValueList = vectorMinus(valueList, newValueList);
+//    deletedValueList = std::move(newValueList);
+    for (const auto &e : additionalValueList) {
+        LOG_SPCL << "to be added value: " << e;
+    }
+    for (const auto &e : deletedValueList) {
+        LOG_SPCL << "to be deleted value: " << e;
+    }
+
+    // 先删除， 后追加
+    if (!additionalValueList.empty() || !deletedValueList.empty()) {
+        // write lock
+        boost::unique_lock<boost::shared_mutex> g(valueListSMtx);
+        size_t tmpSize = valueList.size();
+
+        if (!valueList.empty() && !deletedValueList.empty()) {
+            auto finder = getFinder(deletedValueList);
+            for (size_t i = 0; i < tmpSize;) {
+                if (finder.count(valueList[i]) > 0)
+                    valueList[i] = std::move(valueList[--tmpSize]);
+                else ++i;
+            }
+            valueList.resize(tmpSize);
+            LOG_SPCL << "delete " << deletedValueList.size() << " node(s)";
+        }
+
+        if (!additionalValueList.empty()) {
+            size_t appendSize = additionalValueList.size();
+            std::move(additionalValueList.begin(), additionalValueList.end(),
+                      std::inserter(valueList, valueList.end()));
+            LOG_SPCL << "append " << appendSize << " new node(s)";
+        }
+//        valueList = std::move(newValueList);
+    }
+    lastUpdateTime = (std::int64_t) time(nullptr);
+    ++updateNum;
+    LOG_SPCL << "updated children node value list size: " << valueList.size();
+
+    // valueList is already the new list here
+    if (funcOnChildrenChange != nullptr) funcOnChildrenChange();
+}
+
+std::string ProxyDiscovery::RoundRobinValueList() {
+    // read lock
+    boost::shared_lock<boost::shared_mutex> g(valueListSMtx);
+    if (valueList.empty()) return "";
+    // todo more efficient
+    return valueList[(++roundRobinIndex) % valueList.size()];
+//    roundRobinIndex = (roundRobinIndex + 1) % valueList.size();
+//    return valueList[roundRobinIndex];
+}
+
+std::vector<std::string> ProxyDiscovery::getValueList() {
+    boost::shared_lock<boost::shared_mutex> g(valueListSMtx);
+    return valueList;
+}
+
+size_t ProxyDiscovery::getChildrenNum() {
+    boost::shared_lock<boost::shared_mutex> g(valueListSMtx);
+    return valueList.size();
+}
+
+void ProxyDiscovery::setChildrenWatcher(std::function<void()> func) {
+    funcOnChildrenChange = func;
+}
+
+std::vector<std::string>
+ProxyDiscovery::vectorMinus(const std::vector<std::string> &a, const std::vector<std::string> &b) {
+    std::vector<std::string> res;
+    std::unordered_set<std::string> finder(b.begin(), b.end());
+
+    // in a, not in b
+    for (auto &e : a) {
+        if (finder.count(e) <= 0) res.emplace_back(e);
+    }
+
+    return res;
+}
+
+std::unordered_set<std::string> ProxyDiscovery::getFinder(const std::vector<std::string> &a) {
+    return std::unordered_set<std::string>(a.begin(), a.end());
+}
@@ -0,0 +1,80 @@
+//
+// Created by admin on 2019-03-22.
+//
+
+#ifndef CPPSERVER_PROXYDISCOVERY_H
+#define CPPSERVER_PROXYDISCOVERY_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <vector>
+#include <boost/thread/shared_mutex.hpp>
+
+// ProxyDiscovery is a source of the proxy list: a list of values (the
+// data of the proxy nodes) that changes over time. Backends call
+// publishValueList with each new list; it fills additionalValueList and
+// deletedValueList with the diff against the previous list, updates
+// valueList, then calls the function set by setChildrenWatcher.
+// Implemented by ZKChildrenWatcher, StaticProxyDiscovery and
+// FileProxyDiscovery.
+class ProxyDiscovery {
+    std::atomic<std::int64_t> roundRobinIndex;
+    std::mutex publishMtx;
+
+protected:
+    boost::shared_mutex valueListSMtx;
+
+    std::function<void()> funcOnChildrenChange;
+
+    std::atomic<std::int64_t> lastUpdateTime;  // unix seconds of the last update
+    std::atomic<std::int64_t> updateNum;
+
+    void publishValueList(const std::vector<std::string> &newValueList);
+
+public:
+    std::vector<std::string> valueList;
+    std::vector<std::string> additionalValueList;
+    std::vector<std::string> deletedValueList;
+
+    ProxyDiscovery();
+
+    virtual ~ProxyDiscovery() {}
+
+    // Start discovery. The first update may be published before or
+    // after init returns, depending on the backend.
+    virtual void init() = 0;
+
+    // short name of the backend, e.g. "zk"
+    virtual const char *getType() = 0;
+
+    // change events received; more than getUpdateNum when bursts were coalesced
+    virtual std::int64_t getEventNum() { return updateNum; }
+
+    virtual std::int64_t getSessionExpiredNum() { return 0; }
+
+    virtual std::int64_t getLastResyncConvergeMs() { return -1; }
+
+    std::string RoundRobinValueList();
+
+    // copy of valueList
+    std::vector<std::string> getValueList();
+
+    size_t getChildrenNum();
+
+    std::int64_t getLastUpdateTime() { return lastUpdateTime; }
+
+    std::int64_t getUpdateNum() { return updateNum; }
+
+    void setChildrenWatcher(std::function<void()> func);
+
+    std::vector<std::string> vectorMinus(const std::vector<std::string> &a, const std::vector<std::string> &b);
+
+    std::unordered_set<std::string> getFinder(const std::vector<std::string> &a);
+};
+
+
+#endif //CPPSERVER_PROXYDISCOVERY_H
@@ -4,18 +4,57 @@
 
 #include "ZKChildrenWatcher.h"
 #include <boost/algorithm/string/trim.hpp>
+#include <cstring>
+
+namespace {
+    // codis proxy info is well below this, larger data takes a second Get
+    const int NODE_BUFFER_SIZE = 4096;
+
+    // a failed fetch of the children or of their data is retried after this
+    const int FETCH_RETRY_MS = 1000;
+
+    std::int64_t steadyMs() {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    std::string trimNodeValue(const char *value, int len) {
+        std::string res(value, len);
+        boost::algorithm::trim_if(res, boost::algorithm::is_any_of("/"));
+        return res;
+    }
+}
+
+// children of one initValueList whose data is being fetched
+struct ZKChildrenWatcher::FetchRound {
+    std::int64_t id;
+    std::vector<std::string> children;
+    std::atomic<int> pending;
+    std::atomic<bool> failed;  // a node could not be read: the round is not published
+
+    FetchRound() : id(0), pending(0), failed(false) {}
+};
 
 bool
 ZKChildrenWatcher::globalWatcherFunc(CppZooKeeper::ZookeeperManager &zkCli, int type, int state, const char *path) {
     if (type == ZOO_SESSION_EVENT) {
         if (state == ZOO_CONNECTED_STATE) { // 第一次连接成功与超时之后的重连成功，会触发ZOO_CONNECTED_STATE
-            if (needToInitValueList) { // 不超时的重连成功也会触发会触发ZOO_CONNECTED_STATE
-                LOG_SPCL << "first connection success, will call initValueList";
-                needToInitValueList = false;
-                initValueList();
+            if (needToInitValueList.exchange(false)) { // 不超时的重连成功也会触发会触发ZOO_CONNECTED_STATE
+                if (resyncStartMs > 0) {
+                    LOG_SPCL << "reconnected after session expiry, will resync all children";
+                    resyncValueList();
+                } else {
+                    LOG_SPCL << "first connection success, will call initValueList";
+                    initValueList();
+                }
             }
         } else if (state == ZOO_EXPIRED_SESSION_STATE) { // 超时会触发ZOO_EXPIRED_SESSION_STATE
-//            needToInitValueList = true;
+            // watcher 随会话失效，重连后全量重新拉取，不依赖 resume 回调
+            LOG_WARN << "zk session expired, zk path: " << config.path;
+            ++sessionExpiredNum;
+            std::int64_t expected = 0;
+            resyncStartMs.compare_exchange_strong(expected, steadyMs());
+            needToInitValueList = true;
         }
     }
     return false;
@@ -24,7 +63,7 @@ ZKChildrenWatcher::globalWatcherFunc(CppZooKeeper::ZookeeperManager &zkCli, int
 bool ZKChildrenWatcher::watcherFunc(CppZooKeeper::ZookeeperManager &zkCli, int type, int state, const char *path) {
 //    LOG_INFO << "子结点事件！！！";
     if (type == ZOO_CHILD_EVENT || (type == CppZooKeeper::RESUME_EVENT && state == CppZooKeeper::RESUME_SUCC)) {
-        initValueList();
+        onTopologyEvent();
     } else {
         LOG_ERROR << "not expected event, type: " << type
                   << ", state: " << state << ", path: " << std::string(path ? path : "");
@@ -32,114 +71,192 @@ bool ZKChildrenWatcher::watcherFunc(CppZooKeeper::ZookeeperManager &zkCli, int t
     return false;
 }
 
-std::string ZKChildrenWatcher::getNodeValue(const std::string &path) {
-    char *buffer = nullptr;
+bool ZKChildrenWatcher::dataWatcherFunc(CppZooKeeper::ZookeeperManager &zkCli, int type, int state, const char *path) {
+    if (type == ZOO_CHANGED_EVENT || (type == CppZooKeeper::RESUME_EVENT && state == CppZooKeeper::RESUME_SUCC)) {
+        std::string nodePath(path ? path : "");
+        std::string name = nodePath.substr(nodePath.rfind('/') + 1);
+        {
+            std::lock_guard<std::mutex> g(nodeCacheMtx);
+            auto it = nodeCache.find(name);
+            if (it == nodeCache.end()) return false;
+            it->second.stale = true;
+        }
+        LOG_SPCL << "node data changed, path: " << nodePath;
+        onTopologyEvent();
+    } else if (type != ZOO_DELETED_EVENT) { // 删除由子结点事件处理
+        LOG_ERROR << "not expected event, type: " << type
+                  << ", state: " << state << ", path: " << std::string(path ? path : "");
+    }
+    return false;
+}
+
+void ZKChildrenWatcher::onTopologyEvent() {
+    if (debouncer) debouncer->trigger();
+    else initValueList();
+}
+
+std::string ZKChildrenWatcher::getNodeValue(const std::string &path, std::int32_t *version) {
+    std::vector<char> buffer(NODE_BUFFER_SIZE);
     Stat stat;
-    int buf_len = 0;
+    memset(&stat, 0, sizeof(stat));
 
-    int ret = zkClient.Get(path, nullptr, &buf_len, &stat);
-    if (ret != ZOK || stat.dataLength <= 0) {
-//        LOG_ERROR << "ret: " << ret << ", dataLength: " << stat.dataLength;
-        return "";
+    for (;;) {
+        int buf_len = (int) buffer.size();
+        int ret = zkClient.Get(path, buffer.data(), &buf_len, &stat);
+        if (ret != ZOK) {
+            LOG_ERROR << "get node data error, ret: " << ret << ", path: " << path;
+            return "";
+        }
+        if (stat.dataLength > (int) buffer.size()) { // 数据被截断，按实际大小重读
+            buffer.resize(stat.dataLength);
+            continue;
+        }
+        if (version) *version = stat.version;
+        return buf_len > 0 ? trimNodeValue(buffer.data(), buf_len) : "";
     }
+}
 
-    buffer = (char *) malloc(sizeof(char) * (stat.dataLength + 1));
-    buf_len = stat.dataLength + 1;
+void ZKChildrenWatcher::initValueList() {
+    // local: may run on the zk event thread and the debouncer thread at once
+    CppZooKeeper::ScopedStringVector stringVector;
+    int ret = zkClient.GetChildren(config.path, stringVector,
+                                   std::make_shared<CppZooKeeper::WatcherFuncType>(
+                                           std::bind(&ZKChildrenWatcher::watcherFunc,
+                                                     this,
+                                                     std::placeholders::_1,
+                                                     std::placeholders::_2,
+                                                     std::placeholders::_3,
+                                                     std::placeholders::_4)));
+    if (ret != ZOK) {
+        // 子结点列表未知（watch 也未设置）：保留当前结果，稍后重试
+        LOG_ERROR << "get children error, ret: " << ret << ", zkPath: " << config.path
+                  << ", keep the current value list, retry in " << FETCH_RETRY_MS << "ms";
+        retryTimer->trigger();
+        return;
+    }
+    auto round = std::make_shared<FetchRound>();
+    round->id = ++fetchRoundId;
+    for (auto i = 0; i < stringVector.count; ++i) {
+        round->children.emplace_back(stringVector.data[i]);
+    }
+    LOG_SPCL << "zkPath: " << config.path << ", get children number: " << round->children.size();
 
-    ret = zkClient.Get(path, buffer, &buf_len, &stat);
-    if (ret != ZOK || buf_len <= 0) {
-//        LOG_ERROR << "ret: " << ret << ", buf_len: " << buf_len;
-        if (buffer != nullptr) {
-            free(buffer);
-            buffer = nullptr;
+    // 只拉取新增的和数据有变化的结点
+    std::vector<std::string> toFetch;
+    {
+        std::lock_guard<std::mutex> g(nodeCacheMtx);
+        auto finder = getFinder(round->children);
+        for (auto it = nodeCache.begin(); it != nodeCache.end();) {
+            if (finder.count(it->first) == 0) it = nodeCache.erase(it);
+            else ++it;
+        }
+        for (const auto &name : round->children) {
+            if (nodeCache[name].stale) toFetch.push_back(name);
         }
-        return "";
     }
+    LOG_SPCL << "zkPath: " << config.path << ", node(s) to fetch: " << toFetch.size();
 
-    std::string return_str;
-    if (buffer) {
-        return_str = std::string(buffer, buf_len);
-    } else { LOG_ERROR << "returned path buffer is nullptr"; }
-
-    if (buffer != nullptr) {
-        free(buffer);
-        buffer = nullptr;
+    if (toFetch.empty()) {
+        updateValueList(round->children, round->id);
+        return;
     }
 
-    boost::algorithm::trim_if(return_str, boost::algorithm::is_any_of("/"));
-    return return_str;
+    // 并发异步拉取，最后一个完成的回调负责更新
+    round->pending = (int) toFetch.size();
+    for (const auto &name : toFetch) {
+        std::string nodePath = config.path + '/' + name;
+        auto completion = std::make_shared<CppZooKeeper::DataCompletionFunType>(
+                [this, round, name](CppZooKeeper::ZookeeperManager &, int rc, const char *value, int len,
+                                    const Stat *stat) {
+                    onNodeData(round, name, rc, value, len, stat);
+                });
+        ret = zkClient.AGet(nodePath, completion, dataWatcherPtr);
+        if (ret != ZOK) {
+            LOG_ERROR << "async get node data error, ret: " << ret << ", path: " << nodePath << ", read it directly";
+            std::int32_t version = -1;
+            std::string value = getNodeValue(nodePath, &version);
+            Stat stat;
+            memset(&stat, 0, sizeof(stat));
+            stat.version = version;
+            onNodeData(round, name, version < 0 ? ret : ZOK, value.data(), (int) value.size(), &stat);
+        }
+    }
 }
 
-std::string ZKChildrenWatcher::RoundRobinValueList() {
-    // read lock
-    boost::shared_lock<boost::shared_mutex> g(valueListSMtx);
-    if (valueList.empty()) return "";
-    // todo more efficient
-    return valueList[(++roundRobinIndex) % valueList.size()];
-//    roundRobinIndex = (roundRobinIndex + 1) % valueList.size();
-//    return valueList[roundRobinIndex];
+void ZKChildrenWatcher::resyncValueList() {
+    {
+        std::lock_guard<std::mutex> g(nodeCacheMtx);
+        for (auto &e : nodeCache) e.second.stale = true;
+    }
+    // 此后开始的每一轮都是全量拉取，其中最先发布的一轮即收敛
+    resyncRoundId = fetchRoundId + 1;
+    initValueList();
 }
 
-void ZKChildrenWatcher::initValueList() {
-    zkClient.GetChildren(config.path, stringVector,
-                         std::make_shared<CppZooKeeper::WatcherFuncType>(std::bind(&ZKChildrenWatcher::watcherFunc,
-                                                                                   this,
-                                                                                   std::placeholders::_1,
-                                                                                   std::placeholders::_2,
-                                                                                   std::placeholders::_3,
-                                                                                   std::placeholders::_4)));
-    std::vector<std::string> newValueList;
-    LOG_SPCL << "zkPath: " << config.path << ", get children number: " << stringVector.count;
-    for (auto i = 0; i < stringVector.count; ++i) {
-        newValueList.emplace_back(getNodeValue(config.path + '/' + stringVector.data[i]));
-        LOG_SPCL << "node path: " << stringVector.data[i] << ", node data: " << newValueList.back();
+void ZKChildrenWatcher::onNodeData(const std::shared_ptr<FetchRound> &round, const std::string &name,
+                                   int rc, const char *value, int len, const Stat *stat) {
+    {
+        std::lock_guard<std::mutex> g(nodeCacheMtx);
+        auto it = nodeCache.find(name);
+        if (rc == ZOK && it != nodeCache.end()) {
+            it->second.value = (value && len > 0) ? trimNodeValue(value, len) : "";
+            it->second.version = stat ? stat->version : -1;
+            it->second.stale = false;
+            LOG_SPCL << "node path: " << name << ", node data: " << it->second.value;
+        } else if (rc != ZOK) {
+            // 结点仍为 stale，下一轮重新拉取
+            LOG_ERROR << "get node data error, rc: " << rc << ", node path: " << name;
+            round->failed = true;
+        }
     }
 
-    additionalValueList = vectorMinus(newValueList, valueList);
-    deletedValueList = vectorMinus(valueList, newValueList);
-//    deletedValueList = std::move(newValueList);
-    for (const auto &e : additionalValueList) {
-        LOG_SPCL << "to be added value: " << e;
+    if (--round->pending != 0) return;
+    if (round->failed) {
+        // 不发布缺少结点数据的列表，保留上一次的结果
+        LOG_ERROR << "zkPath: " << config.path << ", fetch round " << round->id
+                  << " failed, keep the current value list";
+        retryTimer->trigger();
+        return;
     }
-    for (const auto &e : deletedValueList) {
-        LOG_SPCL << "to be deleted value: " << e;
-    }
-
-    if (funcOnChildrenChange != nullptr) funcOnChildrenChange();
-
-    // 先删除， 后追加
-    if (!additionalValueList.empty() || !deletedValueList.empty()) {
-        // write lock
-        boost::unique_lock<boost::shared_mutex> g(valueListSMtx);
-        size_t tmpSize = valueList.size();
+    updateValueList(round->children, round->id);
+}
 
-        if (!valueList.empty() && !deletedValueList.empty()) {
-            auto finder = getFinder(deletedValueList);
-            for (size_t i = 0; i < tmpSize;) {
-                if (finder.count(valueList[i]) > 0)
-                    valueList[i] = std::move(valueList[--tmpSize]);
-                else ++i;
-            }
-            valueList.resize(tmpSize);
-            LOG_SPCL << "delete " << deletedValueList.size() << " node(s)";
+void ZKChildrenWatcher::updateValueList(const std::vector<std::string> &children, std::int64_t roundId) {
+    std::lock_guard<std::mutex> updateGuard(updateMtx);
+    // 较新的一轮会覆盖本轮结果；在锁内检查，旧的一轮不会在新的一轮之后发布
+    if (roundId != fetchRoundId) return;
+    std::vector<std::string> newValueList;
+    {
+        std::lock_guard<std::mutex> g(nodeCacheMtx);
+        for (const auto &name : children) {
+            auto it = nodeCache.find(name);
+            newValueList.emplace_back(it != nodeCache.end() ? it->second.value : "");
         }
+    }
 
-        if (!additionalValueList.empty()) {
-            size_t appendSize = additionalValueList.size();
-            std::move(additionalValueList.begin(), additionalValueList.end(),
-                      std::inserter(valueList, valueList.end()));
-            LOG_SPCL << "append " << appendSize << " new node(s)";
-        }
-//        valueList = std::move(newValueList);
+    LOG_SPCL << "zkPath: " << config.path << ", update children node value list";
+    publishValueList(newValueList);
+
+    std::int64_t resyncRound = resyncRoundId;
+    if (resyncRound > 0 && roundId >= resyncRound && resyncRoundId.compare_exchange_strong(resyncRound, 0)) {
+        lastResyncConvergeMs = steadyMs() - resyncStartMs.exchange(0);
+        LOG_SPCL << "zkPath: " << config.path << ", converged " << lastResyncConvergeMs << "ms after session expiry";
     }
-    LOG_SPCL << "zkPath: " << config.path << ", updated children node value list size: " << valueList.size();
 }
 
 ZKChildrenWatcher::ZKChildrenWatcher(const ZKConfig &zkConfig) : config(zkConfig) {
-//    funcOnChildrenChange = std::bind(&ZKChildrenWatcher::updateValueList, this);
-    funcOnChildrenChange = nullptr;
     needToInitValueList = true;
-    roundRobinIndex = -1;
+    sessionExpiredNum = 0;
+    resyncStartMs = 0;
+    resyncRoundId = 0;
+    lastResyncConvergeMs = -1;
+    fetchRoundId = 0;
+    dataWatcherPtr = std::make_shared<CppZooKeeper::WatcherFuncType>(std::bind(&ZKChildrenWatcher::dataWatcherFunc,
+                                                                               this,
+                                                                               std::placeholders::_1,
+                                                                               std::placeholders::_2,
+                                                                               std::placeholders::_3,
+                                                                               std::placeholders::_4));
     globalWatherPtr = std::make_shared<CppZooKeeper::WatcherFuncType>(std::bind(&ZKChildrenWatcher::globalWatcherFunc,
                                                                                 this,
                                                                                 std::placeholders::_1,
@@ -150,6 +267,11 @@ ZKChildrenWatcher::ZKChildrenWatcher(const ZKConfig &zkConfig) : config(zkConfig
     resumeGlobalWatcherNotifier = std::bind(&ZKChildrenWatcher::innerResumeGlobalWatcherNotifier, this);
     resumeCustomWatcherNotifier = std::bind(&ZKChildrenWatcher::innerResumeCustomWatcherNotifier, this);
     resumeEphemeralNodeNotifier = std::bind(&ZKChildrenWatcher::innerResumeEphemeralNodeNotifier, this);
+    retryTimer.reset(new Debouncer(FETCH_RETRY_MS, FETCH_RETRY_MS, std::bind(&ZKChildrenWatcher::initValueList, this)));
+    if (config.debounceQuietMs > 0) {
+        debouncer.reset(new Debouncer(config.debounceQuietMs, config.debounceMaxDelayMs,
+                                      std::bind(&ZKChildrenWatcher::initValueList, this)));
+    }
 }
 
 void ZKChildrenWatcher::init() {
@@ -169,27 +291,6 @@ void ZKChildrenWatcher::init() {
     }
 }
 
-void ZKChildrenWatcher::setChildrenWatcher(std::function<void()> func) {
-    funcOnChildrenChange = func;
-}
-
-std::vector<std::string>
-ZKChildrenWatcher::vectorMinus(const std::vector<std::string> &a, const std::vector<std::string> &b) {
-    std::vector<std::string> res;
-    std::unordered_set<std::string> finder(b.begin(), b.end());
-
-    // in a, not in b
-    for (auto &e : a) {
-        if (finder.count(e) <= 0) res.emplace_back(e);
-    }
-
-    return res;
-}
-
-std::unordered_set<std::string> ZKChildrenWatcher::getFinder(const std::vector<std::string> &a) {
-    return std::unordered_set<std::string>(a.begin(), a.end());
-}
-
 void ZKChildrenWatcher::innerReconnectNotifier() {
     LOG_WARN << "reconnection reaches " << config.userReconnectAlertCount
              << " times, zk address: " << config.address << ", zk path: " << config.path;
@@ -5,57 +5,88 @@
 #ifndef CPPSERVER_ZKCHILDRENWATCHER_H
 #define CPPSERVER_ZKCHILDRENWATCHER_H
 
+#include "ProxyDiscovery.h"
 #include "ZKConfig.h"
+#include "Debouncer.h"
 #include "commen.h"
 #include <CppZooKeeper/CppZooKeeper.h>
 #include <functional>
 #include <memory>
 #include <atomic>
-#include <boost/thread/shared_mutex.hpp>
+#include <chrono>
+#include <mutex>
+#include <unordered_map>
+
+// ProxyDiscovery backed by the children of config.path in zookeeper,
+// the data of each child being one proxy.
+class ZKChildrenWatcher : public ProxyDiscovery {
+    // data of a child node, by child name
+    struct NodeCache {
+        std::string value;
+        std::int32_t version;
+        bool stale;  // data changed or fetch failed, fetch again on the next update
+
+        NodeCache() : version(-1), stale(true) {}
+    };
+
+    struct FetchRound;
 
-class ZKChildrenWatcher {
     ZKConfig config;
-    std::atomic<std::int64_t> roundRobinIndex;
-    boost::shared_mutex valueListSMtx;
 
     CppZooKeeper::ZookeeperManager zkClient;
-    CppZooKeeper::ScopedStringVector stringVector;
-
-    std::function<void()> funcOnChildrenChange;
 
     std::shared_ptr<CppZooKeeper::WatcherFuncType> globalWatherPtr;
 
-    bool needToInitValueList;
+    std::atomic<bool> needToInitValueList;
+
+    std::atomic<std::int64_t> sessionExpiredNum;
+    std::atomic<std::int64_t> resyncStartMs;         // steady clock ms of the expiry being recovered, 0: none
+    std::atomic<std::int64_t> resyncRoundId;         // first fetch round of the resync, 0: none
+    std::atomic<std::int64_t> lastResyncConvergeMs;  // expiry until the resynced list was published, -1: never
+
+    std::mutex nodeCacheMtx;
+    std::unordered_map<std::string, NodeCache> nodeCache;
+    std::shared_ptr<CppZooKeeper::WatcherFuncType> dataWatcherPtr;
+    std::atomic<std::int64_t> fetchRoundId;  // only the latest round publishes
+    std::mutex updateMtx;
 
     std::function<void()> reconnectNotifier;
     std::function<void()> resumeGlobalWatcherNotifier;
     std::function<void()> resumeCustomWatcherNotifier;
     std::function<void()> resumeEphemeralNodeNotifier;
 
-public:
-    std::vector<std::string> valueList;
-    std::vector<std::string> additionalValueList;
-    std::vector<std::string> deletedValueList;
+    // declared last: stopped first on destruction, while the members
+    // used by initValueList are still alive. retryTimer reruns
+    // initValueList after a failed fetch; it outlives debouncer, whose
+    // runs may trigger it.
+    std::unique_ptr<Debouncer> retryTimer;
+    std::unique_ptr<Debouncer> debouncer;
 
+public:
     ZKChildrenWatcher(const ZKConfig &ZKConfig);
 
-    void init();
+    void init() override;
+
+    const char *getType() override { return "zk"; }
 
     bool globalWatcherFunc(CppZooKeeper::ZookeeperManager &zkCli, int type, int state, const char *path);
 
     bool watcherFunc(CppZooKeeper::ZookeeperManager &zkCli, int type, int state, const char *path);
 
-    void initValueList();
+    bool dataWatcherFunc(CppZooKeeper::ZookeeperManager &zkCli, int type, int state, const char *path);
 
-    std::string getNodeValue(const std::string &path);
+    void initValueList();
 
-    std::string RoundRobinValueList();
+    // data of the node in one Get, trimmed of '/'; "" on error
+    std::string getNodeValue(const std::string &path, std::int32_t *version = nullptr);
 
-    void setChildrenWatcher(std::function<void()> func);
+    std::int64_t getSessionExpiredNum() override { return sessionExpiredNum; }
 
-    std::vector<std::string> vectorMinus(const std::vector<std::string> &a, const std::vector<std::string> &b);
+    // time from the last session expiry until the fully resynced list was published
+    std::int64_t getLastResyncConvergeMs() override { return lastResyncConvergeMs; }
 
-    std::unordered_set<std::string> getFinder(const std::vector<std::string> &a);
+    // children and data change events received
+    std::int64_t getEventNum() override { return debouncer ? debouncer->getEventNum() : updateNum.load(); }
 
     void setReconnectNotifier(const std::function<void()> &func) { reconnectNotifier = func; }
 
@@ -65,6 +96,20 @@ public:
 
     void setResumeEphemeralNodeNotifier(const std::function<void()> &func) { resumeEphemeralNodeNotifier = func; }
 
+private:
+    // initValueList refetching the data of every child, after session expiry
+    void resyncValueList();
+
+    // initValueList now, or after the burst of events when debouncing
+    void onTopologyEvent();
+
+    void onNodeData(const std::shared_ptr<FetchRound> &round, const std::string &name,
+                    int rc, const char *value, int len, const Stat *stat);
+
+    // publish the round's list, unless a newer round has started
+    void updateValueList(const std::vector<std::string> &children, std::int64_t roundId);
+
+public:
     void innerReconnectNotifier();
 
     void innerResumeGlobalWatcherNotifier();
@@ -12,6 +12,8 @@ ZKConfig::ZKConfig() {
     userResumeMaxCount = 5;
     userReconnectAlertCount = 3;
     userReconnectMaxCount = INT_MAX;
+    debounceQuietMs = 100;
+    debounceMaxDelayMs = 1000;
 }
 
 //ZKConfig::ZKConfig(const std::string &zkAddress,
@@ -22,6 +22,8 @@ public:
     int userResumeMaxCount;
     int userReconnectAlertCount;
     int userReconnectMaxCount;
+    int debounceQuietMs;     // children/data events are coalesced until quiet this long, 0: no coalescing
+    int debounceMaxDelayMs;  // but handled at most this long after the first one
 
     ZKConfig();
 